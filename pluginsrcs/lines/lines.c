@@ -4,11 +4,7 @@
 #include "../pluginif.h"
 
 GtkWidget *nitem;
-
-typedef struct {
-  gdouble x;
-  gdouble y;
-} point_s;
+const gfig_api_s *gfig_api = NULL;	// NULL when started as version 1
 
 static void
 gtk_plugin_destroy (GtkWidget *object,
@@ -17,43 +13,68 @@ gtk_plugin_destroy (GtkWidget *object,
   gtk_widget_destroy (GTK_WIDGET (user_data));
 }
 
-GList *pline = NULL;
-gint count;
-
 static void
-hilbert(double x, double y, double xi, double xj, double yi, double yj, int n)
+hilbert(GArray *pline,
+	double x, double y, double xi, double xj, double yi, double yj, int n)
 /* x and y are the coordinates of the bottom left corner */
 /* xi & xj are the i & j components of the unit x vector of the frame */
 /* similarly yi and yj */
 {
   if (n <= 0) {
-    point_s *point = g_malloc (sizeof(point_s));
-    point->x = 10.0 * (x + (xi + yi)/2);
-    point->y = 10.0 * (y + (xj + yj)/2);
-    pline = g_list_append (pline, point);
-    count++;
+    gfig_point_s point;
+    point.x = 10.0 * (x + (xi + yi)/2);
+    point.y = 10.0 * (y + (xj + yj)/2);
+    g_array_append_val (pline, point);
   }
   else {
-    hilbert(x,           y,           yi/2, yj/2,  xi/2,  xj/2, n-1);
-    hilbert(x+xi/2,      y+xj/2 ,     xi/2, xj/2,  yi/2,  yj/2, n-1);
-    hilbert(x+xi/2+yi/2, y+xj/2+yj/2, xi/2, xj/2,  yi/2,  yj/2, n-1);
-    hilbert(x+xi/2+yi,   y+xj/2+yj,  -yi/2,-yj/2, -xi/2, -xj/2, n-1);
+    hilbert(pline, x,           y,           yi/2, yj/2,  xi/2,  xj/2, n-1);
+    hilbert(pline, x+xi/2,      y+xj/2 ,     xi/2, xj/2,  yi/2,  yj/2, n-1);
+    hilbert(pline, x+xi/2+yi/2, y+xj/2+yj/2, xi/2, xj/2,  yi/2,  yj/2, n-1);
+    hilbert(pline, x+xi/2+yi,   y+xj/2+yj,  -yi/2,-yj/2, -xi/2, -xj/2, n-1);
   }
 }
 
+/* version 2: generated on a plugin thread, appended in one batch */
+static void
+hilbert_work (const gfig_api_s *api, gpointer data)
+{
+  gint n = GPOINTER_TO_INT (data);
+  GArray *pline = g_array_new (FALSE, FALSE, sizeof(gfig_point_s));
+  hilbert (pline, 0.0, 0.0, 1.0, 0.0, 0.0, 1.0, n);
+
+  gfig_line_s line = {0};
+  line.points    = (const gfig_point_s *)pline->data;
+  line.nr_points = pline->len;
+  line.closed    = TRUE;		// as version 1 draws it
+  gfig_batch_s *batch = api->batch_new ();
+  api->append_lines (batch, &line, 1);
+  api->batch_commit (batch);
+  g_array_free (pline, TRUE);
+}
+
 void
 draw_button_clicked (GtkButton *button,
 		     gpointer   user_data)
 {
-  pline = NULL;
-  count = 0;
-
   gint n = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (nitem));
-  hilbert (0.0, 0.0, 1.0, 0.0, 0.0, 1.0, n);
+
+  if (gfig_api) {
+    gfig_api->run (hilbert_work, NULL, GINT_TO_POINTER (n));
+    return;
+  }
+
+  GArray *pline = g_array_new (FALSE, FALSE, sizeof(gfig_point_s));
+  hilbert (pline, 0.0, 0.0, 1.0, 0.0, 0.0, 1.0, n);
+  GList *verts = NULL;
+  for (gint i = pline->len - 1; i >= 0; i--)
+    verts = g_list_prepend (verts,
+			    g_memdup2 (&g_array_index (pline, gfig_point_s, i),
+				       sizeof(gfig_point_s)));
     
-  entity_append_polyline (get_active_sheet (), pline, 1, 0);
+  entity_append_polyline (get_active_sheet (), verts, 1, 0);
   force_redraw (NULL);
-  g_print ("count = %d\n", count);
+  g_print ("count = %u\n", pline->len);
+  g_array_free (pline, TRUE);
 }
 
 void
@@ -70,8 +91,6 @@ start_plugin (gfig_cb_fcn gfig_cb)
   GtkWidget *hbox;
   GtkWidget *label;
 
-  pline = NULL;
-  
   GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_window_set_title (GTK_WINDOW (window), "Lines Demo");
   gtk_window_set_default_size (GTK_WINDOW (window), 320, 240);
@@ -113,3 +132,10 @@ start_plugin (gfig_cb_fcn gfig_cb)
 
   return 0;
 }
+
+int
+start_plugin_v2 (const gfig_api_s *api)
+{
+  if (api && api->version >= 2) gfig_api = api;
+  return start_plugin (NULL);
+}
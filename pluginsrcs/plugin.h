@@ -18,4 +18,90 @@ typedef void (*plugin_query) (gchar **name_p, gchar **desc_p,
 			      gchar ***icon_xpm_p);
 typedef void (*plugin_start) (gfig_cb_fcn gfig_cb);
 
+
+/***
+    Version 2.  A plugin exporting start_plugin_v2 is handed a table
+    of services instead of gfig_cb; start_plugin is the fallback for
+    older plugins.  Check api->version before using anything added
+    after 2, and api->size before reading past the members known
+    here.
+
+    Entities are appended in bulk: fill a batch, from any thread,
+    and commit it.  Committed batches are merged into the active
+    sheet on the main loop, one redraw per merge, and the batch is
+    gone.  run hands work to a thread of its own; done, if given,
+    runs on the main loop after everything the work committed has
+    been merged.  The work must not touch GTK.
+
+    query reports what is already on the active sheet: every entity
+    whose box on the sheet meets the box asked for.  It may be called
+    from any thread; the hits are collected on the main loop and fcn
+    runs on the caller, returning FALSE to stop.
+ ***/
+
+#define GFIG_PLUGIN_API_VERSION	2
+
+typedef struct {
+  gdouble x;
+  gdouble y;
+} gfig_point_s;
+
+typedef struct {
+  gdouble  x;
+  gdouble  y;
+  gdouble  r;
+  gboolean filled;
+} gfig_circle_s;
+
+typedef struct {
+  const gfig_point_s *points;		// copied on append
+  guint		      nr_points;
+  gboolean	      closed;
+  gboolean	      filled;
+  gboolean	      spline;
+} gfig_line_s;
+
+typedef enum {
+  GFIG_KIND_OTHER,
+  GFIG_KIND_CIRCLE,
+  GFIG_KIND_ELLIPSE,
+  GFIG_KIND_TEXT,
+  GFIG_KIND_LINE
+} gfig_kind_e;
+
+typedef struct {
+  gfig_kind_e	kind;
+  gdouble	box[4];			// x0, y0, x1, y1 on the sheet
+  gconstpointer	id;			// the entity on the sheet list
+} gfig_hit_s;
+
+typedef struct gfig_batch_s gfig_batch_s;
+typedef struct gfig_api_s gfig_api_s;
+
+typedef gboolean (*gfig_hit_fcn) (const gfig_hit_s *hit, gpointer data);
+typedef void (*gfig_work_fcn) (const gfig_api_s *api, gpointer data);
+typedef void (*gfig_done_fcn) (gpointer data);
+
+struct gfig_api_s {
+  guint		  version;
+  gsize		  size;			// sizeof(gfig_api_s) in gfig
+
+  gfig_batch_s *(*batch_new)      (void);
+  void		(*append_circles) (gfig_batch_s *batch,
+				   const gfig_circle_s *circles, guint nr);
+  void		(*append_lines)   (gfig_batch_s *batch,
+				   const gfig_line_s *lines, guint nr);
+  void		(*batch_commit)   (gfig_batch_s *batch);
+  void		(*batch_free)     (gfig_batch_s *batch);
+
+  guint		(*query)	  (gdouble x0, gdouble y0,
+				   gdouble x1, gdouble y1,
+				   gfig_hit_fcn fcn, gpointer data);
+
+  void		(*run)		  (gfig_work_fcn work, gfig_done_fcn done,
+				   gpointer data);
+};
+
+typedef int (*plugin_start_v2) (const gfig_api_s *api);
+
 #endif /* PLUGIN_H */
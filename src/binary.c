@@ -0,0 +1,1087 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <string.h>
+
+#include "gf.h"
+#include "utilities.h"
+#include "entities.h"
+#include "binary.h"
+#include "block.h"
+#include "xml.h"
+
+#if 0 // comments
+
+     Layout, all values little-endian:
+
+         header  = magic[4] version nr_strings nr_pens
+	           strings_off pens_off body_off file_len
+		   base_size base_mtime
+         strings = (len bytes NUL pad4)*
+	 pens    = (r g b a name style lw_idx pad lw)*
+	 body    = environment record* END
+
+	 record  = ENVIRONMENT env
+	         | PROJECT name env
+		 | BLOCK name nr_entities entity*
+		 | SHEET name parent env nr_entities entity*
+
+	 entity  = type ...
+	 polyline verts are an 8-aligned raw array of nr_verts (x, y)
+	 pairs, so they can be used straight out of the mapped file.
+
+     Strings and pens are referenced by u32 index into their tables,
+     BIN_NONE for none.  Blocks and sheets belong to the preceding
+     project; an instance refers to its block by name.
+
+     base_size and base_mtime (since version 3) are zero except in
+     journal snapshots, where they identify the drawing file the
+     snapshot was taken over (see journal.c).
+
+#endif
+
+#define BIN_MAGIC	"GF3B"
+#define BIN_VERSION	3
+#define BIN_NONE	0xffffffff
+#define BIN_HEADER_SIZE	64
+#define BIN_HEADER_MIN	48	// before version 3
+#define BIN_PEN_SIZE	56
+#define BIN_STRING_MIN	8	// len, NUL, pad
+#define BIN_MAX_DEPTH	64	// groups within groups
+
+typedef enum {
+  BIN_REC_END,
+  BIN_REC_ENVIRONMENT,
+  BIN_REC_PROJECT,
+  BIN_REC_SHEET,
+  BIN_REC_BLOCK
+} bin_record_e;
+
+#define BIN_FLAG_0	(1 << 0)
+#define BIN_FLAG_1	(1 << 1)
+#define BIN_FLAG_2	(1 << 2)
+
+typedef struct {
+  GByteArray *body;
+  GHashTable *string_hash;	// string -> index + 1
+  GPtrArray  *strings;
+  GHashTable *pen_hash;		// GBytes -> index + 1
+  GPtrArray  *pens;		// GBytes
+} bin_writer_s;
+
+typedef struct {
+  const guint8 *base;
+  gsize         len;
+  gsize         pos;
+  gboolean      bad;
+  const gchar **strings;	// point into the mapped file
+  guint32       nr_strings;
+  pen_s       **pens;
+  guint32       nr_pens;
+  guint         depth;
+  project_s    *project;	// for resolving instances
+} bin_reader_s;
+
+
+/*************** write it **************/
+
+static void
+put_u32 (GByteArray *ba, guint32 val)
+{
+  val = GUINT32_TO_LE (val);
+  g_byte_array_append (ba, (const guint8 *)&val, sizeof(val));
+}
+
+static void
+put_u64 (GByteArray *ba, guint64 val)
+{
+  val = GUINT64_TO_LE (val);
+  g_byte_array_append (ba, (const guint8 *)&val, sizeof(val));
+}
+
+static void
+put_f64 (GByteArray *ba, gdouble dval)
+{
+  guint64 val;
+  memcpy (&val, &dval, sizeof(val));
+  put_u64 (ba, val);
+}
+
+static void
+put_align (GByteArray *ba, guint align)
+{
+  static const guint8 zeros[8] = {0};
+  guint pad = (align - (ba->len % align)) % align;
+  if (pad) g_byte_array_append (ba, zeros, pad);
+}
+
+static void
+put_matrix (GByteArray *ba, cairo_matrix_t *matrix)
+{
+  put_f64 (ba, matrix->xx);
+  put_f64 (ba, matrix->yx);
+  put_f64 (ba, matrix->xy);
+  put_f64 (ba, matrix->yy);
+  put_f64 (ba, matrix->x0);
+  put_f64 (ba, matrix->y0);
+}
+
+static guint32
+intern_string (bin_writer_s *wr, const gchar *str)
+{
+  if (!str) return BIN_NONE;
+
+  guint idx = GPOINTER_TO_UINT (g_hash_table_lookup (wr->string_hash, str));
+  if (idx) return idx - 1;
+
+  gchar *copy = g_strdup (str);
+  g_ptr_array_add (wr->strings, copy);
+  idx = wr->strings->len;
+  g_hash_table_insert (wr->string_hash, copy, GUINT_TO_POINTER (idx));
+  return idx - 1;
+}
+
+static guint32
+intern_pen (bin_writer_s *wr, pen_s *pen)
+{
+  if (!pen) return BIN_NONE;
+
+  GByteArray *rec = g_byte_array_sized_new (BIN_PEN_SIZE);
+  GdkRGBA *colour = pen_colour (pen);
+  put_f64 (rec, colour ? colour->red   : 0.0);
+  put_f64 (rec, colour ? colour->green : 0.0);
+  put_f64 (rec, colour ? colour->blue  : 0.0);
+  put_f64 (rec, colour ? colour->alpha : 1.0);
+  put_u32 (rec, intern_string (wr, pen_colour_name (pen)));
+  put_u32 (rec, (guint32)pen_line_style (pen));
+  put_u32 (rec, (guint32)pen_lw_std_idx (pen));
+  put_u32 (rec, 0);
+  put_f64 (rec, pen_lw (pen));
+
+  GBytes *bytes = g_byte_array_free_to_bytes (rec);
+  guint idx = GPOINTER_TO_UINT (g_hash_table_lookup (wr->pen_hash, bytes));
+  if (idx) {
+    g_bytes_unref (bytes);
+    return idx - 1;
+  }
+
+  g_ptr_array_add (wr->pens, bytes);
+  idx = wr->pens->len;
+  g_hash_table_insert (wr->pen_hash, bytes, GUINT_TO_POINTER (idx));
+  return idx - 1;
+}
+
+static void
+write_environment (bin_writer_s *wr, environment_s *env)
+{
+  GByteArray *ba = wr->body;
+  paper_s *paper = environment_paper (env);
+  GdkRGBA *colour = paper_colour (paper);
+
+  put_u32 (ba, intern_string (wr, paper_size (paper) ?
+			      gtk_paper_size_get_name (paper_size (paper)) :
+			      NULL));
+  put_u32 (ba, (guint32)paper_orientation (paper));
+  put_u32 (ba, intern_string (wr, paper_colour_name (paper)));
+  put_u32 (ba, intern_pen (wr, environment_pen (env)));
+  put_f64 (ba, colour ? colour->red   : 1.0);
+  put_f64 (ba, colour ? colour->green : 1.0);
+  put_f64 (ba, colour ? colour->blue  : 1.0);
+  put_f64 (ba, colour ? colour->alpha : 1.0);
+  put_u32 (ba, (guint32)environment_dunit (env));
+  put_u32 (ba, intern_string (wr, environment_fontname (env)));
+  put_u32 (ba, environment_show_grid (env) ? 1 : 0);
+  put_u32 (ba, environment_snap_grid (env) ? 1 : 0);
+  put_f64 (ba, environment_textsize (env));
+  put_f64 (ba, environment_target_grid (env));
+}
+
+static void
+write_entity (gpointer data, gpointer user_data)
+{
+  bin_writer_s *wr = user_data;
+  GByteArray *ba = wr->body;
+  entity_type_e type = entity_type (data);
+
+  put_u32 (ba, (guint32)type);
+  switch (type) {
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_CIRCLE:
+    {
+      entity_circle_s *circle = data;
+      put_u32 (ba, intern_pen (wr, entity_circle_pen (circle)));
+      put_u32 (ba,
+	       (entity_circle_fill (circle)     ? BIN_FLAG_0 : 0) |
+	       (entity_circle_negative (circle) ? BIN_FLAG_1 : 0));
+      put_f64 (ba, entity_circle_x (circle));
+      put_f64 (ba, entity_circle_y (circle));
+      put_f64 (ba, entity_circle_r (circle));
+      put_f64 (ba, entity_circle_start (circle));
+      put_f64 (ba, entity_circle_stop (circle));
+    }
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    {
+      entity_ellipse_s *ellipse = data;
+      put_u32 (ba, intern_pen (wr, entity_ellipse_pen (ellipse)));
+      put_u32 (ba,
+	       (entity_ellipse_fill (ellipse)     ? BIN_FLAG_0 : 0) |
+	       (entity_ellipse_negative (ellipse) ? BIN_FLAG_1 : 0));
+      put_f64 (ba, entity_ellipse_x (ellipse));
+      put_f64 (ba, entity_ellipse_y (ellipse));
+      put_f64 (ba, entity_ellipse_a (ellipse));
+      put_f64 (ba, entity_ellipse_b (ellipse));
+      put_f64 (ba, entity_ellipse_t (ellipse));
+      put_f64 (ba, entity_ellipse_start (ellipse));
+      put_f64 (ba, entity_ellipse_stop (ellipse));
+    }
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      entity_text_s *text = data;
+      put_u32 (ba, intern_pen (wr, entity_text_pen (text)));
+      put_u32 (ba,
+	       (entity_text_justify (text) ? BIN_FLAG_0 : 0) |
+	       (entity_text_filled (text)  ? BIN_FLAG_1 : 0));
+      put_u32 (ba, intern_string (wr, entity_text_string (text)));
+      put_u32 (ba, intern_string (wr, entity_text_font (text)));
+      put_u32 (ba, (guint32)entity_text_size (text));
+      put_u32 (ba, (guint32)entity_text_alignment (text));
+      put_u32 (ba, (guint32)entity_text_lead (text));
+      put_u32 (ba, (guint32)entity_text_spread (text));
+      put_f64 (ba, entity_text_x (text));
+      put_f64 (ba, entity_text_y (text));
+      put_f64 (ba, entity_text_t (text));
+      put_f64 (ba, entity_text_txtsize (text));
+    }
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    {
+      entity_polyline_s *polyline = data;
+      put_u32 (ba, intern_pen (wr, entity_polyline_pen (polyline)));
+      put_u32 (ba,
+	       (entity_polyline_closed (polyline) ? BIN_FLAG_0 : 0) |
+	       (entity_polyline_filled (polyline) ? BIN_FLAG_1 : 0) |
+	       (entity_polyline_spline (polyline) ? BIN_FLAG_2 : 0));
+      put_u32 (ba, (guint32)entity_polyline_intersect (polyline));
+      put_f64 (ba, entity_polyline_isect_radius (polyline));
+      put_u32 (ba, g_list_length (entity_polyline_verts (polyline)));
+      put_align (ba, 8);
+      for (GList *l = entity_polyline_verts (polyline); l; l = l->next) {
+	point_s *pt = l->data;
+	put_f64 (ba, point_x (pt));
+	put_f64 (ba, point_y (pt));
+      }
+    }
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    {
+      entity_transform_s *transform = data;
+      gboolean has_tf =
+	!entity_tf_unset (transform) && entity_tf_matrix (transform);
+      put_u32 (ba,
+	       (entity_tf_unset (transform) ? BIN_FLAG_0 : 0) |
+	       (has_tf ? BIN_FLAG_1 : 0));
+      if (has_tf) put_matrix (ba, entity_tf_matrix (transform));
+    }
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      entity_group_s *group = data;
+      put_u32 (ba,
+	       (entity_group_transform (group) ? BIN_FLAG_0 : 0) |
+	       (entity_group_centre (group)    ? BIN_FLAG_1 : 0));
+      if (entity_group_transform (group))
+	put_matrix (ba, entity_group_transform (group));
+      if (entity_group_centre (group)) {
+	put_f64 (ba, point_x (entity_group_centre (group)));
+	put_f64 (ba, point_y (entity_group_centre (group)));
+      }
+      put_u32 (ba, g_list_length (entity_group_entities (group)));
+      g_list_foreach (entity_group_entities (group), write_entity, wr);
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    {
+      entity_instance_s *instance = data;
+      block_s *block = entity_instance_block (instance);
+      put_u32 (ba, intern_pen (wr, entity_instance_pen (instance)));
+      put_u32 (ba, intern_string (wr, block ? block_name (block) : NULL));
+      put_matrix (ba, &entity_instance_transform (instance));
+    }
+    break;
+  }
+}
+
+static gboolean
+save_sheet_func (GtkTreeModel *model,
+		 GtkTreePath *path,
+		 GtkTreeIter *iter,
+		 gpointer data)
+{
+  bin_writer_s *wr = data;
+  sheet_s *sheet = NULL;
+
+  gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
+  if (sheet) {
+    materialize_sheet (sheet);
+    GtkTreeIter parent;
+    gchar *ppath_string = NULL;
+    if (gtk_tree_model_iter_parent (model, &parent, iter))
+      ppath_string = gtk_tree_model_get_string_from_iter (model, &parent);
+
+    put_u32 (wr->body, BIN_REC_SHEET);
+    put_u32 (wr->body, intern_string (wr, sheet_name (sheet)));
+    put_u32 (wr->body, intern_string (wr, ppath_string));
+    write_environment (wr, sheet_environment (sheet));
+    put_u32 (wr->body, g_list_length (sheet_entities (sheet)));
+    g_list_foreach (sheet_entities (sheet), write_entity, wr);
+    if (ppath_string) g_free (ppath_string);
+  }
+  return FALSE;
+}
+
+static gboolean
+save_project_func (GtkTreeModel *model,
+		   GtkTreePath *path,
+		   GtkTreeIter *iter,
+		   gpointer data)
+{
+  bin_writer_s *wr = data;
+  project_s *project = NULL;
+
+  gtk_tree_model_get (model, iter, PROJECT_STRUCT_COL, &project, -1);
+  if (project) {
+    put_u32 (wr->body, BIN_REC_PROJECT);
+    put_u32 (wr->body, intern_string (wr, project_name (project)));
+    write_environment (wr, project_environment (project));
+    GList *blocks = block_list (project);
+    for (GList *l = blocks; l; l = l->next) {
+      block_s *block = l->data;
+      put_u32 (wr->body, BIN_REC_BLOCK);
+      put_u32 (wr->body, intern_string (wr, block_name (block)));
+      put_u32 (wr->body, g_list_length (block_entities (block)));
+      g_list_foreach (block_entities (block), write_entity, wr);
+    }
+    g_list_free (blocks);
+    gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
+			    save_sheet_func, wr);
+  }
+  return FALSE;
+}
+
+static void
+writer_init (bin_writer_s *wr)
+{
+  wr->body        = g_byte_array_new ();
+  wr->strings     = g_ptr_array_new_with_free_func (g_free);
+  wr->string_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  wr->pens        = g_ptr_array_new_with_free_func
+    ((GDestroyNotify)g_bytes_unref);
+  wr->pen_hash    = g_hash_table_new (g_bytes_hash, g_bytes_equal);
+}
+
+static void
+writer_clear (bin_writer_s *wr)
+{
+  g_byte_array_free (wr->body, TRUE);
+  g_hash_table_destroy (wr->string_hash);
+  g_hash_table_destroy (wr->pen_hash);
+  g_ptr_array_free (wr->strings, TRUE);
+  g_ptr_array_free (wr->pens, TRUE);
+}
+
+/***
+    The string table, padded to 8, followed by the pen table.  Returns
+    the offset of the pens within the result.
+ ***/
+
+static GByteArray *
+write_tables (bin_writer_s *wr, guint64 *pens_at)
+{
+  GByteArray *tables = g_byte_array_new ();
+  for (guint i = 0; i < wr->strings->len; i++) {
+    const gchar *str = g_ptr_array_index (wr->strings, i);
+    guint32 len = strlen (str);
+    put_u32 (tables, len);
+    g_byte_array_append (tables, (const guint8 *)str, len + 1);
+    put_align (tables, 4);
+  }
+  put_align (tables, 8);
+  *pens_at = tables->len;
+  for (guint i = 0; i < wr->pens->len; i++) {
+    gsize size;
+    const guint8 *rec = g_bytes_get_data (g_ptr_array_index (wr->pens, i),
+					  &size);
+    g_byte_array_append (tables, rec, size);
+  }
+  return tables;
+}
+
+GBytes *
+save_drawing_binary_bytes (guint64 base_size, guint64 base_mtime)
+{
+  bin_writer_s wr;
+  guint64 pens_at;
+
+  writer_init (&wr);
+  put_u32 (wr.body, BIN_REC_ENVIRONMENT);
+  write_environment (&wr, get_global_environment ());
+  gtk_tree_model_foreach (GTK_TREE_MODEL (get_projects ()),
+			  save_project_func, &wr);
+  put_u32 (wr.body, BIN_REC_END);
+
+  GByteArray *tables = write_tables (&wr, &pens_at);
+  guint64 pens_off = BIN_HEADER_SIZE + pens_at;
+  guint64 body_off = BIN_HEADER_SIZE + tables->len;
+
+  GByteArray *out = g_byte_array_sized_new (body_off + wr.body->len);
+  g_byte_array_append (out, (const guint8 *)BIN_MAGIC, 4);
+  put_u32 (out, BIN_VERSION);
+  put_u32 (out, wr.strings->len);
+  put_u32 (out, wr.pens->len);
+  put_u64 (out, BIN_HEADER_SIZE);
+  put_u64 (out, pens_off);
+  put_u64 (out, body_off);
+  put_u64 (out, body_off + wr.body->len);
+  put_u64 (out, base_size);
+  put_u64 (out, base_mtime);
+  g_byte_array_append (out, tables->data, tables->len);
+  g_byte_array_append (out, wr.body->data, wr.body->len);
+
+  g_byte_array_free (tables, TRUE);
+  writer_clear (&wr);
+  return g_byte_array_free_to_bytes (out);
+}
+
+gboolean
+save_drawing_binary (gchar *file)
+{
+  GError *error = NULL;
+  gsize len;
+  GBytes *bytes = save_drawing_binary_bytes (0, 0);
+  const gchar *data = g_bytes_get_data (bytes, &len);
+  gboolean rc = g_file_set_contents (file, data, len, &error);
+
+  if (!rc) {
+    log_string (LOG_GFIG_ERROR, NULL, error->message);
+    g_clear_error (&error);
+  }
+  g_bytes_unref (bytes);
+  return rc;
+}
+
+/***
+    A single entity with its own string and pen tables, for records
+    that have to stand alone (see journal.c):
+
+        nr_strings nr_pens pens_off body_off strings pens entity
+ ***/
+
+#define BIN_ENTITY_HEADER_SIZE	16
+
+GBytes *
+binary_encode_entity (gpointer entity)
+{
+  bin_writer_s wr;
+  guint64 pens_at;
+
+  writer_init (&wr);
+  write_entity (entity, &wr);
+  GByteArray *tables = write_tables (&wr, &pens_at);
+
+  GByteArray *out =
+    g_byte_array_sized_new (BIN_ENTITY_HEADER_SIZE + tables->len +
+			    wr.body->len);
+  put_u32 (out, wr.strings->len);
+  put_u32 (out, wr.pens->len);
+  put_u32 (out, BIN_ENTITY_HEADER_SIZE + pens_at);
+  put_u32 (out, BIN_ENTITY_HEADER_SIZE + tables->len);
+  g_byte_array_append (out, tables->data, tables->len);
+  g_byte_array_append (out, wr.body->data, wr.body->len);
+
+  g_byte_array_free (tables, TRUE);
+  writer_clear (&wr);
+  return g_byte_array_free_to_bytes (out);
+}
+
+
+/*************  read it **************/
+
+static gboolean
+get_check (bin_reader_s *rd, gsize size)
+{
+  if (rd->bad || rd->pos + size > rd->len) {
+    rd->bad = TRUE;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static guint32
+get_u32 (bin_reader_s *rd)
+{
+  guint32 val = 0;
+  if (get_check (rd, sizeof(val))) {
+    memcpy (&val, rd->base + rd->pos, sizeof(val));
+    rd->pos += sizeof(val);
+  }
+  return GUINT32_FROM_LE (val);
+}
+
+static guint64
+get_u64 (bin_reader_s *rd)
+{
+  guint64 val = 0;
+  if (get_check (rd, sizeof(val))) {
+    memcpy (&val, rd->base + rd->pos, sizeof(val));
+    rd->pos += sizeof(val);
+  }
+  return GUINT64_FROM_LE (val);
+}
+
+static gdouble
+get_f64 (bin_reader_s *rd)
+{
+  guint64 val = get_u64 (rd);
+  gdouble dval;
+  memcpy (&dval, &val, sizeof(dval));
+  return dval;
+}
+
+static void
+get_align (bin_reader_s *rd, guint align)
+{
+  rd->pos += (align - (rd->pos % align)) % align;
+}
+
+static void
+get_matrix (bin_reader_s *rd, cairo_matrix_t *matrix)
+{
+  matrix->xx = get_f64 (rd);
+  matrix->yx = get_f64 (rd);
+  matrix->xy = get_f64 (rd);
+  matrix->yy = get_f64 (rd);
+  matrix->x0 = get_f64 (rd);
+  matrix->y0 = get_f64 (rd);
+}
+
+static const gchar *
+get_string (bin_reader_s *rd)
+{
+  guint32 idx = get_u32 (rd);
+  if (idx == BIN_NONE) return NULL;
+  if (idx >= rd->nr_strings) {
+    rd->bad = TRUE;
+    return NULL;
+  }
+  return rd->strings[idx];
+}
+
+static pen_s *
+get_pen (bin_reader_s *rd, environment_s *env)
+{
+  guint32 idx = get_u32 (rd);
+  if (idx == BIN_NONE || idx >= rd->nr_pens)
+    return copy_environment_pen (env);
+  return copy_pen (rd->pens[idx]);
+}
+
+static pen_s *
+read_pen_table_entry (bin_reader_s *rd)
+{
+  pen_s *pen = gfig_try_malloc0 (sizeof(pen_s));
+  GdkRGBA colour;
+  colour.red   = get_f64 (rd);
+  colour.green = get_f64 (rd);
+  colour.blue  = get_f64 (rd);
+  colour.alpha = get_f64 (rd);
+  pen_colour (pen)       = gdk_rgba_copy (&colour);
+  pen_colour_name (pen)  = g_strdup (get_string (rd));
+  pen_line_style (pen)   = (gint)get_u32 (rd);
+  pen_lw_std_idx (pen)   = (gint)get_u32 (rd);
+  get_u32 (rd);
+  pen_lw (pen)           = get_f64 (rd);
+  return pen;
+}
+
+static void
+read_environment (bin_reader_s *rd, environment_s *env)
+{
+  paper_s *paper = environment_paper (env);
+  const gchar *size_name = get_string (rd);
+
+  if (size_name) {
+    if (paper_size (paper)) gtk_paper_size_free (paper_size (paper));
+    paper_size (paper) = gtk_paper_size_new (size_name);
+  }
+  paper_orientation (paper) = (gint)get_u32 (rd);
+  const gchar *colour_name = get_string (rd);
+  if (paper_colour_name (paper)) g_free (paper_colour_name (paper));
+  paper_colour_name (paper) = g_strdup (colour_name);
+
+  guint32 pen_idx = get_u32 (rd);
+  if (pen_idx < rd->nr_pens) {
+    pen_s *pen = environment_pen (env);
+    if (pen) {
+      if (pen_colour (pen)) gdk_rgba_free (pen_colour (pen));
+      if (pen_colour_name (pen)) g_free (pen_colour_name (pen));
+      g_free (pen);
+    }
+    environment_pen (env) = copy_pen (rd->pens[pen_idx]);
+  }
+
+  if (!paper_colour (paper))
+    paper_colour (paper) = gfig_try_malloc0 (sizeof(GdkRGBA));
+  paper_colour_red (paper)   = get_f64 (rd);
+  paper_colour_green (paper) = get_f64 (rd);
+  paper_colour_blue (paper)  = get_f64 (rd);
+  paper_colour_alpha (paper) = get_f64 (rd);
+  environment_dunit (env) = (gint)get_u32 (rd);
+  const gchar *font_name = get_string (rd);
+  if (font_name) environment_fontname (env) = g_strdup (font_name);
+  environment_show_grid (env)   = get_u32 (rd) ? TRUE : FALSE;
+  environment_snap_grid (env)   = get_u32 (rd) ? TRUE : FALSE;
+  environment_textsize (env)    = get_f64 (rd);
+  environment_target_grid (env) = get_f64 (rd);
+}
+
+static gpointer
+read_entity (bin_reader_s *rd, environment_s *env)
+{
+  gpointer entity = NULL;
+  entity_type_e type = (entity_type_e)get_u32 (rd);
+
+  if (rd->bad) return NULL;
+
+  switch (type) {
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_CIRCLE:
+    {
+      entity_circle_s *circle = gfig_try_malloc0 (sizeof(entity_circle_s));
+      entity_circle_type (circle) = ENTITY_TYPE_CIRCLE;
+      entity_circle_pen (circle) = get_pen (rd, env);
+      guint32 flags = get_u32 (rd);
+      entity_circle_fill (circle)     = (flags & BIN_FLAG_0) ? TRUE : FALSE;
+      entity_circle_negative (circle) = (flags & BIN_FLAG_1) ? TRUE : FALSE;
+      entity_circle_x (circle)     = get_f64 (rd);
+      entity_circle_y (circle)     = get_f64 (rd);
+      entity_circle_r (circle)     = get_f64 (rd);
+      entity_circle_start (circle) = get_f64 (rd);
+      entity_circle_stop (circle)  = get_f64 (rd);
+      entity = circle;
+    }
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    {
+      entity_ellipse_s *ellipse =
+	gfig_try_malloc0 (sizeof(entity_ellipse_s));
+      entity_ellipse_type (ellipse) = ENTITY_TYPE_ELLIPSE;
+      entity_ellipse_pen (ellipse) = get_pen (rd, env);
+      guint32 flags = get_u32 (rd);
+      entity_ellipse_fill (ellipse)     = (flags & BIN_FLAG_0) ? TRUE : FALSE;
+      entity_ellipse_negative (ellipse) = (flags & BIN_FLAG_1) ? TRUE : FALSE;
+      entity_ellipse_x (ellipse)     = get_f64 (rd);
+      entity_ellipse_y (ellipse)     = get_f64 (rd);
+      entity_ellipse_a (ellipse)     = get_f64 (rd);
+      entity_ellipse_b (ellipse)     = get_f64 (rd);
+      entity_ellipse_t (ellipse)     = get_f64 (rd);
+      entity_ellipse_start (ellipse) = get_f64 (rd);
+      entity_ellipse_stop (ellipse)  = get_f64 (rd);
+      entity = ellipse;
+    }
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      entity_text_s *text = gfig_try_malloc0 (sizeof(entity_text_s));
+      entity_text_type (text) = ENTITY_TYPE_TEXT;
+      entity_text_pen (text) = get_pen (rd, env);
+      guint32 flags = get_u32 (rd);
+      entity_text_justify (text)   = (flags & BIN_FLAG_0) ? TRUE : FALSE;
+      entity_text_filled (text)    = (flags & BIN_FLAG_1) ? TRUE : FALSE;
+      entity_text_string (text)    = g_strdup (get_string (rd));
+      entity_text_font (text)      = g_strdup (get_string (rd));
+      entity_text_size (text)      = (gint)get_u32 (rd);
+      entity_text_alignment (text) = (PangoAlignment)get_u32 (rd);
+      entity_text_lead (text)      = (gint)get_u32 (rd);
+      entity_text_spread (text)    = (gint)get_u32 (rd);
+      entity_text_x (text)         = get_f64 (rd);
+      entity_text_y (text)         = get_f64 (rd);
+      entity_text_t (text)         = get_f64 (rd);
+      entity_text_txtsize (text)   = get_f64 (rd);
+      entity = text;
+    }
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    {
+      entity_polyline_s *polyline =
+	gfig_try_malloc0 (sizeof(entity_polyline_s));
+      entity_polyline_type (polyline) = ENTITY_TYPE_POLYLINE;
+      entity_polyline_pen (polyline) = get_pen (rd, env);
+      guint32 flags = get_u32 (rd);
+      entity_polyline_closed (polyline) = (flags & BIN_FLAG_0) ? TRUE : FALSE;
+      entity_polyline_filled (polyline) = (flags & BIN_FLAG_1) ? TRUE : FALSE;
+      entity_polyline_spline (polyline) = (flags & BIN_FLAG_2) ? TRUE : FALSE;
+      entity_polyline_intersect (polyline) = (intersect_e)get_u32 (rd);
+      entity_polyline_isect_radius (polyline) = get_f64 (rd);
+      guint32 nr_verts = get_u32 (rd);
+      get_align (rd, 8);
+      if (get_check (rd, (gsize)nr_verts * 2 * sizeof(gdouble))) {
+	GList *verts = NULL;
+	for (guint32 i = 0; i < nr_verts; i++) {
+	  point_s *pt = gfig_try_malloc0 (sizeof(point_s));
+	  point_x (pt) = get_f64 (rd);
+	  point_y (pt) = get_f64 (rd);
+	  verts = g_list_prepend (verts, pt);
+	}
+	entity_polyline_verts (polyline) = g_list_reverse (verts);
+      }
+      entity = polyline;
+    }
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    {
+      entity_transform_s *transform =
+	gfig_try_malloc0 (sizeof(entity_transform_s));
+      entity_tf_type (transform) = ENTITY_TYPE_TRANSFORM;
+      guint32 flags = get_u32 (rd);
+      entity_tf_unset (transform) = (flags & BIN_FLAG_0) ? TRUE : FALSE;
+      if (flags & BIN_FLAG_1) {
+	entity_tf_matrix (transform) =
+	  gfig_try_malloc0 (sizeof(cairo_matrix_t));
+	get_matrix (rd, entity_tf_matrix (transform));
+      }
+      entity = transform;
+    }
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      entity_group_s *group = gfig_try_malloc0 (sizeof(entity_group_s));
+      entity_group_type (group) = ENTITY_TYPE_GROUP;
+      guint32 flags = get_u32 (rd);
+      if (flags & BIN_FLAG_0) {
+	entity_group_transform (group) =
+	  gfig_try_malloc0 (sizeof(cairo_matrix_t));
+	get_matrix (rd, entity_group_transform (group));
+      }
+      if (flags & BIN_FLAG_1) {
+	entity_group_centre (group) = gfig_try_malloc0 (sizeof(point_s));
+	point_x (entity_group_centre (group)) = get_f64 (rd);
+	point_y (entity_group_centre (group)) = get_f64 (rd);
+      }
+      guint32 nr_children = get_u32 (rd);
+      GList *children = NULL;
+      if (++rd->depth > BIN_MAX_DEPTH) rd->bad = TRUE;
+      for (guint32 i = 0; !rd->bad && i < nr_children; i++) {
+	gpointer child = read_entity (rd, env);
+	if (child) children = g_list_prepend (children, child);
+      }
+      rd->depth--;
+      entity_group_entities (group) = g_list_reverse (children);
+      entity = group;
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    {
+      entity_instance_s *instance =
+	gfig_try_malloc0 (sizeof(entity_instance_s));
+      entity_instance_type (instance) = ENTITY_TYPE_INSTANCE;
+      guint32 pen_idx = get_u32 (rd);
+      if (pen_idx < rd->nr_pens)
+	entity_instance_pen (instance) = copy_pen (rd->pens[pen_idx]);
+      entity_instance_block (instance) = block_get (rd->project,
+						    get_string (rd));
+      get_matrix (rd, &entity_instance_transform (instance));
+      entity = instance;
+    }
+    break;
+  default:
+    rd->bad = TRUE;
+    break;
+  }
+  return entity;
+}
+
+/***
+    The counts come from the file, so they are held to what the file
+    could possibly contain before anything is sized from them.
+ ***/
+
+static void
+read_tables (bin_reader_s *rd, guint64 strings_off, guint64 pens_off)
+{
+  if (strings_off > rd->len ||
+      (gsize)rd->nr_strings > (rd->len - strings_off) / BIN_STRING_MIN) {
+    rd->bad = TRUE;
+    return;
+  }
+
+  rd->strings = gfig_try_malloc0 (((gsize)rd->nr_strings + 1) *
+				  sizeof(gchar *));
+  rd->pos = strings_off;
+  for (guint32 i = 0; !rd->bad && i < rd->nr_strings; i++) {
+    guint32 len = get_u32 (rd);
+    if (get_check (rd, (gsize)len + 1) && rd->base[rd->pos + len] == 0) {
+      rd->strings[i] = (const gchar *)(rd->base + rd->pos);
+      rd->pos += len + 1;
+      get_align (rd, 4);
+    }
+    else rd->bad = TRUE;
+  }
+
+  if (!rd->bad) {
+    rd->pens = gfig_try_malloc0 (((gsize)rd->nr_pens + 1) * sizeof(pen_s *));
+    rd->pos = pens_off;
+    for (guint32 i = 0; !rd->bad && i < rd->nr_pens; i++)
+      rd->pens[i] = read_pen_table_entry (rd);
+  }
+}
+
+static void
+reader_clear (bin_reader_s *rd)
+{
+  if (rd->pens) {
+    for (guint32 i = 0; i < rd->nr_pens; i++) {
+      pen_s *pen = rd->pens[i];
+      if (!pen) continue;
+      if (pen_colour (pen)) gdk_rgba_free (pen_colour (pen));
+      if (pen_colour_name (pen)) g_free (pen_colour_name (pen));
+      g_free (pen);
+    }
+    g_free (rd->pens);
+  }
+  if (rd->strings) g_free (rd->strings);
+}
+
+static GList *
+read_entities (bin_reader_s *rd, environment_s *env)
+{
+  guint32 nr_entities = get_u32 (rd);
+  GList *entities = NULL;
+  for (guint32 i = 0; !rd->bad && i < nr_entities; i++) {
+    gpointer entity = read_entity (rd, env);
+    if (entity) entities = g_list_prepend (entities, entity);
+  }
+  return g_list_reverse (entities);
+}
+
+static gboolean
+read_body (bin_reader_s *rd)
+{
+  project_s *project = NULL;
+
+  while (!rd->bad) {
+    switch (get_u32 (rd)) {
+    case BIN_REC_END:
+      return !rd->bad;
+    case BIN_REC_ENVIRONMENT:
+      read_environment (rd, get_global_environment ());
+      break;
+    case BIN_REC_PROJECT:
+      project = rd->project = create_project (get_string (rd));
+      read_environment (rd, project_environment (project));
+      break;
+    case BIN_REC_BLOCK:
+      {
+	if (!project) {
+	  rd->bad = TRUE;
+	  break;
+	}
+	gchar *name = g_strdup (get_string (rd));
+	GList *entities = read_entities (rd, project_environment (project));
+	block_define (project, name, entities);
+	g_free (name);
+      }
+      break;
+    case BIN_REC_SHEET:
+      {
+	if (!project) {
+	  rd->bad = TRUE;
+	  break;
+	}
+	sheet_s *sheet;
+	GtkTreeIter parent;
+	const gchar *name  = get_string (rd);
+	const gchar *ppath = get_string (rd);
+	gboolean valid_parent = ppath &&
+	  gtk_tree_model_get_iter_from_string
+	  (GTK_TREE_MODEL (project_sheets (project)), &parent, ppath);
+	GtkTreeIter *iter = append_sheet (project,
+					  valid_parent ? &parent : NULL,
+					  (gchar *)name, &sheet);
+	gtk_tree_iter_free (iter);
+	environment_s *env = sheet_environment (sheet);
+	read_environment (rd, env);
+	sheet_entities (sheet) = read_entities (rd, env);
+      }
+      break;
+    default:
+      rd->bad = TRUE;
+      break;
+    }
+  }
+  return FALSE;
+}
+
+static void
+binary_error_dialogue (const gchar *filename, const gchar *msg)
+{
+  GtkWidget *dialog;
+
+  dialog = gtk_message_dialog_new (NULL,
+				   GTK_DIALOG_DESTROY_WITH_PARENT,
+				   GTK_MESSAGE_WARNING,
+				   GTK_BUTTONS_OK,
+				   _ ("Error reading drawing file %s: %s"),
+				   filename, msg);
+  gtk_window_set_keep_above (GTK_WINDOW (dialog), TRUE);
+  gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_MOUSE);
+  gtk_dialog_run (GTK_DIALOG (dialog));
+  gtk_widget_destroy (dialog);
+}
+
+gboolean
+is_drawing_binary (const gchar *file)
+{
+  gboolean rc = FALSE;
+  gchar magic[4];
+
+  FILE *fp = fopen (file, "rb");
+  if (fp) {
+    rc = (fread (magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+	  !memcmp (magic, BIN_MAGIC, sizeof(magic)));
+    fclose (fp);
+  }
+  return rc;
+}
+
+/***
+    The base stamp of a version 3 file; FALSE for anything older or
+    unreadable.
+ ***/
+
+gboolean
+binary_base_stamp (const gchar *file, guint64 *size_p, guint64 *mtime_p)
+{
+  gboolean rc = FALSE;
+  guint8 header[BIN_HEADER_SIZE];
+
+  FILE *fp = fopen (file, "rb");
+  if (fp) {
+    if (fread (header, 1, sizeof(header), fp) == sizeof(header) &&
+	!memcmp (header, BIN_MAGIC, 4)) {
+      bin_reader_s rd = {0};
+      rd.base = header;
+      rd.len  = sizeof(header);
+      rd.pos  = 4;
+      if (get_u32 (&rd) >= 3) {
+	rd.pos = BIN_HEADER_MIN;
+	*size_p  = get_u64 (&rd);
+	*mtime_p = get_u64 (&rd);
+	rc = !rd.bad;
+      }
+    }
+    fclose (fp);
+  }
+  return rc;
+}
+
+/***
+    FALSE if the file could not be read; whatever it had built by
+    then is discarded.
+ ***/
+
+gboolean
+load_drawing_binary (gchar *file)
+{
+  GError *error = NULL;
+  gint first =
+    gtk_tree_model_iter_n_children (GTK_TREE_MODEL (get_projects ()), NULL);
+  GMappedFile *mapped = g_mapped_file_new (file, FALSE, &error);
+
+  if (error) {
+    binary_error_dialogue (file, error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+
+  bin_reader_s rd = {0};
+  rd.base = (const guint8 *)g_mapped_file_get_contents (mapped);
+  rd.len  = g_mapped_file_get_length (mapped);
+
+  if (rd.len < BIN_HEADER_MIN || memcmp (rd.base, BIN_MAGIC, 4)) {
+    binary_error_dialogue (file, _ ("not a gf3 binary drawing"));
+    g_mapped_file_unref (mapped);
+    return FALSE;
+  }
+  rd.pos = 4;
+  guint32 version = get_u32 (&rd);
+  if (version > BIN_VERSION) {
+    binary_error_dialogue (file, _ ("unsupported binary drawing version"));
+    g_mapped_file_unref (mapped);
+    return FALSE;
+  }
+  rd.nr_strings = get_u32 (&rd);
+  rd.nr_pens    = get_u32 (&rd);
+  guint64 strings_off = get_u64 (&rd);
+  guint64 pens_off    = get_u64 (&rd);
+  guint64 body_off    = get_u64 (&rd);
+  guint64 file_len    = get_u64 (&rd);
+
+  if (file_len != rd.len || strings_off > rd.len ||
+      pens_off > rd.len || body_off > rd.len ||
+      (guint64)rd.nr_pens * BIN_PEN_SIZE > rd.len - pens_off)
+    rd.bad = TRUE;
+
+  if (!rd.bad) read_tables (&rd, strings_off, pens_off);
+
+  if (!rd.bad) {
+    rd.pos = body_off;
+    read_body (&rd);
+  }
+
+  if (rd.bad)
+    binary_error_dialogue (file, _ ("file is truncated or corrupt"));
+
+  reader_clear (&rd);
+  g_mapped_file_unref (mapped);
+  if (rd.bad) discard_projects (first);
+  return !rd.bad;
+}
+
+gpointer
+binary_decode_entity (const guint8 *data, gsize len, environment_s *env,
+		      project_s *project)
+{
+  gpointer entity = NULL;
+  bin_reader_s rd = {0};
+  rd.base    = data;
+  rd.len     = len;
+  rd.project = project;
+
+  rd.nr_strings = get_u32 (&rd);
+  rd.nr_pens    = get_u32 (&rd);
+  guint32 pens_off = get_u32 (&rd);
+  guint32 body_off = get_u32 (&rd);
+  if (pens_off > rd.len || body_off > rd.len ||
+      (guint64)rd.nr_pens * BIN_PEN_SIZE > rd.len - pens_off)
+    rd.bad = TRUE;
+
+  if (!rd.bad) read_tables (&rd, BIN_ENTITY_HEADER_SIZE, pens_off);
+  if (!rd.bad) {
+    rd.pos = body_off;
+    entity = read_entity (&rd, env);
+  }
+  if (rd.bad && entity) {
+    delete_entities (entity);
+    entity = NULL;
+  }
+
+  reader_clear (&rd);
+  return entity;
+}
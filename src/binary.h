@@ -0,0 +1,16 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#define BINARY_DRAWING_SUFFIX	".gfb"
+
+gboolean is_drawing_binary (const gchar *file);
+gboolean save_drawing_binary (gchar *file);
+GBytes *save_drawing_binary_bytes (guint64 base_size, guint64 base_mtime);
+gboolean binary_base_stamp (const gchar *file, guint64 *size_p,
+			    guint64 *mtime_p);
+gboolean load_drawing_binary (gchar *file);
+GBytes *binary_encode_entity (gpointer entity);
+gpointer binary_decode_entity (const guint8 *data, gsize len,
+			       environment_s *env, project_s *project);
+
+#endif /* BINARY_H */
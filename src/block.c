@@ -0,0 +1,202 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "block.h"
+#include "pick.h"
+#include "display.h"
+#include "view.h"
+
+#if 0 // comments
+
+     A block is a named list of entities defined once per project and
+     drawn any number of times by instance entities, each of which
+     holds only the block, a transform and an optional pen.  Ten
+     thousand copies of a symbol are ten thousand small records, and
+     the block itself is recorded once (see recorded_draw in
+     entities.c) and replayed by every instance.
+
+     Blocks live as long as their project.  Redefining a block
+     replaces its entities in place, so every instance picks up the
+     new geometry.  An instance naming a block not yet defined gets
+     an empty one, to be filled in by a later definition; that is how
+     the loaders keep sharing intact whatever the order.  Names still
+     undefined when a load is done are reported then.
+
+     A definition that would make a block contain itself, directly or
+     through other blocks or groups, is refused, since drawing and
+     indexing it would never end.
+
+#endif
+
+static void
+block_free (gpointer data)
+{
+  block_s *block = data;
+
+  clear_entities (&block_entities (block));
+  entity_cache_free (&block_cache (block));
+  g_free (block_name (block));
+  g_free (block);
+}
+
+block_s *
+block_lookup (project_s *project, const gchar *name)
+{
+  if (!project || !name || !project_blocks (project)) return NULL;
+  return g_hash_table_lookup (project_blocks (project), name);
+}
+
+block_s *
+block_get (project_s *project, const gchar *name)
+{
+  if (!project || !name) return NULL;
+
+  block_s *block = block_lookup (project, name);
+  if (!block) {
+    if (!project_blocks (project))
+      project_blocks (project) =
+	g_hash_table_new_full (g_str_hash, g_str_equal, NULL, block_free);
+    block = gfig_try_malloc0 (sizeof(block_s));
+    block_name (block) = g_strdup (name);
+    g_hash_table_insert (project_blocks (project), block_name (block), block);
+  }
+  return block;
+}
+
+static gboolean
+block_sheet_changed (GtkTreeModel *model,
+		     GtkTreePath *path,
+		     GtkTreeIter *iter,
+		     gpointer data)
+{
+  sheet_s *sheet = NULL;
+
+  gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
+  if (sheet) {
+    pick_invalidate (sheet);
+    display_invalidate (sheet);
+    force_redraw (sheet);
+  }
+  return FALSE;
+}
+
+static gboolean
+block_reaches (GList *entities, block_s *block, GHashTable *seen)
+{
+  for (GList *l = entities; l; l = l->next) {
+    switch (entity_type (l->data)) {
+    case ENTITY_TYPE_GROUP:
+      if (block_reaches (entity_group_entities ((entity_group_s *)l->data),
+			 block, seen))
+	return TRUE;
+      break;
+    case ENTITY_TYPE_INSTANCE:
+      {
+	block_s *inner =
+	  entity_instance_block ((entity_instance_s *)l->data);
+	if (inner == block) return TRUE;
+	if (inner && g_hash_table_add (seen, inner) &&
+	    block_reaches (block_entities (inner), block, seen))
+	  return TRUE;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return FALSE;
+}
+
+/***
+    Takes over the entity list.  FALSE, with the list freed, if the
+    definition is refused.
+ ***/
+
+gboolean
+block_define (project_s *project, const gchar *name, GList *entities)
+{
+  block_s *block = block_get (project, name);
+  if (!block) {
+    clear_entities (&entities);
+    return FALSE;
+  }
+
+  GHashTable *seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+  gboolean cycle = block_reaches (entities, block, seen);
+  g_hash_table_destroy (seen);
+  if (cycle) {
+    gchar *msg =
+      g_strdup_printf (_ ("Block %s would contain itself; definition ignored.\n"),
+		       name);
+    log_string (LOG_GFIG_ERROR, NULL, msg);
+    g_free (msg);
+    clear_entities (&entities);
+    return FALSE;
+  }
+
+  clear_entities (&block_entities (block));
+  block_entities (block) = entities;
+  block_defined (block) = TRUE;
+  entity_changed (NULL);
+  // instances may already hold the block, placeholder or not
+  if (project_sheets (project))
+    gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
+			    block_sheet_changed, NULL);
+  return TRUE;
+}
+
+/***
+    Log the blocks that instances name but nothing defines, in the
+    projects from position first on.
+ ***/
+
+void
+block_report_undefined (gint first)
+{
+  GtkTreeModel *projects = GTK_TREE_MODEL (get_projects ());
+  GtkTreeIter iter;
+
+  if (!projects ||
+      !gtk_tree_model_iter_nth_child (projects, &iter, NULL, first))
+    return;
+  do {
+    project_s *project = NULL;
+    gtk_tree_model_get (projects, &iter, PROJECT_STRUCT_COL, &project, -1);
+    GList *blocks = block_list (project);
+    for (GList *l = blocks; l; l = l->next) {
+      block_s *block = l->data;
+      if (block_defined (block)) continue;
+      gchar *msg =
+	g_strdup_printf (_ ("Block %s in project %s is used but never defined.\n"),
+			 block_name (block), project_name (project));
+      log_string (LOG_GFIG_ERROR, NULL, msg);
+      g_free (msg);
+    }
+    g_list_free (blocks);
+  } while (gtk_tree_model_iter_next (projects, &iter));
+}
+
+static gint
+block_compare (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (block_name ((block_s *)a), block_name ((block_s *)b));
+}
+
+/***
+    The blocks of a project sorted by name, so saves are stable.  The
+    caller frees the list, not the blocks.
+ ***/
+
+GList *
+block_list (project_s *project)
+{
+  if (!project || !project_blocks (project)) return NULL;
+  return g_list_sort (g_hash_table_get_values (project_blocks (project)),
+		      block_compare);
+}
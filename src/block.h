@@ -0,0 +1,11 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+block_s *block_lookup (project_s *project, const gchar *name);
+block_s *block_get (project_s *project, const gchar *name);
+gboolean block_define (project_s *project, const gchar *name,
+		       GList *entities);
+void block_report_undefined (gint first);
+GList *block_list (project_s *project);
+
+#endif  /* BLOCK_H */
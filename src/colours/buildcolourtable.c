@@ -2,6 +2,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <values.h>
 
 /********
@@ -9,6 +10,113 @@
 	 ./buildcolortable <css-colours.txt
 *******/
 
+#define MAX_COLOURS	1024
+
+/***
+    Colour names are looked up through a perfect hash: the name hashed
+    with seed 0 picks a bucket, the bucket holds a displacement, and
+    the name hashed again with that displacement picks a slot holding
+    the index of the colour.  The displacements are found here, so no
+    two names share a slot.  Names are case-folded, as the old lookup
+    used strcasecmp.
+
+    colour_hash below is written verbatim into css_colour_table.h as
+    css_colour_hash, so the two must stay the same.
+ ***/
+
+#define BUCKETS		64
+#define SLOTS		256
+
+static unsigned int
+colour_hash (const char *s, unsigned int seed)
+{
+  unsigned int h = 2166136261u ^ (seed * 0x9e3779b1u);
+  for (; *s; s++) {
+    unsigned int c = (unsigned char)*s;
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    h = (h ^ c) * 16777619u;
+  }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return h;
+}
+
+static const char *colour_hash_src[] = {
+  "static inline guint",
+  "css_colour_hash (const gchar *s, guint seed)",
+  "{",
+  "  guint h = 2166136261u ^ (seed * 0x9e3779b1u);",
+  "  for (; *s; s++) {",
+  "    guint c = (guchar)*s;",
+  "    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';",
+  "    h = (h ^ c) * 16777619u;",
+  "  }",
+  "  h ^= h >> 15;",
+  "  h *= 0x2c1b3c6du;",
+  "  h ^= h >> 12;",
+  "  return h;",
+  "}",
+  NULL
+};
+
+static int bucket_of[MAX_COLOURS];
+
+static int
+bucket_compare (const void *a, const void *b)
+{
+  return ((const int *)b)[1] - ((const int *)a)[1];
+}
+
+/***
+    Biggest buckets first, each given the first displacement that puts
+    all its names in free slots.
+ ***/
+
+static int
+build_hash (char **names, int count, unsigned char *displace, short *slots)
+{
+  int sizes[BUCKETS][2];
+
+  for (int b = 0; b < BUCKETS; b++) {
+    sizes[b][0] = b;
+    sizes[b][1] = 0;
+    displace[b] = 0;
+  }
+  for (int i = 0; i < SLOTS; i++) slots[i] = -1;
+  for (int i = 0; i < count; i++) {
+    bucket_of[i] = colour_hash (names[i], 0) % BUCKETS;
+    sizes[bucket_of[i]][1]++;
+  }
+  qsort (sizes, BUCKETS, sizeof(sizes[0]), bucket_compare);
+
+  for (int k = 0; k < BUCKETS && sizes[k][1] > 0; k++) {
+    int b = sizes[k][0];
+    int d;
+    for (d = 1; d < 256; d++) {
+      int taken[MAX_COLOURS];
+      int n = 0;
+      int ok = 1;
+      for (int i = 0; ok && i < count; i++) {
+	if (bucket_of[i] != b) continue;
+	int s = colour_hash (names[i], d) % SLOTS;
+	if (slots[s] >= 0) ok = 0;
+	for (int j = 0; ok && j < n; j++)
+	  if (colour_hash (names[taken[j]], d) % SLOTS == s) ok = 0;
+	taken[n++] = i;
+      }
+      if (ok) {
+	for (int j = 0; j < n; j++)
+	  slots[colour_hash (names[taken[j]], d) % SLOTS] = taken[j];
+	displace[b] = d;
+	break;
+      }
+    }
+    if (d == 256) return 0;
+  }
+  return 1;
+}
+
 #define MIN3(a,b,c) (fmin (a, fmin (b, c)))
 #define MAX3(a,b,c) (fmax (a, fmax (b, c)))
 
@@ -53,6 +161,9 @@ main ()
   char  green[3];
   char  blue[3];
   int   count = 0;
+  char *names[MAX_COLOURS];
+  unsigned char displace[BUCKETS];
+  short slots[SLOTS];
 
   FILE *file;
 
@@ -87,11 +198,31 @@ main ()
 	     red, green, blue,
 	     rv, gv, bv, hv, sv, vv);
 #endif
+    if (count < MAX_COLOURS) names[count] = strdup (name);
     count++;
   }
   fprintf (file, "};\n");
   fprintf (file, "\n");
   //  fprintf (file, "gint css_colour_count = %d;\n", count);
+
+  if (count > MAX_COLOURS || count > SLOTS ||
+      !build_hash (names, count, displace, slots)) {
+    fprintf (stderr, "no perfect hash for %d colours\n", count);
+    fclose (file);
+    exit (1);
+  }
+  fprintf (file, "const guint8 css_colour_displace[CSS_COLOUR_BUCKETS] = {");
+  for (int b = 0; b < BUCKETS; b++)
+    fprintf (file, "%s%d%s", (b % 16) ? " " : "\n  ", displace[b],
+	     (b < BUCKETS - 1) ? "," : "");
+  fprintf (file, "\n};\n");
+  fprintf (file, "\n");
+  fprintf (file, "const gint16 css_colour_slots[CSS_COLOUR_SLOTS] = {");
+  for (int i = 0; i < SLOTS; i++)
+    fprintf (file, "%s%d%s", (i % 16) ? " " : "\n  ", slots[i],
+	     (i < SLOTS - 1) ? "," : "");
+  fprintf (file, "\n};\n");
+  fprintf (file, "\n");
   fclose (file);
 
   file = fopen ("css_colour_table.h", "w");
@@ -129,6 +260,15 @@ main ()
   fprintf (file, "\n");
   fprintf (file, "#define CSS_COLOUR_COUNT  %d\n", count);
   fprintf (file, "css_colours_s css_colours[CSS_COLOUR_COUNT];\n");
+  fprintf (file, "\n");
+  fprintf (file, "#define CSS_COLOUR_BUCKETS  %d\n", BUCKETS);
+  fprintf (file, "#define CSS_COLOUR_SLOTS  %d\n", SLOTS);
+  fprintf (file, "extern const guint8 css_colour_displace[CSS_COLOUR_BUCKETS];\n");
+  fprintf (file, "extern const gint16 css_colour_slots[CSS_COLOUR_SLOTS];\n");
+  fprintf (file, "\n");
+  for (int i = 0; colour_hash_src[i]; i++)
+    fprintf (file, "%s\n", colour_hash_src[i]);
+  fprintf (file, "\n");
   fprintf (file, "#endif   /* CSS_COLOUR_TABLE_H */\n\n");
   fclose (file);
 }
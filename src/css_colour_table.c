@@ -149,3 +149,29 @@ css_colours_s css_colours[CSS_COLOUR_COUNT] = {
   {"YellowGreen", TRUE, "#9ACD32FF", 1.0, 0.603922, 0.803922, 0.196078, 1.391759, 0.756098, 0.803922},
 };
 
+const guint8 css_colour_displace[CSS_COLOUR_BUCKETS] = {
+  1, 1, 1, 1, 6, 1, 2, 4, 5, 0, 1, 3, 1, 0, 0, 1,
+  0, 2, 2, 3, 3, 8, 1, 1, 1, 3, 2, 1, 1, 2, 5, 1,
+  2, 1, 1, 1, 2, 1, 1, 6, 1, 4, 1, 3, 3, 3, 4, 2,
+  9, 3, 2, 6, 0, 1, 2, 1, 0, 5, 2, 1, 2, 0, 7, 1
+};
+
+const gint16 css_colour_slots[CSS_COLOUR_SLOTS] = {
+  21, 42, 135, -1, 95, 32, 47, -1, 102, -1, 138, -1, -1, 5, -1, -1,
+  83, 117, -1, -1, 61, -1, 85, 50, -1, 51, -1, -1, -1, 58, -1, -1,
+  -1, 62, -1, -1, -1, 101, -1, -1, 77, -1, -1, -1, 30, 90, 4, -1,
+  -1, -1, 63, 72, 9, 123, -1, 108, 59, -1, 93, 125, 79, -1, -1, 112,
+  -1, -1, 29, -1, -1, 13, -1, -1, -1, 26, 64, -1, 22, -1, 97, -1,
+  98, 75, 128, -1, 7, -1, 126, 49, 38, -1, -1, 43, 34, -1, 36, -1,
+  114, 110, -1, -1, 96, -1, -1, 70, -1, 71, 69, 132, -1, 35, 124, -1,
+  130, 119, -1, 53, 8, -1, 3, -1, 20, -1, 89, 139, -1, -1, -1, 31,
+  68, 0, -1, -1, -1, -1, -1, 134, 127, -1, 40, 60, -1, -1, -1, 113,
+  -1, -1, 122, -1, 136, 46, 44, 78, 16, 33, 94, -1, -1, -1, 15, 19,
+  -1, -1, 73, -1, -1, 74, 41, 57, 55, 76, -1, -1, -1, -1, 133, 104,
+  56, 137, 48, 66, -1, -1, 39, 67, 2, -1, -1, 109, -1, -1, 100, 129,
+  -1, -1, -1, -1, 6, 111, -1, 37, -1, -1, 23, 81, 131, 18, 87, 11,
+  28, -1, 92, 116, 84, 121, -1, 14, -1, 118, 52, -1, 24, 88, -1, 10,
+  25, -1, -1, 91, -1, -1, -1, 103, -1, -1, 80, 105, 27, -1, 115, 82,
+  86, -1, 1, 12, 45, -1, 54, -1, 120, 65, -1, 99, 17, 107, 106, -1
+};
+
@@ -32,5 +32,26 @@ typedef struct {
 
 #define CSS_COLOUR_COUNT  140
 css_colours_s css_colours[CSS_COLOUR_COUNT];
+
+#define CSS_COLOUR_BUCKETS  64
+#define CSS_COLOUR_SLOTS  256
+extern const guint8 css_colour_displace[CSS_COLOUR_BUCKETS];
+extern const gint16 css_colour_slots[CSS_COLOUR_SLOTS];
+
+static inline guint
+css_colour_hash (const gchar *s, guint seed)
+{
+  guint h = 2166136261u ^ (seed * 0x9e3779b1u);
+  for (; *s; s++) {
+    guint c = (guchar)*s;
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    h = (h ^ c) * 16777619u;
+  }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return h;
+}
+
 #endif   /* CSS_COLOUR_TABLE_H */
 
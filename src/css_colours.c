@@ -5,11 +5,8 @@
 #include <gtk/gtk.h>
 #include <glib/gi18n-lib.h>
 
-#define __USE_GNU
 #include <math.h>
-#include <search.h>
 #include <stdlib.h>
-#include <strings.h>
 
 #include "gf.h"
 #include "css_colour_table.h"
@@ -17,7 +14,7 @@
 #include "persistents.h"
 #include "rgbhsv.h"
 
-static void *colours_hash = NULL;
+static GHashTable *custom_colours = NULL;	// case-folded name -> colour
 static gboolean colours_hash_modified = FALSE;
 static GtkListStore *colour_store = NULL;
 static gint name_seqr = 1;
@@ -42,20 +39,29 @@ get_css_colour_name (gint idx)
 }
 
 
-static int
-colours_hash_compare_struct (const void *a, const void *b)
-{
-  const css_colours_s *aa = (const css_colours_s *)a;
-  const css_colours_s *ba = (const css_colours_s *)b;
-  return strcasecmp (aa->name, ba->name);
-}
+/***
+    The preset colours are found through the perfect hash generated
+    with css_colour_table.c (see colours/buildcolourtable.c): two
+    hashes of the name and one compare, whatever the name.  Custom
+    colours live in a small overlay consulted after the presets, so a
+    custom colour can't shadow a preset one.
+ ***/
 
-static int
-colours_hash_compare_string (const void *a, const void *b)
+static css_colours_s *
+find_css_colour (const gchar *str)
 {
-  const gchar         *aa = (const gchar *)a;
-  const css_colours_s *ba = (const css_colours_s *)b;
-  return strcasecmp (aa, ba->name);
+  if (!str) return NULL;
+
+  guint d = css_colour_displace[css_colour_hash (str, 0) % CSS_COLOUR_BUCKETS];
+  gint idx = css_colour_slots[css_colour_hash (str, d) % CSS_COLOUR_SLOTS];
+  if (idx >= 0 && !g_ascii_strcasecmp (css_colours[idx].name, str))
+    return &css_colours[idx];
+
+  if (!custom_colours) return NULL;
+  gchar *key = g_ascii_strdown (str, -1);
+  css_colours_s *rc = g_hash_table_lookup (custom_colours, key);
+  g_free (key);
+  return rc;
 }
 
 css_colours_s *
@@ -63,12 +69,8 @@ find_css_colour_rgba (const gchar *str, GdkRGBA *rgba)
 {
   g_assert (rgba != NULL);
   
-  css_colours_s *rc = NULL;
-
-  void *res = tfind ((const void *)str, &colours_hash,
-		     colours_hash_compare_string);
-  if (res) {
-    rc = *(css_colours_s **)res;
+  css_colours_s *rc = find_css_colour (str);
+  if (rc) {
     rgba->red   = rc->red;
     rgba->green = rc->green;
     rgba->blue  = rc->blue;
@@ -78,30 +80,13 @@ find_css_colour_rgba (const gchar *str, GdkRGBA *rgba)
   return rc;
 }
 
-static  css_colours_s *
-find_css_colour (const gchar *str,
-		 gdouble *r, gdouble *g, gdouble *b, gdouble *a)
-{
-  css_colours_s *rc = NULL;
-
-  void *res = tfind ((const void *)str, &colours_hash,
-		     colours_hash_compare_string);
-  if (res) rc = *(css_colours_s **)res;
-
-  return rc;
-}
-
 gboolean colour_table_modified () {
   return colours_hash_modified;
 }
 
-void
-append_colour_ety (css_colours_s *ety)
+static void
+store_colour_ety (css_colours_s *ety)
 {
-  tsearch (ety, &colours_hash, colours_hash_compare_struct);
-
-  colours_hash_modified = TRUE;
-      
   GtkTreeIter   iter;
 
   gtk_list_store_append (colour_store, &iter);
@@ -118,6 +103,20 @@ append_colour_ety (css_colours_s *ety)
 		      -1);
 }
 
+void
+append_colour_ety (css_colours_s *ety)
+{
+  if (!find_css_colour (ety->name)) {
+    if (!custom_colours)
+      custom_colours = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      g_free, NULL);
+    g_hash_table_insert (custom_colours, g_ascii_strdown (ety->name, -1), ety);
+  }
+
+  colours_hash_modified = TRUE;
+  if (colour_store) store_colour_ety (ety);
+}
+
 static void
 append_colour (gchar *aname, gchar *hex,
 	       GdkRGBA* rgba, gdouble h, gdouble s, gdouble v)
@@ -137,25 +136,25 @@ append_colour (gchar *aname, gchar *hex,
   append_colour_ety (ety);
 }
 
+static gint
+colour_compare (gconstpointer a, gconstpointer b)
+{
+  return g_ascii_strcasecmp (((const css_colours_s *)a)->name,
+			     ((const css_colours_s *)b)->name);
+}
+
 void
 store_custom_colours (GKeyFile *key_file)
 {
-  void colours_hash_walk (const void *nodep,
-		   const VISIT which,
-		   const int depth) {
-    switch(which) {
-    case leaf:
-      {
-        css_colours_s *ety = *(css_colours_s **) nodep;
-        if (!ety->preset) save_colour_entry (ety, key_file);
-      }
-      break;
-    default:
-      break;
-    }
-  }
+  if (!custom_colours) return;
 
-  twalk (colours_hash, colours_hash_walk);
+  GList *etys = g_list_sort (g_hash_table_get_values (custom_colours),
+			     colour_compare);
+  for (GList *l = etys; l; l = l->next) {
+    css_colours_s *ety = l->data;
+    if (!ety->preset) save_colour_entry (ety, key_file);
+  }
+  g_list_free (etys);
 }
 
 
@@ -163,28 +162,30 @@ store_custom_colours (GKeyFile *key_file)
 static void
 build_colours_list ()
 {
-  for (gint i = 0; i < CSS_COLOUR_COUNT; i++) {
-    GtkTreeIter   iter;
-
-    tsearch (&css_colours[i], &colours_hash, colours_hash_compare_struct);
-    gtk_list_store_append (colour_store, &iter);
-    gtk_list_store_set (colour_store, &iter,
-			COLOUR_NAME,		css_colours[i].name,
-			COLOUR_HEX,		css_colours[i].hex,
-			COLOUR_ALPHA,		css_colours[i].alpha,
-			COLOUR_RED,		css_colours[i].red,
-			COLOUR_GREEN,		css_colours[i].green,
-			COLOUR_BLUE,		css_colours[i].blue,
-			COLOUR_HUE,		css_colours[i].hue,
-			COLOUR_SATURATION,	css_colours[i].saturation,
-			COLOUR_VALUE,		css_colours[i].value,
-			-1);
+  for (gint i = 0; i < CSS_COLOUR_COUNT; i++)
+    store_colour_ety (&css_colours[i]);
+
+  if (custom_colours) {
+    GHashTableIter iter;
+    gpointer ety;
+    g_hash_table_iter_init (&iter, custom_colours);
+    while (g_hash_table_iter_next (&iter, NULL, &ety))
+      store_colour_ety (ety);
   }
 }
 
+/***
+    The list store behind the colour chooser is only needed by the
+    chooser; lookups go through find_css_colour.  It is built after
+    startup or by the first chooser, whichever comes first, and takes
+    in the custom colours added before then.
+ ***/
+
 void
 build_colours_store ()
 {
+  if (colour_store) return;
+
   colour_store = gtk_list_store_new (COLOUR_N_COLUMNS,
 				     G_TYPE_STRING,
 				     G_TYPE_STRING,
@@ -427,7 +428,7 @@ custom_clicked (GtkButton *button,
     if (!name || !*name)	// invent a name
       aname = g_strdup_printf ("Custom%d", name_seqr++);
     else {
-      css_colours_s *cn = find_css_colour (name, NULL, NULL, NULL, NULL);
+      css_colours_s *cn = find_css_colour (name);
       if (cn)		// name exists, invent unique variation
 	aname = g_strdup_printf ("%s%d", name, name_seqr++);
       else		// name is non null && unique
@@ -504,6 +505,7 @@ css_button_new (GtkTreeSelection **css_button_p, gchar *which, pen_s *pen)
 
   
   
+  build_colours_store ();
   css_button = gtk_tree_view_new_with_model (GTK_TREE_MODEL (colour_store));
   gtk_tree_view_set_activate_on_single_click (GTK_TREE_VIEW (css_button), TRUE);
   g_signal_connect (G_OBJECT (css_button), "row-activated",
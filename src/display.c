@@ -0,0 +1,881 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "display.h"
+#include "stats.h"
+
+#if 0 // comments
+
+     The display list is the entities of a sheet compiled for drawing.
+     Sheet-level transform entities are resolved once, at compile
+     time, so every entry carries the full matrix it is painted
+     under, relative to the sheet, and a frame is a straight walk
+     setting that matrix, appending the path and painting it: no
+     nested save and restore, no pango layout, no arc or spline
+     construction.  A group or block instance is a single entry that
+     replays the recording kept for it (recorded_draw in entities.c),
+     so ten thousand instances of a block share one recording rather
+     than each carrying copies of its paths; its extents are those
+     of the block, or the group children, mapped through its matrix.
+
+     Entries are kept as parallel arrays: paint operation, matrix,
+     style and path.  Styles (colour, line width and dashes) are
+     interned, so consecutive entries drawn with the same pen share
+     one.  Paths are built on a scratch context scaled up by
+     DISPLAY_PATH_SCALE so that arcs are split finely enough for close
+     zooms; markers, whose size is in pixels, are the one kind rebuilt
+     at draw time.
+
+     Every sheet entity other than a transform has one entry, kept in
+     an index.  Entities appended to the sheet are compiled onto the
+     end of the list on the next draw, and one changed in place is
+     passed to display_modify and compiled again into its own entry.
+     Anything else that changes the entity list calls
+     display_invalidate, and block redefinitions bump the entity
+     generation (entity_changed (NULL)); either, or a change of
+     drawing unit or default font, rebuilds the list from scratch
+     when next drawn.
+
+     Long plain polylines are simplified at draw time, Douglas-Peucker
+     to a tolerance of LOD_TOLERANCE pixels, so a dense digitised
+     contour zoomed out costs about as many segments as it covers
+     pixels.  The tolerance is rounded down to a power of two in user
+     units and the simplified path for each such bucket is kept on
+     the polyline, a few buckets at a time.  Only the screen goes
+     through the display list; draw_entities stays exact.
+
+     Each entry also keeps its painted extents on the sheet, stroke
+     width included, and entries wholly outside the clip are skipped.
+     Markers, sized in pixels, are never skipped.
+
+#endif
+
+#define DISPLAY_PATH_SCALE	64.0
+
+#define DISPLAY_LOD		0x80	// op flag, the entry may be simplified
+#define DISPLAY_REPLAY		0x40	// op, a group or instance recording
+#define LOD_MIN_VERTS		64
+#define LOD_TOLERANCE		0.5	// in pixels
+#define LOD_SLOTS		4
+
+typedef struct {
+  gboolean      used;
+  gint          bucket;		// log2 of the tolerance in user units
+  cairo_path_t *path;		// NULL when not worth simplifying
+} lod_slot_s;
+
+typedef struct {
+  lod_slot_s slots[LOD_SLOTS];
+  guint      next;
+} lod_s;
+
+typedef struct {
+  gdouble rgba[4];
+  gdouble lw;
+  guint   dash_at;
+  guint   nr_dashes;
+} display_style_s;
+
+typedef struct {
+  gdouble x0, y0, x1, y1;
+} display_box_s;
+
+typedef struct {
+  GArray    *ops;		// guint8 paint_e, maybe | DISPLAY_LOD
+  GArray    *matrices;		// cairo_matrix_t, sheet relative
+  GArray    *styles;		// guint32 index into style_table
+  GPtrArray *paths;		// cairo_path_t, NULL for markers
+  GPtrArray *entities;		// leaf entity, for markers
+  GArray    *boxes;		// display_box_s, sheet relative
+  GArray    *style_table;	// display_style_s
+  GArray    *dashes;		// gdouble, shared by the styles
+  GHashTable *style_hash;	// GBytes -> index + 1
+  GHashTable *block_boxes;	// block_s -> display_box_s, block units
+  GArray    *bases;		// cairo_matrix_t, each entity compiled under
+  GHashTable *index;		// sheet entity -> entry + 1
+  GHashTable *dirty;		// sheet entities changed in place
+  GArray    *stack;		// cairo_matrix_t, sheet level transforms
+  GList     *tail;		// last sheet entity compiled
+  guint      generation;
+  gint       dunit;		// the environment the paths were built in
+  gdouble    textsize;
+  gchar     *fontname;
+  cairo_t   *scratch;
+} display_s;
+
+static void
+display_clear (display_s *dl, environment_s *env)
+{
+  g_array_set_size (dl->ops, 0);
+  g_array_set_size (dl->matrices, 0);
+  g_array_set_size (dl->styles, 0);
+  g_ptr_array_set_size (dl->paths, 0);
+  g_ptr_array_set_size (dl->entities, 0);
+  g_array_set_size (dl->boxes, 0);
+  g_array_set_size (dl->style_table, 0);
+  g_array_set_size (dl->dashes, 0);
+  g_hash_table_remove_all (dl->style_hash);
+  g_hash_table_remove_all (dl->block_boxes);
+  g_array_set_size (dl->bases, 0);
+  g_hash_table_remove_all (dl->index);
+  g_hash_table_remove_all (dl->dirty);
+
+  cairo_matrix_t identity;
+  cairo_matrix_init_identity (&identity);
+  g_array_set_size (dl->stack, 0);
+  g_array_append_val (dl->stack, identity);
+  dl->tail = NULL;
+  dl->generation = entity_generation ();
+  dl->dunit      = environment_dunit (env);
+  dl->textsize   = environment_textsize (env);
+  g_free (dl->fontname);
+  dl->fontname   = g_strdup (environment_fontname (env));
+}
+
+static void
+path_free (gpointer data)
+{
+  if (data) cairo_path_destroy (data);
+}
+
+static display_s *
+display_for (sheet_s *sheet, environment_s *env)
+{
+  display_s *dl = sheet_display (sheet);
+
+  if (!dl) {
+    dl = sheet_display (sheet) = gfig_try_malloc0 (sizeof(display_s));
+    dl->ops         = g_array_new (FALSE, FALSE, sizeof(guint8));
+    dl->matrices    = g_array_new (FALSE, FALSE, sizeof(cairo_matrix_t));
+    dl->styles      = g_array_new (FALSE, FALSE, sizeof(guint32));
+    dl->paths       = g_ptr_array_new_with_free_func (path_free);
+    dl->entities    = g_ptr_array_new ();
+    dl->boxes       = g_array_new (FALSE, FALSE, sizeof(display_box_s));
+    dl->style_table = g_array_new (FALSE, FALSE, sizeof(display_style_s));
+    dl->dashes      = g_array_new (FALSE, FALSE, sizeof(gdouble));
+    dl->style_hash  = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+					     (GDestroyNotify)g_bytes_unref,
+					     NULL);
+    dl->block_boxes = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+    dl->bases       = g_array_new (FALSE, FALSE, sizeof(cairo_matrix_t));
+    dl->index       = g_hash_table_new (NULL, NULL);
+    dl->dirty       = g_hash_table_new (NULL, NULL);
+    dl->stack       = g_array_new (FALSE, FALSE, sizeof(cairo_matrix_t));
+    cairo_surface_t *surface =
+      cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+    dl->scratch = cairo_create (surface);
+    cairo_surface_destroy (surface);
+    display_clear (dl, env);
+  }
+  return dl;
+}
+
+/***
+    entity, on the sheet, has changed in place; its entry alone is
+    compiled again on the next draw.
+ ***/
+
+void
+display_modify (sheet_s *sheet, gpointer entity)
+{
+  display_s *dl = sheet ? sheet_display (sheet) : NULL;
+  if (dl && entity) g_hash_table_add (dl->dirty, entity);
+}
+
+void
+display_invalidate (sheet_s *sheet)
+{
+  display_s *dl = sheet ? sheet_display (sheet) : NULL;
+  if (dl) {
+    dl->tail = NULL;
+    dl->generation = 0;		// entity generations start at 1
+  }
+}
+
+/***
+    Release the display list of a sheet that is going away.
+ ***/
+
+void
+display_free (sheet_s *sheet)
+{
+  display_s *dl = sheet ? sheet_display (sheet) : NULL;
+  if (!dl) return;
+
+  g_array_free (dl->ops, TRUE);
+  g_array_free (dl->matrices, TRUE);
+  g_array_free (dl->styles, TRUE);
+  g_ptr_array_free (dl->paths, TRUE);
+  g_ptr_array_free (dl->entities, TRUE);
+  g_array_free (dl->boxes, TRUE);
+  g_array_free (dl->style_table, TRUE);
+  g_array_free (dl->dashes, TRUE);
+  g_hash_table_destroy (dl->style_hash);
+  g_hash_table_destroy (dl->block_boxes);
+  g_array_free (dl->bases, TRUE);
+  g_hash_table_destroy (dl->index);
+  g_hash_table_destroy (dl->dirty);
+  g_array_free (dl->stack, TRUE);
+  g_free (dl->fontname);
+  cairo_destroy (dl->scratch);
+  g_free (dl);
+  sheet_display (sheet) = NULL;
+}
+
+/***
+    The style left on the scratch context by entity_path.
+ ***/
+
+static guint32
+intern_style (display_s *dl, cairo_t *cr)
+{
+  display_style_s style = {0};
+  gint nr_dashes = cairo_get_dash_count (cr);
+  gdouble *dashes = NULL;
+  gdouble offset;
+
+  cairo_pattern_get_rgba (cairo_get_source (cr),
+			  &style.rgba[0], &style.rgba[1],
+			  &style.rgba[2], &style.rgba[3]);
+  style.lw = cairo_get_line_width (cr);
+  style.nr_dashes = nr_dashes;
+  if (nr_dashes > 0) {
+    dashes = gfig_try_malloc0 (nr_dashes * sizeof(gdouble));
+    cairo_get_dash (cr, dashes, &offset);
+  }
+
+  GByteArray *key = g_byte_array_new ();
+  g_byte_array_append (key, (const guint8 *)style.rgba, sizeof(style.rgba));
+  g_byte_array_append (key, (const guint8 *)&style.lw, sizeof(style.lw));
+  if (nr_dashes > 0)
+    g_byte_array_append (key, (const guint8 *)dashes,
+			 nr_dashes * sizeof(gdouble));
+  GBytes *bytes = g_byte_array_free_to_bytes (key);
+
+  guint idx = GPOINTER_TO_UINT (g_hash_table_lookup (dl->style_hash, bytes));
+  if (idx) {
+    g_bytes_unref (bytes);
+    g_free (dashes);
+    return idx - 1;
+  }
+
+  style.dash_at = dl->dashes->len;
+  if (nr_dashes > 0) g_array_append_vals (dl->dashes, dashes, nr_dashes);
+  g_free (dashes);
+  g_array_append_val (dl->style_table, style);
+  idx = dl->style_table->len;
+  g_hash_table_insert (dl->style_hash, bytes, GUINT_TO_POINTER (idx));
+  return idx - 1;
+}
+
+static void
+transform_step (GArray *stack, entity_transform_s *tf)
+{
+  if (entity_tf_unset (tf)) {
+    if (stack->len > 1) g_array_set_size (stack, stack->len - 1);
+  }
+  else if (entity_tf_matrix (tf)) {
+    cairo_matrix_t m;
+    cairo_matrix_multiply (&m, entity_tf_matrix (tf),
+			   &g_array_index (stack, cairo_matrix_t,
+					   stack->len - 1));
+    g_array_append_val (stack, m);
+  }
+}
+
+static const display_box_s box_all =
+  {-G_MAXDOUBLE, -G_MAXDOUBLE, G_MAXDOUBLE, G_MAXDOUBLE};
+static const display_box_s box_none =
+  {G_MAXDOUBLE, G_MAXDOUBLE, -G_MAXDOUBLE, -G_MAXDOUBLE};
+
+static void
+box_add (display_box_s *box, gdouble x, gdouble y)
+{
+  box->x0 = MIN (box->x0, x);
+  box->y0 = MIN (box->y0, y);
+  box->x1 = MAX (box->x1, x);
+  box->y1 = MAX (box->y1, y);
+}
+
+/***
+    Add in, mapped through m, to box.  An unbounded in makes box
+    unbounded; an empty one adds nothing.
+ ***/
+
+static void
+box_add_mapped (display_box_s *box, const display_box_s *in,
+		const cairo_matrix_t *m)
+{
+  if (in->x0 > in->x1) return;
+  if (in->x0 == -G_MAXDOUBLE) {
+    *box = box_all;
+    return;
+  }
+  if (box->x0 == -G_MAXDOUBLE) return;
+
+  gdouble cx[4] = {in->x0, in->x1, in->x1, in->x0};
+  gdouble cy[4] = {in->y0, in->y0, in->y1, in->y1};
+  for (gint i = 0; i < 4; i++) {
+    cairo_matrix_transform_point (m, &cx[i], &cy[i]);
+    box_add (box, cx[i], cy[i]);
+  }
+}
+
+/***
+    The sheet extents of the path entity_path has just laid on the
+    scratch context, stroke width included.
+ ***/
+
+static void
+path_box (cairo_t *cr, paint_e paint, display_box_s *box)
+{
+  gdouble ux0, uy0, ux1, uy1;
+
+  if (paint == PAINT_FILL) cairo_fill_extents (cr, &ux0, &uy0, &ux1, &uy1);
+  else cairo_stroke_extents (cr, &ux0, &uy0, &ux1, &uy1);
+  gdouble cx[4] = {ux0, ux1, ux1, ux0};
+  gdouble cy[4] = {uy0, uy0, uy1, uy1};
+  for (gint i = 0; i < 4; i++) {	// scratch device space is the sheet
+    cairo_user_to_device (cr, &cx[i], &cy[i]);
+    box_add (box, cx[i] / DISPLAY_PATH_SCALE, cy[i] / DISPLAY_PATH_SCALE);
+  }
+}
+
+static void
+group_matrix (entity_group_s *group, const cairo_matrix_t *matrix,
+	      cairo_matrix_t *inner)
+{
+  if (entity_group_transform (group))
+    *inner = *entity_group_transform (group);
+  else cairo_matrix_init_identity (inner);
+  if (entity_group_centre (group)) {
+    cairo_matrix_t centre;
+    cairo_matrix_init_translate (&centre,
+				 -point_x (entity_group_centre (group)),
+				 -point_y (entity_group_centre (group)));
+    cairo_matrix_multiply (inner, inner, &centre);
+  }
+  cairo_matrix_multiply (inner, inner, matrix);
+}
+
+static void extents (display_s *dl, gpointer entity,
+		     const cairo_matrix_t *matrix, environment_s *env,
+		     display_box_s *box);
+
+static void
+extents_children (display_s *dl, GList *entities,
+		  const cairo_matrix_t *inner, environment_s *env,
+		  display_box_s *box)
+{
+  GArray *stack = g_array_new (FALSE, FALSE, sizeof(cairo_matrix_t));
+  g_array_append_val (stack, *inner);
+  for (GList *l = entities; l; l = l->next) {
+    if (entity_type (l->data) == ENTITY_TYPE_TRANSFORM)
+      transform_step (stack, l->data);
+    else
+      extents (dl, l->data,
+	       &g_array_index (stack, cairo_matrix_t, stack->len - 1),
+	       env, box);
+  }
+  g_array_free (stack, TRUE);
+}
+
+/***
+    A block's extents in its own units, worked out once per display
+    list and mapped through each instance.
+ ***/
+
+static const display_box_s *
+block_box (display_s *dl, block_s *block, environment_s *env)
+{
+  display_box_s *box = g_hash_table_lookup (dl->block_boxes, block);
+
+  if (!box) {
+    cairo_matrix_t identity;
+    cairo_matrix_init_identity (&identity);
+    box = gfig_try_malloc0 (sizeof(display_box_s));
+    *box = box_none;
+    g_hash_table_insert (dl->block_boxes, block, box);
+    extents_children (dl, block_entities (block), &identity, env, box);
+  }
+  return box;
+}
+
+static void
+extents (display_s *dl, gpointer entity, const cairo_matrix_t *matrix,
+	 environment_s *env, display_box_s *box)
+{
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_NONE:
+  case ENTITY_TYPE_TRANSFORM:
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      cairo_matrix_t inner;
+      group_matrix (entity, matrix, &inner);
+      extents_children (dl, entity_group_entities ((entity_group_s *)entity),
+			&inner, env, box);
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    {
+      entity_instance_s *instance = entity;
+      block_s *block = entity_instance_block (instance);
+      cairo_matrix_t inner;
+
+      if (!block) break;
+      cairo_matrix_multiply (&inner, &entity_instance_transform (instance),
+			     matrix);
+      box_add_mapped (box, block_box (dl, block, env), &inner);
+    }
+    break;
+  default:
+    {
+      cairo_t *cr = dl->scratch;
+      cairo_matrix_t scale;
+      cairo_matrix_t m;
+
+      cairo_matrix_init_scale (&scale, DISPLAY_PATH_SCALE,
+			       DISPLAY_PATH_SCALE);
+      cairo_matrix_multiply (&m, matrix, &scale);
+      cairo_save (cr);
+      cairo_set_matrix (cr, &m);
+      paint_e paint = entity_path (cr, entity, env);
+      if (paint == PAINT_MARKER) *box = box_all;
+      else if (paint != PAINT_NONE && box->x0 != -G_MAXDOUBLE)
+	path_box (cr, paint, box);
+      cairo_new_path (cr);
+      cairo_restore (cr);
+    }
+    break;
+  }
+}
+
+/***
+    Set entry at, appending if it is one past the end.
+ ***/
+
+static void
+entry_put (display_s *dl, guint at, guint8 op, const cairo_matrix_t *matrix,
+	   guint32 style, cairo_path_t *path, gpointer entity,
+	   const display_box_s *box)
+{
+  if (at == dl->ops->len) {
+    g_array_append_val (dl->ops, op);
+    g_array_append_vals (dl->matrices, matrix, 1);
+    g_array_append_val (dl->styles, style);
+    g_ptr_array_add (dl->paths, path);
+    g_ptr_array_add (dl->entities, entity);
+    g_array_append_vals (dl->boxes, box, 1);
+    return;
+  }
+
+  g_array_index (dl->ops, guint8, at)             = op;
+  g_array_index (dl->matrices, cairo_matrix_t, at) = *matrix;
+  g_array_index (dl->styles, guint32, at)         = style;
+  path_free (g_ptr_array_index (dl->paths, at));
+  g_ptr_array_index (dl->paths, at)               = path;
+  g_ptr_array_index (dl->entities, at)            = entity;
+  g_array_index (dl->boxes, display_box_s, at)    = *box;
+}
+
+/***
+    A leaf that paints nothing still has its entry, with an empty box,
+    so that it keeps its place should it change.
+ ***/
+
+static void
+compile_leaf (display_s *dl, gpointer entity, const cairo_matrix_t *matrix,
+	      environment_s *env, guint at)
+{
+  cairo_t *cr = dl->scratch;
+  cairo_matrix_t scale;
+  cairo_matrix_t m;
+
+  cairo_matrix_init_scale (&scale, DISPLAY_PATH_SCALE, DISPLAY_PATH_SCALE);
+  cairo_matrix_multiply (&m, matrix, &scale);
+
+  cairo_save (cr);
+  cairo_set_matrix (cr, &m);
+  paint_e paint = entity_path (cr, entity, env);
+  guint8 op = paint;
+  if (entity_type (entity) == ENTITY_TYPE_POLYLINE && paint != PAINT_MARKER) {
+    entity_polyline_s *polyline = entity;
+    if (!entity_polyline_spline (polyline) &&
+	entity_polyline_intersect (polyline) == INTERSECT_POINT &&
+	g_list_length (entity_polyline_verts (polyline)) >= LOD_MIN_VERTS)
+      op |= DISPLAY_LOD;
+  }
+  guint32 style = G_MAXUINT32;
+  cairo_path_t *path = NULL;
+  display_box_s box = box_none;
+  if (paint != PAINT_NONE) {
+    style = intern_style (dl, cr);
+    box   = box_all;
+
+    if (paint == PAINT_MARKER) m = *matrix;
+    else {
+      box = box_none;
+      path_box (cr, paint, &box);
+      cairo_matrix_init_scale (&scale, 1.0 / DISPLAY_PATH_SCALE,
+			       1.0 / DISPLAY_PATH_SCALE);
+      cairo_get_matrix (cr, &m);
+      cairo_matrix_multiply (&m, &m, &scale);
+      path = cairo_copy_path (cr);
+    }
+  }
+  entry_put (dl, at, op, &m, style, path, entity, &box);
+  cairo_new_path (cr);
+  cairo_restore (cr);
+}
+
+/***
+    A group or block instance is one entry, replayed from the
+    recording entities.c keeps for it (recorded_draw) under the
+    sheet-level matrix, and culled on its extents.
+ ***/
+
+static void
+compile_recorded (display_s *dl, gpointer entity,
+		  const cairo_matrix_t *matrix, environment_s *env, guint at)
+{
+  display_box_s box = box_none;
+
+  extents (dl, entity, matrix, env, &box);
+  entry_put (dl, at, DISPLAY_REPLAY, matrix, G_MAXUINT32, NULL, entity, &box);
+}
+
+/***
+    Compile a sheet entity into entry at, under the sheet-level
+    matrix, which is kept so the entry can be compiled again in place.
+ ***/
+
+static void
+compile (display_s *dl, gpointer entity, const cairo_matrix_t *matrix,
+	 environment_s *env, guint at)
+{
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_NONE:
+  case ENTITY_TYPE_TRANSFORM:
+    return;
+  case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
+    compile_recorded (dl, entity, matrix, env, at);
+    break;
+  default:
+    compile_leaf (dl, entity, matrix, env, at);
+    break;
+  }
+  if (at == dl->bases->len) {
+    g_array_append_vals (dl->bases, matrix, 1);
+    g_hash_table_insert (dl->index, entity, GUINT_TO_POINTER (at + 1));
+  }
+}
+
+void
+display_lod_free (entity_polyline_s *polyline)
+{
+  lod_s *lod = entity_polyline_lod (polyline);
+  if (!lod) return;
+
+  for (gint i = 0; i < LOD_SLOTS; i++)
+    if (lod->slots[i].path) cairo_path_destroy (lod->slots[i].path);
+  g_free (lod);
+  entity_polyline_lod (polyline) = NULL;
+}
+
+static gsize
+path_size (cairo_path_t *path)
+{
+  return path ? sizeof(cairo_path_t) +
+    path->num_data * sizeof(cairo_path_data_t) : 0;
+}
+
+gsize
+display_lod_size (entity_polyline_s *polyline)
+{
+  lod_s *lod = entity_polyline_lod (polyline);
+  if (!lod) return 0;
+
+  gsize size = sizeof(lod_s);
+  for (gint i = 0; i < LOD_SLOTS; i++)
+    size += path_size (lod->slots[i].path);
+  return size;
+}
+
+/***
+    What the display list of a sheet holds, by the lengths of its
+    arrays rather than their allocations.
+ ***/
+
+gsize
+display_size (sheet_s *sheet)
+{
+  display_s *dl = sheet ? sheet_display (sheet) : NULL;
+  if (!dl) return 0;
+
+  gsize size = sizeof(display_s) +
+    dl->ops->len         * sizeof(guint8) +
+    dl->matrices->len    * sizeof(cairo_matrix_t) +
+    dl->styles->len      * sizeof(guint32) +
+    dl->entities->len    * sizeof(gpointer) +
+    dl->boxes->len       * sizeof(display_box_s) +
+    dl->style_table->len * sizeof(display_style_s) +
+    dl->dashes->len      * sizeof(gdouble) +
+    dl->stack->len       * sizeof(cairo_matrix_t) +
+    g_hash_table_size (dl->style_hash) * sizeof(display_style_s) +
+    g_hash_table_size (dl->block_boxes) * sizeof(display_box_s) +
+    dl->bases->len       * sizeof(cairo_matrix_t) +
+    g_hash_table_size (dl->index) * 2 * sizeof(gpointer);
+  for (guint i = 0; i < dl->paths->len; i++)
+    size += sizeof(gpointer) + path_size (g_ptr_array_index (dl->paths, i));
+  return size;
+}
+
+/***
+    Douglas-Peucker, marking the vertices to keep.  Returns how many.
+ ***/
+
+static guint
+simplify (point_s **verts, guint nr, gdouble tolerance, guint8 *keep)
+{
+  GArray *stack = g_array_new (FALSE, FALSE, sizeof(guint));
+  gdouble tol2 = tolerance * tolerance;
+  guint kept = 2;
+  guint span[2] = {0, nr - 1};
+
+  memset (keep, 0, nr);
+  keep[0] = keep[nr - 1] = 1;
+  g_array_append_vals (stack, span, 2);
+  while (stack->len >= 2) {
+    guint first = g_array_index (stack, guint, stack->len - 2);
+    guint last  = g_array_index (stack, guint, stack->len - 1);
+    g_array_set_size (stack, stack->len - 2);
+
+    gdouble x0 = point_x (verts[first]);
+    gdouble y0 = point_y (verts[first]);
+    gdouble dx = point_x (verts[last]) - x0;
+    gdouble dy = point_y (verts[last]) - y0;
+    gdouble len2 = dx * dx + dy * dy;
+    gdouble worst = 0.0;
+    guint at = 0;
+
+    for (guint i = first + 1; i < last; i++) {
+      gdouble px = point_x (verts[i]) - x0;
+      gdouble py = point_y (verts[i]) - y0;
+      gdouble d2;
+      if (len2 > 0.0) {
+	gdouble cross = px * dy - py * dx;
+	d2 = cross * cross / len2;
+      }
+      else d2 = px * px + py * py;
+      if (d2 > worst) {
+	worst = d2;
+	at = i;
+      }
+    }
+
+    if (worst > tol2) {
+      keep[at] = 1;
+      kept++;
+      span[0] = first; span[1] = at;
+      g_array_append_vals (stack, span, 2);
+      span[0] = at; span[1] = last;
+      g_array_append_vals (stack, span, 2);
+    }
+  }
+  g_array_free (stack, TRUE);
+  return kept;
+}
+
+static cairo_path_t *
+lod_build (display_s *dl, entity_polyline_s *polyline, gdouble tolerance)
+{
+  guint nr = g_list_length (entity_polyline_verts (polyline));
+  point_s **verts = gfig_try_malloc0 (nr * sizeof(point_s *));
+  guint8 *keep = gfig_try_malloc0 (nr);
+  cairo_path_t *path = NULL;
+  guint i = 0;
+
+  for (GList *l = entity_polyline_verts (polyline); l; l = l->next)
+    verts[i++] = l->data;
+
+  guint kept = simplify (verts, nr, tolerance, keep);
+  if (kept * 4 < nr * 3) {
+    cairo_t *cr = dl->scratch;
+    cairo_save (cr);
+    cairo_identity_matrix (cr);
+    cairo_scale (cr, DISPLAY_PATH_SCALE, DISPLAY_PATH_SCALE);
+    cairo_new_path (cr);
+    for (i = 0; i < nr; i++)
+      if (keep[i]) cairo_line_to (cr, point_x (verts[i]), point_y (verts[i]));
+    if (entity_polyline_closed (polyline)) cairo_close_path (cr);
+    path = cairo_copy_path (cr);
+    cairo_new_path (cr);
+    cairo_restore (cr);
+  }
+  g_free (keep);
+  g_free (verts);
+  return path;
+}
+
+/***
+    The simplified path of a polyline for the device scale of matrix,
+    or NULL to draw it exactly.
+ ***/
+
+static cairo_path_t *
+lod_path (display_s *dl, entity_polyline_s *polyline,
+	  const cairo_matrix_t *matrix)
+{
+  gdouble sx2 = matrix->xx * matrix->xx + matrix->yx * matrix->yx;
+  gdouble sy2 = matrix->xy * matrix->xy + matrix->yy * matrix->yy;
+  gdouble scale = sqrt (MAX (sx2, sy2));
+  if (!(scale > 0.0)) return NULL;
+
+  gint bucket = (gint)floor (log2 (LOD_TOLERANCE / scale));
+  lod_s *lod = entity_polyline_lod (polyline);
+  if (!lod)
+    lod = entity_polyline_lod (polyline) = gfig_try_malloc0 (sizeof(lod_s));
+
+  for (gint i = 0; i < LOD_SLOTS; i++)
+    if (lod->slots[i].used && lod->slots[i].bucket == bucket)
+      return lod->slots[i].path;
+
+  lod_slot_s *slot = &lod->slots[lod->next];
+  lod->next = (lod->next + 1) % LOD_SLOTS;
+  if (slot->path) cairo_path_destroy (slot->path);
+  slot->used   = TRUE;
+  slot->bucket = bucket;
+  slot->path   = lod_build (dl, polyline, ldexp (1.0, bucket));
+  return slot->path;
+}
+
+static void
+display_update (sheet_s *sheet, display_s *dl, environment_s *env)
+{
+  if (dl->generation != entity_generation () ||
+      dl->dunit      != environment_dunit (env) ||
+      dl->textsize   != environment_textsize (env) ||
+      g_strcmp0 (dl->fontname, environment_fontname (env)))
+    display_clear (dl, env);
+
+  if (g_hash_table_size (dl->dirty) > 0) {
+    GHashTableIter iter;
+    gpointer entity;
+    g_hash_table_iter_init (&iter, dl->dirty);
+    while (g_hash_table_iter_next (&iter, &entity, NULL)) {
+      guint at = GPOINTER_TO_UINT (g_hash_table_lookup (dl->index, entity));
+      if (at--)
+	compile (dl, entity, &g_array_index (dl->bases, cairo_matrix_t, at),
+		 env, at);
+    }
+    g_hash_table_remove_all (dl->dirty);
+  }
+
+  GList *l = dl->tail ? dl->tail->next : sheet_entities (sheet);
+  for (; l; l = l->next) {
+    if (entity_type (l->data) == ENTITY_TYPE_TRANSFORM)
+      transform_step (dl->stack, l->data);
+    else
+      compile (dl, l->data,
+	       &g_array_index (dl->stack, cairo_matrix_t, dl->stack->len - 1),
+	       env, dl->ops->len);
+    dl->tail = l;
+  }
+}
+
+/***
+    Draw the sheet entities through the display list, under whatever
+    transform cr has now.
+ ***/
+
+void
+display_draw (sheet_s *sheet, environment_s *env)
+{
+  cairo_t *cr = environment_cr (env);
+  if (!sheet || !cr) return;
+
+  display_s *dl = display_for (sheet, env);
+  display_update (sheet, dl, env);
+
+  cairo_matrix_t base;
+  cairo_matrix_t m;
+  guint32 current = G_MAXUINT32;
+  gint last = -1;			// entry whose matrix is set
+  const guint8 *ops = (const guint8 *)dl->ops->data;
+  const cairo_matrix_t *matrices = (const cairo_matrix_t *)dl->matrices->data;
+  const guint32 *styles = (const guint32 *)dl->styles->data;
+  const display_box_s *boxes = (const display_box_s *)dl->boxes->data;
+  frame_stats_s *fs = stats_frame ();
+  gboolean timed = stats_detail ();
+  gdouble cx0, cy0, cx1, cy1;
+
+  cairo_save (cr);
+  cairo_get_matrix (cr, &base);
+  cairo_clip_extents (cr, &cx0, &cy0, &cx1, &cy1);
+  for (guint i = 0; i < dl->ops->len; i++) {
+    if (ops[i] == PAINT_NONE) continue;
+    if (boxes[i].x1 < cx0 || boxes[i].x0 > cx1 ||
+	boxes[i].y1 < cy0 || boxes[i].y0 > cy1) {
+      if (fs) fs->culled++;
+      continue;
+    }
+    gint64 start = timed ? stats_now () : 0;
+    if (last < 0 ||
+	memcmp (&matrices[i], &matrices[last], sizeof(cairo_matrix_t))) {
+      cairo_matrix_multiply (&m, &matrices[i], &base);
+      cairo_set_matrix (cr, &m);
+      if (fs) fs->matrix_changes++;
+    }
+    last = i;
+    if (fs) fs->drawn++;
+
+    if (ops[i] == DISPLAY_REPLAY) {
+      current = G_MAXUINT32;		// replays set their own state
+      last = -1;
+      draw_entities (g_ptr_array_index (dl->entities, i), env);
+      if (timed) stats_entry (g_ptr_array_index (dl->entities, i), start);
+      continue;
+    }
+
+    paint_e op = ops[i] & ~DISPLAY_LOD;
+    if (op == PAINT_MARKER) {
+      current = G_MAXUINT32;		// markers set their own state
+      last = -1;
+      entity_paint (cr, entity_path (cr, g_ptr_array_index (dl->entities, i),
+				     env));
+      if (timed) stats_entry (g_ptr_array_index (dl->entities, i), start);
+      continue;
+    }
+
+    if (styles[i] != current) {
+      const display_style_s *style =
+	&g_array_index (dl->style_table, display_style_s, styles[i]);
+      current = styles[i];
+      cairo_set_source_rgba (cr, style->rgba[0], style->rgba[1],
+			     style->rgba[2], style->rgba[3]);
+      cairo_set_line_width (cr, style->lw);
+      cairo_set_dash (cr, style->nr_dashes ?
+		      &g_array_index (dl->dashes, gdouble, style->dash_at) :
+		      NULL,
+		      style->nr_dashes, 0.0);
+      if (fs) fs->style_changes++;
+    }
+    cairo_path_t *path = NULL;
+    if (ops[i] & DISPLAY_LOD)
+      path = lod_path (dl, g_ptr_array_index (dl->entities, i), &m);
+    cairo_new_path (cr);
+    cairo_append_path (cr, path ? : g_ptr_array_index (dl->paths, i));
+    entity_paint (cr, op);
+    if (timed) stats_entry (g_ptr_array_index (dl->entities, i), start);
+  }
+  cairo_restore (cr);
+}
@@ -0,0 +1,12 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+void display_draw (sheet_s *sheet, environment_s *env);
+void display_modify (sheet_s *sheet, gpointer entity);
+void display_invalidate (sheet_s *sheet);
+void display_free (sheet_s *sheet);
+void display_lod_free (entity_polyline_s *polyline);
+gsize display_lod_size (entity_polyline_s *polyline);
+gsize display_size (sheet_s *sheet);
+
+#endif  /* DISPLAY_H */
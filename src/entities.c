@@ -11,6 +11,13 @@
 #include "utilities.h"
 #include "fallbacks.h"
 #include "select_pen.h"
+#include "entities.h"
+#include "journal.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+#include "stats.h"
+#include "python.h"
 
 #define Q1_A (4.0 / 6.0)
 #define Q1_B (2.0 / 6.0)
@@ -70,120 +77,185 @@ draw_segments (gpointer data, gpointer user_data)
       
  ***/
 
-typedef struct {
-  point_s p0;
-  point_s p1;
-} segment_s;
-#define segment_p0_x(s)	point_x (&((s).p0))
-#define segment_p0_y(s)	point_y (&((s).p0))
-#define segment_p1_x(s)	point_x (&((s).p1))
-#define segment_p1_y(s)	point_y (&((s).p1))
+/***
+    Work out the trimmed segments and corner pieces of an arc or
+    bevel intersected polyline.  Leaves trim->last at 0 if the
+    polyline isn't trimmed.
+ ***/
 
 static void
-trim_segs (cairo_t *cr, entity_polyline_s *polyline)
+trim_build (entity_polyline_s *polyline, trim_s *trim)
 {
-  if (entity_polyline_isect_radius (polyline) > 0.0) {
-    guint length = g_list_length (entity_polyline_verts (polyline));
-    if (length > 2) {
-      segment_s *segments = gfig_try_malloc0 (length * sizeof(segment_s));
-      for (gint pcidx = 0; pcidx < length; pcidx++) {
-	gint p1idx = (pcidx + length - 1) % length;
-	gint p2idx = (pcidx + 1) % length;
+  GArray *corners = trim_corners (trim);
+  guint length = g_list_length (entity_polyline_verts (polyline));
+  if (length <= 2) return;
+
+  segment_s *segments = gfig_try_malloc0 (length * sizeof(segment_s));
+  point_s **verts = gfig_try_malloc0 (length * sizeof(point_s *));
+  gint i = 0;
+  for (GList *l = entity_polyline_verts (polyline); l; l = l->next)
+    verts[i++] = l->data;
+
+  for (gint pcidx = 0; pcidx < length; pcidx++) {
+    gint p1idx = (pcidx + length - 1) % length;
+    gint p2idx = (pcidx + 1) % length;
+
+    point_s *PC = verts[pcidx];
+    gdouble pcx = point_x (PC);
+    gdouble pcy = point_y (PC);
+    segment_p0_x (segments[pcidx]) = pcx;
+    segment_p0_y (segments[pcidx]) = pcy;
+    segment_p1_x (segments[p1idx]) = pcx;
+    segment_p1_y (segments[p1idx]) = pcy;
+
+    point_s *P1 = verts[p1idx];
+    gdouble p1x = point_x (P1);
+    gdouble p1y = point_y (P1);
+
+    point_s *P2 = verts[p2idx];
+    gdouble p2x = point_x (P2);
+    gdouble p2y = point_y (P2);
 	
-
-	point_s *PC =
-	  g_list_nth_data (entity_polyline_verts (polyline), pcidx);
-	gdouble pcx = point_x (PC);
-	gdouble pcy = point_y (PC);
-	segment_p0_x (segments[pcidx]) = pcx;
-	segment_p0_y (segments[pcidx]) = pcy;
-	segment_p1_x (segments[p1idx]) = pcx;
-	segment_p1_y (segments[p1idx]) = pcy;
-
-	point_s *P1 =
-	  g_list_nth_data (entity_polyline_verts (polyline), p1idx);
-	gdouble p1x = point_x (P1);
-	gdouble p1y = point_y (P1);
-
-	point_s *P2 =
-	  g_list_nth_data (entity_polyline_verts (polyline), p2idx);
-	gdouble p2x = point_x (P2);
-	gdouble p2y = point_y (P2);
-	
-	gdouble xa = p1x - pcx;
-	gdouble ya = p1y - pcy;
-	gdouble xb = p2x - pcx;
-	gdouble yb = p2y - pcy;
-
-	gdouble magA = hypot (ya, xa);
-	gdouble magB = hypot (yb, xb);
-
-	gdouble cosT = (xa * xb + ya * yb) / (magA * magB);
-	gdouble T = acos (cosT) / 2.0;
-	gdouble sinT = sin (T);
-	gdouble tanT = tan (T);
-
-	if (sinT != 0.0 && tanT != 0.0) {
-	  gdouble Q = entity_polyline_isect_radius (polyline) / tanT;
-	  gdouble W = entity_polyline_isect_radius (polyline) / sinT;
-
-	  gdouble phaA = atan2 (ya, xa);
-	  gdouble phaB = atan2 (yb, xb);
-	  gdouble phaV = atan2 ((sin (phaA) + sin (phaB))/2.0,
-				(cos (phaA) + cos (phaB))/2.0);
-
-	  point_s C;
-	  point_x (&C) = pcx + W * cos (phaV);
-	  point_y (&C) = pcy + W * sin (phaV);
-	  point_s D;
-	  point_x (&D) = pcx + Q * cos (phaA);
-	  point_y (&D) = pcy + Q * sin (phaA);
-	  point_s E;
-	  point_x (&E) = pcx + Q * cos (phaB);
-	  point_y (&E) = pcy + Q * sin (phaB);
+    gdouble xa = p1x - pcx;
+    gdouble ya = p1y - pcy;
+    gdouble xb = p2x - pcx;
+    gdouble yb = p2y - pcy;
+
+    gdouble magA = hypot (ya, xa);
+    gdouble magB = hypot (yb, xb);
+
+    gdouble cosT = (xa * xb + ya * yb) / (magA * magB);
+    gdouble T = acos (cosT) / 2.0;
+    gdouble sinT = sin (T);
+    gdouble tanT = tan (T);
+
+    if (sinT != 0.0 && tanT != 0.0) {
+      gdouble Q = entity_polyline_isect_radius (polyline) / tanT;
+      gdouble W = entity_polyline_isect_radius (polyline) / sinT;
+
+      gdouble phaA = atan2 (ya, xa);
+      gdouble phaB = atan2 (yb, xb);
+      gdouble phaV = atan2 ((sin (phaA) + sin (phaB))/2.0,
+			    (cos (phaA) + cos (phaB))/2.0);
+
+      point_s C;
+      point_x (&C) = pcx + W * cos (phaV);
+      point_y (&C) = pcy + W * sin (phaV);
+      point_s D;
+      point_x (&D) = pcx + Q * cos (phaA);
+      point_y (&D) = pcy + Q * sin (phaA);
+      point_s E;
+      point_x (&E) = pcx + Q * cos (phaB);
+      point_y (&E) = pcy + Q * sin (phaB);
 	  
-	  if (entity_polyline_closed (polyline) || pcidx != 0) {
-	    segment_p0_x (segments[pcidx]) = point_x (&E);
-	    segment_p0_y (segments[pcidx]) = point_y (&E);
-	  }
-	  if (entity_polyline_closed (polyline) || p1idx != length - 2) {
-	    segment_p1_x (segments[p1idx]) = point_x (&D);
-	    segment_p1_y (segments[p1idx]) = point_y (&D);
-	  }
-
-
-	  if (entity_polyline_intersect (polyline) == INTERSECT_ARC) {
-	    gdouble phaD = atan2 (point_y (&D) - point_y (&C),
-				  point_x (&D) - point_x (&C));
-	    gdouble phaE = atan2 (point_y (&E) - point_y (&C),
-				  point_x (&E) - point_x (&C));
-	    if (entity_polyline_closed (polyline) ||
-		(pcidx != 0 && pcidx != length - 1)) {
-	      cairo_new_sub_path (cr);
-	      cairo_arc (cr, point_x (&C), point_y (&C),
-			 entity_polyline_isect_radius (polyline),
-			 phaE, phaD);
-	    }
-	  }
-	  else {		// bevel
-	    if (entity_polyline_closed (polyline) ||
-		(pcidx != 0 && pcidx != length - 1)) {
-	      cairo_move_to (cr, point_x (&E), point_y (&E));
-	      cairo_line_to (cr, point_x (&D), point_y (&D));
-	    }
-	  }
-	}
+      if (entity_polyline_closed (polyline) || pcidx != 0) {
+	segment_p0_x (segments[pcidx]) = point_x (&E);
+	segment_p0_y (segments[pcidx]) = point_y (&E);
       }
-      gint last = entity_polyline_closed (polyline) ? length : length - 1;
-      for (gint i = 0; i < last; i++) {
-	cairo_move_to (cr, segment_p0_x (segments[i]),
-		       segment_p0_y (segments[i]));
-	cairo_line_to (cr, segment_p1_x (segments[i]),
-		       segment_p1_y (segments[i]));
+      if (entity_polyline_closed (polyline) || p1idx != length - 2) {
+	segment_p1_x (segments[p1idx]) = point_x (&D);
+	segment_p1_y (segments[p1idx]) = point_y (&D);
+      }
+
+      if (entity_polyline_closed (polyline) ||
+	  (pcidx != 0 && pcidx != length - 1)) {
+	corner_s corner;
+	corner_centre (&corner) = C;
+	corner_e (&corner)      = E;
+	corner_d (&corner)      = D;
+	corner_start (&corner)  = atan2 (point_y (&E) - point_y (&C),
+					 point_x (&E) - point_x (&C));
+	corner_stop (&corner)   = atan2 (point_y (&D) - point_y (&C),
+					 point_x (&D) - point_x (&C));
+	g_array_append_val (corners, corner);
       }
-      cairo_stroke (cr);
     }
   }
+  g_free (verts);
+
+  trim_segments (trim) = segments;
+  trim_last (trim) = entity_polyline_closed (polyline) ? length : length - 1;
+}
+
+/***
+    The trimmed geometry is worked out on first use and kept with the
+    polyline until entity_changed or delete_entities drops it, so a
+    filleted outline costs no more per frame than a plain one.  NULL
+    if the polyline isn't trimmed.
+ ***/
+
+const trim_s *
+polyline_trim (entity_polyline_s *polyline)
+{
+  if (entity_polyline_isect_radius (polyline) <= 0.0) return NULL;
+
+  trim_s *trim = entity_polyline_trim (polyline);
+  if (!trim) {
+    trim = gfig_try_malloc0 (sizeof(trim_s));
+    trim_corners (trim) = g_array_new (FALSE, FALSE, sizeof(corner_s));
+    trim_build (polyline, trim);
+    entity_polyline_trim (polyline) = trim;
+  }
+  return (trim_last (trim) > 0) ? trim : NULL;
+}
+
+void
+polyline_trim_free (entity_polyline_s *polyline)
+{
+  trim_s *trim = entity_polyline_trim (polyline);
+  if (!trim) return;
+
+  g_free (trim_segments (trim));
+  g_array_free (trim_corners (trim), TRUE);
+  g_free (trim);
+  entity_polyline_trim (polyline) = NULL;
+}
+
+gsize
+polyline_trim_size (entity_polyline_s *polyline)
+{
+  trim_s *trim = entity_polyline_trim (polyline);
+  if (!trim) return 0;
+
+  return sizeof(trim_s) +
+    trim_last (trim) * sizeof(segment_s) +
+    trim_corners (trim)->len * sizeof(corner_s);
+}
+
+static guint
+trim_segs (cairo_t *cr, entity_polyline_s *polyline)
+{
+  const trim_s *trim = polyline_trim (polyline);
+  if (!trim) return 0;
+
+  GArray *corners = trim_corners (trim);
+  segment_s *segments = trim_segments (trim);
+  for (gint i = 0; i < corners->len; i++) {
+    corner_s *corner = &g_array_index (corners, corner_s, i);
+    if (entity_polyline_intersect (polyline) == INTERSECT_ARC) {
+      cairo_new_sub_path (cr);
+      cairo_arc (cr,
+		 point_x (&corner_centre (corner)),
+		 point_y (&corner_centre (corner)),
+		 entity_polyline_isect_radius (polyline),
+		 corner_start (corner), corner_stop (corner));
+    }
+    else {		// bevel
+      cairo_move_to (cr,
+		     point_x (&corner_e (corner)),
+		     point_y (&corner_e (corner)));
+      cairo_line_to (cr,
+		     point_x (&corner_d (corner)),
+		     point_y (&corner_d (corner)));
+    }
+  }
+  for (gint i = 0; i < trim_last (trim); i++) {
+    cairo_move_to (cr, segment_p0_x (segments[i]),
+		   segment_p0_y (segments[i]));
+    cairo_line_to (cr, segment_p1_x (segments[i]),
+		   segment_p1_y (segments[i]));
+  }
+  return trim_last (trim);
 }
 
 static void
@@ -207,143 +279,308 @@ set_dashes (cairo_t *cr, pen_s *pen, environment_s *env)
   else cairo_set_dash (cr, NULL, 0, 0);
 }
 
+/****
+     There's something weird either in pango layout or in my
+     understanding thereof that if the font size is set too small
+     the letter spacing seems to go to zero.  I'm getting around
+     this by scaling up the font size by an arbitrary amount and
+     then scaling it back down when I stroke or fill the text.
+ ****/
+#define FIXIT	256.0
+
+static void
+text_layout (PangoLayout *layout, entity_text_s *text, environment_s *env)
+{
+  gchar *tfont = entity_text_font (text);
+  if (!tfont || !*tfont) tfont = environment_fontname (env);
+  if (!tfont) tfont = FALLBACK_FONT;
+  PangoFontDescription *desc =
+    pango_font_description_from_string (tfont);
+
+  gdouble font_size = entity_text_txtsize (text);
+  if (font_size == 0.0) font_size = environment_textsize (env);
+  font_size *= FIXIT * (double)PANGO_SCALE;
+
+  pango_font_description_set_absolute_size (desc, font_size);
+
+  pango_layout_set_font_description (layout, desc);
+  pango_font_description_free (desc);
+
+  if (entity_text_lead (text) != 0) {
+    // fixme -- may need to scale by FIXIT
+    gint sp = pango_layout_get_spacing (layout);
+    sp += entity_text_lead (text);
+    pango_layout_set_spacing (layout, PANGO_SCALE * sp);
+  }
+
+  if (!entity_text_justify (text))
+    pango_layout_set_alignment (layout, entity_text_alignment (text));
+
+  pango_layout_set_justify (layout, entity_text_justify (text));
+      
+  if (entity_text_spread (text) != 0) {
+    // fixme -- may need to scale by FIXIT
+    PangoAttribute *lsp =
+      pango_attr_letter_spacing_new (entity_text_spread (text) *
+				     PANGO_SCALE);
+    PangoAttrList *pal = pango_attr_list_new ();
+    pango_attr_list_insert (pal, lsp);
+    pango_layout_set_attributes (layout, pal);
+    pango_attr_list_unref (pal);
+  }
+      
+  pango_layout_set_text (layout, entity_text_string (text), -1);
+}
+
+/***
+    The logical box of a text entity as drawn, x0, y0, x1, y1 in the
+    frame that is then rotated and moved to the text origin.
+ ***/
+
 void
-draw_entities (gpointer data, gpointer user_data)
+entity_text_box (entity_text_s *text, environment_s *env, gdouble *box)
 {
-  environment_s *env = user_data;
+  static PangoContext *context = NULL;
+  if (!context)
+    context =
+      pango_font_map_create_context (pango_cairo_font_map_get_default ());
+
+  PangoLayout *layout = pango_layout_new (context);
+  text_layout (layout, text, env);
+
+  PangoRectangle logical_rect;
+  pango_layout_get_extents (layout, NULL, &logical_rect);
+  g_object_unref (layout);
+
+  gdouble scale = 1.0 / (FIXIT * (gdouble)PANGO_SCALE);
+  box[0] = (gdouble)logical_rect.x * scale;
+  box[1] = (gdouble)logical_rect.y * scale;
+  box[2] = (gdouble)(logical_rect.x + logical_rect.width)  * scale;
+  box[3] = (gdouble)(logical_rect.y + logical_rect.height) * scale;
+}
+
+/***
+    Groups are mostly drawn many times over, one Python group under
+    any number of gf_draw transforms, so each renders its children
+    once into a recording surface and every instance replays that
+    under its own transform.  Block definitions (block.c) are cached
+    the same way and replayed by each instance entity.  The recording
+    depends on the drawing unit and the default font, checked on
+    replay, and on the children themselves.  A block redefinition
+    (entity_changed (NULL)) retires all of them, since nested groups
+    and blocks replay into their parents and would go stale too.  A
+    sheet entity changed in place only drops its own caches.  Leaves
+    drawn into a recording are not counted in the frame statistics;
+    the replay that paints them is.
+ ***/
+
+typedef struct {
+  cairo_surface_t *recording;
+  guint		   epoch;
+  gint		   dunit;
+  gdouble	   textsize;
+  gchar		  *fontname;
+} group_cache_s;
+
+typedef void (*render_f)(gpointer data, environment_s *env);
+
+static guint group_epoch = 1;
+static gint  recording   = 0;	// nested recordings being made
+
+void
+entity_changed (gpointer entity)
+{
+  if (!entity) group_epoch++;
+  else if (entity_type (entity) == ENTITY_TYPE_POLYLINE) {
+    display_lod_free (entity);
+    polyline_trim_free (entity);
+  }
+}
+
+guint
+entity_generation (void)
+{
+  return group_epoch;
+}
+
+void
+entity_cache_free (void **cache_p)
+{
+  group_cache_s *cache = *cache_p;
+
+  if (cache) {
+    if (cache->recording) cairo_surface_destroy (cache->recording);
+    g_free (cache->fontname);
+    g_free (cache);
+    *cache_p = NULL;
+  }
+}
+
+/***
+    The recording surface itself is opaque to us, so only the record
+    and its font name are counted.
+ ***/
+
+gsize
+entity_cache_size (void *cache)
+{
+  group_cache_s *gc = cache;
+  if (!gc) return 0;
+  return sizeof(group_cache_s) + (gc->fontname ? strlen (gc->fontname) + 1 : 0);
+}
+
+static gboolean
+group_cache_valid (group_cache_s *cache, environment_s *env)
+{
+  return cache && cache->recording &&
+    cache->epoch    == group_epoch &&
+    cache->dunit    == environment_dunit (env) &&
+    cache->textsize == environment_textsize (env) &&
+    !g_strcmp0 (cache->fontname, environment_fontname (env));
+}
+
+static void
+group_render (gpointer data, environment_s *env)
+{
+  entity_group_s *tf = data;
   cairo_t *cr = environment_cr (env);
 
-  entity_type_e type = entity_type (data);
-  switch (type) {
-  case ENTITY_TYPE_GROUP:
-    {
-      entity_group_s *tf = data;
+  if (entity_group_centre (tf)) {
+    cairo_save (cr);
+    cairo_translate (cr,
+		     -point_x (entity_group_centre (tf)),
+		     -point_y (entity_group_centre (tf)));
+  }
 
-      if (entity_group_centre (tf)) {
-	cairo_save (cr);
-	cairo_translate (cr,
-			 -point_x (entity_group_centre (tf)),
-			 -point_y (entity_group_centre (tf)));
-      }
+  if (entity_group_transform (tf)) {
+    cairo_save (cr);
+    cairo_transform (cr, entity_group_transform (tf));
+  }
 
-      if (entity_group_transform (tf)) {
-	cairo_save (cr);
-	cairo_transform (cr, entity_group_transform (tf));
-      }
+  g_list_foreach (entity_group_entities (tf), draw_entities, env);
 
-      g_list_foreach (entity_group_entities (tf), draw_entities, env);
+  if (entity_group_transform (tf)) 
+    cairo_restore (cr);
+  if (entity_group_centre (tf)) 
+    cairo_restore (cr);
+}
 
-      if (entity_group_transform (tf)) 
-	cairo_restore (cr);
-      if (entity_group_centre (tf)) 
-	cairo_restore (cr);
-    }
-    break;
-  case ENTITY_TYPE_TRANSFORM:
-    {
-      entity_transform_s *tf = data;
-      if (entity_tf_unset (tf))
-	cairo_restore (cr);
-      else {
-	cairo_save (cr);
-	cairo_transform (cr, entity_tf_matrix (tf));
-      }
-    }
-    break;
-  case ENTITY_TYPE_NONE:
-    break;
-  case ENTITY_TYPE_TEXT:
-    {
-      PangoLayout *layout;
-      entity_text_s *text = data;
-      pen_s *pen = entity_text_pen (text);
-      gdouble lw = pen_lw (pen);
-      PangoAttribute *lsp = NULL;
-      PangoAttrList *pal  = NULL;
+static void
+block_render (gpointer data, environment_s *env)
+{
+  cairo_t *cr = environment_cr (env);
 
-      
-      cairo_save (cr);
+  cairo_save (cr);
+  g_list_foreach (block_entities ((block_s *)data), draw_entities, env);
+  cairo_restore (cr);
+}
 
-      layout = pango_cairo_create_layout (cr);
+static void
+recorded_draw (void **cache_p, render_f render, gpointer data,
+	       environment_s *env)
+{
+  cairo_t *cr = environment_cr (env);
+  group_cache_s *cache = *cache_p;
+
+  if (!group_cache_valid (cache, env)) {
+    entity_cache_free (cache_p);
+    cache = *cache_p = gfig_try_malloc0 (sizeof(group_cache_s));
+    cache->recording =
+      cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+    cache->epoch    = group_epoch;
+    cache->dunit    = environment_dunit (env);
+    cache->textsize = environment_textsize (env);
+    cache->fontname = g_strdup (environment_fontname (env));
+
+    cairo_t *rcr = cairo_create (cache->recording);
+    cairo_set_source (rcr, cairo_get_source (cr));
+    cairo_set_line_width (rcr, cairo_get_line_width (cr));
+    environment_cr (env) = rcr;
+    recording++;
+    (*render)(data, env);
+    recording--;
+    environment_cr (env) = cr;
+    cairo_destroy (rcr);
+  }
 
+  cairo_save (cr);
+  cairo_set_source_surface (cr, cache->recording, 0.0, 0.0);
+  cairo_paint (cr);
+  cairo_restore (cr);
+}
 
-      gchar *tfont = entity_text_font (text);
-      if (!tfont || !*tfont) tfont = environment_fontname (env);
-      if (!tfont) tfont = FALLBACK_FONT;
-      PangoFontDescription *desc =
-	pango_font_description_from_string (tfont);
+/***
+    A pen override recolours the whole block: the replay goes to an
+    intermediate group which is then used as a mask for the pen
+    colour.  Line widths and styles stay those of the definition.
+ ***/
 
-      /****
-	   There's something weird either in pango layout or in my
-	   understanding thereof that if the font size is set too small
-	   the letter spacing seems to go to zero.  I'm getting around
-	   this by scaling up the font size by an arbitrary amount and
-	   then scaling it back down when I stroke or fill the text.
-       ****/
-#define FIXIT	256.0
-      
-      gdouble font_size = entity_text_txtsize (text);
-      if (font_size == 0.0) font_size = environment_textsize (env);
-      font_size *= FIXIT * (double)PANGO_SCALE;
+static void
+instance_draw (entity_instance_s *instance, environment_s *env)
+{
+  cairo_t *cr = environment_cr (env);
+  block_s *block = entity_instance_block (instance);
+  pen_s *pen = entity_instance_pen (instance);
 
-      
-      pango_font_description_set_absolute_size (desc, font_size);
+  if (!block || !block_entities (block)) return;
 
-      pango_layout_set_font_description (layout, desc);
-      pango_font_description_free (desc);
+  cairo_save (cr);
+  cairo_transform (cr, &entity_instance_transform (instance));
+  if (pen) {
+    cairo_push_group (cr);
+    recorded_draw (&block_cache (block), block_render, block, env);
+    cairo_pattern_t *mask = cairo_pop_group (cr);
+    cairo_set_source_rgba (cr,
+			   pen_colour_red (pen),
+			   pen_colour_green (pen),
+			   pen_colour_blue (pen),
+			   pen_colour_alpha (pen));
+    cairo_mask (cr, mask);
+    cairo_pattern_destroy (mask);
+  }
+  else
+    recorded_draw (&block_cache (block), block_render, block, env);
+  cairo_restore (cr);
+}
 
-      if (entity_text_lead (text) != 0) {
-	// fixme -- may need to scale by FIXIT
-        gint sp = pango_layout_get_spacing (layout);
-	sp += entity_text_lead (text);
-	pango_layout_set_spacing (layout, PANGO_SCALE * sp);
-      }
+/***
+    Lay down the path of a leaf entity and set its line width, dashes
+    and colour, leaving the current transform as it must be when the
+    path is painted.  Returns how to paint it; the caller saves and
+    restores around the lot.  This is shared by draw_entities and the
+    display list (display.c), which keeps the paths.
+ ***/
 
-      if (!entity_text_justify (text))
-	pango_layout_set_alignment (layout, entity_text_alignment (text));
+paint_e
+entity_path (cairo_t *cr, gpointer data, environment_s *env)
+{
+  paint_e paint = PAINT_NONE;
 
-      pango_layout_set_justify (layout, entity_text_justify (text));
-      
-      if (entity_text_spread (text) != 0) {
-	// fixme -- may need to scale by FIXIT
-	lsp =
-	  pango_attr_letter_spacing_new (entity_text_spread (text) *
-					 PANGO_SCALE);
-	pal  = pango_attr_list_new ();
-	pango_attr_list_insert (pal, lsp);
-	pango_layout_set_attributes (layout, pal);
-      }
-      
-      pango_layout_set_text (layout, entity_text_string (text), -1);
-      // pango_layout_set_markup (layout, entity_text_text (t), -1);
+  switch (entity_type (data)) {
+  case ENTITY_TYPE_NONE:
+  case ENTITY_TYPE_TRANSFORM:
+  case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      PangoLayout *layout;
+      entity_text_s *text = data;
+      pen_s *pen = entity_text_pen (text);
+      gdouble lw = pen_lw (pen);
 
-      PangoRectangle ink_rect;
-      PangoRectangle logical_rect;
-      pango_layout_get_extents (layout, &ink_rect, &logical_rect);
+      layout = pango_cairo_create_layout (cr);
+      text_layout (layout, text, env);
 
       pango_cairo_layout_path (cr, layout);
       cairo_path_t *path = cairo_copy_path (cr);
       g_object_unref (layout);
       cairo_new_path (cr);  // kill the default
 
-
       cairo_translate (cr, entity_text_x (text), entity_text_y (text));
-      cairo_rotate (cr, -entity_ellipse_t (text));
+      cairo_rotate (cr, -entity_text_t (text));
       cairo_scale (cr, 1.0 / FIXIT, 1.0 / FIXIT);
 
-#if 0
-      double dashes[] = {100., 50., 50, 50.};
-      cairo_set_dash (cr, dashes, sizeof(dashes) / sizeof(double), 0);
-      cairo_set_line_width (cr, 10.0);
-      cairo_set_source_rgba (cr, 1.0, 1.0, 0.0, 1.0);
-      cairo_rectangle (cr,
-	       ((double)ink_rect.x)      / ( (double)PANGO_SCALE),
-	       ((double)ink_rect.y)      / ( (double)PANGO_SCALE),
-	       ((double)ink_rect.width)  / ( (double)PANGO_SCALE),
-	       ((double)ink_rect.height) / ( (double)PANGO_SCALE));
-      cairo_stroke (cr);
-#endif
-      
       cairo_set_dash (cr, NULL, 0, 0.0);
       cairo_set_line_width (cr, lw);
       cairo_set_source_rgba (cr,
@@ -351,44 +588,10 @@ draw_entities (gpointer data, gpointer user_data)
 			     pen_colour_green (pen),
 			     pen_colour_blue (pen),
 			     pen_colour_alpha (pen));
-
-      for (int i = 0; i < path->num_data; i += path->data[i].header.length) {
-	cairo_path_data_t *data;
-	data = &path->data[i];
-	switch (data->header.type) {
-	case CAIRO_PATH_MOVE_TO:
-	  cairo_move_to (cr, data[1].point.x, data[1].point.y);
-	  break;
-	case CAIRO_PATH_LINE_TO:
-	  cairo_line_to (cr, data[1].point.x, data[1].point.y);
-	  break;
-	case CAIRO_PATH_CURVE_TO:
-	  cairo_curve_to (cr,
-			  data[1].point.x, data[1].point.y,
-			  data[2].point.x, data[2].point.y,
-			  data[3].point.x, data[3].point.y);
-	  break;
-	case CAIRO_PATH_CLOSE_PATH:
-	  cairo_close_path (cr);
-	  break;
-	}
-      }
-	      
-
-      if (lsp) {
-	pango_attribute_destroy (lsp);
-	lsp = NULL;
-      }
-      if (pal) {
-	pal  = NULL;
-	pango_attr_list_unref (pal);
-      }
-              
-      if (entity_text_filled (text)) cairo_fill (cr);
-      else cairo_stroke (cr);
+      cairo_append_path (cr, path);
       cairo_path_destroy (path);
 
-      cairo_restore (cr);
+      paint = entity_text_filled (text) ? PAINT_FILL : PAINT_STROKE;
     }
     break;
   case ENTITY_TYPE_CIRCLE:
@@ -417,8 +620,7 @@ draw_entities (gpointer data, gpointer user_data)
 		   entity_circle_r (circle),
 		   entity_circle_start (circle),
 		   entity_circle_stop (circle));
-      if (entity_circle_fill (circle)) cairo_fill (cr);
-      else cairo_stroke (cr);
+      paint = entity_circle_fill (circle) ? PAINT_FILL : PAINT_STROKE;
     }	
     break;
   case ENTITY_TYPE_ELLIPSE:
@@ -427,7 +629,6 @@ draw_entities (gpointer data, gpointer user_data)
       pen_s *pen = entity_ellipse_pen (ellipse);
       gdouble lw = pen_lw (pen);
       if (environment_dunit (env) == GTK_UNIT_INCH) lw /= 25.4;
-      cairo_save (cr);
       cairo_set_line_width (cr, lw);
       cairo_set_source_rgba (cr,
 			     pen_colour_red (pen),
@@ -458,9 +659,7 @@ draw_entities (gpointer data, gpointer user_data)
 	cairo_arc (cr, 0.0, 0.0, radius,
 		   entity_ellipse_start (ellipse),
 		   entity_ellipse_stop (ellipse));
-      if (entity_ellipse_fill (ellipse)) cairo_fill (cr);
-      else cairo_stroke (cr);
-      cairo_restore (cr);
+      paint = entity_ellipse_fill (ellipse) ? PAINT_FILL : PAINT_STROKE;
     }	
     break;
   case ENTITY_TYPE_POLYLINE:
@@ -509,8 +708,8 @@ draw_entities (gpointer data, gpointer user_data)
 				point_x (p3), point_y (p3));
 	      }
 	    }
-	    if (entity_polyline_filled (polyline)) cairo_fill (cr);
-	    else cairo_stroke (cr);
+	    paint = entity_polyline_filled (polyline) ?
+	      PAINT_FILL : PAINT_STROKE;
 	  }
 	  else {		// spline, but not enough verts
 #define MARKER_RADIUS	3.0		// in pixels
@@ -519,10 +718,11 @@ draw_entities (gpointer data, gpointer user_data)
 	    cairo_device_to_user_distance (cr, &xradius, &yradius);
 	    for (int i = 0; i < nr_verts; i++) {
 	      p1 = g_list_nth_data (entity_polyline_verts (polyline), i);
+	      cairo_new_sub_path (cr);
 	      cairo_arc (cr, point_x (p1), point_y (p1), xradius,
 			 0.0, 2.0 * G_PI);
-	      cairo_fill (cr);
 	    }
+	    paint = PAINT_MARKER;
 	  }
 	}
 	else {						/* polyline */
@@ -532,12 +732,12 @@ draw_entities (gpointer data, gpointer user_data)
 	    g_list_foreach (g_list_nth (entity_polyline_verts (polyline), 1),
 			    draw_segments, cr);
 	    if (entity_polyline_closed (polyline)) cairo_close_path (cr);
-	    if (entity_polyline_filled (polyline)) cairo_fill (cr);
-	    else cairo_stroke (cr);
+	    paint = entity_polyline_filled (polyline) ?
+	      PAINT_FILL : PAINT_STROKE;
 	    break;
 	  case INTERSECT_ARC:
 	  case INTERSECT_BEVEL:
-	    trim_segs (cr, polyline);
+	    if (trim_segs (cr, polyline)) paint = PAINT_STROKE;
 	    break;
 	  }
 	}
@@ -545,6 +745,69 @@ draw_entities (gpointer data, gpointer user_data)
     }
     break;
   }
+  return paint;
+}
+
+void
+entity_paint (cairo_t *cr, paint_e paint)
+{
+  switch (paint) {
+  case PAINT_NONE:
+    cairo_new_path (cr);
+    break;
+  case PAINT_STROKE:
+    cairo_stroke (cr);
+    break;
+  case PAINT_FILL:
+  case PAINT_MARKER:
+    cairo_fill (cr);
+    break;
+  }
+}
+
+void
+draw_entities (gpointer data, gpointer user_data)
+{
+  environment_s *env = user_data;
+  cairo_t *cr = environment_cr (env);
+
+  entity_type_e type = entity_type (data);
+  switch (type) {
+  case ENTITY_TYPE_GROUP:
+    recorded_draw (&entity_group_cache ((entity_group_s *)data),
+		   group_render, data, env);
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    instance_draw (data, env);
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    {
+      entity_transform_s *tf = data;
+      if (entity_tf_unset (tf))
+	cairo_restore (cr);
+      else {
+	cairo_save (cr);
+	cairo_transform (cr, entity_tf_matrix (tf));
+      }
+    }
+    break;
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_TEXT:
+  case ENTITY_TYPE_CIRCLE:
+  case ENTITY_TYPE_ELLIPSE:
+  case ENTITY_TYPE_POLYLINE:
+    {
+      frame_stats_s *fs = recording ? NULL : stats_frame ();
+      gint64 start = (fs && stats_detail ()) ? stats_now () : 0;
+      cairo_save (cr);
+      entity_paint (cr, entity_path (cr, data, env));
+      cairo_restore (cr);
+      if (fs) fs->drawn++;
+      if (start) stats_entry (data, start);
+    }
+    break;
+  }
 }
 
 entity_polyline_s *
@@ -579,7 +842,7 @@ entity_append_polyline (sheet_s *sheet, GList *verts,
 			   intersect, radius);
 			   
 
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), polyline);  
+  entity_append_entity (sheet, polyline);
 }
 
 entity_text_s *
@@ -620,7 +883,7 @@ entity_append_text (sheet_s *sheet, gdouble x, gdouble y,
   entity_text_s *text = entity_build_text (sheet, x, y, string, size, theta,
 					   txt_size, filled, font, alignment,
 					   justify, spread, lead, pen);
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), text);
+  entity_append_entity (sheet, text);
 }
 
 entity_circle_s *
@@ -652,13 +915,42 @@ entity_append_circle (sheet_s *sheet, gdouble x, gdouble y,
   entity_circle_s *circle = entity_build_circle (sheet, x, y, r, start,
 						 stop, negative,
 						 filled, pen);
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), circle);
+  entity_append_entity (sheet, circle);
 }
 
 void
 entity_append_entity (sheet_s *sheet, void *entity)
 {
+  if (python_in_worker ()) {		// see python.c
+    python_defer_append (sheet, entity);
+    return;
+  }
+  history_append (sheet, entity);
   sheet_entities (sheet) = g_list_append (sheet_entities (sheet), entity);
+  journal_append (sheet, entity);
+  pick_append (sheet, entity);
+}
+
+/***
+    Appends a list of entities, which the sheet takes over, joining
+    it to the sheet list once rather than walking it per entity.
+ ***/
+
+void
+entity_append_entities (sheet_s *sheet, GList *entities)
+{
+  if (python_in_worker ()) {
+    for (GList *l = entities; l; l = l->next)
+      python_defer_append (sheet, l->data);
+    g_list_free (entities);
+    return;
+  }
+  for (GList *l = entities; l; l = l->next) {
+    history_append (sheet, l->data);
+    pick_append (sheet, l->data);
+  }
+  journal_append_list (sheet, entities);
+  sheet_entities (sheet) = g_list_concat (sheet_entities (sheet), entities);
 }
 
 entity_ellipse_s *
@@ -695,7 +987,7 @@ entity_append_ellipse (sheet_s *sheet, gdouble x, gdouble y,
   entity_ellipse_s *ellipse =
     entity_build_ellipse (sheet, x, y, a, b, t, start, stop, negative,
 			  filled, pen);
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), ellipse); 
+  entity_append_entity (sheet, ellipse);
 }
 
 void
@@ -706,7 +998,7 @@ entity_append_transform (sheet_s *sheet, cairo_matrix_t *matrix,
   entity_tf_type (tf) = ENTITY_TYPE_TRANSFORM;
   entity_tf_unset (tf) = unset;
   entity_tf_matrix (tf) = matrix;
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), tf);
+  entity_append_entity (sheet, tf);
 }
 
 entity_group_s *
@@ -729,10 +1021,35 @@ entity_append_group (sheet_s *sheet, cairo_matrix_t *matrix,
   entity_group_s *group = entity_build_group (sheet, matrix,
 					      centre, entities);
 
-  sheet_entities (sheet) = g_list_append (sheet_entities (sheet), group);
+  entity_append_entity (sheet, group);
 }
 
-static void
+entity_instance_s *
+entity_build_instance (sheet_s *sheet, block_s *block,
+		       cairo_matrix_t *matrix, pen_s *pen)
+{
+  entity_instance_s *instance =
+    gfig_try_malloc0 (sizeof(entity_instance_s));
+  entity_instance_type (instance)  = ENTITY_TYPE_INSTANCE;
+  entity_instance_block (instance) = block;
+  if (matrix) entity_instance_transform (instance) = *matrix;
+  else cairo_matrix_init_identity (&entity_instance_transform (instance));
+  entity_instance_pen (instance) = pen ? copy_pen (pen) : NULL;
+
+  return instance;
+}
+
+void
+entity_append_instance (sheet_s *sheet, block_s *block,
+			cairo_matrix_t *matrix, pen_s *pen)
+{
+  entity_instance_s *instance =
+    entity_build_instance (sheet, block, matrix, pen);
+
+  entity_append_entity (sheet, instance);
+}
+
+void
 delete_pen_copy (pen_s *pen)
 {
   if (pen) {
@@ -783,6 +1100,8 @@ delete_entities (gpointer data)
       entity_polyline_s *polyline = data;
       pen_s *pen = entity_polyline_pen (polyline);
       delete_pen_copy (pen);
+      display_lod_free (polyline);
+      polyline_trim_free (polyline);
       if (entity_polyline_verts (polyline)) {
 	g_list_free_full (entity_polyline_verts (polyline), g_free);
 	entity_polyline_verts (polyline) = NULL;
@@ -802,10 +1121,19 @@ delete_entities (gpointer data)
 	g_free (entity_group_transform (group));
       if (entity_group_centre (group))
 	g_free (entity_group_centre (group));
+      entity_cache_free (&entity_group_cache (group));
       g_free (group);
       group = NULL;
     }
     break;
+  case ENTITY_TYPE_INSTANCE:		// the block belongs to the project
+    {
+      entity_instance_s *instance = data;
+      delete_pen_copy (entity_instance_pen (instance));
+      g_free (instance);
+      instance = NULL;
+    }
+    break;
   case ENTITY_TYPE_TRANSFORM:
     {
       entity_transform_s *tf = data;
@@ -818,6 +1146,79 @@ delete_entities (gpointer data)
   }
 }
 
+gsize
+pen_copy_size (pen_s *pen)
+{
+  gsize size = 0;
+  if (pen) {
+    size += sizeof(pen_s);
+    if (pen_colour (pen))      size += sizeof(GdkRGBA);
+    if (pen_colour_name (pen)) size += strlen (pen_colour_name (pen)) + 1;
+  }
+  return size;
+}
+
+/***
+    Approximate heap footprint of an entity, counting what
+    delete_entities would free.
+ ***/
+
+gsize
+entity_size (gpointer data)
+{
+  gsize size = 0;
+  switch (entity_type (data)) {
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      entity_text_s *text = data;
+      size = sizeof(entity_text_s) + pen_copy_size (entity_text_pen (text));
+      if (entity_text_string (text))
+	size += strlen (entity_text_string (text)) + 1;
+    }
+    break;
+  case ENTITY_TYPE_CIRCLE:
+    size = sizeof(entity_circle_s) +
+      pen_copy_size (entity_circle_pen ((entity_circle_s *)data));
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    size = sizeof(entity_ellipse_s) +
+      pen_copy_size (entity_ellipse_pen ((entity_ellipse_s *)data));
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    {
+      entity_polyline_s *polyline = data;
+      size = sizeof(entity_polyline_s) +
+	pen_copy_size (entity_polyline_pen (polyline)) +
+	g_list_length (entity_polyline_verts (polyline)) *
+	(sizeof(GList) + sizeof(point_s)) +
+	polyline_trim_size (polyline);
+    }
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      entity_group_s *group = data;
+      size = sizeof(entity_group_s);
+      for (GList *l = entity_group_entities (group); l; l = l->next)
+	size += sizeof(GList) + entity_size (l->data);
+      if (entity_group_transform (group)) size += sizeof(cairo_matrix_t);
+      if (entity_group_centre (group))    size += sizeof(point_s);
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    size = sizeof(entity_instance_s) +
+      pen_copy_size (entity_instance_pen ((entity_instance_s *)data));
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    size = sizeof(entity_transform_s);
+    if (entity_tf_matrix ((entity_transform_s *)data))
+      size += sizeof(cairo_matrix_t);
+    break;
+  }
+  return size;
+}
+
 void
 clear_entities (GList **entities)
 {
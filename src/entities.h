@@ -1,7 +1,20 @@
 #ifndef ENTITIES_H
 #define ENTITIES_H
 
+typedef enum {
+  PAINT_NONE,
+  PAINT_STROKE,
+  PAINT_FILL,
+  PAINT_MARKER		// a fill whose path depends on the device scale
+} paint_e;
+
 void draw_entities (gpointer data, gpointer user_data);
+paint_e entity_path (cairo_t *cr, gpointer data, environment_s *env);
+void entity_paint (cairo_t *cr, paint_e paint);
+void entity_changed (gpointer entity);
+guint entity_generation (void);
+void entity_cache_free (void **cache_p);
+gsize entity_cache_size (void *cache);
 void clear_entities (GList **entities);
 
 void entity_append_text (sheet_s *sheet, gdouble x, gdouble yy,
@@ -48,10 +61,24 @@ void entity_append_group (sheet_s *sheet, cairo_matrix_t *matrix,
 entity_group_s *entity_build_group (sheet_s *sheet, cairo_matrix_t *matrix,
 				    point_s *centre, GList *entities);
 
+void entity_append_instance (sheet_s *sheet, block_s *block,
+			     cairo_matrix_t *matrix, pen_s *pen);
+entity_instance_s *entity_build_instance (sheet_s *sheet, block_s *block,
+					  cairo_matrix_t *matrix,
+					  pen_s *pen);
+
 void entity_append_transform (sheet_s *sheet, cairo_matrix_t *matrix,
 			      gboolean unset);
 void entity_append_entity (sheet_s *sheet, void *entity);
+void entity_append_entities (sheet_s *sheet, GList *entities);
 void delete_entities (gpointer data);
+void delete_pen_copy (pen_s *pen);
+gsize entity_size (gpointer data);
+gsize pen_copy_size (pen_s *pen);
+gsize polyline_trim_size (entity_polyline_s *polyline);
 point_s *copy_point (point_s *orig);
+const trim_s *polyline_trim (entity_polyline_s *polyline);
+void polyline_trim_free (entity_polyline_s *polyline);
+void entity_text_box (entity_text_s *text, environment_s *env, gdouble *box);
 
 #endif  /* ENTITIES_H */
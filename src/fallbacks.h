@@ -31,6 +31,7 @@
 #define FALLBACK_DRAWING_SHOW_ORG	FALSE
 #define FALLBACK_DRAWING_SHOW_GRID	FALSE
 #define FALLBACK_DRAWING_SNAP_GRID	FALSE
+#define FALLBACK_DRAWING_SNAP_OBJECTS	TRUE
 #define FALLBACK_DRAWING_TARGET_GRID	NAN
 
 #define FALLBACK_FONT			"Serif"
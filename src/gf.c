@@ -4,6 +4,7 @@
 
 #include <gtk/gtk.h>
 #include <glib/gi18n-lib.h>
+#include <sys/stat.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <string.h>
@@ -22,8 +23,19 @@
 #include "utilities.h"
 #include "python.h"
 #include "xml.h"
+#include "journal.h"
+#include "binary.h"
+#include "history.h"
+#include "pick.h"
+#include "snap.h"
+#include "display.h"
+#include "trace.h"
+#include "memory.h"
 #include "drawing_header.h"
 #include "../pluginsrcs/plugin.h"
+#include "plugin_api.h"
+#include "plugin_cache.h"
+#include "startup.h"
 
 
 enum {
@@ -135,7 +147,9 @@ notify_key_set (gint etype)
 static void
 gfig_quit (GtkWidget *object, gpointer data)
 {
+  trace_quit ();
   save_persistents (global_environment);
+  journal_detach ();
   term_python ();
   gtk_main_quit ();
 }
@@ -203,6 +217,8 @@ copy_environment (environment_s *source_environment)
   environment_show_org (copy) = environment_show_org (source_environment);
   environment_show_grid (copy) = environment_show_grid (source_environment);
   environment_snap_grid (copy) = environment_snap_grid (source_environment);
+  environment_snap_objects (copy) =
+    environment_snap_objects (source_environment);
   environment_target_grid (copy) = environment_target_grid (source_environment);
   environment_readout (copy) = environment_readout (source_environment);
   environment_surface (copy) = NULL;
@@ -236,8 +252,6 @@ init_global_environment ()
   };
 #define ALL_COOL_MASK (OK_PAPER_MASK | OK_PEN_MASK)
 
-  build_colours_store ();
-  
   guint ok_status = 0;
   global_environment = gfig_try_malloc0 (sizeof(environment_s));
   if (global_environment) {
@@ -283,6 +297,8 @@ init_global_environment ()
     environment_show_org (global_environment)	= FALLBACK_DRAWING_SHOW_ORG;
     environment_show_grid (global_environment)	= FALLBACK_DRAWING_SHOW_GRID;
     environment_snap_grid (global_environment)	= FALLBACK_DRAWING_SNAP_GRID;
+    environment_snap_objects (global_environment) =
+      FALLBACK_DRAWING_SNAP_OBJECTS;
     environment_target_grid (global_environment)= FALLBACK_DRAWING_TARGET_GRID;
     environment_surface  (global_environment)	= NULL;
     environment_history  (global_environment)	= NULL;
@@ -324,6 +340,11 @@ loop_sheets (GtkTreeModel *model,
     case NOTIFY_MAP:
       create_new_view (project, sheet, NULL);	// fixme default script?
       break;
+    case NOTIFY_MAP_FIRST:
+      if (gtk_tree_path_get_depth (path) == 1 &&
+	  gtk_tree_path_get_indices (path)[0] == 0)
+	create_new_view (project, sheet, NULL);
+      break;
     case NOTIFY_TOOL_STOP:
       if (sheet_transients (sheet))
 	clear_entities (&sheet_transients (sheet));
@@ -378,6 +399,7 @@ create_project (const gchar *name)
 		      PROJECT_STRUCT_COL, project, -1);
   project_sheets (project) =
     gtk_tree_store_new (SHEET_COL_COUNT, G_TYPE_POINTER);
+  journal_new_project (project);
   return project;
 }
 
@@ -418,7 +440,7 @@ append_sheet (project_s *project, GtkTreeIter *parent, gchar *name,
   }
   environment_s	*env = copy_environment (project_environment (project));
   sheet_environment (new_sheet) = env;
-  sheet_pydict (new_sheet)      = get_local_pydict (new_sheet);
+  sheet_pydict (new_sheet)      = NULL;	// see sheet_dict in python.c
   sheet_project (new_sheet)     = project;
   sheet_entities (new_sheet)    = NULL;
   point_x (&sheet_current_point (new_sheet)) = NAN;
@@ -430,9 +452,66 @@ append_sheet (project_s *project, GtkTreeIter *parent, gchar *name,
   if (unlikely(sheet_iter (new_sheet)))
     gtk_tree_iter_free (sheet_iter (new_sheet));
   sheet_iter (new_sheet) = gtk_tree_iter_copy (&iter);
+  journal_new_sheet (new_sheet);
   return gtk_tree_iter_copy (&iter);
 }
 
+static gboolean
+discard_sheet (GtkTreeModel *model,
+	       GtkTreePath *path,
+	       GtkTreeIter *iter,
+	       gpointer data)
+{
+  sheet_s *sheet = NULL;
+
+  gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
+  if (sheet == active_sheet) active_sheet = NULL;
+  if (sheet && python_forget_sheet (sheet)) {	// else a script still has it
+    history_forget (sheet);
+    lazy_sheet_free (sheet);
+    pick_invalidate (sheet);
+    snap_invalidate (sheet);
+    display_free (sheet);
+    clear_entities (&sheet_entities (sheet));
+    if (sheet_iter (sheet)) gtk_tree_iter_free (sheet_iter (sheet));
+    g_free (sheet_environment (sheet));
+    g_free (sheet_name (sheet));
+    g_free (sheet);
+  }
+  return FALSE;
+}
+
+/***
+    Drop the projects from position first on, with their sheets.  For
+    a load that did not complete; the sheets must not be mapped.
+ ***/
+
+void
+discard_projects (gint first)
+{
+  GtkTreeIter iter;
+
+  if (!projects) return;
+  while (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (projects), &iter,
+					NULL, first)) {
+    project_s *project = NULL;
+    gtk_tree_model_get (GTK_TREE_MODEL (projects), &iter,
+			PROJECT_STRUCT_COL, &project, -1);
+    gtk_list_store_remove (projects, &iter);
+    if (!project) continue;
+    if (project_sheets (project)) {
+      gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
+			      discard_sheet, NULL);
+      g_object_unref (project_sheets (project));
+    }
+    if (project_blocks (project))
+      g_hash_table_destroy (project_blocks (project));
+    g_free (project_environment (project));
+    g_free ((gchar *)project_name (project));
+    g_free (project);
+  }
+}
+
 static void
 create_new_project (GtkWidget *widget,
 		    gpointer   data)
@@ -467,6 +546,7 @@ custom_project_renderer_destroy (gpointer data)
 void
 gfig_cb (gfig_op_e gfig_op, ...)
 {
+  TRACE_BEGIN ("gfig_cb");
   switch(gfig_op) {
   case GFIG_OP_NONE:
     break;
@@ -488,6 +568,7 @@ gfig_cb (gfig_op_e gfig_op, ...)
   case GFIG_OP_APPEND_LINE:
     break;
   }
+  TRACE_END ("gfig_cb");
 }
 /* end of plug-in i/f */
 
@@ -498,20 +579,40 @@ plugin_clicked (GtkButton *button,
   gint pidx = GPOINTER_TO_INT (user_data);
   if (plugins) {
     plugin_s *plugin = g_list_nth_data (plugins, pidx);
-    void *dl = dlopen (plugin_path (plugin), RTLD_LAZY);
+    if (!plugin) return;
+    if (!plugin_open (plugin)) {
+      TRACE_BEGIN ("dlopen");
+      plugin_handle (plugin) = dlopen (plugin_path (plugin), RTLD_LAZY);
+      TRACE_END ("dlopen");
+      plugin_open (plugin) = plugin_handle (plugin) != NULL;
+    }
+    void *dl = plugin_handle (plugin);
     if (dl) {
-      plugin_start ps = dlsym (dl, "start_plugin");
-      if (!ps) log_string (LOG_GFIG_ERROR, NULL, dlerror());
-      else (*ps) (gfig_cb);
+      plugin_start_v2 ps2 = dlsym (dl, "start_plugin_v2");
+      plugin_start ps = ps2 ? NULL : dlsym (dl, "start_plugin");
+      if (ps2) {
+	TRACE_BEGIN ("start_plugin");
+	(*ps2) (plugin_api ());
+	TRACE_END ("start_plugin");
+      }
+      else if (!ps) log_string (LOG_GFIG_ERROR, NULL, dlerror());
+      else {
+	TRACE_BEGIN ("start_plugin");
+	(*ps) (gfig_cb);
+	TRACE_END ("start_plugin");
+      }
     }
     else log_string (LOG_GFIG_ERROR, NULL, dlerror());
   }
 }
 
+static void find_plugins ();
+
 static void
 select_plugin (GtkWidget *widget,
 	       gpointer   data)
 {
+  find_plugins ();		// if startup has not got to it
   if (plugins) {
     guint nr_plugins = g_list_length (plugins);
     if (0 < nr_plugins) {
@@ -540,6 +641,12 @@ select_plugin (GtkWidget *widget,
 
 	  plugin_s *plugin = g_list_nth_data (sol, count);
 	  GtkWidget *button;
+	  if (!plugin_icon (plugin) && plugin_xpm (plugin)) {
+	    plugin_icon (plugin) =
+	      gdk_pixbuf_new_from_xpm_data ((const gchar **)plugin_xpm (plugin));
+	    g_strfreev (plugin_xpm (plugin));
+	    plugin_xpm (plugin) = NULL;
+	  }
 	  if (plugin_icon (plugin)) {
 	    button = gtk_button_new ();
 	    GtkWidget *pi = gtk_image_new_from_pixbuf (plugin_icon (plugin));
@@ -647,6 +754,8 @@ show_projects (GtkWidget *object, gpointer data)
 enum {
   STRUCT_NAME_COL,
   STRUCT_POINTER_COL,
+  STRUCT_MEMORY_COL,
+  STRUCT_DETAIL_COL,
   STRUCT_COL_COUNT
 };
 
@@ -668,11 +777,19 @@ sheet_func (GtkTreeModel *model,
   sheet = NULL;
   gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
   if (sheet) {
+    memory_s mem = {0};
+    memory_sheet (sheet, &mem);
+    gchar *total  = g_format_size (memory_total (&mem));
+    gchar *detail = memory_describe (&mem);
     gtk_tree_store_append (capsule->store, &set_iter, capsule->iter);
     gtk_tree_store_set (capsule->store, &set_iter,
 			STRUCT_NAME_COL, sheet_name (sheet),
 			STRUCT_POINTER_COL, sheet,
+			STRUCT_MEMORY_COL, total,
+			STRUCT_DETAIL_COL, detail,
 			-1);
+    g_free (total);
+    g_free (detail);
   }
   return GDK_EVENT_PROPAGATE;
 }
@@ -692,11 +809,19 @@ proj_func (GtkTreeModel *model,
 
   if (project) {
     capsule_s capsule;
+    memory_s mem = {0};
+    memory_project (project, &mem);
+    gchar *total  = g_format_size (memory_total (&mem));
+    gchar *detail = memory_describe (&mem);
     gtk_tree_store_append (store, &set_iter, NULL);
     gtk_tree_store_set (store, &set_iter,
 			STRUCT_NAME_COL, project_name (project),
 			STRUCT_POINTER_COL, project,
+			STRUCT_MEMORY_COL, total,
+			STRUCT_DETAIL_COL, detail,
 			-1);
+    g_free (total);
+    g_free (detail);
     capsule.store = store;
     capsule.iter  = &set_iter;
     gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
@@ -726,7 +851,7 @@ show_structure (GtkWidget *object, gpointer data)
   
   scroll =  gtk_scrolled_window_new (NULL, NULL);
   gtk_scrolled_window_set_min_content_width (GTK_SCROLLED_WINDOW (scroll),
-					     160);
+					     480);
   gtk_scrolled_window_set_min_content_height (GTK_SCROLLED_WINDOW (scroll),
 					     100);
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroll),
@@ -734,15 +859,11 @@ show_structure (GtkWidget *object, gpointer data)
 				  GTK_POLICY_AUTOMATIC);
   gtk_box_pack_end (GTK_BOX (content), scroll, TRUE, TRUE, 0);
 
-  enum {
-    STRUCT_NAME_COL,
-    STRUCT_POINTER_COL,
-    STRUCT_COL_COUNT
-  };
-  
   GtkTreeStore *model = gtk_tree_store_new (STRUCT_COL_COUNT,
 					    G_TYPE_STRING,
-					    G_TYPE_POINTER);
+					    G_TYPE_POINTER,
+					    G_TYPE_STRING,
+					    G_TYPE_STRING);
   gtk_tree_model_foreach (GTK_TREE_MODEL (projects), proj_func, model);
 
   GtkWidget *tree = gtk_tree_view_new_with_model (GTK_TREE_MODEL (model));
@@ -759,7 +880,17 @@ show_structure (GtkWidget *object, gpointer data)
   GtkCellRenderer *renderer = gtk_cell_renderer_text_new ();
   GtkTreeViewColumn *column =
     gtk_tree_view_column_new_with_attributes ("Name", renderer,
-					      "text", 0,
+					      "text", STRUCT_NAME_COL,
+					      NULL);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (tree), column);
+  column =
+    gtk_tree_view_column_new_with_attributes (_ ("Memory"), renderer,
+					      "text", STRUCT_MEMORY_COL,
+					      NULL);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (tree), column);
+  column =
+    gtk_tree_view_column_new_with_attributes (_ ("Breakdown"), renderer,
+					      "text", STRUCT_DETAIL_COL,
 					      NULL);
   gtk_tree_view_append_column (GTK_TREE_VIEW (tree), column);
   gtk_tree_view_expand_all (GTK_TREE_VIEW (tree));
@@ -782,6 +913,7 @@ load_dialogue (GtkWidget *widget, gpointer data)
 
   GtkFileFilter *filter = gtk_file_filter_new ();
   gtk_file_filter_add_pattern (filter, "*.xml");
+  gtk_file_filter_add_pattern (filter, "*" BINARY_DRAWING_SUFFIX);
   
   GtkWidget *dialog =
     gtk_file_chooser_dialog_new (_ ("Project Load"),
@@ -812,6 +944,7 @@ save_dialogue (GtkWidget *widget, gpointer data)
 
   GtkFileFilter *filter = gtk_file_filter_new ();
   gtk_file_filter_add_pattern (filter, "*.xml");
+  gtk_file_filter_add_pattern (filter, "*" BINARY_DRAWING_SUFFIX);
   
   GtkWidget *dialog =
     gtk_file_chooser_dialog_new (_ ("Project Save"),
@@ -835,6 +968,40 @@ save_dialogue (GtkWidget *widget, gpointer data)
   gtk_widget_destroy (dialog);
 }
 
+static void
+trace_toggled (GtkCheckMenuItem *item, gpointer data)
+{
+  trace_set (gtk_check_menu_item_get_active (item));
+}
+
+static void
+trace_save_dialogue (GtkWidget *widget, gpointer data)
+{
+  GtkFileFilter *filter = gtk_file_filter_new ();
+  gtk_file_filter_add_pattern (filter, "*.json");
+  
+  GtkWidget *dialog =
+    gtk_file_chooser_dialog_new (_ ("Save trace"),
+				 NULL,
+				 GTK_FILE_CHOOSER_ACTION_SAVE,
+                                 _ ("_OK"), GTK_RESPONSE_ACCEPT,
+                                 _ ("_Cancel"), GTK_RESPONSE_CANCEL,
+                                 NULL);
+  gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_MOUSE);
+  gtk_dialog_set_default_response (GTK_DIALOG (dialog),
+                                   GTK_RESPONSE_ACCEPT);
+  gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (dialog),
+				     "gf3-trace.json");
+  gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (dialog), filter);
+
+  if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
+    gchar *file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+    trace_dump (file);
+    g_free (file);
+  }
+  gtk_widget_destroy (dialog);
+}
+
 static void
 build_menu (GtkWidget *vbox)
 {
@@ -887,6 +1054,20 @@ build_menu (GtkWidget *vbox)
   item = gtk_separator_menu_item_new();
   gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
 
+  item = gtk_check_menu_item_new_with_label (_ ("Trace events"));
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), trace_enabled);
+  g_signal_connect (G_OBJECT (item), "toggled",
+                    G_CALLBACK (trace_toggled), NULL);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
+  item = gtk_menu_item_new_with_label (_ ("Save trace"));
+  g_signal_connect (G_OBJECT (item), "activate",
+                    G_CALLBACK (trace_save_dialogue), NULL);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
+  item = gtk_separator_menu_item_new();
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
   item = gtk_menu_item_new_with_label (_ ("Quit"));
   g_signal_connect (G_OBJECT (item), "activate",
                     G_CALLBACK (gfig_quit), NULL);
@@ -912,44 +1093,65 @@ build_menu (GtkWidget *vbox)
   gtk_box_pack_start (GTK_BOX (vbox), GTK_WIDGET (menubar), FALSE, FALSE, 2);
 }
 
+/***
+    Plugins are opened when first used.  What the list needs to show
+    comes from the plugin cache, and the plugin is only opened here
+    when its entry is missing or stale.
+ ***/
+
 static void
 insert_plugin (gchar *eafile)
 {
-  void *dl = dlopen (eafile, RTLD_LAZY);
-  if (dl) {
-    plugin_query pq = dlsym (dl, "query_plugin");
+  struct stat sb;
+  if (stat (eafile, &sb) != 0) {
+    g_free (eafile);
+    return;
+  }
+
+  gchar *name = NULL;
+  gchar *desc = NULL;
+  gchar **icon_xpm = NULL;
+  if (!plugin_cache_lookup (eafile, sb.st_mtime, sb.st_size,
+			    &name, &desc, &icon_xpm)) {
+    void *dl = dlopen (eafile, RTLD_LAZY);
+    plugin_query pq = dl ? dlsym (dl, "query_plugin") : NULL;
     if (!pq) {
       log_string (LOG_GFIG_ERROR, NULL, dlerror());
+      if (dl) dlclose (dl);
       g_free (eafile);
+      return;
     }
-    else {
-      gchar *name = NULL;
-      gchar *desc = NULL;
-      gchar **icon_xpm = NULL;
-      (*pq) (&name, &desc, &icon_xpm);
-      GdkPixbuf *pb = icon_xpm ?
-	gdk_pixbuf_new_from_xpm_data ((const gchar **)icon_xpm)
-	: NULL;
-      plugin_s *plugin = gfig_try_malloc0 (sizeof (plugin_s));
-      plugin_path (plugin) = eafile;
-      plugin_name (plugin) = g_strdup (name);
-      plugin_desc (plugin) = g_strdup (desc);
-      plugin_icon (plugin) = pb;
-      plugin_open (plugin) = FALSE;
-      plugins = g_list_append (plugins, plugin);
-      dlclose (dl);
-    }
-  }
-  else {
-    log_string (LOG_GFIG_ERROR, NULL, dlerror());
-    g_free (eafile);
+    gchar *q_name = NULL;
+    gchar *q_desc = NULL;
+    gchar **q_xpm = NULL;
+    (*pq) (&q_name, &q_desc, &q_xpm);
+    name     = g_strdup (q_name);
+    desc     = g_strdup (q_desc);
+    icon_xpm = plugin_xpm_copy (q_xpm);
+    plugin_cache_store (eafile, sb.st_mtime, sb.st_size,
+			name, desc, icon_xpm);
+    dlclose (dl);
   }
+
+  plugin_s *plugin = gfig_try_malloc0 (sizeof (plugin_s));
+  plugin_path (plugin) = eafile;
+  plugin_name (plugin) = name;
+  plugin_desc (plugin) = desc;
+  plugin_xpm (plugin)  = icon_xpm;
+  plugin_icon (plugin) = NULL;
+  plugin_open (plugin) = FALSE;
+  plugins = g_list_prepend (plugins, plugin);
 }
 
 static void
 find_plugins ()
 {
+  static gboolean found = FALSE;
   gboolean search_local  = FALSE;
+
+  if (found) return;
+  found = TRUE;
+  plugin_cache_load ();
 #ifdef TOPSRCDIR
   gchar *cwd = g_get_current_dir ();
   if (cwd) {
@@ -1015,6 +1217,8 @@ find_plugins ()
       g_free (sdir);
     }
   }
+  plugins = g_list_reverse (plugins);
+  plugin_cache_save ();
 }
 
 
@@ -1024,6 +1228,10 @@ void
 log_string (log_level_e log_level, sheet_s *sheet, gchar *str)
 {
   if (!str || !*str) return;
+  if (python_in_worker ()) {		// see python.c
+    python_defer_log (log_level, sheet, str);
+    return;
+  }
   
   const char *projname = NULL;
   char *sheetname = NULL;
@@ -1242,14 +1450,15 @@ main (int   argc,
   GError *error = NULL;
   GOptionEntry entries[] = {
     { "dump-xml", 'x', 0, G_OPTION_ARG_FILENAME,
-      &write_xml, "Dump XML after loading.", NULL },
+      &write_xml, "Dump XML (or binary, if .gfb) after loading.", NULL },
     { "load-xml", 'l', 0, G_OPTION_ARG_FILENAME,
-      &load_xml, "Load XML.", NULL },
+      &load_xml, "Load XML or binary.", NULL },
     { NULL }
   };
 
 
-  init_python ();
+  startup_begin ();
+  trace_init ();
 
   signal(SIGINT, catch_intr);	// python grabs it if we don't
 
@@ -1263,15 +1472,16 @@ main (int   argc,
     g_warning ("option parsing failed: %s\n", error->message);
     g_clear_error (&error);
   }
-
-  find_plugins ();
+  startup_phase ("gtk init");
 
   if (!init_global_environment ()) {
     log_string (LOG_GFIG_ERROR, NULL, _ ("Initialisation error."));
     return 1;
   }
+  startup_phase ("environment");
 
   load_persistents (global_environment);
+  startup_phase ("persistents");
 
 #if 0
   PangoFontMap *fontmap = pango_cairo_font_map_get_default();
@@ -1323,10 +1533,12 @@ main (int   argc,
   projects = gtk_list_store_new (PROJECT_COL_COUNT, G_TYPE_POINTER);
 
   gtk_widget_show_all (window);
+  startup_phase ("main window");
 
   
   if (load_xml) {
-    load_drawing (load_xml);
+    if (write_xml) load_drawing_now (load_xml);
+    else load_drawing (load_xml);
     g_free (load_xml);
   }
 
@@ -1335,13 +1547,25 @@ main (int   argc,
       create_new_project (NULL, argv[i]);
   }
 
-  if (!load_xml && argc <= 1) create_new_project (NULL, NULL);
+  if (!load_xml && argc <= 1) {
+    if (write_xml) create_new_project (NULL, NULL);
+    else if (!journal_recover ()) {
+      create_new_project (NULL, NULL);
+      journal_attach (NULL, 0);
+    }
+  }
   
   if (write_xml) {
     save_drawing (write_xml);
     g_free (write_xml);
     return 0;
   }
+  startup_phase ("projects");
+
+  startup_defer ("python", init_python);
+  startup_defer ("colours", build_colours_store);
+  startup_defer ("plugins", find_plugins);
+  startup_first_frame (window);
   
   gtk_main ();
     
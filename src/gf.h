@@ -103,6 +103,7 @@ typedef struct {
   gboolean	 show_origin;
   gboolean	 show_grid;
   gboolean	 snap_grid;
+  gboolean	 snap_objects;
   gdouble	 target_grid;
   cairo_surface_t *surface;
   gdouble	 hoff;
@@ -110,6 +111,8 @@ typedef struct {
   GtkWidget	*readout;
   gdouble	 zoom_factor;
   GtkWidget	*da;
+  GdkEvent	*motion;	// latest, waiting for the frame clock
+  guint		 motion_tick;
   GtkWidget	*scale;
   GtkWidget	*lcb;		// line_colour_button
   GtkAdjustment *hadj;
@@ -121,6 +124,7 @@ typedef struct {
   cairo_t	*cr;
   gchar 	*font_name;
   gdouble 	 text_size;
+  void		*grid;		// see grid.c
 } environment_s;
 #define environment_paper(e)	(e)->paper
 #define environment_pen(e)	(e)->pen
@@ -146,6 +150,7 @@ typedef struct {
 #define environment_show_org(e)	(e)->show_origin
 #define environment_show_grid(e)	(e)->show_grid
 #define environment_snap_grid(e)	(e)->snap_grid
+#define environment_snap_objects(e)	(e)->snap_objects
 #define environment_target_grid(e)	(e)->target_grid
 #define environment_surface(e)	(e)->surface
 #define environment_hoff(e)	(e)->hoff
@@ -153,6 +158,8 @@ typedef struct {
 #define environment_readout(e)	(e)->readout
 #define environment_zoom(e)	(e)->zoom_factor
 #define environment_da(e)	(e)->da
+#define environment_motion(e)	(e)->motion
+#define environment_motion_tick(e)	(e)->motion_tick
 #define environment_scale(e)	(e)->scale
 #define environment_lcb(e)	(e)->lcb
 #define environment_hadj(e)	(e)->hadj
@@ -164,6 +171,7 @@ typedef struct {
 #define environment_cr(e)	(e)->cr
 #define environment_fontname(e)	(e)->font_name
 #define environment_textsize(e)	(e)->text_size
+#define environment_grid(e)	(e)->grid
 
 typedef enum {
   ENTITY_TYPE_NONE,
@@ -172,7 +180,8 @@ typedef enum {
   ENTITY_TYPE_TEXT,
   ENTITY_TYPE_POLYLINE,
   ENTITY_TYPE_TRANSFORM,
-  ENTITY_TYPE_GROUP
+  ENTITY_TYPE_GROUP,
+  ENTITY_TYPE_INSTANCE
 } entity_type_e;
 
 typedef struct {
@@ -193,11 +202,35 @@ typedef struct {
   GList		 *entities;
   cairo_matrix_t *transform;
   point_s	 *centre;
+  void		 *cache;		// see recorded_draw in entities.c
 } entity_group_s;
 #define entity_group_type(p)		(p)->type
 #define entity_group_entities(p)	(p)->entities
 #define entity_group_transform(p)	(p)->transform
 #define entity_group_centre(p)		(p)->centre
+#define entity_group_cache(p)		(p)->cache
+
+typedef struct {		// a named block definition, see block.c
+  gchar		*name;
+  GList		*entities;
+  void		*cache;			// see recorded_draw in entities.c
+  gboolean	 defined;		// else only named by instances
+} block_s;
+#define block_name(b)		(b)->name
+#define block_entities(b)	(b)->entities
+#define block_cache(b)		(b)->cache
+#define block_defined(b)	(b)->defined
+
+typedef struct {
+  entity_type_e	 type;
+  block_s	*block;			// owned by the project
+  cairo_matrix_t transform;
+  pen_s		*pen;			// NULL unless overriding
+} entity_instance_s;
+#define entity_instance_type(p)		(p)->type
+#define entity_instance_block(p)	(p)->block
+#define entity_instance_transform(p)	(p)->transform
+#define entity_instance_pen(p)		(p)->pen
 
 typedef enum {
   INTERSECT_POINT,	// be sure to keep in sync with python.c
@@ -214,6 +247,8 @@ typedef struct {
   intersect_e	 intersect;
   gdouble	 isect_radius;
   pen_s		*pen;
+  void		*lod;			// simplified paths, see display.c
+  void		*trim;			// see polyline_trim in entities.c
 } entity_polyline_s;
 #define entity_polyline_type(p)		(p)->type
 #define entity_polyline_verts(p)	(p)->verts
@@ -223,6 +258,39 @@ typedef struct {
 #define entity_polyline_intersect(p)	(p)->intersect
 #define entity_polyline_isect_radius(p)	(p)->isect_radius
 #define entity_polyline_pen(p)		(p)->pen
+#define entity_polyline_lod(p)		(p)->lod
+#define entity_polyline_trim(p)		(p)->trim
+
+typedef struct {
+  point_s p0;
+  point_s p1;
+} segment_s;
+#define segment_p0_x(s)	point_x (&((s).p0))
+#define segment_p0_y(s)	point_y (&((s).p0))
+#define segment_p1_x(s)	point_x (&((s).p1))
+#define segment_p1_y(s)	point_y (&((s).p1))
+
+typedef struct {		// an arc or bevel trimmed polyline corner
+  point_s	 centre;
+  point_s	 e;		// trimmed end of the outgoing segment
+  point_s	 d;		// trimmed end of the incoming segment
+  gdouble	 start;		// arc runs positively from e to d
+  gdouble	 stop;
+} corner_s;
+#define corner_centre(c)	(c)->centre
+#define corner_e(c)		(c)->e
+#define corner_d(c)		(c)->d
+#define corner_start(c)		(c)->start
+#define corner_stop(c)		(c)->stop
+
+typedef struct {		// the trimmed geometry of a polyline
+  guint		 last;		// segments to draw
+  segment_s	*segments;
+  GArray	*corners;	// corner_s
+} trim_s;
+#define trim_last(t)		(t)->last
+#define trim_segments(t)	(t)->segments
+#define trim_corners(t)		(t)->corners
 
 typedef struct {
   entity_type_e	type;
@@ -342,6 +410,11 @@ typedef struct {
   void		*tool_entity;		// for private use by tools
   point_s	 current_point;
   GtkWidget	*window;
+  void		*lazy;			// unparsed entities, see xml.c
+  void		*history;		// see history.c
+  void		*pick;			// see pick.c
+  void		*snap;			// see snap.c
+  void		*display;		// see display.c
 } sheet_s;		// add more stuff later
 #define sheet_name(s)		(s)->name
 #define sheet_environment(s)	(s)->environment
@@ -354,6 +427,11 @@ typedef struct {
 #define sheet_tool_state(s)	(s)->tool_state
 #define sheet_tool_entity(s)	(s)->tool_entity
 #define sheet_current_point(s)	(s)->current_point
+#define sheet_lazy(s)		(s)->lazy
+#define sheet_history(s)	(s)->history
+#define sheet_pick(s)		(s)->pick
+#define sheet_snap(s)		(s)->snap
+#define sheet_display(s)	(s)->display
 #define TOOL_IDLE	0
 
 typedef void (*button_f)(GdkEvent *event, sheet_s *sheet,
@@ -375,11 +453,15 @@ typedef struct {
   GtkTreeStore	*sheets;
   GtkTreeIter	*current_iter;
   environment_s	*environment;
+  void		*journal;		// GOutputStream, see journal.c
+  GHashTable	*blocks;		// name -> block_s, see block.c
 } project_s;		// add more stuff later
 #define project_name(p)   		(p)->name
 #define project_sheets(p) 		(p)->sheets
 #define project_current_iter(p)		(p)->current_iter
 #define project_environment(p) 		(p)->environment
+#define project_journal(p) 		(p)->journal
+#define project_blocks(p) 		(p)->blocks
 
 enum {
   PROJECT_STRUCT_COL,
@@ -395,14 +477,18 @@ typedef struct {
   gchar *path;
   gchar *name;
   gchar *desc;
+  gchar **icon_xpm;		// until the icon is first shown
   GdkPixbuf *icon;
   gboolean open;
+  void *handle;			// from dlopen, once opened
 } plugin_s;
 #define plugin_path(p)	(p)->path
 #define plugin_name(p)	(p)->name
 #define plugin_desc(p)	(p)->desc
+#define plugin_xpm(p)	(p)->icon_xpm
 #define plugin_icon(p)	(p)->icon
 #define plugin_open(p)	(p)->open
+#define plugin_handle(p)	(p)->handle
 
 typedef enum {
   LOG_NORMAL,
@@ -414,6 +500,7 @@ typedef enum {
 
 typedef enum {
   NOTIFY_MAP,
+  NOTIFY_MAP_FIRST,
   NOTIFY_TOOL_STOP
 } notify_e;
 
@@ -435,6 +522,7 @@ GtkListStore *get_projects (void);
 environment_s *get_global_environment (void);
 project_s *initialise_project (const gchar *name, gchar *script);
 project_s *create_project (const gchar *name);
+void discard_projects (gint first);
 GtkTreeIter *append_sheet (project_s *project, GtkTreeIter *parent,
 			   gchar *name, sheet_s **new_sheet_p);
 void notify_projects (notify_e type);
@@ -0,0 +1,171 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <string.h>
+
+#include "gf.h"
+#include "rgbhsv.h"
+#include "grid.h"
+
+#if 0 // comments
+
+     The grid is painted as a repeating surface pattern rather than
+     stroked line by line.  One tile holds a single grid cell, a
+     hairline along its left and top edges, rendered at the pitch
+     the cell has on screen; the pattern matrix then lays the tile
+     down on the grid in user units, so a frame costs one fill no
+     matter how many lines are showing.
+
+     The tile is kept with the environment and only made again when
+     the on-screen pitch or the paper colour changes, which in
+     practice means on zoom.  When lines would be closer than
+     GRID_MIN_PITCH pixels only every 2nd, 5th, 10th, ... line is
+     drawn; snapping still uses the full target grid.
+
+     A coarse grid zoomed in would want a tile as big as the window,
+     so past GRID_MAX_TILE pixels the few lines in view are stroked
+     directly instead.
+
+#endif
+
+typedef struct {
+  cairo_surface_t *tile;
+  gint		   size;		// tile edge, in pixels
+  GdkRGBA	   colour;
+} grid_cache_s;
+
+/***
+    Stretch the grid by 1, 2, 5, 10, 20, ... until lines are at
+    least GRID_MIN_PITCH pixels apart.
+ ***/
+
+static gdouble
+grid_decimate (gdouble pitch, gdouble *factor_p)
+{
+  static const gdouble steps[] = {1.0, 2.0, 5.0};
+  gdouble decade = 1.0;
+
+  for (gint i = 0; i < 30; i++) {
+    gdouble factor = decade * steps[i % 3];
+    if (pitch * factor >= GRID_MIN_PITCH) {
+      *factor_p = factor;
+      return pitch * factor;
+    }
+    if (i % 3 == 2) decade *= 10.0;
+  }
+  return NAN;
+}
+
+static cairo_surface_t *
+grid_tile (environment_s *env, gint size, const GdkRGBA *colour)
+{
+  grid_cache_s *cache = environment_grid (env);
+
+  if (!cache)
+    cache = environment_grid (env) = gfig_try_malloc0 (sizeof(grid_cache_s));
+
+  if (cache->tile && cache->size == size &&
+      gdk_rgba_equal (&cache->colour, colour))
+    return cache->tile;
+
+  if (cache->tile) cairo_surface_destroy (cache->tile);
+  cache->tile = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, size, size);
+  cache->size = size;
+  memmove (&cache->colour, colour, sizeof(GdkRGBA));
+
+  cairo_t *cr = cairo_create (cache->tile);
+  cairo_set_source_rgba (cr, colour->red, colour->green, colour->blue,
+			 colour->alpha);
+  cairo_set_line_width (cr, 1.0);
+  cairo_move_to (cr, 0.5, 0.0);
+  cairo_line_to (cr, 0.5, (gdouble)size);
+  cairo_move_to (cr, 1.0, 0.5);
+  cairo_line_to (cr, (gdouble)size, 0.5);
+  cairo_stroke (cr);
+  cairo_destroy (cr);
+
+  return cache->tile;
+}
+
+static void
+grid_stroke (cairo_t *cr, gdouble step, gdouble width,
+	     const GdkRGBA *colour)
+{
+  gdouble x0, y0, x1, y1;
+
+  cairo_clip_extents (cr, &x0, &y0, &x1, &y1);
+  cairo_save (cr);
+  cairo_set_source_rgba (cr, colour->red, colour->green, colour->blue,
+			 colour->alpha);
+  cairo_set_line_width (cr, width);
+  for (gdouble x = ceil (x0 / step) * step; x <= x1; x += step) {
+    cairo_move_to (cr, x, y0);
+    cairo_line_to (cr, x, y1);
+  }
+  for (gdouble y = ceil (y0 / step) * step; y <= y1; y += step) {
+    cairo_move_to (cr, x0, y);
+    cairo_line_to (cr, x1, y);
+  }
+  cairo_stroke (cr);
+  cairo_restore (cr);
+}
+
+/***
+    Paint the grid over the current clip.  The cairo matrix must be
+    the user-unit one entities are drawn with.
+ ***/
+
+void
+grid_draw (environment_s *env, cairo_t *cr)
+{
+  gdouble grid = environment_target_grid (env);
+  if (!environment_show_grid (env) || isnan (grid) || grid <= 0.0) return;
+
+  cairo_matrix_t m;
+  cairo_get_matrix (cr, &m);
+  gdouble pitch = MIN (hypot (m.xx, m.yx), hypot (m.xy, m.yy)) * grid;
+  gdouble factor;
+  gdouble shown = grid_decimate (pitch, &factor);
+  if (isnan (shown)) return;
+
+  GdkRGBA colour;
+  memmove (&colour, paper_colour (environment_paper (env)), sizeof(GdkRGBA));
+  compliment (&colour);
+  colour.alpha = 0.25;
+
+  if (shown > GRID_MAX_TILE) {
+    grid_stroke (cr, grid * factor, grid / pitch, &colour);
+    return;
+  }
+
+  gint size = (gint)lrint (shown);
+  cairo_surface_t *tile = grid_tile (env, size, &colour);
+
+  cairo_pattern_t *pattern = cairo_pattern_create_for_surface (tile);
+  cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
+  cairo_matrix_t pm;
+  cairo_matrix_init_scale (&pm, (gdouble)size / (grid * factor),
+			   (gdouble)size / (grid * factor));
+  cairo_pattern_set_matrix (pattern, &pm);
+
+  cairo_save (cr);
+  cairo_set_source (cr, pattern);
+  cairo_paint (cr);
+  cairo_restore (cr);
+  cairo_pattern_destroy (pattern);
+}
+
+void
+grid_free (environment_s *env)
+{
+  grid_cache_s *cache = environment_grid (env);
+
+  if (cache) {
+    if (cache->tile) cairo_surface_destroy (cache->tile);
+    g_free (cache);
+    environment_grid (env) = NULL;
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef GRID_H
+#define GRID_H
+
+#define GRID_MIN_PITCH	8.0		// in pixels, closer gets decimated
+#define GRID_MAX_TILE	256		// in pixels, wider gets stroked
+
+void grid_draw (environment_s *env, cairo_t *cr);
+void grid_free (environment_s *env);
+
+#endif  /* GRID_H */
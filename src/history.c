@@ -0,0 +1,466 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "view.h"
+#include "journal.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+
+#if 0 // comments
+
+     The entities of each sheet are mirrored by a persistent vector: a
+     32-way trie whose nodes are shared between versions and never
+     changed once built.  Appending copies only the path to the new
+     slot, so every version costs O(changed) and a checkpoint is just
+     a reference to the current vector.  The GList in the sheet stays
+     what everything else draws from; it is rebuilt from the vector
+     on undo and redo.
+
+     Entities are owned by the history once it exists: each carries a
+     count of the leaves holding it and is deleted when that drops to
+     zero.  An entity may be changed in place only until the next
+     checkpoint, which is how the lines tool grows its polyline.
+
+     Checkpoints are taken from an idle, so everything one event or
+     one script does becomes one step, and are held off while a tool
+     has an entity under construction.
+
+#endif
+
+#define PV_BITS		5
+#define PV_WIDTH	(1 << PV_BITS)
+#define PV_MASK		(PV_WIDTH - 1)
+
+typedef struct {
+  gint      refs;
+  guint     count;
+  gpointer  slots[PV_WIDTH];	// child nodes, or entities in leaves
+} pv_node_s;
+
+typedef struct {
+  gint       refs;
+  guint      count;
+  guint      shift;
+  pv_node_s *root;
+  gsize      delta;		// bytes added over the previous step
+} pvec_s;
+
+typedef struct {
+  guint     refs;
+  gsize     bytes;
+} entity_ref_s;
+
+typedef struct {
+  pvec_s     *current;		// mirrors sheet_entities
+  pvec_s     *saved;		// as of the last checkpoint
+  GQueue      undo;		// pvec_s *, oldest at the head
+  GQueue      redo;
+  GHashTable *refs;		// entity -> entity_ref_s
+  GList      *fresh;		// appended since the last checkpoint
+  gsize       node_bytes;
+  gsize       entity_bytes;
+  gsize       pending;		// bytes added since the last checkpoint
+  gsize       retained;		// sum of deltas over undo and redo
+  guint       source;
+} history_s;
+
+
+/*************** entity ownership **************/
+
+static void
+entity_ref (history_s *hist, gpointer entity)
+{
+  entity_ref_s *ref = g_hash_table_lookup (hist->refs, entity);
+  if (!ref) {
+    ref = gfig_try_malloc0 (sizeof(entity_ref_s));
+    ref->bytes = entity_size (entity);
+    hist->entity_bytes += ref->bytes;
+    hist->pending      += ref->bytes;
+    g_hash_table_insert (hist->refs, entity, ref);
+  }
+  ref->refs++;
+}
+
+static void
+entity_unref (history_s *hist, gpointer entity)
+{
+  entity_ref_s *ref = g_hash_table_lookup (hist->refs, entity);
+  if (ref && --ref->refs == 0) {
+    hist->entity_bytes -= ref->bytes;
+    g_hash_table_remove (hist->refs, entity);
+    delete_entities (entity);
+  }
+}
+
+
+/*************** persistent vector **************/
+
+static pv_node_s *
+node_new (history_s *hist)
+{
+  pv_node_s *node = gfig_try_malloc0 (sizeof(pv_node_s));
+  node->refs = 1;
+  hist->node_bytes += sizeof(pv_node_s);
+  hist->pending    += sizeof(pv_node_s);
+  return node;
+}
+
+static void
+node_unref (history_s *hist, pv_node_s *node, guint shift)
+{
+  if (!node || --node->refs > 0) return;
+
+  for (guint i = 0; i < node->count; i++) {
+    if (shift > 0) node_unref (hist, node->slots[i], shift - PV_BITS);
+    else entity_unref (hist, node->slots[i]);
+  }
+  hist->node_bytes -= sizeof(pv_node_s);
+  g_free (node);
+}
+
+static pv_node_s *
+node_copy (history_s *hist, pv_node_s *node, guint shift)
+{
+  pv_node_s *copy = node_new (hist);
+  copy->count = node->count;
+  memcpy (copy->slots, node->slots, node->count * sizeof(gpointer));
+  for (guint i = 0; i < node->count; i++) {
+    if (shift > 0) ((pv_node_s *)node->slots[i])->refs++;
+    else entity_ref (hist, node->slots[i]);
+  }
+  return copy;
+}
+
+static pv_node_s *
+node_path (history_s *hist, guint shift, gpointer entity)
+{
+  pv_node_s *node = node_new (hist);
+  node->count = 1;
+  if (shift > 0) node->slots[0] = node_path (hist, shift - PV_BITS, entity);
+  else {
+    node->slots[0] = entity;
+    entity_ref (hist, entity);
+  }
+  return node;
+}
+
+static pv_node_s *
+node_push (history_s *hist, pv_node_s *node, guint shift,
+	   guint index, gpointer entity)
+{
+  pv_node_s *copy = node_copy (hist, node, shift);
+
+  if (shift == 0) {
+    copy->slots[copy->count++] = entity;
+    entity_ref (hist, entity);
+  }
+  else {
+    guint sub = (index >> shift) & PV_MASK;
+    if (sub < copy->count) {
+      pv_node_s *child = copy->slots[sub];
+      copy->slots[sub] = node_push (hist, child, shift - PV_BITS,
+				    index, entity);
+      node_unref (hist, child, shift - PV_BITS);
+    }
+    else
+      copy->slots[copy->count++] = node_path (hist, shift - PV_BITS, entity);
+  }
+  return copy;
+}
+
+static pvec_s *
+pvec_new (void)
+{
+  pvec_s *vec = gfig_try_malloc0 (sizeof(pvec_s));
+  vec->refs = 1;
+  return vec;
+}
+
+static pvec_s *
+pvec_ref (pvec_s *vec)
+{
+  vec->refs++;
+  return vec;
+}
+
+static void
+pvec_unref (history_s *hist, pvec_s *vec)
+{
+  if (!vec || --vec->refs > 0) return;
+  node_unref (hist, vec->root, vec->shift);
+  g_free (vec);
+}
+
+static pvec_s *
+pvec_push (history_s *hist, pvec_s *vec, gpointer entity)
+{
+  pvec_s *new = pvec_new ();
+  new->count = vec->count + 1;
+  new->shift = vec->shift;
+
+  if (!vec->root)
+    new->root = node_path (hist, 0, entity);
+  else if (vec->count == (1u << (vec->shift + PV_BITS))) {
+    new->root = node_new (hist);		// full, grow a level
+    new->root->count = 2;
+    new->root->slots[0] = vec->root;
+    vec->root->refs++;
+    new->root->slots[1] = node_path (hist, vec->shift, entity);
+    new->shift += PV_BITS;
+  }
+  else
+    new->root = node_push (hist, vec->root, vec->shift, vec->count, entity);
+  return new;
+}
+
+static void
+node_collect (pv_node_s *node, guint shift, GList **list)
+{
+  for (guint i = 0; i < node->count; i++) {
+    if (shift > 0) node_collect (node->slots[i], shift - PV_BITS, list);
+    else *list = g_list_prepend (*list, node->slots[i]);
+  }
+}
+
+static GList *
+pvec_to_list (pvec_s *vec)
+{
+  GList *list = NULL;
+  if (vec->root) node_collect (vec->root, vec->shift, &list);
+  return g_list_reverse (list);
+}
+
+
+/*************** history **************/
+
+static history_s *
+history_for (sheet_s *sheet)
+{
+  history_s *hist = sheet_history (sheet);
+  if (hist) return hist;
+
+  hist = gfig_try_malloc0 (sizeof(history_s));
+  g_queue_init (&hist->undo);
+  g_queue_init (&hist->redo);
+  hist->refs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+				      NULL, g_free);
+  hist->current = pvec_new ();
+  for (GList *l = sheet_entities (sheet); l; l = l->next) {
+    pvec_s *next = pvec_push (hist, hist->current, l->data);
+    pvec_unref (hist, hist->current);
+    hist->current = next;
+  }
+  hist->saved   = pvec_ref (hist->current);
+  hist->pending = 0;			// the starting point isn't history
+  sheet_history (sheet) = hist;
+  return hist;
+}
+
+static void
+drop_redo (history_s *hist)
+{
+  pvec_s *vec;
+  while ((vec = g_queue_pop_head (&hist->redo))) {
+    hist->retained -= vec->delta;
+    pvec_unref (hist, vec);
+  }
+}
+
+static void
+checkpoint (history_s *hist)
+{
+  if (hist->source) {
+    g_source_remove (hist->source);
+    hist->source = 0;
+  }
+  if (hist->current == hist->saved) return;
+
+  /***
+      Entities built up in place since the last checkpoint are
+      finished now; take their sizes again.
+   ***/
+  for (GList *l = hist->fresh; l; l = l->next) {
+    entity_ref_s *ref = g_hash_table_lookup (hist->refs, l->data);
+    if (ref) {
+      gsize bytes = entity_size (l->data);
+      hist->entity_bytes += bytes - ref->bytes;
+      hist->pending      += bytes - ref->bytes;
+      ref->bytes = bytes;
+    }
+  }
+  g_list_free (hist->fresh);
+  hist->fresh = NULL;
+
+  hist->current->delta = hist->pending;
+  hist->retained += hist->saved->delta;
+  hist->pending = 0;
+  g_queue_push_tail (&hist->undo, hist->saved);
+  hist->saved = pvec_ref (hist->current);
+
+  while (hist->retained > HISTORY_BYTE_CAP &&
+	 !g_queue_is_empty (&hist->undo)) {
+    pvec_s *oldest = g_queue_pop_head (&hist->undo);
+    hist->retained -= oldest->delta;
+    pvec_unref (hist, oldest);
+  }
+}
+
+static gboolean
+checkpoint_idle (gpointer data)
+{
+  sheet_s *sheet = data;
+  history_s *hist = sheet_history (sheet);
+
+  hist->source = 0;
+  if (!sheet_tool_entity (sheet)) checkpoint (hist);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+touch (sheet_s *sheet, history_s *hist)
+{
+  drop_redo (hist);
+  if (!hist->source)
+    hist->source = g_idle_add (checkpoint_idle, sheet);
+}
+
+void
+history_append (sheet_s *sheet, gpointer entity)
+{
+  if (!sheet || !entity) return;
+
+  history_s *hist = history_for (sheet);
+  pvec_s *next = pvec_push (hist, hist->current, entity);
+  pvec_unref (hist, hist->current);
+  hist->current = next;
+  hist->fresh = g_list_prepend (hist->fresh, entity);
+  touch (sheet, hist);
+}
+
+void
+history_modify (sheet_s *sheet, gpointer entity)
+{
+  if (sheet) touch (sheet, history_for (sheet));
+}
+
+/***
+    The entities stay alive for as long as some step still holds
+    them, so the list is only unlinked here.
+ ***/
+
+void
+history_clear (sheet_s *sheet)
+{
+  if (!sheet) return;
+
+  history_s *hist = history_for (sheet);
+  pvec_unref (hist, hist->current);
+  hist->current = pvec_new ();
+  g_list_free (sheet_entities (sheet));
+  sheet_entities (sheet) = NULL;
+  pick_invalidate (sheet);
+  display_invalidate (sheet);
+  touch (sheet, hist);
+}
+
+/***
+    Drop the history but keep what is on the sheet, handing the
+    entities back to the list.  For code that rewrites the list
+    directly.
+ ***/
+
+void
+history_forget (sheet_s *sheet)
+{
+  history_s *hist = sheet ? sheet_history (sheet) : NULL;
+  if (!hist) return;
+
+  if (hist->source) g_source_remove (hist->source);
+  for (GList *l = sheet_entities (sheet); l; l = l->next)
+    g_hash_table_remove (hist->refs, l->data);
+
+  pvec_s *vec;
+  while ((vec = g_queue_pop_head (&hist->undo))) pvec_unref (hist, vec);
+  while ((vec = g_queue_pop_head (&hist->redo))) pvec_unref (hist, vec);
+  pvec_unref (hist, hist->saved);
+  pvec_unref (hist, hist->current);
+  g_hash_table_destroy (hist->refs);
+  g_list_free (hist->fresh);
+  g_free (hist);
+  sheet_history (sheet) = NULL;
+}
+
+static void
+restore (sheet_s *sheet, history_s *hist)
+{
+  pvec_unref (hist, hist->current);
+  hist->current = pvec_ref (hist->saved);
+  g_list_free (sheet_entities (sheet));
+  sheet_entities (sheet) = pvec_to_list (hist->current);
+  pick_invalidate (sheet);
+  display_invalidate (sheet);
+  sheet_tool_entity (sheet) = NULL;
+  sheet_tool_state (sheet)  = TOOL_IDLE;
+  journal_sheet (sheet);
+  force_redraw (sheet);
+}
+
+gboolean
+history_undo (sheet_s *sheet)
+{
+  history_s *hist = sheet ? sheet_history (sheet) : NULL;
+  if (!hist) return FALSE;
+
+  checkpoint (hist);
+  if (g_queue_is_empty (&hist->undo)) return FALSE;
+
+  g_queue_push_head (&hist->redo, hist->saved);
+  hist->saved = g_queue_pop_tail (&hist->undo);
+  hist->retained -= hist->saved->delta;
+  hist->retained += ((pvec_s *)g_queue_peek_head (&hist->redo))->delta;
+  restore (sheet, hist);
+  return TRUE;
+}
+
+gboolean
+history_redo (sheet_s *sheet)
+{
+  history_s *hist = sheet ? sheet_history (sheet) : NULL;
+  if (!hist) return FALSE;
+
+  checkpoint (hist);
+  if (g_queue_is_empty (&hist->redo)) return FALSE;
+
+  g_queue_push_tail (&hist->undo, hist->saved);
+  hist->retained += hist->saved->delta;
+  hist->saved = g_queue_pop_head (&hist->redo);
+  hist->retained -= hist->saved->delta;
+  restore (sheet, hist);
+  return TRUE;
+}
+
+/***
+    total is everything the history holds, the current entities
+    included; retained is the estimate of what the undo and redo
+    steps add to that, which is what HISTORY_BYTE_CAP limits.
+ ***/
+
+void
+history_memory (sheet_s *sheet, gsize *total_p, gsize *retained_p,
+		guint *undo_p, guint *redo_p)
+{
+  history_s *hist = sheet ? sheet_history (sheet) : NULL;
+
+  if (total_p)    *total_p    = hist ? hist->node_bytes + hist->entity_bytes : 0;
+  if (retained_p) *retained_p = hist ? hist->retained : 0;
+  if (undo_p)     *undo_p     = hist ? g_queue_get_length (&hist->undo) : 0;
+  if (redo_p)     *redo_p     = hist ? g_queue_get_length (&hist->redo) : 0;
+}
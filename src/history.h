@@ -0,0 +1,15 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#define HISTORY_BYTE_CAP	(16 * 1024 * 1024)
+
+void history_append (sheet_s *sheet, gpointer entity);
+void history_modify (sheet_s *sheet, gpointer entity);
+void history_clear (sheet_s *sheet);
+void history_forget (sheet_s *sheet);
+gboolean history_undo (sheet_s *sheet);
+gboolean history_redo (sheet_s *sheet);
+void history_memory (sheet_s *sheet, gsize *total_p, gsize *retained_p,
+		     guint *undo_p, guint *redo_p);
+
+#endif  /* HISTORY_H */
@@ -11,6 +11,7 @@
 #include <gsl/gsl_poly.h>
 #include <gsl/gsl_complex.h>
 #include "quartic.h"
+#include "trace.h"
 
 /***
             text circle ellipse line 
@@ -18,6 +19,7 @@
    circle         done     done  done
    ellipse        done     done  done
    line           done     done  done
+   spline         done     done  done  (and spline/spline)
    
  ***/
 
@@ -579,16 +581,489 @@ x^2 - 2Dx + D^2 + R^2 - x^2 = P^2
   return points;
 }
 
+/***
+    Splines.  The cubics are taken from the vertices exactly as
+    draw_entities lays them, then intersected by recursive subdivision:
+    a pair of pieces whose control-point boxes miss each other is
+    dropped, anything else is split at t = 0.5 until the pieces are
+    flat, and the crossing of the flat chords is polished by Newton
+    iteration on the original cubic.  Circles and ellipses are mapped
+    onto the unit circle first, which leaves a cubic a cubic.
+ ***/
+
+#define SPLINE_FLAT	1.0e-6		// of the extent of the curves
+#define SPLINE_DEPTH	48
+#define SPLINE_NEWTON	8
+
+typedef struct {
+  point_s p[4];
+} cubic_s;
+
+typedef struct {
+  GList   *points;
+  gdouble  tol;			// flatness, in the units of the cubics
+  gdouble  merge;		// duplicate distance, in the callers' units
+} spline_isect_s;
+
+static GArray *
+spline_cubics (entity_polyline_s *polyline)
+{
+  GList *verts = entity_polyline_verts (polyline);
+  guint n = g_list_length (verts);
+  gboolean closed =
+    entity_polyline_closed (polyline) || entity_polyline_filled (polyline);
+
+  if (!(( closed && n >= 3) || (!closed && n >= 4))) return NULL;
+
+  point_s *pts = gfig_try_malloc0 (n * sizeof(point_s));
+  guint i = 0;
+  for (GList *l = verts; l; l = l->next) pts[i++] = *(point_s *)l->data;
+
+  GArray *cubics = g_array_new (FALSE, FALSE, sizeof(cubic_s));
+  point_s cur = pts[0];
+  for (i = 1; i + 2 < n; i++) {
+    cubic_s c = {{cur, pts[i], pts[i + 1], pts[i + 2]}};
+    g_array_append_val (cubics, c);
+    cur = pts[i + 2];
+    if (closed) {
+      cubic_s k = {{cur, pts[n - 2], pts[n - 1], pts[0]}};
+      g_array_append_val (cubics, k);
+      cur = pts[0];
+    }
+  }
+  g_free (pts);
+  return cubics;
+}
+
+static void
+cubic_at (const cubic_s *c, gdouble t, point_s *b, point_s *d)
+{
+  gdouble s = 1.0 - t;
+  gdouble b0 = s * s * s;
+  gdouble b1 = 3.0 * s * s * t;
+  gdouble b2 = 3.0 * s * t * t;
+  gdouble b3 = t * t * t;
+  point_x (b) = b0 * c->p[0].x + b1 * c->p[1].x + b2 * c->p[2].x +
+    b3 * c->p[3].x;
+  point_y (b) = b0 * c->p[0].y + b1 * c->p[1].y + b2 * c->p[2].y +
+    b3 * c->p[3].y;
+  if (d) {
+    gdouble d0 = 3.0 * s * s;
+    gdouble d1 = 6.0 * s * t;
+    gdouble d2 = 3.0 * t * t;
+    point_x (d) = d0 * (c->p[1].x - c->p[0].x) +
+      d1 * (c->p[2].x - c->p[1].x) + d2 * (c->p[3].x - c->p[2].x);
+    point_y (d) = d0 * (c->p[1].y - c->p[0].y) +
+      d1 * (c->p[2].y - c->p[1].y) + d2 * (c->p[3].y - c->p[2].y);
+  }
+}
+
+static void
+cubic_split (const cubic_s *c, cubic_s *l, cubic_s *r)
+{
+  point_s m01, m12, m23, m012, m123, mid;
+
+#define MID(a, b, m) \
+  (m).x = 0.5 * ((a).x + (b).x); (m).y = 0.5 * ((a).y + (b).y)
+  MID (c->p[0], c->p[1], m01);
+  MID (c->p[1], c->p[2], m12);
+  MID (c->p[2], c->p[3], m23);
+  MID (m01, m12, m012);
+  MID (m12, m23, m123);
+  MID (m012, m123, mid);
+#undef MID
+
+  l->p[0] = c->p[0]; l->p[1] = m01;  l->p[2] = m012; l->p[3] = mid;
+  r->p[0] = mid;     r->p[1] = m123; r->p[2] = m23;  r->p[3] = c->p[3];
+}
+
+static void
+cubic_box (const cubic_s *c, gdouble box[4])
+{
+  box[0] = box[2] = c->p[0].x;
+  box[1] = box[3] = c->p[0].y;
+  for (gint i = 1; i < 4; i++) {
+    box[0] = fmin (box[0], c->p[i].x);
+    box[1] = fmin (box[1], c->p[i].y);
+    box[2] = fmax (box[2], c->p[i].x);
+    box[3] = fmax (box[3], c->p[i].y);
+  }
+}
+
+static gboolean
+boxes_meet (const gdouble a[4], const gdouble b[4], gdouble tol)
+{
+  return a[0] <= b[2] + tol && b[0] <= a[2] + tol &&
+    a[1] <= b[3] + tol && b[1] <= a[3] + tol;
+}
+
+/***
+    Flat when both inner control points lie within tol of the chord.
+ ***/
+
+static gboolean
+cubic_flat (const cubic_s *c, gdouble tol)
+{
+  gdouble dx = c->p[3].x - c->p[0].x;
+  gdouble dy = c->p[3].y - c->p[0].y;
+  gdouble len = hypot (dx, dy);
+
+  for (gint i = 1; i < 3; i++) {
+    gdouble ex = c->p[i].x - c->p[0].x;
+    gdouble ey = c->p[i].y - c->p[0].y;
+    gdouble d = (len > 0.0) ? fabs (dx * ey - dy * ex) / len : hypot (ex, ey);
+    if (d > tol) return FALSE;
+  }
+  return TRUE;
+}
+
+/***
+    Adjacent pieces share their ends, so a crossing there turns up
+    twice.
+ ***/
+
+static void
+spline_store (spline_isect_s *si, gdouble x, gdouble y)
+{
+  for (GList *l = si->points; l; l = l->next) {
+    point_s *p = l->data;
+    if (fabs (point_x (p) - x) <= si->merge &&
+	fabs (point_y (p) - y) <= si->merge) return;
+  }
+  si->points = storexy (si->points, x, y);
+}
+
+static gdouble
+curves_tol (GArray *c0, GArray *c1)
+{
+  gdouble ext = 0.0;
+  GArray *both[2] = {c0, c1};
+
+  for (gint k = 0; k < 2; k++) {
+    if (!both[k]) continue;
+    for (guint i = 0; i < both[k]->len; i++) {
+      gdouble box[4];
+      cubic_box (&g_array_index (both[k], cubic_s, i), box);
+      ext = fmax (ext, fmax (box[2] - box[0], box[3] - box[1]));
+      for (gint j = 0; j < 4; j++) ext = fmax (ext, fabs (box[j]));
+    }
+  }
+  return fmax (ext * SPLINE_FLAT, 1.0e-12);
+}
+
+/***
+    Spline against straight segments.  The signed distance of a cubic
+    from a line is itself a cubic in t, so no subdivision is needed:
+    its roots are the crossings, kept if they fall on the segment.
+ ***/
+
+static void
+spline_segment (spline_isect_s *si, const cubic_s *c,
+		gdouble x1, gdouble y1, gdouble x2, gdouble y2)
+{
+  gdouble dx = x2 - x1;
+  gdouble dy = y2 - y1;
+  gdouble len2 = dx * dx + dy * dy;
+  gdouble box[4];
+  gdouble seg[4] = {fmin (x1, x2), fmin (y1, y2), fmax (x1, x2), fmax (y1, y2)};
+
+  if (len2 == 0.0) return;
+  cubic_box (c, box);
+  if (!boxes_meet (box, seg, si->tol)) return;
+
+  gdouble d[4];
+  for (gint i = 0; i < 4; i++)
+    d[i] = dx * (c->p[i].y - y1) - dy * (c->p[i].x - x1);
+
+  gdouble a3 = -d[0] + 3.0 * d[1] - 3.0 * d[2] + d[3];
+  gdouble a2 = 3.0 * d[0] - 6.0 * d[1] + 3.0 * d[2];
+  gdouble a1 = -3.0 * d[0] + 3.0 * d[1];
+  gdouble a0 = d[0];
+  gdouble scale = fmax (fmax (fabs (a0), fabs (a1)), fmax (fabs (a2), fabs (a3)));
+  gdouble t[3];
+  gint nt;
+
+  if (scale == 0.0) return;		// lies along the line
+  if (fabs (a3) > 1.0e-12 * scale)
+    nt = gsl_poly_solve_cubic (a2 / a3, a1 / a3, a0 / a3, &t[0], &t[1], &t[2]);
+  else nt = gsl_poly_solve_quadratic (a2, a1, a0, &t[0], &t[1]);
+
+  gdouble eps = 1.0e-9;
+  for (gint i = 0; i < nt; i++) {
+    if (t[i] < -eps || t[i] > 1.0 + eps) continue;
+    point_s b;
+    cubic_at (c, CLAMP (t[i], 0.0, 1.0), &b, NULL);
+    gdouble u = ((point_x (&b) - x1) * dx + (point_y (&b) - y1) * dy) / len2;
+    if (u < -eps || u > 1.0 + eps) continue;
+    spline_store (si, point_x (&b), point_y (&b));
+  }
+}
+
+static GList *
+spline_line_intersections (entity_polyline_s *s0, entity_polyline_s *c1)
+{
+  GArray *cubics = spline_cubics (s0);
+  GList *p1 = entity_polyline_verts (c1);
+  if (!cubics) return NULL;
+
+  gdouble tol = curves_tol (cubics, NULL);
+  spline_isect_s si = {NULL, tol, tol};
+  for (guint i = 0; i < cubics->len; i++) {
+    cubic_s *c = &g_array_index (cubics, cubic_s, i);
+    for (GList *l = p1; l && l->next; l = l->next) {
+      point_s *pt1 = l->data;
+      point_s *pt2 = l->next->data;
+      spline_segment (&si, c,
+		      point_x (pt1), point_y (pt1),
+		      point_x (pt2), point_y (pt2));
+    }
+  }
+  g_array_free (cubics, TRUE);
+  return si.points;
+}
+
+/***
+    Spline against the unit circle, f(t) = |B(t)|^2 - 1.  A piece whose
+    box misses the disc, or whose control points all lie inside it,
+    cannot cross it.
+ ***/
+
+static void
+spline_unit_circle (spline_isect_s *si, const cubic_s *orig,
+		    const cubic_s *c, gdouble t0, gdouble t1, gint depth,
+		    const cairo_matrix_t *back)
+{
+  gdouble box[4];
+  cubic_box (c, box);
+  gdouble nx = fmax (0.0, fmax (box[0], -box[2]));
+  gdouble ny = fmax (0.0, fmax (box[1], -box[3]));
+  if (nx * nx + ny * ny > 1.0) return;
+
+  gboolean inside = TRUE;
+  for (gint i = 0; inside && i < 4; i++)
+    if (hypot (c->p[i].x, c->p[i].y) >= 1.0) inside = FALSE;
+  if (inside) return;
+
+  if (depth < SPLINE_DEPTH && !cubic_flat (c, si->tol)) {
+    cubic_s l, r;
+    gdouble tm = 0.5 * (t0 + t1);
+    cubic_split (c, &l, &r);
+    spline_unit_circle (si, orig, &l, t0, tm, depth + 1, back);
+    spline_unit_circle (si, orig, &r, tm, t1, depth + 1, back);
+    return;
+  }
+
+  // chord against the circle, |P + u D|^2 = 1
+  gdouble px = c->p[0].x, py = c->p[0].y;
+  gdouble dx = c->p[3].x - px, dy = c->p[3].y - py;
+  gdouble u[2];
+  gint nu = gsl_poly_solve_quadratic (dx * dx + dy * dy,
+				      2.0 * (px * dx + py * dy),
+				      px * px + py * py - 1.0, &u[0], &u[1]);
+  for (gint i = 0; i < nu; i++) {
+    if (u[i] < 0.0 || u[i] > 1.0) continue;
+    gdouble t = t0 + u[i] * (t1 - t0);
+    point_s b, d;
+    for (gint k = 0; k < SPLINE_NEWTON; k++) {
+      cubic_at (orig, t, &b, &d);
+      gdouble f = point_x (&b) * point_x (&b) + point_y (&b) * point_y (&b)
+	- 1.0;
+      gdouble df = 2.0 * (point_x (&b) * point_x (&d) +
+			  point_y (&b) * point_y (&d));
+      if (df == 0.0) break;
+      t = CLAMP (t - f / df, 0.0, 1.0);
+    }
+    cubic_at (orig, t, &b, NULL);
+    gdouble x = point_x (&b);
+    gdouble y = point_y (&b);
+    cairo_matrix_transform_point (back, &x, &y);
+    spline_store (si, x, y);
+  }
+}
+
+static GList *
+spline_ellipse_intersections (entity_polyline_s *s0, gdouble X, gdouble Y,
+			      gdouble A, gdouble B, gdouble T)
+{
+  if (A == 0.0 || B == 0.0) return NULL;
+  GArray *cubics = spline_cubics (s0);
+  if (!cubics) return NULL;
+
+  cairo_matrix_t matrix;		// as in ellipse_line_intersections
+  cairo_matrix_t rmatrix;
+  cairo_matrix_init_scale (&matrix, 1.0 / A, 1.0 / B);
+  cairo_matrix_rotate (&matrix, T);
+  cairo_matrix_translate (&matrix, -X, -Y);
+  cairo_matrix_init_translate (&rmatrix, X, Y);
+  cairo_matrix_rotate (&rmatrix, -T);
+  cairo_matrix_scale (&rmatrix, A, B);
+
+  spline_isect_s si = {NULL, 0.0, 0.0};
+  for (guint i = 0; i < cubics->len; i++) {
+    cubic_s *c = &g_array_index (cubics, cubic_s, i);
+    for (gint k = 0; k < 4; k++)
+      cairo_matrix_transform_point (&matrix, &c->p[k].x, &c->p[k].y);
+  }
+  si.tol = curves_tol (cubics, NULL);
+  si.merge = si.tol * fmax (A, B);
+  for (guint i = 0; i < cubics->len; i++) {
+    cubic_s *c = &g_array_index (cubics, cubic_s, i);
+    spline_unit_circle (&si, c, c, 0.0, 1.0, 0, &rmatrix);
+  }
+  g_array_free (cubics, TRUE);
+  return si.points;
+}
+
+/***
+    Spline against spline.  The larger of the two pieces is split until
+    both are flat, then the chords are crossed and the result polished
+    by Newton iteration on B0(s) - B1(t) = 0.
+ ***/
+
+static void
+spline_spline (spline_isect_s *si,
+	       const cubic_s *o0, const cubic_s *c0, gdouble s0, gdouble s1,
+	       const cubic_s *o1, const cubic_s *c1, gdouble t0, gdouble t1,
+	       gint depth)
+{
+  gdouble b0[4], b1[4];
+  cubic_box (c0, b0);
+  cubic_box (c1, b1);
+  if (!boxes_meet (b0, b1, si->tol)) return;
+
+  gboolean flat0 = cubic_flat (c0, si->tol);
+  gboolean flat1 = cubic_flat (c1, si->tol);
+  if (depth < SPLINE_DEPTH && !(flat0 && flat1)) {
+    gdouble e0 = fmax (b0[2] - b0[0], b0[3] - b0[1]);
+    gdouble e1 = fmax (b1[2] - b1[0], b1[3] - b1[1]);
+    cubic_s l, r;
+    if (flat1 || (!flat0 && e0 >= e1)) {
+      gdouble sm = 0.5 * (s0 + s1);
+      cubic_split (c0, &l, &r);
+      spline_spline (si, o0, &l, s0, sm, o1, c1, t0, t1, depth + 1);
+      spline_spline (si, o0, &r, sm, s1, o1, c1, t0, t1, depth + 1);
+    }
+    else {
+      gdouble tm = 0.5 * (t0 + t1);
+      cubic_split (c1, &l, &r);
+      spline_spline (si, o0, c0, s0, s1, o1, &l, t0, tm, depth + 1);
+      spline_spline (si, o0, c0, s0, s1, o1, &r, tm, t1, depth + 1);
+    }
+    return;
+  }
+
+  gdouble ax = c0->p[3].x - c0->p[0].x, ay = c0->p[3].y - c0->p[0].y;
+  gdouble bx = c1->p[3].x - c1->p[0].x, by = c1->p[3].y - c1->p[0].y;
+  gdouble qx = c1->p[0].x - c0->p[0].x, qy = c1->p[0].y - c0->p[0].y;
+  gdouble D = ax * by - ay * bx;
+  if (D == 0.0) return;			// parallel or overlapping chords
+
+  gdouble u = (qx * by - qy * bx) / D;
+  gdouble v = (qx * ay - qy * ax) / D;
+  gdouble eps = 1.0e-9;
+  if (u < -eps || u > 1.0 + eps || v < -eps || v > 1.0 + eps) return;
+
+  gdouble s = s0 + CLAMP (u, 0.0, 1.0) * (s1 - s0);
+  gdouble t = t0 + CLAMP (v, 0.0, 1.0) * (t1 - t0);
+  point_s p0, d0, p1, d1;
+  for (gint k = 0; k < SPLINE_NEWTON; k++) {
+    cubic_at (o0, s, &p0, &d0);
+    cubic_at (o1, t, &p1, &d1);
+    gdouble fx = point_x (&p0) - point_x (&p1);
+    gdouble fy = point_y (&p0) - point_y (&p1);
+    gdouble J = -point_x (&d0) * point_y (&d1) + point_x (&d1) * point_y (&d0);
+    if (J == 0.0) break;
+    gdouble ds = (-fx * -point_y (&d1) + point_x (&d1) * -fy) / J;
+    gdouble dt = (point_x (&d0) * -fy - point_y (&d0) * -fx) / J;
+    s = CLAMP (s + ds, 0.0, 1.0);
+    t = CLAMP (t + dt, 0.0, 1.0);
+  }
+  cubic_at (o0, s, &p0, NULL);
+  spline_store (si, point_x (&p0), point_y (&p0));
+}
+
+static GList *
+spline_spline_intersections (entity_polyline_s *s0, entity_polyline_s *s1)
+{
+  GArray *cubics0 = spline_cubics (s0);
+  GArray *cubics1 = spline_cubics (s1);
+  spline_isect_s si = {NULL, 0.0, 0.0};
+
+  if (cubics0 && cubics1) {
+    si.tol = si.merge = curves_tol (cubics0, cubics1);
+    for (guint i = 0; i < cubics0->len; i++) {
+      cubic_s *c0 = &g_array_index (cubics0, cubic_s, i);
+      for (guint j = 0; j < cubics1->len; j++) {
+	cubic_s *c1 = &g_array_index (cubics1, cubic_s, j);
+	spline_spline (&si, c0, c0, 0.0, 1.0, c1, c1, 0.0, 1.0, 0);
+      }
+    }
+  }
+  if (cubics0) g_array_free (cubics0, TRUE);
+  if (cubics1) g_array_free (cubics1, TRUE);
+  return si.points;
+}
+
+static GList *
+spline_intersections (entity_polyline_s *s0, gpointer e1)
+{
+  GList *points = NULL;
+  entity_type_e t1 = entity_type (e1);
+
+  switch (t1) {
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
+    break;
+  case ENTITY_TYPE_TEXT:
+    break;
+  case ENTITY_TYPE_CIRCLE:
+    {
+      entity_circle_s *ci = e1;
+      points = spline_ellipse_intersections (s0,
+					     entity_circle_x (ci),
+					     entity_circle_y (ci),
+					     entity_circle_r (ci),
+					     entity_circle_r (ci), 0.0);
+    }
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    {
+      entity_ellipse_s *el = e1;
+      points = spline_ellipse_intersections (s0,
+					     entity_ellipse_x (el),
+					     entity_ellipse_y (el),
+					     entity_ellipse_a (el),
+					     entity_ellipse_b (el),
+					     entity_ellipse_t (el));
+    }
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    if (entity_polyline_spline ((entity_polyline_s *)e1))
+      points = spline_spline_intersections (s0, (entity_polyline_s *)e1);
+    else
+      points = spline_line_intersections (s0, (entity_polyline_s *)e1);
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    break;
+  }
+  return points;
+}
+
 static GList *
 line_intersections (entity_polyline_s *c0, gpointer e1)
 {
   GList *points = NULL;
   entity_type_e t1 = entity_type (e1);
+
+  if (entity_polyline_spline (c0)) return spline_intersections (c0, e1);
   
   switch (t1) {
   case ENTITY_TYPE_NONE:
     break;
   case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
     break;
   case ENTITY_TYPE_TEXT:
     break;
@@ -599,7 +1074,10 @@ line_intersections (entity_polyline_s *c0, gpointer e1)
     points = ellipse_line_intersections ((entity_ellipse_s *)e1, c0);
     break;
   case ENTITY_TYPE_POLYLINE:
-    points = line_line_intersections (c0, (entity_polyline_s *)e1);
+    if (entity_polyline_spline ((entity_polyline_s *)e1))
+      points = spline_line_intersections ((entity_polyline_s *)e1, c0);
+    else
+      points = line_line_intersections (c0, (entity_polyline_s *)e1);
     break;
   case ENTITY_TYPE_TRANSFORM:
     break;
@@ -617,6 +1095,7 @@ circle_intersections (entity_circle_s *c0, gpointer e1)
   case ENTITY_TYPE_NONE:
     break;
   case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
     break;
   case ENTITY_TYPE_TEXT:
     break;
@@ -638,7 +1117,10 @@ circle_intersections (entity_circle_s *c0, gpointer e1)
     }
     break;
   case ENTITY_TYPE_POLYLINE:
-    points = circle_line_intersections (c0, (entity_polyline_s *)e1);
+    if (entity_polyline_spline ((entity_polyline_s *)e1))
+      points = spline_intersections ((entity_polyline_s *)e1, c0);
+    else
+      points = circle_line_intersections (c0, (entity_polyline_s *)e1);
     break;
   case ENTITY_TYPE_TRANSFORM:
     break;
@@ -656,6 +1138,7 @@ ellipse_intersections (entity_ellipse_s *c0, gpointer e1)
   case ENTITY_TYPE_NONE:
     break;
   case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
     break;
   case ENTITY_TYPE_TEXT:
     break;
@@ -678,7 +1161,10 @@ ellipse_intersections (entity_ellipse_s *c0, gpointer e1)
     points = ellipse_ellipse_intersections (c0, (entity_ellipse_s *)e1);
     break;
   case ENTITY_TYPE_POLYLINE:
-    points = ellipse_line_intersections (c0, (entity_polyline_s *)e1);
+    if (entity_polyline_spline ((entity_polyline_s *)e1))
+      points = spline_intersections ((entity_polyline_s *)e1, c0);
+    else
+      points = ellipse_line_intersections (c0, (entity_polyline_s *)e1);
     break;
   case ENTITY_TYPE_TRANSFORM:
     break;
@@ -692,10 +1178,13 @@ do_intersect (gpointer e0, gpointer e1)
   GList *points = NULL;
   entity_type_e t0 = entity_type (e0);
 
+  TRACE_BEGIN ("do_intersect");
+
   switch (t0) {
   case ENTITY_TYPE_NONE:
     break;
   case ENTITY_TYPE_GROUP:
+  case ENTITY_TYPE_INSTANCE:
     break;
   case ENTITY_TYPE_TEXT:
     break;
@@ -711,5 +1200,6 @@ do_intersect (gpointer e0, gpointer e1)
   case ENTITY_TYPE_TRANSFORM:
     break;
   }
+  TRACE_END ("do_intersect");
   return points;
 }
@@ -0,0 +1,1070 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "binary.h"
+#include "xml.h"
+#include "journal.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+#include "block.h"
+
+#if 0 // comments
+
+     Edits are appended to a journal as they happen, one file per
+     project, so autosave costs only what the edit costs.  Journals
+     are kept in the user cache directory, never beside the drawing,
+     under <cache>/<prgname>/journals/<key>, where the key is a SHA-1
+     of the absolute drawing path, or untitled:
+
+         <gen>.gfb		full snapshot, binary format
+	 <gen>-<project>.gfj	journal of edits made after snapshot <gen>
+
+     Generation 0 means "after the drawing file itself".  Once the
+     journals grow past JOURNAL_COMPACT_SIZE the drawing is serialised
+     on the main loop, a new generation is started and the snapshot is
+     written from a worker thread; only when it is safely on disk are
+     the older generations removed.  Recovery loads the newest
+     snapshot and replays every journal at or after its generation.
+
+     Journal layout, little-endian:
+
+         header = magic[4] version base_size base_mtime
+	 record = len check op index path_len path entity-blob
+
+     check is FNV-1a over everything after it, so a record torn by a
+     crash ends the replay rather than corrupting it.  The entity blob
+     comes from binary_encode_entity.  Projects are identified by
+     position, sheets by tree path and entities by position in the
+     sheet.
+
+     Undo and redo write the whole of the one sheet they touched; new
+     projects, new sheets and block definitions have records of their
+     own, so none of them needs a snapshot.  Entities appended as a
+     batch share one record, written and flushed once.
+
+     Journals (since version 4) and snapshots carry the size and
+     modification time of the drawing file they were written over.
+     Records find their entities by position, so if the file has been
+     changed outside gf3 since, nothing is restored: the journals are
+     set aside and the file is loaded as it is.
+
+#endif
+
+#define JOURNAL_MAGIC		"GF3J"
+#define JOURNAL_VERSION		4
+#define JOURNAL_HEADER_SIZE	24
+#define JOURNAL_HEADER_MIN	8	// before version 4
+#define JOURNAL_COMPACT_SIZE	(1024 * 1024)
+#define JOURNAL_UNTITLED	"untitled"
+#define JOURNAL_SUFFIX		".gfj"
+
+typedef enum {
+  JOURNAL_OP_APPEND,
+  JOURNAL_OP_MODIFY,
+  JOURNAL_OP_DELETE,
+  JOURNAL_OP_SHEET,		// since version 2
+  JOURNAL_OP_NEW_PROJECT,
+  JOURNAL_OP_NEW_SHEET,
+  JOURNAL_OP_BLOCK,
+  JOURNAL_OP_APPEND_LIST	// since version 3
+} journal_op_e;
+
+typedef struct {
+  gchar   *dir;
+  gchar   *path;
+  GBytes  *bytes;
+  guint64  gen;
+} compact_s;
+
+typedef struct {
+  guint64  gen;
+  gint     project;
+  gchar   *name;
+} journal_file_s;
+
+static gchar    *journal_dir    = NULL;	// NULL when not journalling
+static guint64   journal_gen    = 0;
+static gint      journal_first  = 0;	// projects before this aren't ours
+static gsize     journal_bytes  = 0;
+static guint     compact_source = 0;
+static gboolean  journal_replaying = FALSE;
+static guint64   journal_base_size  = 0;	// of the drawing file
+static guint64   journal_base_mtime = 0;
+
+static void journal_compact_soon (void);
+static void compact_now (void);
+
+static guint32
+fnv1a (const guint8 *data, gsize len)
+{
+  guint32 hash = 2166136261u;
+  for (gsize i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void
+put_u32 (GByteArray *ba, guint32 val)
+{
+  val = GUINT32_TO_LE (val);
+  g_byte_array_append (ba, (const guint8 *)&val, sizeof(val));
+}
+
+static void
+put_u64 (GByteArray *ba, guint64 val)
+{
+  val = GUINT64_TO_LE (val);
+  g_byte_array_append (ba, (const guint8 *)&val, sizeof(val));
+}
+
+static guint32
+get_u32 (const guint8 *data)
+{
+  guint32 val;
+  memcpy (&val, data, sizeof(val));
+  return GUINT32_FROM_LE (val);
+}
+
+static guint64
+get_u64 (const guint8 *data)
+{
+  guint64 val;
+  memcpy (&val, data, sizeof(val));
+  return GUINT64_FROM_LE (val);
+}
+
+/***
+    Size and modification time, in microseconds, of the drawing file;
+    zero for an untitled drawing or a file that isn't there.
+ ***/
+
+static void
+base_stamp (const gchar *base, guint64 *size_p, guint64 *mtime_p)
+{
+  *size_p  = 0;
+  *mtime_p = 0;
+  if (!base) return;
+
+  GFile *file = g_file_new_for_path (base);
+  GFileInfo *info =
+    g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		       G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+		       G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+		       G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info) {
+    *size_p  = g_file_info_get_size (info);
+    *mtime_p =
+      g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)
+      * G_USEC_PER_SEC +
+      g_file_info_get_attribute_uint32 (info,
+					G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    g_object_unref (info);
+  }
+  g_object_unref (file);
+}
+
+/***
+    FALSE if the journal at path was written over a different version
+    of the drawing file than the one there now.  Journals from before
+    version 4 carry no stamp and are taken on trust.
+ ***/
+
+static gboolean
+journal_matches (const gchar *path, guint64 size, guint64 mtime)
+{
+  gboolean rc = TRUE;
+  guint8 header[JOURNAL_HEADER_SIZE];
+
+  FILE *fp = fopen (path, "rb");
+  if (fp) {
+    if (fread (header, 1, sizeof(header), fp) == sizeof(header) &&
+	!memcmp (header, JOURNAL_MAGIC, 4) && get_u32 (header + 4) >= 4)
+      rc = get_u64 (header + 8) == size && get_u64 (header + 16) == mtime;
+    fclose (fp);
+  }
+  return rc;
+}
+
+static gchar *
+journal_dir_for (const gchar *base)
+{
+  gchar *key;
+
+  if (base) {
+    gchar *path;
+    if (g_path_is_absolute (base)) path = g_strdup (base);
+    else {
+      gchar *cwd = g_get_current_dir ();
+      path = g_build_filename (cwd, base, NULL);
+      g_free (cwd);
+    }
+    key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, path, -1);
+    g_free (path);
+  }
+  else key = g_strdup (JOURNAL_UNTITLED);
+
+  gchar *dir = g_build_filename (g_get_user_cache_dir (),
+				 g_get_prgname (),
+				 "journals", key, NULL);
+  g_free (key);
+  return dir;
+}
+
+static gint
+project_index (project_s *project)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (get_projects ());
+  GtkTreeIter iter;
+  gint idx = 0;
+
+  if (gtk_tree_model_get_iter_first (model, &iter)) {
+    do {
+      project_s *this = NULL;
+      gtk_tree_model_get (model, &iter, PROJECT_STRUCT_COL, &this, -1);
+      if (this == project) return idx - journal_first;
+      idx++;
+    } while (gtk_tree_model_iter_next (model, &iter));
+  }
+  return -1;
+}
+
+static project_s *
+project_nth (gint idx)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (get_projects ());
+  GtkTreeIter iter;
+  project_s *project = NULL;
+
+  if (gtk_tree_model_iter_nth_child (model, &iter, NULL,
+				     idx + journal_first))
+    gtk_tree_model_get (model, &iter, PROJECT_STRUCT_COL, &project, -1);
+  return project;
+}
+
+static gboolean
+close_stream_func (GtkTreeModel *model,
+		   GtkTreePath *path,
+		   GtkTreeIter *iter,
+		   gpointer data)
+{
+  project_s *project = NULL;
+
+  gtk_tree_model_get (model, iter, PROJECT_STRUCT_COL, &project, -1);
+  if (project && project_journal (project)) {
+    g_output_stream_close (project_journal (project), NULL, NULL);
+    g_object_unref (project_journal (project));
+    project_journal (project) = NULL;
+  }
+  return FALSE;
+}
+
+static void
+close_streams (void)
+{
+  GtkListStore *projects = get_projects ();
+  if (projects)
+    gtk_tree_model_foreach (GTK_TREE_MODEL (projects),
+			    close_stream_func, NULL);
+}
+
+static GOutputStream *
+journal_stream (project_s *project)
+{
+  if (project_journal (project)) return project_journal (project);
+
+  gint idx = project_index (project);
+  if (idx < 0) return NULL;
+
+  GError *error = NULL;
+  gchar *path = g_strdup_printf ("%s/%" G_GUINT64_FORMAT "-%d%s",
+				 journal_dir, journal_gen, idx,
+				 JOURNAL_SUFFIX);
+  GFile *file = g_file_new_for_path (path);
+  gboolean fresh = !g_file_query_exists (file, NULL);
+  GFileOutputStream *stream =
+    g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+
+  if (!error && fresh) {
+    GByteArray *header = g_byte_array_new ();
+    g_byte_array_append (header, (const guint8 *)JOURNAL_MAGIC, 4);
+    put_u32 (header, JOURNAL_VERSION);
+    put_u64 (header, journal_base_size);
+    put_u64 (header, journal_base_mtime);
+    g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+			       header->data, header->len,
+			       NULL, NULL, &error);
+    g_byte_array_free (header, TRUE);
+  }
+
+  if (error) {
+    log_string (LOG_GFIG_ERROR, NULL, error->message);
+    g_clear_error (&error);
+    if (stream) g_object_unref (stream);
+    stream = NULL;
+  }
+  g_object_unref (file);
+  g_free (path);
+
+  project_journal (project) = stream ? G_OUTPUT_STREAM (stream) : NULL;
+  return project_journal (project);
+}
+
+static void
+journal_record (project_s *project, journal_op_e op, gint index,
+		const gchar *path, GByteArray *body)
+{
+  if (!journal_dir || journal_replaying || !project) return;
+
+  GOutputStream *stream = journal_stream (project);
+  if (!stream) return;
+
+  guint32 path_len = path ? strlen (path) : 0;
+
+  GByteArray *rec = g_byte_array_new ();
+  put_u32 (rec, 0);		// len and check, filled in below
+  put_u32 (rec, 0);
+  put_u32 (rec, (guint32)op);
+  put_u32 (rec, (guint32)index);
+  put_u32 (rec, path_len);
+  g_byte_array_append (rec, (const guint8 *)path, path_len);
+  if (body) g_byte_array_append (rec, body->data, body->len);
+
+  guint32 len   = GUINT32_TO_LE (rec->len - 8);
+  guint32 check = GUINT32_TO_LE (fnv1a (rec->data + 8, rec->len - 8));
+  memcpy (rec->data,     &len,   sizeof(len));
+  memcpy (rec->data + 4, &check, sizeof(check));
+
+  GError *error = NULL;
+  if (g_output_stream_write_all (stream, rec->data, rec->len,
+				 NULL, NULL, &error))
+    g_output_stream_flush (stream, NULL, &error);
+  if (error) {
+    log_string (LOG_GFIG_ERROR, NULL, error->message);
+    g_clear_error (&error);
+  }
+
+  journal_bytes += rec->len;
+  g_byte_array_free (rec, TRUE);
+
+  if (journal_bytes > JOURNAL_COMPACT_SIZE) journal_compact_soon ();
+}
+
+static gchar *
+sheet_path (sheet_s *sheet)
+{
+  if (!sheet || !sheet_project (sheet) || !sheet_iter (sheet)) return NULL;
+  project_s *project = sheet_project (sheet);
+  return gtk_tree_model_get_string_from_iter
+    (GTK_TREE_MODEL (project_sheets (project)), sheet_iter (sheet));
+}
+
+static void
+put_entity (GByteArray *ba, gpointer entity)
+{
+  gsize len;
+  GBytes *blob = binary_encode_entity (entity);
+  const guint8 *data = g_bytes_get_data (blob, &len);
+  g_byte_array_append (ba, data, len);
+  g_bytes_unref (blob);
+}
+
+/***
+    Entity lists are each blob prefixed by its length, the count
+    going in the record index.
+ ***/
+
+static void
+put_entities (GByteArray *ba, GList *entities)
+{
+  for (GList *l = entities; l; l = l->next) {
+    guint at = ba->len;
+    put_u32 (ba, 0);
+    put_entity (ba, l->data);
+    guint32 len = GUINT32_TO_LE (ba->len - at - 4);
+    memcpy (ba->data + at, &len, sizeof(len));
+  }
+}
+
+static void
+journal_write (sheet_s *sheet, journal_op_e op, gint index, GList *entities)
+{
+  if (!journal_dir || journal_replaying) return;
+
+  gchar *path = sheet_path (sheet);
+  if (!path) return;
+
+  GByteArray *body = g_byte_array_new ();
+  if (op == JOURNAL_OP_APPEND || op == JOURNAL_OP_MODIFY) {
+    if (entities) put_entity (body, entities->data);
+  }
+  else put_entities (body, entities);
+  journal_record (sheet_project (sheet), op, index, path, body);
+  g_byte_array_free (body, TRUE);
+  g_free (path);
+}
+
+void
+journal_append (sheet_s *sheet, gpointer entity)
+{
+  GList link = { entity, NULL, NULL };
+  journal_write (sheet, JOURNAL_OP_APPEND, -1, &link);
+}
+
+/***
+    Several entities appended at once, as one record.
+ ***/
+
+void
+journal_append_list (sheet_s *sheet, GList *entities)
+{
+  if (entities)
+    journal_write (sheet, JOURNAL_OP_APPEND_LIST,
+		   g_list_length (entities), entities);
+}
+
+void
+journal_modify (sheet_s *sheet, gpointer entity)
+{
+  if (!sheet) return;
+  gint index = g_list_index (sheet_entities (sheet), entity);
+  GList link = { entity, NULL, NULL };
+  if (index >= 0) journal_write (sheet, JOURNAL_OP_MODIFY, index, &link);
+}
+
+void
+journal_delete (sheet_s *sheet, gint index)
+{
+  journal_write (sheet, JOURNAL_OP_DELETE, index, NULL);
+}
+
+/***
+    The whole of a sheet, after undo or redo has swapped its entities
+    for an earlier list.
+ ***/
+
+void
+journal_sheet (sheet_s *sheet)
+{
+  if (sheet)
+    journal_write (sheet, JOURNAL_OP_SHEET,
+		   g_list_length (sheet_entities (sheet)),
+		   sheet_entities (sheet));
+}
+
+void
+journal_new_project (project_s *project)
+{
+  if (!journal_dir || journal_replaying || !project) return;
+
+  GByteArray *body = g_byte_array_new ();
+  if (project_name (project))
+    g_byte_array_append (body, (const guint8 *)project_name (project),
+			 strlen (project_name (project)));
+  journal_record (project, JOURNAL_OP_NEW_PROJECT, -1, NULL, body);
+  g_byte_array_free (body, TRUE);
+}
+
+void
+journal_new_sheet (sheet_s *sheet)
+{
+  if (!journal_dir || journal_replaying) return;
+
+  gchar *path = sheet_path (sheet);
+  if (!path) return;
+
+  GByteArray *body = g_byte_array_new ();
+  if (sheet_name (sheet))
+    g_byte_array_append (body, (const guint8 *)sheet_name (sheet),
+			 strlen (sheet_name (sheet)));
+  journal_record (sheet_project (sheet), JOURNAL_OP_NEW_SHEET, -1,
+		  path, body);
+  g_byte_array_free (body, TRUE);
+  g_free (path);
+}
+
+void
+journal_block (project_s *project, const gchar *name, GList *entities)
+{
+  if (!journal_dir || journal_replaying || !name) return;
+
+  GByteArray *body = g_byte_array_new ();
+  put_entities (body, entities);
+  journal_record (project, JOURNAL_OP_BLOCK, g_list_length (entities),
+		  name, body);
+  g_byte_array_free (body, TRUE);
+}
+
+
+/*************** replay **************/
+
+static gboolean
+get_entities (const guint8 *data, gsize len, guint32 nr,
+	      environment_s *env, project_s *project, GList **entities_p)
+{
+  GList *entities = NULL;
+  gsize pos = 0;
+
+  for (guint32 i = 0; i < nr; i++) {
+    if (len - pos < 4) break;
+    guint32 elen = get_u32 (data + pos);
+    pos += 4;
+    if (elen > len - pos) break;
+    gpointer entity = binary_decode_entity (data + pos, elen, env, project);
+    if (!entity) break;
+    entities = g_list_prepend (entities, entity);
+    pos += elen;
+  }
+
+  if (g_list_length (entities) != nr) {
+    clear_entities (&entities);
+    return FALSE;
+  }
+  *entities_p = g_list_reverse (entities);
+  return TRUE;
+}
+
+/***
+    A sheet is recreated under the parent its path names, and only if
+    that puts it at the same path; one the snapshot already holds is
+    left alone.
+ ***/
+
+static gboolean
+replay_new_sheet (project_s *project, const gchar *path,
+		  const guint8 *data, gsize len)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (project_sheets (project));
+  GtkTreeIter iter;
+  GtkTreeIter parent;
+  gboolean has_parent = FALSE;
+
+  if (gtk_tree_model_get_iter_from_string (model, &iter, path)) return TRUE;
+
+  const gchar *colon = strrchr (path, ':');
+  if (colon) {
+    gchar *ppath = g_strndup (path, colon - path);
+    has_parent = gtk_tree_model_get_iter_from_string (model, &parent, ppath);
+    g_free (ppath);
+    if (!has_parent) return FALSE;
+  }
+
+  gchar *name = g_strndup ((const gchar *)data, len);
+  sheet_s *sheet = NULL;
+  GtkTreeIter *new_iter =
+    append_sheet (project, has_parent ? &parent : NULL, name, &sheet);
+  g_free (name);
+
+  gchar *new_path = gtk_tree_model_get_string_from_iter (model, new_iter);
+  gboolean ok = !g_strcmp0 (new_path, path);
+  g_free (new_path);
+  gtk_tree_iter_free (new_iter);
+  return ok;
+}
+
+static gboolean
+replay_record (gint idx, const guint8 *data, gsize len)
+{
+  if (len < 12) return FALSE;
+
+  journal_op_e op = (journal_op_e)get_u32 (data);
+  gint index      = (gint)get_u32 (data + 4);
+  guint32 path_len = get_u32 (data + 8);
+  if (path_len > len - 12) return FALSE;
+
+  project_s *project = project_nth (idx);
+  gchar *path = g_strndup ((const gchar *)data + 12, path_len);
+  const guint8 *blob = data + 12 + path_len;
+  gsize blob_len = len - 12 - path_len;
+  gboolean ok = FALSE;
+
+  switch (op) {
+  case JOURNAL_OP_NEW_PROJECT:
+    if (!project) {
+      gchar *name = g_strndup ((const gchar *)blob, blob_len);
+      project = create_project (name);
+      g_free (name);
+    }
+    ok = project_index (project) == idx;
+    g_free (path);
+    return ok;
+  case JOURNAL_OP_NEW_SHEET:
+    ok = project && replay_new_sheet (project, path, blob, blob_len);
+    g_free (path);
+    return ok;
+  case JOURNAL_OP_BLOCK:
+    {
+      GList *entities = NULL;
+      ok = project &&
+	get_entities (blob, blob_len, (guint32)index,
+		      project_environment (project), project, &entities);
+      if (ok) block_define (project, path, entities);
+    }
+    g_free (path);
+    return ok;
+  default:
+    break;
+  }
+
+  sheet_s *sheet = NULL;
+  GtkTreeIter iter;
+  GtkTreeModel *model =
+    project ? GTK_TREE_MODEL (project_sheets (project)) : NULL;
+  if (model && gtk_tree_model_get_iter_from_string (model, &iter, path))
+    gtk_tree_model_get (model, &iter, SHEET_STRUCT_COL, &sheet, -1);
+  g_free (path);
+  if (!sheet || !materialize_sheet (sheet)) return FALSE;
+
+  history_forget (sheet);
+  pick_invalidate (sheet);
+  display_invalidate (sheet);
+
+  environment_s *env = sheet_environment (sheet);
+  gpointer entity = NULL;
+  GList *entities = NULL;
+  GList *link = NULL;
+
+  switch (op) {
+  case JOURNAL_OP_APPEND:
+    entity = binary_decode_entity (blob, blob_len, env, project);
+    if (!entity) return FALSE;
+    sheet_entities (sheet) = g_list_append (sheet_entities (sheet), entity);
+    break;
+  case JOURNAL_OP_APPEND_LIST:
+    if (!get_entities (blob, blob_len, (guint32)index, env, project,
+		       &entities))
+      return FALSE;
+    sheet_entities (sheet) = g_list_concat (sheet_entities (sheet), entities);
+    break;
+  case JOURNAL_OP_MODIFY:
+    link = g_list_nth (sheet_entities (sheet), index);
+    if (!link) return FALSE;
+    entity = binary_decode_entity (blob, blob_len, env, project);
+    if (!entity) return FALSE;
+    delete_entities (link->data);
+    link->data = entity;
+    break;
+  case JOURNAL_OP_DELETE:
+    if (index == JOURNAL_ALL)
+      clear_entities (&sheet_entities (sheet));
+    else {
+      link = g_list_nth (sheet_entities (sheet), index);
+      if (!link) return FALSE;
+      delete_entities (link->data);
+      sheet_entities (sheet) =
+	g_list_delete_link (sheet_entities (sheet), link);
+    }
+    break;
+  case JOURNAL_OP_SHEET:
+    if (!get_entities (blob, blob_len, (guint32)index, env, project,
+		       &entities))
+      return FALSE;
+    clear_entities (&sheet_entities (sheet));
+    sheet_entities (sheet) = entities;
+    break;
+  default:
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gint
+replay_journal (const gchar *path, gint idx)
+{
+  gchar *contents = NULL;
+  gsize len = 0;
+  gint nr = 0;
+
+  if (!g_file_get_contents (path, &contents, &len, NULL)) return 0;
+
+  const guint8 *data = (const guint8 *)contents;
+  guint32 version = len >= JOURNAL_HEADER_MIN ? get_u32 (data + 4) : 0;
+  gsize header = version >= 4 ? JOURNAL_HEADER_SIZE : JOURNAL_HEADER_MIN;
+  if (len >= header &&
+      !memcmp (data, JOURNAL_MAGIC, 4) &&
+      version <= JOURNAL_VERSION) {
+    gsize pos = header;
+    journal_replaying = TRUE;
+    while (pos + 8 <= len) {
+      guint32 rlen  = get_u32 (data + pos);
+      guint32 check = get_u32 (data + pos + 4);
+      if (rlen > len - pos - 8 || fnv1a (data + pos + 8, rlen) != check)
+	break;				// torn by a crash
+      if (replay_record (idx, data + pos + 8, rlen)) nr++;
+      pos += 8 + rlen;
+    }
+    journal_replaying = FALSE;
+  }
+  g_free (contents);
+  return nr;
+}
+
+static gint
+journal_file_cmp (gconstpointer a, gconstpointer b)
+{
+  const journal_file_s *ja = a;
+  const journal_file_s *jb = b;
+  if (ja->gen != jb->gen) return (ja->gen < jb->gen) ? -1 : 1;
+  return ja->project - jb->project;
+}
+
+/***
+    Names are <gen>-<project>.gfj or <gen>.gfb; returns FALSE for
+    anything else.
+ ***/
+
+static gboolean
+parse_name (const gchar *name, guint64 *gen_p, gint *project_p)
+{
+  gchar *end;
+  guint64 gen = g_ascii_strtoull (name, &end, 10);
+  if (end == name) return FALSE;
+  if (gen_p) *gen_p = gen;
+  if (project_p) {
+    if (*end != '-') return FALSE;
+    gchar *tail;
+    *project_p = (gint)g_ascii_strtoll (end + 1, &tail, 10);
+    return tail != end + 1 && !g_strcmp0 (tail, JOURNAL_SUFFIX);
+  }
+  return !g_strcmp0 (end, BINARY_DRAWING_SUFFIX);
+}
+
+static void
+prune (const gchar *dir, guint64 before)
+{
+  GDir *gdir = g_dir_open (dir, 0, NULL);
+  if (!gdir) return;
+
+  const gchar *name;
+  while ((name = g_dir_read_name (gdir))) {
+    guint64 gen;
+    gint project;
+    if ((parse_name (name, &gen, NULL) ||
+	 parse_name (name, &gen, &project)) && gen < before) {
+      gchar *path = g_build_filename (dir, name, NULL);
+      g_remove (path);
+      g_free (path);
+    }
+  }
+  g_dir_close (gdir);
+}
+
+
+/*************** compaction **************/
+
+static void
+compact_free (gpointer data)
+{
+  compact_s *compact = data;
+  g_free (compact->dir);
+  g_free (compact->path);
+  g_bytes_unref (compact->bytes);
+  g_free (compact);
+}
+
+static void
+compact_thread (GTask *task, gpointer source_object,
+		gpointer task_data, GCancellable *cancellable)
+{
+  compact_s *compact = task_data;
+  GError *error = NULL;
+  gsize len;
+  const gchar *data = g_bytes_get_data (compact->bytes, &len);
+
+  if (g_file_set_contents (compact->path, data, len, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+compact_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  compact_s *compact = g_task_get_task_data (G_TASK (res));
+  GError *error = NULL;
+
+  if (g_task_propagate_boolean (G_TASK (res), &error))
+    prune (compact->dir, compact->gen);
+  else {
+    log_string (LOG_GFIG_ERROR, NULL, error->message);
+    g_clear_error (&error);
+  }
+}
+
+/***
+    The snapshot is taken here and now, and later edits go to the new
+    generation's journals; only the write is left to the thread.  A
+    snapshot still being written when a newer one starts is harmless,
+    since recovery always takes the newest.
+ ***/
+
+static void
+compact_now (void)
+{
+  if (!materialize_all ()) return;	// a snapshot would lose sheets
+
+  compact_s *compact = gfig_try_malloc0 (sizeof(compact_s));
+  compact->gen   = MAX ((guint64)g_get_real_time (), journal_gen + 1);
+  compact->dir   = g_strdup (journal_dir);
+  compact->path  = g_strdup_printf ("%s/%" G_GUINT64_FORMAT "%s",
+				    journal_dir, compact->gen,
+				    BINARY_DRAWING_SUFFIX);
+  compact->bytes = save_drawing_binary_bytes (journal_base_size,
+					      journal_base_mtime);
+
+  close_streams ();
+  journal_gen   = compact->gen;
+  journal_first = 0;
+  journal_bytes = 0;
+
+  GTask *task = g_task_new (NULL, NULL, compact_done, NULL);
+  g_task_set_task_data (task, compact, compact_free);
+  g_task_run_in_thread (task, compact_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+compact_idle (gpointer data)
+{
+  compact_source = 0;
+  if (journal_dir) compact_now ();
+  return G_SOURCE_REMOVE;
+}
+
+static void
+journal_compact_soon (void)
+{
+  if (!compact_source)
+    compact_source = g_idle_add_full (G_PRIORITY_LOW, compact_idle,
+				      NULL, NULL);
+}
+
+
+/*************** attach and recover **************/
+
+static void
+journal_stale (const gchar *base)
+{
+  gchar *msg =
+    g_strdup_printf (_ ("%s has changed since its unsaved changes were journalled.\n"),
+		     base);
+  log_string (LOG_GFIG_ERROR, NULL, msg);
+  g_free (msg);
+  journal_set_aside (base);
+}
+
+/***
+    The newest snapshot for base, or NULL if there is none or it was
+    taken over another version of the file.
+ ***/
+
+gchar *
+journal_snapshot (const gchar *base, guint64 *gen_p)
+{
+  gchar *dir = journal_dir_for (base);
+  GDir *gdir = g_dir_open (dir, 0, NULL);
+  gchar *best_name = NULL;
+  guint64 best = 0;
+
+  if (gdir) {
+    const gchar *name;
+    while ((name = g_dir_read_name (gdir))) {
+      guint64 gen;
+      if (parse_name (name, &gen, NULL) && (!best_name || gen > best)) {
+	g_free (best_name);
+	best_name = g_strdup (name);
+	best = gen;
+      }
+    }
+    g_dir_close (gdir);
+  }
+
+  gchar *path = best_name ? g_build_filename (dir, best_name, NULL) : NULL;
+  g_free (best_name);
+  g_free (dir);
+
+  guint64 size, mtime, snap_size, snap_mtime;
+  base_stamp (base, &size, &mtime);
+  if (path && base && binary_base_stamp (path, &snap_size, &snap_mtime) &&
+      (snap_size != size || snap_mtime != mtime)) {
+    g_free (path);
+    path = NULL;
+    best = 0;
+    journal_stale (base);
+  }
+  if (gen_p) *gen_p = best;
+  return path;
+}
+
+static void
+journal_stop (void)
+{
+  if (compact_source) {
+    g_source_remove (compact_source);
+    compact_source = 0;
+  }
+  close_streams ();
+  g_free (journal_dir);
+  journal_dir   = NULL;
+  journal_bytes = 0;
+}
+
+/***
+    Start journalling against base (NULL for untitled), whose state
+    as just loaded is generation gen.  Journals left over from a
+    session that didn't end with a save are replayed first.
+ ***/
+
+void
+journal_attach (const gchar *base, guint64 gen)
+{
+  journal_stop ();
+  journal_dir = journal_dir_for (base);
+  journal_gen = gen;
+  base_stamp (base, &journal_base_size, &journal_base_mtime);
+  g_mkdir_with_parents (journal_dir, 0700);
+
+  GArray *files = g_array_new (FALSE, FALSE, sizeof(journal_file_s));
+  GDir *gdir = g_dir_open (journal_dir, 0, NULL);
+  if (gdir) {
+    const gchar *name;
+    while ((name = g_dir_read_name (gdir))) {
+      journal_file_s jf;
+      if (parse_name (name, &jf.gen, &jf.project) && jf.gen >= gen) {
+	jf.name = g_build_filename (journal_dir, name, NULL);
+	g_array_append_val (files, jf);
+      }
+    }
+    g_dir_close (gdir);
+  }
+  g_array_sort (files, journal_file_cmp);
+
+  gboolean stale = FALSE;
+  for (guint i = 0; i < files->len; i++)
+    if (!journal_matches (g_array_index (files, journal_file_s, i).name,
+			  journal_base_size, journal_base_mtime))
+      stale = TRUE;
+  if (stale) {
+    for (guint i = 0; i < files->len; i++)
+      g_free (g_array_index (files, journal_file_s, i).name);
+    g_array_set_size (files, 0);
+    journal_stale (base);
+    g_mkdir_with_parents (journal_dir, 0700);
+  }
+
+  gint nr = 0;
+  for (guint i = 0; i < files->len; i++) {
+    journal_file_s *jf = &g_array_index (files, journal_file_s, i);
+    nr += replay_journal (jf->name, jf->project);
+    journal_gen = MAX (journal_gen, jf->gen);
+    g_free (jf->name);
+  }
+  g_array_free (files, TRUE);
+
+  if (nr > 0) {
+    gchar *msg = g_strdup_printf (_ ("Recovered %d unsaved edits.\n"), nr);
+    log_string (LOG_NORMAL, NULL, msg);
+    g_free (msg);
+  }
+
+  /***
+      Fold recovered edits, and any projects that were open before
+      this drawing was loaded, into a snapshot.
+   ***/
+  if (nr > 0 || journal_first > 0 || (stale && gen > 0))
+    journal_compact_soon ();
+}
+
+/***
+    Stop journalling while a drawing is loaded.  Whatever is loaded
+    next lands after the projects already open.
+ ***/
+
+void
+journal_detach (void)
+{
+  journal_stop ();
+  GtkListStore *projects = get_projects ();
+  journal_first = projects ?
+    gtk_tree_model_iter_n_children (GTK_TREE_MODEL (projects), NULL) : 0;
+}
+
+/***
+    The drawing has been written in full, so nothing journalled so far
+    is needed any longer.
+ ***/
+
+void
+journal_saved (const gchar *base)
+{
+  gchar *dir = journal_dir_for (base);
+
+  if (journal_dir) {
+    prune (journal_dir, G_MAXUINT64);
+    g_rmdir (journal_dir);
+  }
+  prune (dir, G_MAXUINT64);
+  g_free (dir);
+
+  journal_stop ();
+  journal_first = 0;
+  journal_attach (base, 0);
+}
+
+/***
+    The journals for base can't be used, so move them out of the way
+    of the next attach; they are kept for whoever wants to dig.
+ ***/
+
+void
+journal_set_aside (const gchar *base)
+{
+  gchar *dir = journal_dir_for (base);
+  gchar *aside = g_strdup_printf ("%s-%" G_GINT64_FORMAT,
+				  dir, g_get_real_time ());
+
+  if (g_file_test (dir, G_FILE_TEST_IS_DIR) && !g_rename (dir, aside)) {
+    gchar *msg =
+      g_strdup_printf (_ ("Unsaved changes to %s were not restored; they are kept in %s.\n"),
+		       base ? : _ ("the untitled drawing"), aside);
+    log_string (LOG_GFIG_ERROR, NULL, msg);
+    g_free (msg);
+  }
+  g_free (aside);
+  g_free (dir);
+}
+
+/***
+    Bring back an untitled drawing from its last snapshot.  Returns
+    FALSE if there isn't one.
+ ***/
+
+gboolean
+journal_recover (void)
+{
+  guint64 gen;
+  gchar *snapshot = journal_snapshot (NULL, &gen);
+
+  if (!snapshot) return FALSE;
+  journal_detach ();
+  gboolean loaded = load_drawing_binary (snapshot);
+  g_free (snapshot);
+  if (!loaded) {
+    journal_set_aside (NULL);
+    return FALSE;
+  }
+  journal_attach (NULL, gen);
+  block_report_undefined (0);
+  notify_projects (NOTIFY_MAP_FIRST);
+  return TRUE;
+}
@@ -0,0 +1,22 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#define JOURNAL_ALL	-1
+
+void journal_append (sheet_s *sheet, gpointer entity);
+void journal_append_list (sheet_s *sheet, GList *entities);
+void journal_modify (sheet_s *sheet, gpointer entity);
+void journal_delete (sheet_s *sheet, gint index);
+void journal_sheet (sheet_s *sheet);
+void journal_new_project (project_s *project);
+void journal_new_sheet (sheet_s *sheet);
+void journal_block (project_s *project, const gchar *name, GList *entities);
+
+gchar *journal_snapshot (const gchar *base, guint64 *gen_p);
+void journal_attach (const gchar *base, guint64 gen);
+void journal_detach (void);
+void journal_saved (const gchar *base);
+void journal_set_aside (const gchar *base);
+gboolean journal_recover (void);
+
+#endif  /* JOURNAL_H */
@@ -13,6 +13,11 @@
 #include "view.h"
 #include "utilities.h"
 #include "python.h"
+#include "journal.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+#include "snap.h"
 
 typedef enum {
   // initial idle state must always be TOOL_IDLE (= 0)
@@ -175,7 +180,7 @@ lines_primary_button_press (GdkEvent *event, sheet_s *sheet,
       px = button->x + environment_hoff (env);
       py = button->y + environment_voff (env);
       cairo_matrix_transform_point (&environment_inv_tf (env), &px, &py);
-      snap_to_grid (env, &px, &py);
+      snap_point (sheet, &px, &py, SNAP_TOLERANCE * device_pixel (env));
     }
     else {
       px = pxi; py = pyi;
@@ -207,6 +212,11 @@ lines_primary_button_press (GdkEvent *event, sheet_s *sheet,
       if (last_point) g_free (last_point);
       entity_polyline_verts (polyline) =
 	g_list_delete_link (entity_polyline_verts (polyline), last);
+      journal_modify (sheet, polyline);
+      history_modify (sheet, polyline);
+      pick_modify (sheet, polyline);
+      display_modify (sheet, polyline);
+      entity_changed (polyline);
     }
     sheet_tool_entity (sheet) = NULL;
     set_current_line_colour (env, NULL);
@@ -232,11 +242,9 @@ lines_primary_button_press (GdkEvent *event, sheet_s *sheet,
     polyline = sheet_tool_entity (sheet) =
       entity_build_polyline (sheet, NULL, closed, fill, spline, NULL,
 			     intersect_type, radius);
-    sheet_entities (sheet) =
-      g_list_append (sheet_entities (sheet), sheet_tool_entity (sheet));
-    
     entity_polyline_verts (polyline) =		// set initial point
       g_list_append (entity_polyline_verts (polyline), point);
+    entity_append_entity (sheet, sheet_tool_entity (sheet));
     point = copy_point (point);
     set_current_line_colour (env, entity_polyline_pen (polyline));
   }
@@ -244,6 +252,11 @@ lines_primary_button_press (GdkEvent *event, sheet_s *sheet,
   polyline = sheet_tool_entity (sheet);
   entity_polyline_verts (polyline) =
     g_list_append (entity_polyline_verts (polyline), point);
+  journal_modify (sheet, polyline);
+  history_modify (sheet, polyline);
+  pick_modify (sheet, polyline);
+  display_modify (sheet, polyline);
+  entity_changed (polyline);
   point_x (&sheet_current_point (sheet)) = px;
   point_y (&sheet_current_point (sheet)) = py;
 
@@ -312,20 +325,23 @@ DRAW_FUNCTION ("draw_lines.png", draw_lines, FALSE, \
 	    environment_s *env = sheet_environment (sheet);
 	    GdkEventMotion *motion = (GdkEventMotion *)event;
 	    gdouble px, py;
-	    //if (isnan (pxi)) {
+	    if (isnan (pxi)) {
 	      px = motion->x + environment_hoff (env);
 	      py = motion->y + environment_voff (env);
 	      cairo_matrix_transform_point (&environment_inv_tf (env),
 					    &px, &py);
-	      snap_to_grid (env, &px, &py);
-	      //}
-	      //else {
-	      //px = pxi; py = pyi;
-	      //}
+	      snap_point (sheet, &px, &py,
+			  SNAP_TOLERANCE * device_pixel (env));
+	    }
+	    else {
+	      px = pxi; py = pyi;
+	    }
 	    point_s *last =
 	      g_list_last (entity_polyline_verts (polyline))->data;
 	    point_x (last) = px;
 	    point_y (last) = py;
+	    display_modify (sheet, polyline);	// and drop trim and LOD
+	    entity_changed (polyline);
 	    force_redraw (sheet);
 	  }
 #if 0
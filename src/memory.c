@@ -0,0 +1,215 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "display.h"
+#include "history.h"
+#include "python.h"
+#include "block.h"
+#include "memory.h"
+
+#if 0 // comments
+
+     Memory accounting.  memory_sheet adds up what a sheet holds,
+     split the way it is spent: entity records, polyline vertices,
+     pen copies, text strings, the caches hung off entities (trims,
+     simplified paths and recordings), the display list, the undo
+     history, the backing surface of the drawing area and the Python
+     local dictionary with the gfig objects in it.  memory_project
+     adds its sheets and its blocks.
+
+     The figures are estimates from the sizes of the records and the
+     lengths of their lists and arrays.  Allocator overhead, spare
+     capacity and the insides of cairo and pango are not seen, so
+     they are a floor, good for telling which sheet or which kind of
+     thing is growing.  Everything here runs on the main thread.
+
+#endif
+
+static void memory_entities (GList *entities, memory_s *mem);
+
+static void
+memory_entity (gpointer entity, memory_s *mem)
+{
+  mem->nr_entities++;
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_NONE:
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      entity_text_s *text = entity;
+      mem->entities += sizeof(entity_text_s);
+      mem->pens     += pen_copy_size (entity_text_pen (text));
+      if (entity_text_string (text))
+	mem->strings += strlen (entity_text_string (text)) + 1;
+    }
+    break;
+  case ENTITY_TYPE_CIRCLE:
+    mem->entities += sizeof(entity_circle_s);
+    mem->pens     +=
+      pen_copy_size (entity_circle_pen ((entity_circle_s *)entity));
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    mem->entities += sizeof(entity_ellipse_s);
+    mem->pens     +=
+      pen_copy_size (entity_ellipse_pen ((entity_ellipse_s *)entity));
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    {
+      entity_polyline_s *polyline = entity;
+      guint nr = g_list_length (entity_polyline_verts (polyline));
+      mem->entities    += sizeof(entity_polyline_s);
+      mem->pens        += pen_copy_size (entity_polyline_pen (polyline));
+      mem->vertices    += nr * (sizeof(GList) + sizeof(point_s));
+      mem->nr_vertices += nr;
+      mem->caches      += polyline_trim_size (polyline) +
+	display_lod_size (polyline);
+    }
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      entity_group_s *group = entity;
+      mem->entities += sizeof(entity_group_s);
+      if (entity_group_transform (group))
+	mem->entities += sizeof(cairo_matrix_t);
+      if (entity_group_centre (group))
+	mem->entities += sizeof(point_s);
+      mem->caches += entity_cache_size (entity_group_cache (group));
+      memory_entities (entity_group_entities (group), mem);
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    mem->entities += sizeof(entity_instance_s);
+    mem->pens     +=
+      pen_copy_size (entity_instance_pen ((entity_instance_s *)entity));
+    break;
+  case ENTITY_TYPE_TRANSFORM:
+    mem->entities += sizeof(entity_transform_s);
+    if (entity_tf_matrix ((entity_transform_s *)entity))
+      mem->entities += sizeof(cairo_matrix_t);
+    break;
+  }
+}
+
+static void
+memory_entities (GList *entities, memory_s *mem)
+{
+  for (GList *l = entities; l; l = l->next) {
+    mem->entities += sizeof(GList);
+    memory_entity (l->data, mem);
+  }
+}
+
+/***
+    Adds the sheet to mem, which the caller zeroes.
+ ***/
+
+void
+memory_sheet (sheet_s *sheet, memory_s *mem)
+{
+  if (!sheet || !mem) return;
+
+  memory_entities (sheet_entities (sheet), mem);
+  memory_entities (sheet_transients (sheet), mem);
+  mem->display += display_size (sheet);
+
+  gsize total, retained;
+  guint undo, redo;
+  history_memory (sheet, &total, &retained, &undo, &redo);
+  mem->history += total;
+
+  environment_s *env = sheet_environment (sheet);
+  cairo_surface_t *surface = env ? environment_surface (env) : NULL;
+  if (surface) {
+    if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE)
+      mem->surface += (gsize)cairo_image_surface_get_stride (surface) *
+	cairo_image_surface_get_height (surface);
+    else
+      mem->surface += (gsize)4 *
+	environment_da_wid (env) * environment_da_ht (env);
+  }
+
+  gsize bytes;
+  guint wrappers;
+  python_memory (sheet, &bytes, &wrappers);
+  mem->python      += bytes;
+  mem->nr_wrappers += wrappers;
+}
+
+static gboolean
+memory_sheet_func (GtkTreeModel *model,
+		   GtkTreePath *path,
+		   GtkTreeIter *iter,
+		   gpointer data)
+{
+  sheet_s *sheet = NULL;
+
+  gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
+  memory_sheet (sheet, data);
+  return FALSE;
+}
+
+/***
+    Adds the sheets and the blocks of the project to mem.
+ ***/
+
+void
+memory_project (project_s *project, memory_s *mem)
+{
+  if (!project || !mem) return;
+
+  if (project_sheets (project))
+    gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
+			    memory_sheet_func, mem);
+
+  GList *blocks = block_list (project);
+  for (GList *l = blocks; l; l = l->next) {
+    block_s *block = l->data;
+    mem->entities += sizeof(block_s);
+    mem->strings  += strlen (block_name (block)) + 1;
+    mem->caches   += entity_cache_size (block_cache (block));
+    memory_entities (block_entities (block), mem);
+  }
+  g_list_free (blocks);
+}
+
+gsize
+memory_total (memory_s *mem)
+{
+  return mem->entities + mem->vertices + mem->pens + mem->strings +
+    mem->caches + mem->display + mem->history + mem->surface + mem->python;
+}
+
+/***
+    A one line breakdown for the structure view; the caller frees it.
+ ***/
+
+gchar *
+memory_describe (memory_s *mem)
+{
+  gchar *total    = g_format_size (memory_total (mem));
+  gchar *entities = g_format_size (mem->entities + mem->vertices +
+				   mem->pens + mem->strings);
+  gchar *caches   = g_format_size (mem->caches + mem->display);
+  gchar *history  = g_format_size (mem->history);
+  gchar *surface  = g_format_size (mem->surface);
+  gchar *python   = g_format_size (mem->python);
+  gchar *desc =
+    g_strdup_printf (_ ("%s: %u entities, %u vertices in %s; caches %s; "
+			"history %s; surface %s; python %s, %u objects"),
+		     total, mem->nr_entities, mem->nr_vertices, entities,
+		     caches, history, surface, python, mem->nr_wrappers);
+  g_free (total);
+  g_free (entities);
+  g_free (caches);
+  g_free (history);
+  g_free (surface);
+  g_free (python);
+  return desc;
+}
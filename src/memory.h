@@ -0,0 +1,24 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+typedef struct {
+  gsize	entities;		// entity records and their list links
+  gsize	vertices;		// polyline vertices and their list links
+  gsize	pens;			// pen copies and colour names
+  gsize	strings;		// text strings
+  gsize	caches;			// trims, simplified paths, recordings
+  gsize	display;		// the display list
+  gsize	history;		// undo and redo, see history.c
+  gsize	surface;		// the drawing area backing surface
+  gsize	python;			// the local dict and what it holds
+  guint	nr_entities;
+  guint	nr_vertices;
+  guint	nr_wrappers;		// gfig objects in the local dict
+} memory_s;
+
+void memory_sheet (sheet_s *sheet, memory_s *mem);
+void memory_project (project_s *project, memory_s *mem);
+gsize memory_total (memory_s *mem);
+gchar *memory_describe (memory_s *mem);
+
+#endif  /* MEMORY_H */
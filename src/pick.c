@@ -0,0 +1,1569 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "pick.h"
+#include "snap.h"
+
+#if 0 // comments
+
+     Picking finds the entity nearest a point on the sheet.  Every
+     drawable leaf entity, group members included, becomes an item
+     holding the transform that carries it onto the sheet and its
+     bounding box there.  The items are packed into an R-tree by
+     sort-tile-recursive bulk loading, so a query visits O(log n)
+     nodes, nearer children first, pruning on the best distance so
+     far.
+
+     Distances are measured against the geometry as draw_entities
+     lays it down, after transformation, so they hold under any
+     affine group or sheet transform: segments and Bezier curves
+     are transformed through their control points, circles and
+     ellipses become general parametric conics, and text is its
+     logical box.  Curves are sampled to bracket the nearest point
+     and then refined by Newton iteration.  A point inside a filled
+     area is at distance zero.
+
+     A block instance is one item, boxed by the extents of its block
+     carried onto the sheet.  Each block has an index of its own, in
+     block units, built the first time an instance of it is indexed
+     and shared by every instance on the sheet.  A query that meets
+     an instance maps its reach back into block units and descends
+     into the block index there, so ten thousand instances of a
+     block cost ten thousand items, not ten thousand copies of the
+     block.  Snap points inside instances are found the same way, on
+     demand (pick_instance_leaves).
+
+     The index is built on first use.  Appends go to an unindexed
+     tail that is searched linearly and folded into the tree once it
+     grows past a fraction of the whole; anything else that changes
+     the entity list throws the index away.
+
+#endif
+
+#define PICK_FANOUT	16
+#define PICK_SLACK	64		// unindexed items before repacking
+#define PICK_SAMPLES	16		// per curve, before refining
+#define PICK_NEWTON	8
+
+typedef struct {
+  gpointer  top;			// entity on the sheet list
+  gpointer  entity;			// leaf, the same unless grouped
+  const cairo_matrix_t *base;		// sheet transform in force at top
+  const cairo_matrix_t *matrix;		// leaf to sheet, NULL for identity
+  gdouble   box[4];			// x0, y0, x1, y1 on the sheet
+} pick_item_s;
+
+typedef struct {
+  gdouble   box[4];
+  guint     first;			// first child node, or first item
+  guint     count;
+  gboolean  leaf;
+} pick_node_s;
+
+typedef struct {
+  GArray     *items;			// pick_item_s
+  guint       indexed;			// items covered by the tree
+  GArray     *nodes;			// pick_node_s, root last
+  GPtrArray  *matrices;			// owned here, items point in
+  GPtrArray  *stack;			// sheet transforms at the list end
+  GHashTable *text_boxes;		// entity_text_s * -> gdouble[4]
+  sheet_s    *sheet;
+  environment_s *env;
+  GHashTable *blocks;			// block_s -> pick_index_s, shared
+  gdouble     box[4];			// of the lot, for block indexes
+  gpointer    hover;
+  const cairo_matrix_t *hover_base;
+} pick_index_s;
+
+typedef struct {
+  point_s   c;
+  point_s   u;				// c + u cos(a) + v sin(a)
+  point_s   v;
+  gdouble   start;
+  gdouble   sweep;			// signed
+  gboolean  fill;
+} conic_s;
+
+typedef struct {
+  GArray   *segments;			// segment_s
+  GArray   *cubics;			// point_s, four to a curve
+  GArray   *conics;			// conic_s
+  GArray   *dots;			// point_s
+  GArray   *outline;			// point_s, bounds the filled area
+  GArray   *verts;			// point_s, scratch
+} shape_s;
+
+
+/*************** geometry **************/
+
+static void
+map_point (const cairo_matrix_t *m, gdouble x, gdouble y, point_s *p)
+{
+  if (m) cairo_matrix_transform_point (m, &x, &y);
+  point_x (p) = x;
+  point_y (p) = y;
+}
+
+static void
+map_distance (const cairo_matrix_t *m, gdouble dx, gdouble dy, point_s *p)
+{
+  if (m) cairo_matrix_transform_distance (m, &dx, &dy);
+  point_x (p) = dx;
+  point_y (p) = dy;
+}
+
+static void
+box_empty (gdouble *box)
+{
+  box[0] = box[1] =  G_MAXDOUBLE;
+  box[2] = box[3] = -G_MAXDOUBLE;
+}
+
+static void
+box_add (gdouble *box, gdouble x, gdouble y)
+{
+  if (x < box[0]) box[0] = x;
+  if (y < box[1]) box[1] = y;
+  if (x > box[2]) box[2] = x;
+  if (y > box[3]) box[3] = y;
+}
+
+static void
+box_union (gdouble *box, const gdouble *other)
+{
+  if (other[0] <= other[2]) {
+    box_add (box, other[0], other[1]);
+    box_add (box, other[2], other[3]);
+  }
+}
+
+/***
+    The box around in carried through m.
+ ***/
+
+static void
+box_map (gdouble *box, const gdouble *in, const cairo_matrix_t *m)
+{
+  box_empty (box);
+  if (in[0] > in[2]) return;
+
+  gdouble cx[4] = {in[0], in[2], in[2], in[0]};
+  gdouble cy[4] = {in[1], in[1], in[3], in[3]};
+  for (gint i = 0; i < 4; i++) {
+    point_s p;
+    map_point (m, cx[i], cy[i], &p);
+    box_add (box, point_x (&p), point_y (&p));
+  }
+}
+
+static gdouble
+box_distance (const gdouble *box, gdouble x, gdouble y)
+{
+  if (box[0] > box[2]) return G_MAXDOUBLE;
+  gdouble dx = (x < box[0]) ? box[0] - x : ((x > box[2]) ? x - box[2] : 0.0);
+  gdouble dy = (y < box[1]) ? box[1] - y : ((y > box[3]) ? y - box[3] : 0.0);
+  return hypot (dx, dy);
+}
+
+static gdouble
+dist_segment (gdouble x, gdouble y, const point_s *a, const point_s *b)
+{
+  gdouble dx = point_x (b) - point_x (a);
+  gdouble dy = point_y (b) - point_y (a);
+  gdouble len2 = dx * dx + dy * dy;
+  gdouble t = 0.0;
+
+  if (len2 > 0.0) {
+    t = ((x - point_x (a)) * dx + (y - point_y (a)) * dy) / len2;
+    t = CLAMP (t, 0.0, 1.0);
+  }
+  return hypot (x - (point_x (a) + t * dx), y - (point_y (a) + t * dy));
+}
+
+static void
+cubic_1d (gdouble p0, gdouble p1, gdouble p2, gdouble p3, gdouble t,
+	  gdouble *b, gdouble *d1, gdouble *d2)
+{
+  gdouble mt = 1.0 - t;
+  *b  = mt * mt * mt * p0 + 3.0 * mt * mt * t * p1 +
+    3.0 * mt * t * t * p2 + t * t * t * p3;
+  *d1 = 3.0 * (mt * mt * (p1 - p0) + 2.0 * mt * t * (p2 - p1) +
+	       t * t * (p3 - p2));
+  *d2 = 6.0 * (mt * (p2 - 2.0 * p1 + p0) + t * (p3 - 2.0 * p2 + p1));
+}
+
+static void
+cubic_at (const point_s *p, gdouble t, point_s *b, point_s *d1, point_s *d2)
+{
+  cubic_1d (point_x (&p[0]), point_x (&p[1]), point_x (&p[2]),
+	    point_x (&p[3]), t, &point_x (b), &point_x (d1), &point_x (d2));
+  cubic_1d (point_y (&p[0]), point_y (&p[1]), point_y (&p[2]),
+	    point_y (&p[3]), t, &point_y (b), &point_y (d1), &point_y (d2));
+}
+
+static gdouble
+dist_cubic (gdouble x, gdouble y, const point_s *p)
+{
+  point_s b, d1, d2;
+  gdouble best = G_MAXDOUBLE;
+  gdouble t = 0.0;
+
+  for (gint i = 0; i <= PICK_SAMPLES; i++) {
+    gdouble s = (gdouble)i / (gdouble)PICK_SAMPLES;
+    cubic_at (p, s, &b, &d1, &d2);
+    gdouble d = hypot (point_x (&b) - x, point_y (&b) - y);
+    if (d < best) {
+      best = d;
+      t = s;
+    }
+  }
+
+  for (gint i = 0; i < PICK_NEWTON; i++) {
+    cubic_at (p, t, &b, &d1, &d2);
+    gdouble ex = point_x (&b) - x;
+    gdouble ey = point_y (&b) - y;
+    gdouble f1 = ex * point_x (&d1) + ey * point_y (&d1);
+    gdouble f2 = point_x (&d1) * point_x (&d1) +
+      point_y (&d1) * point_y (&d1) +
+      ex * point_x (&d2) + ey * point_y (&d2);
+    if (f2 <= 0.0) break;
+    gdouble next = CLAMP (t - f1 / f2, 0.0, 1.0);
+    if (next == t) break;
+    t = next;
+  }
+  cubic_at (p, t, &b, &d1, &d2);
+  return MIN (best, hypot (point_x (&b) - x, point_y (&b) - y));
+}
+
+/***
+    Angles as cairo_arc and cairo_arc_negative take them: the end is
+    moved by whole turns until it lies on the right side of the
+    start.
+ ***/
+
+static void
+conic_init (conic_s *k, const cairo_matrix_t *m,
+	    gdouble cx, gdouble cy, gdouble ux, gdouble uy,
+	    gdouble vx, gdouble vy, gdouble start, gdouble stop,
+	    gboolean negative, gboolean fill)
+{
+  map_point (m, cx, cy, &k->c);
+  map_distance (m, ux, uy, &k->u);
+  map_distance (m, vx, vy, &k->v);
+  if (negative && stop > start)
+    stop -= 2.0 * G_PI * ceil ((stop - start) / (2.0 * G_PI));
+  else if (!negative && stop < start)
+    stop += 2.0 * G_PI * ceil ((start - stop) / (2.0 * G_PI));
+  k->start = start;
+  k->sweep = CLAMP (stop - start, -2.0 * G_PI, 2.0 * G_PI);
+  k->fill  = fill;
+}
+
+static void
+conic_at (const conic_s *k, gdouble a, point_s *p, point_s *d1)
+{
+  gdouble c = cos (a);
+  gdouble s = sin (a);
+  point_x (p)  = point_x (&k->c) + point_x (&k->u) * c + point_x (&k->v) * s;
+  point_y (p)  = point_y (&k->c) + point_y (&k->u) * c + point_y (&k->v) * s;
+  point_x (d1) = point_x (&k->v) * c - point_x (&k->u) * s;
+  point_y (d1) = point_y (&k->v) * c - point_y (&k->u) * s;
+}
+
+static gdouble
+dist_conic (gdouble x, gdouble y, const conic_s *k)
+{
+  point_s p, d1;
+  gdouble best = G_MAXDOUBLE;
+  gdouble a  = k->start;
+  gdouble lo = MIN (k->start, k->start + k->sweep);
+  gdouble hi = MAX (k->start, k->start + k->sweep);
+  gint samples = 2 * PICK_SAMPLES;
+
+  for (gint i = 0; i <= samples; i++) {
+    gdouble s = k->start + k->sweep * (gdouble)i / (gdouble)samples;
+    conic_at (k, s, &p, &d1);
+    gdouble d = hypot (point_x (&p) - x, point_y (&p) - y);
+    if (d < best) {
+      best = d;
+      a = s;
+    }
+  }
+
+  for (gint i = 0; i < PICK_NEWTON; i++) {
+    conic_at (k, a, &p, &d1);
+    gdouble ex = point_x (&p) - x;
+    gdouble ey = point_y (&p) - y;
+    gdouble f1 = ex * point_x (&d1) + ey * point_y (&d1);
+    gdouble f2 = point_x (&d1) * point_x (&d1) +
+      point_y (&d1) * point_y (&d1) -
+      ex * (point_x (&p) - point_x (&k->c)) -
+      ey * (point_y (&p) - point_y (&k->c));
+    if (f2 <= 0.0) break;
+    gdouble next = CLAMP (a - f1 / f2, lo, hi);
+    if (next == a) break;
+    a = next;
+  }
+  conic_at (k, a, &p, &d1);
+  return MIN (best, hypot (point_x (&p) - x, point_y (&p) - y));
+}
+
+/***
+    A filled arc is closed by its chord, so the area is the disc cut
+    by the chord, on the side of the middle of the arc.
+ ***/
+
+static gboolean
+conic_inside (gdouble x, gdouble y, const conic_s *k)
+{
+  gdouble det = point_x (&k->u) * point_y (&k->v) -
+    point_x (&k->v) * point_y (&k->u);
+  if (det == 0.0) return FALSE;
+
+  gdouble dx = x - point_x (&k->c);
+  gdouble dy = y - point_y (&k->c);
+  gdouble a  = (dx * point_y (&k->v) - dy * point_x (&k->v)) / det;
+  gdouble b  = (dy * point_x (&k->u) - dx * point_y (&k->u)) / det;
+  if (a * a + b * b > 1.0) return FALSE;
+  if (fabs (k->sweep) >= 2.0 * G_PI) return TRUE;
+
+  gdouble ax = cos (k->start);
+  gdouble ay = sin (k->start);
+  gdouble bx = cos (k->start + k->sweep) - ax;
+  gdouble by = sin (k->start + k->sweep) - ay;
+  gdouble mid = k->start + k->sweep / 2.0;
+  gdouble side = bx * (b - ay) - by * (a - ax);
+  gdouble mside = bx * (sin (mid) - ay) - by * (cos (mid) - ax);
+  return side * mside >= 0.0;
+}
+
+static void
+conic_box (const conic_s *k, gdouble *box)
+{
+  gdouble rx = hypot (point_x (&k->u), point_x (&k->v));
+  gdouble ry = hypot (point_y (&k->u), point_y (&k->v));
+  box_add (box, point_x (&k->c) - rx, point_y (&k->c) - ry);
+  box_add (box, point_x (&k->c) + rx, point_y (&k->c) + ry);
+}
+
+static gint
+winding (gdouble x, gdouble y, const point_s *pts, guint n)
+{
+  gint wn = 0;
+  for (guint i = 0; i < n; i++) {
+    const point_s *a = &pts[i];
+    const point_s *b = &pts[(i + 1) % n];
+    gdouble left = (point_x (b) - point_x (a)) * (y - point_y (a)) -
+      (x - point_x (a)) * (point_y (b) - point_y (a));
+    if (point_y (a) <= y) {
+      if (point_y (b) > y && left > 0.0) wn++;
+    }
+    else if (point_y (b) <= y && left < 0.0) wn--;
+  }
+  return wn;
+}
+
+
+/*************** shapes **************/
+
+static shape_s *
+shape_scratch (void)
+{
+  static shape_s shape = {NULL};
+
+  if (!shape.segments) {
+    shape.segments = g_array_new (FALSE, FALSE, sizeof(segment_s));
+    shape.cubics   = g_array_new (FALSE, FALSE, sizeof(point_s));
+    shape.conics   = g_array_new (FALSE, FALSE, sizeof(conic_s));
+    shape.dots     = g_array_new (FALSE, FALSE, sizeof(point_s));
+    shape.outline  = g_array_new (FALSE, FALSE, sizeof(point_s));
+    shape.verts    = g_array_new (FALSE, FALSE, sizeof(point_s));
+  }
+  g_array_set_size (shape.segments, 0);
+  g_array_set_size (shape.cubics, 0);
+  g_array_set_size (shape.conics, 0);
+  g_array_set_size (shape.dots, 0);
+  g_array_set_size (shape.outline, 0);
+  g_array_set_size (shape.verts, 0);
+  return &shape;
+}
+
+static void
+add_segment (shape_s *shape, const point_s *p0, const point_s *p1)
+{
+  segment_s seg;
+  seg.p0 = *p0;
+  seg.p1 = *p1;
+  g_array_append_val (shape->segments, seg);
+}
+
+static void
+add_conic (shape_s *shape, const conic_s *k)
+{
+  g_array_append_val (shape->conics, *k);
+  if (k->fill && fabs (k->sweep) < 2.0 * G_PI) {
+    point_s p0, p1, d1;
+    conic_at (k, k->start, &p0, &d1);
+    conic_at (k, k->start + k->sweep, &p1, &d1);
+    add_segment (shape, &p1, &p0);
+  }
+}
+
+static void
+shape_polyline (shape_s *shape, entity_polyline_s *polyline,
+		const cairo_matrix_t *m)
+{
+  for (GList *l = entity_polyline_verts (polyline); l; l = l->next) {
+    point_s p;
+    map_point (m, point_x ((point_s *)l->data),
+	       point_y ((point_s *)l->data), &p);
+    g_array_append_val (shape->verts, p);
+  }
+  point_s *pts = (point_s *)shape->verts->data;
+  guint n = shape->verts->len;
+  gboolean filled = entity_polyline_filled (polyline);
+  if (n == 0) return;
+
+  if (entity_polyline_spline (polyline)) {	// as draw_entities lays it
+    gboolean closed = entity_polyline_closed (polyline) || filled;
+    if ((closed && n >= 3) || (!closed && n >= 4)) {
+      point_s cur = pts[0];
+      for (guint i = 1; i + 2 < n; i++) {
+	g_array_append_val (shape->cubics, cur);
+	g_array_append_vals (shape->cubics, &pts[i], 3);
+	cur = pts[i + 2];
+	if (closed) {
+	  g_array_append_val (shape->cubics, cur);
+	  g_array_append_vals (shape->cubics, &pts[n - 2], 2);
+	  g_array_append_val (shape->cubics, pts[0]);
+	  cur = pts[0];
+	}
+      }
+      if (filled) {
+	point_s *cubics = (point_s *)shape->cubics->data;
+	for (guint c = 0; c < shape->cubics->len; c += 4) {
+	  for (gint j = 0; j < PICK_SAMPLES; j++) {
+	    point_s b, d1, d2;
+	    cubic_at (&cubics[c], (gdouble)j / (gdouble)PICK_SAMPLES,
+		      &b, &d1, &d2);
+	    g_array_append_val (shape->outline, b);
+	  }
+	}
+      }
+    }
+    else g_array_append_vals (shape->dots, pts, n);
+    return;
+  }
+
+  switch (entity_polyline_intersect (polyline)) {
+  case INTERSECT_POINT:
+    for (guint i = 0; i + 1 < n; i++)
+      add_segment (shape, &pts[i], &pts[i + 1]);
+    if ((entity_polyline_closed (polyline) || filled) && n > 2)
+      add_segment (shape, &pts[n - 1], &pts[0]);
+    if (filled) g_array_append_vals (shape->outline, pts, n);
+    break;
+  case INTERSECT_ARC:
+  case INTERSECT_BEVEL:
+    {
+      const trim_s *trim = polyline_trim (polyline);
+      gdouble r = entity_polyline_isect_radius (polyline);
+      if (trim) {
+	GArray *corners = trim_corners (trim);
+	segment_s *segments = trim_segments (trim);
+	guint last = trim_last (trim);
+	for (guint i = 0; i < corners->len; i++) {
+	  corner_s *corner = &g_array_index (corners, corner_s, i);
+	  if (entity_polyline_intersect (polyline) == INTERSECT_ARC) {
+	    conic_s k;
+	    conic_init (&k, m,
+			point_x (&corner_centre (corner)),
+			point_y (&corner_centre (corner)),
+			r, 0.0, 0.0, r,
+			corner_start (corner), corner_stop (corner),
+			FALSE, FALSE);
+	    add_conic (shape, &k);
+	  }
+	  else {
+	    point_s e, d;
+	    map_point (m, point_x (&corner_e (corner)),
+		       point_y (&corner_e (corner)), &e);
+	    map_point (m, point_x (&corner_d (corner)),
+		       point_y (&corner_d (corner)), &d);
+	    add_segment (shape, &e, &d);
+	  }
+	}
+	for (guint i = 0; i < last; i++) {
+	  point_s p0, p1;
+	  map_point (m, segment_p0_x (segments[i]),
+		     segment_p0_y (segments[i]), &p0);
+	  map_point (m, segment_p1_x (segments[i]),
+		     segment_p1_y (segments[i]), &p1);
+	  add_segment (shape, &p0, &p1);
+	}
+      }
+    }
+    break;
+  }
+}
+
+static const gdouble *
+text_box (pick_index_s *idx, entity_text_s *text)
+{
+  gdouble *box = g_hash_table_lookup (idx->text_boxes, text);
+  if (!box) {
+    box = gfig_try_malloc0 (4 * sizeof(gdouble));
+    entity_text_box (text, idx->env, box);
+    g_hash_table_insert (idx->text_boxes, text, box);
+  }
+  return box;
+}
+
+static void
+shape_build (pick_index_s *idx, shape_s *shape, pick_item_s *item)
+{
+  const cairo_matrix_t *m = item->matrix;
+  conic_s k;
+
+  switch (entity_type (item->entity)) {
+  case ENTITY_TYPE_CIRCLE:
+    {
+      entity_circle_s *circle = item->entity;
+      gdouble r = entity_circle_r (circle);
+      conic_init (&k, m, entity_circle_x (circle), entity_circle_y (circle),
+		  r, 0.0, 0.0, r,
+		  entity_circle_start (circle), entity_circle_stop (circle),
+		  entity_circle_negative (circle), entity_circle_fill (circle));
+      add_conic (shape, &k);
+    }
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    {
+      entity_ellipse_s *ellipse = item->entity;
+      gdouble a  = entity_ellipse_a (ellipse);
+      gdouble b  = entity_ellipse_b (ellipse);
+      gdouble ct = cos (entity_ellipse_t (ellipse));
+      gdouble st = sin (entity_ellipse_t (ellipse));
+      conic_init (&k, m, entity_ellipse_x (ellipse), entity_ellipse_y (ellipse),
+		  a * ct, -a * st, b * st, b * ct,
+		  entity_ellipse_start (ellipse), entity_ellipse_stop (ellipse),
+		  entity_ellipse_negative (ellipse),
+		  entity_ellipse_fill (ellipse));
+      add_conic (shape, &k);
+    }
+    break;
+  case ENTITY_TYPE_TEXT:
+    {
+      entity_text_s *text = item->entity;
+      const gdouble *box = text_box (idx, text);
+      gdouble ct = cos (entity_text_t (text));
+      gdouble st = sin (entity_text_t (text));
+      gdouble corners[4][2] = {{box[0], box[1]}, {box[2], box[1]},
+			       {box[2], box[3]}, {box[0], box[3]}};
+      for (gint i = 0; i < 4; i++) {
+	point_s p;
+	map_point (m,
+		   entity_text_x (text) + corners[i][0] * ct + corners[i][1] * st,
+		   entity_text_y (text) - corners[i][0] * st + corners[i][1] * ct,
+		   &p);
+	g_array_append_val (shape->outline, p);
+      }
+      point_s *q = (point_s *)shape->outline->data;
+      for (gint i = 0; i < 4; i++) add_segment (shape, &q[i], &q[(i + 1) % 4]);
+    }
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    shape_polyline (shape, item->entity, m);
+    break;
+  default:
+    break;
+  }
+}
+
+static void
+shape_box (shape_s *shape, gdouble *box)
+{
+  box_empty (box);
+  for (guint i = 0; i < shape->segments->len; i++) {
+    segment_s *seg = &g_array_index (shape->segments, segment_s, i);
+    box_add (box, segment_p0_x (*seg), segment_p0_y (*seg));
+    box_add (box, segment_p1_x (*seg), segment_p1_y (*seg));
+  }
+  for (guint i = 0; i < shape->cubics->len; i++) {
+    point_s *p = &g_array_index (shape->cubics, point_s, i);
+    box_add (box, point_x (p), point_y (p));
+  }
+  for (guint i = 0; i < shape->conics->len; i++)
+    conic_box (&g_array_index (shape->conics, conic_s, i), box);
+  for (guint i = 0; i < shape->dots->len; i++) {
+    point_s *p = &g_array_index (shape->dots, point_s, i);
+    box_add (box, point_x (p), point_y (p));
+  }
+  for (guint i = 0; i < shape->outline->len; i++) {
+    point_s *p = &g_array_index (shape->outline, point_s, i);
+    box_add (box, point_x (p), point_y (p));
+  }
+}
+
+static gdouble
+shape_distance (shape_s *shape, gdouble x, gdouble y)
+{
+  gdouble best = G_MAXDOUBLE;
+
+  if (shape->outline->len > 2 &&
+      winding (x, y, (point_s *)shape->outline->data, shape->outline->len))
+    return 0.0;
+
+  for (guint i = 0; i < shape->segments->len; i++) {
+    segment_s *seg = &g_array_index (shape->segments, segment_s, i);
+    best = MIN (best, dist_segment (x, y, &seg->p0, &seg->p1));
+  }
+  for (guint i = 0; i + 3 < shape->cubics->len; i += 4)
+    best = MIN (best,
+		dist_cubic (x, y, &g_array_index (shape->cubics, point_s, i)));
+  for (guint i = 0; i < shape->conics->len; i++) {
+    conic_s *k = &g_array_index (shape->conics, conic_s, i);
+    if (k->fill && conic_inside (x, y, k)) return 0.0;
+    best = MIN (best, dist_conic (x, y, k));
+  }
+  for (guint i = 0; i < shape->dots->len; i++) {
+    point_s *p = &g_array_index (shape->dots, point_s, i);
+    best = MIN (best, hypot (point_x (p) - x, point_y (p) - y));
+  }
+  return best;
+}
+
+
+/*************** index **************/
+
+static const cairo_matrix_t *
+matrix_keep (pick_index_s *idx, const cairo_matrix_t *matrix)
+{
+  cairo_matrix_t *kept = gfig_try_malloc0 (sizeof(cairo_matrix_t));
+  memmove (kept, matrix, sizeof(cairo_matrix_t));
+  g_ptr_array_add (idx->matrices, kept);
+  return kept;
+}
+
+/***
+    The stack starts with the transform outside the list; a
+    transform entity pushes itself onto the one in force and an
+    unset pops it, as the cairo_save and cairo_restore in
+    draw_entities do.
+ ***/
+
+static void
+transform_step (pick_index_s *idx, GPtrArray *stack, entity_transform_s *tf)
+{
+  if (entity_tf_unset (tf)) {
+    if (stack->len > 1) g_ptr_array_remove_index (stack, stack->len - 1);
+  }
+  else if (entity_tf_matrix (tf)) {
+    const cairo_matrix_t *current = g_ptr_array_index (stack, stack->len - 1);
+    cairo_matrix_t m = *entity_tf_matrix (tf);
+    if (current) cairo_matrix_multiply (&m, &m, current);
+    g_ptr_array_add (stack, (gpointer)matrix_keep (idx, &m));
+  }
+}
+
+static pick_index_s *block_index (pick_index_s *idx, block_s *block);
+
+static void
+item_box (pick_index_s *idx, pick_item_s *item)
+{
+  if (entity_type (item->entity) == ENTITY_TYPE_INSTANCE) {
+    entity_instance_s *instance = item->entity;
+    pick_index_s *bidx = block_index (idx, entity_instance_block (instance));
+    box_map (item->box, bidx->box, item->matrix);
+  }
+  else {
+    shape_s *shape = shape_scratch ();
+    shape_build (idx, shape, item);
+    shape_box (shape, item->box);
+  }
+}
+
+/***
+    Snap points inside instances aren't stored; see
+    pick_instance_leaves.
+ ***/
+
+static void
+add_item (pick_index_s *idx, gpointer top, gpointer entity,
+	  const cairo_matrix_t *base, const cairo_matrix_t *matrix)
+{
+  pick_item_s item;
+  item.top    = top;
+  item.entity = entity;
+  item.base   = base;
+  item.matrix = matrix;
+
+  item_box (idx, &item);
+  g_array_append_val (idx->items, item);
+  if (entity_type (entity) != ENTITY_TYPE_INSTANCE)
+    snap_add (idx->sheet, top, entity, matrix);
+}
+
+static void collect (pick_index_s *idx, gpointer top, gpointer entity,
+		     const cairo_matrix_t *base, const cairo_matrix_t *matrix);
+
+static void
+collect_children (pick_index_s *idx, gpointer top, GList *entities,
+		  const cairo_matrix_t *base, const cairo_matrix_t *inner)
+{
+  GPtrArray *stack = g_ptr_array_new ();
+  g_ptr_array_add (stack, (gpointer)matrix_keep (idx, inner));
+  for (GList *l = entities; l; l = l->next) {
+    if (entity_type (l->data) == ENTITY_TYPE_TRANSFORM)
+      transform_step (idx, stack, l->data);
+    else
+      collect (idx, top, l->data, base,
+	       g_ptr_array_index (stack, stack->len - 1));
+  }
+  g_ptr_array_free (stack, TRUE);
+}
+
+static void
+collect (pick_index_s *idx, gpointer top, gpointer entity,
+	 const cairo_matrix_t *base, const cairo_matrix_t *matrix)
+{
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_NONE:
+  case ENTITY_TYPE_TRANSFORM:
+    break;
+  case ENTITY_TYPE_GROUP:
+    {
+      entity_group_s *group = entity;
+      cairo_matrix_t inner;
+
+      if (entity_group_transform (group))
+	inner = *entity_group_transform (group);
+      else cairo_matrix_init_identity (&inner);
+      if (entity_group_centre (group)) {
+	cairo_matrix_t centre;
+	cairo_matrix_init_translate (&centre,
+				     -point_x (entity_group_centre (group)),
+				     -point_y (entity_group_centre (group)));
+	cairo_matrix_multiply (&inner, &inner, &centre);
+      }
+      if (matrix) cairo_matrix_multiply (&inner, &inner, matrix);
+      collect_children (idx, top, entity_group_entities (group),
+			base, &inner);
+    }
+    break;
+  case ENTITY_TYPE_INSTANCE:
+    {
+      entity_instance_s *instance = entity;
+      block_s *block = entity_instance_block (instance);
+      cairo_matrix_t inner = entity_instance_transform (instance);
+
+      if (!block) break;
+      if (matrix) cairo_matrix_multiply (&inner, &inner, matrix);
+      add_item (idx, top, entity, base, matrix_keep (idx, &inner));
+    }
+    break;
+  default:
+    add_item (idx, top, entity, base, matrix);
+    break;
+  }
+}
+
+static void
+collect_top (pick_index_s *idx, gpointer entity)
+{
+  if (entity_type (entity) == ENTITY_TYPE_TRANSFORM)
+    transform_step (idx, idx->stack, entity);
+  else {
+    const cairo_matrix_t *current =
+      g_ptr_array_index (idx->stack, idx->stack->len - 1);
+    collect (idx, entity, entity, current, current);
+  }
+}
+
+static gint
+item_cmp_x (const void *a, const void *b)
+{
+  const pick_item_s *ia = a;
+  const pick_item_s *ib = b;
+  gdouble ca = ia->box[0] + ia->box[2];
+  gdouble cb = ib->box[0] + ib->box[2];
+  return (ca > cb) - (ca < cb);
+}
+
+static gint
+item_cmp_y (const void *a, const void *b)
+{
+  const pick_item_s *ia = a;
+  const pick_item_s *ib = b;
+  gdouble ca = ia->box[1] + ia->box[3];
+  gdouble cb = ib->box[1] + ib->box[3];
+  return (ca > cb) - (ca < cb);
+}
+
+/***
+    Sort-tile-recursive packing: sort on x, cut into vertical slices
+    of whole leaves, sort each slice on y, then fill leaves and the
+    levels above them in order.
+ ***/
+
+static void
+index_pack (pick_index_s *idx)
+{
+  guint n = idx->items->len;
+  pick_item_s *items = (pick_item_s *)idx->items->data;
+
+  g_array_set_size (idx->nodes, 0);
+  idx->indexed = n;
+  if (n == 0) return;
+
+  guint leaves = (n + PICK_FANOUT - 1) / PICK_FANOUT;
+  guint slice  = PICK_FANOUT * (guint)ceil (sqrt ((gdouble)leaves));
+
+  qsort (items, n, sizeof(pick_item_s), item_cmp_x);
+  for (guint i = 0; i < n; i += slice)
+    qsort (items + i, MIN (slice, n - i), sizeof(pick_item_s), item_cmp_y);
+
+  for (guint i = 0; i < n; i += PICK_FANOUT) {
+    pick_node_s node;
+    node.first = i;
+    node.count = MIN (PICK_FANOUT, n - i);
+    node.leaf  = TRUE;
+    box_empty (node.box);
+    for (guint j = 0; j < node.count; j++)
+      box_union (node.box, items[i + j].box);
+    g_array_append_val (idx->nodes, node);
+  }
+
+  guint level = 0;
+  guint end   = idx->nodes->len;
+  while (end - level > 1) {
+    for (guint i = level; i < end; i += PICK_FANOUT) {
+      pick_node_s node;
+      node.first = i;
+      node.count = MIN (PICK_FANOUT, end - i);
+      node.leaf  = FALSE;
+      box_empty (node.box);
+      for (guint j = 0; j < node.count; j++)
+	box_union (node.box,
+		   g_array_index (idx->nodes, pick_node_s, i + j).box);
+      g_array_append_val (idx->nodes, node);
+    }
+    level = end;
+    end   = idx->nodes->len;
+  }
+}
+
+static void
+index_free (gpointer data)
+{
+  pick_index_s *idx = data;
+
+  g_array_free (idx->items, TRUE);
+  g_array_free (idx->nodes, TRUE);
+  g_ptr_array_free (idx->matrices, TRUE);
+  g_ptr_array_free (idx->stack, TRUE);
+  g_hash_table_destroy (idx->text_boxes);
+  if (idx->sheet) g_hash_table_destroy (idx->blocks);
+  g_free (idx);
+}
+
+/***
+    The index of a sheet, or with sheet NULL of a block, sharing the
+    block indexes of the sheet it is for.
+ ***/
+
+static pick_index_s *
+index_new (sheet_s *sheet, environment_s *env, GHashTable *blocks)
+{
+  pick_index_s *idx = gfig_try_malloc0 (sizeof(pick_index_s));
+  idx->items      = g_array_new (FALSE, FALSE, sizeof(pick_item_s));
+  idx->nodes      = g_array_new (FALSE, FALSE, sizeof(pick_node_s));
+  idx->matrices   = g_ptr_array_new_with_free_func (g_free);
+  idx->stack      = g_ptr_array_new ();
+  idx->text_boxes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					   NULL, g_free);
+  idx->blocks     = blocks ? :
+    g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, index_free);
+  idx->sheet      = sheet;
+  idx->env        = env;
+  box_empty (idx->box);
+  g_ptr_array_add (idx->stack, NULL);
+  return idx;
+}
+
+/***
+    The index goes in the table before the block is collected, so a
+    block that contains itself finds it empty rather than recursing.
+ ***/
+
+static pick_index_s *
+block_index (pick_index_s *idx, block_s *block)
+{
+  pick_index_s *bidx = g_hash_table_lookup (idx->blocks, block);
+
+  if (!bidx) {
+    bidx = index_new (NULL, idx->env, idx->blocks);
+    g_hash_table_insert (idx->blocks, block, bidx);
+    for (GList *l = block ? block_entities (block) : NULL; l; l = l->next)
+      collect_top (bidx, l->data);
+    index_pack (bidx);
+    if (bidx->nodes->len > 0)
+      memmove (bidx->box, g_array_index (bidx->nodes, pick_node_s,
+					 bidx->nodes->len - 1).box,
+	       sizeof(bidx->box));
+  }
+  return bidx;
+}
+
+static pick_index_s *
+index_get (sheet_s *sheet)
+{
+  pick_index_s *idx = sheet_pick (sheet);
+
+  if (!idx) {
+    idx = index_new (sheet, sheet_environment (sheet), NULL);
+    for (GList *l = sheet_entities (sheet); l; l = l->next)
+      collect_top (idx, l->data);
+    index_pack (idx);
+    sheet_pick (sheet) = idx;
+  }
+  else if (idx->items->len - idx->indexed > PICK_SLACK + idx->indexed / 8)
+    index_pack (idx);
+
+  return idx;
+}
+
+
+/*************** queries **************/
+
+static gboolean
+box_meets (const gdouble *a, const gdouble *b)
+{
+  return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
+
+typedef gboolean (*visit_f) (pick_index_s *idx, pick_item_s *item,
+			     gpointer data);
+
+static gboolean
+visit_node (pick_index_s *idx, guint n, const gdouble *region,
+	    visit_f fcn, gpointer data)
+{
+  pick_node_s *node = &g_array_index (idx->nodes, pick_node_s, n);
+
+  for (guint i = 0; i < node->count; i++) {
+    if (node->leaf) {
+      pick_item_s *item =
+	&g_array_index (idx->items, pick_item_s, node->first + i);
+      if (box_meets (item->box, region) && !(*fcn) (idx, item, data))
+	return FALSE;
+    }
+    else {
+      guint child = node->first + i;
+      if (box_meets (g_array_index (idx->nodes, pick_node_s, child).box,
+		     region) &&
+	  !visit_node (idx, child, region, fcn, data))
+	return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/***
+    Every item whose box meets region, tree and tail, until fcn
+    returns FALSE.
+ ***/
+
+static gboolean
+visit_index (pick_index_s *idx, const gdouble *region, visit_f fcn,
+	     gpointer data)
+{
+  if (idx->nodes->len > 0 &&
+      !visit_node (idx, idx->nodes->len - 1, region, fcn, data))
+    return FALSE;
+  for (guint i = idx->indexed; i < idx->items->len; i++) {
+    pick_item_s *item = &g_array_index (idx->items, pick_item_s, i);
+    if (box_meets (item->box, region) && !(*fcn) (idx, item, data))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+typedef struct {
+  pick_item_s   *outer;			// the instance
+  const gdouble *region;		// on the sheet
+  visit_f        fcn;
+  gpointer       data;
+} descend_s;
+
+static gboolean visit_leaves (pick_index_s *idx, pick_item_s *item,
+			      const gdouble *region, visit_f fcn,
+			      gpointer data);
+
+/***
+    An item of a block index, carried onto the sheet through the
+    instance it was reached by.  It lives only as long as the call.
+ ***/
+
+static gboolean
+descend_item (pick_index_s *bidx, pick_item_s *sub, gpointer data)
+{
+  descend_s *descend = data;
+  pick_item_s *outer = descend->outer;
+  pick_item_s leaf;
+  cairo_matrix_t m = *outer->matrix;
+
+  if (sub->matrix) cairo_matrix_multiply (&m, sub->matrix, outer->matrix);
+  leaf.top    = outer->top;
+  leaf.entity = sub->entity;
+  leaf.base   = outer->base;
+  leaf.matrix = &m;
+  box_map (leaf.box, sub->box, outer->matrix);
+  if (!box_meets (leaf.box, descend->region)) return TRUE;
+  return visit_leaves (bidx, &leaf, descend->region,
+		       descend->fcn, descend->data);
+}
+
+/***
+    fcn on item itself, or if it is an instance on the leaves of its
+    block that might meet region, which is mapped back into block
+    units for the descent.
+ ***/
+
+static gboolean
+visit_leaves (pick_index_s *idx, pick_item_s *item, const gdouble *region,
+	      visit_f fcn, gpointer data)
+{
+  if (entity_type (item->entity) != ENTITY_TYPE_INSTANCE)
+    return (*fcn) (idx, item, data);
+
+  entity_instance_s *instance = item->entity;
+  pick_index_s *bidx = block_index (idx, entity_instance_block (instance));
+  cairo_matrix_t inverse = *item->matrix;
+  gdouble local[4];
+
+  if (cairo_matrix_invert (&inverse) == CAIRO_STATUS_SUCCESS)
+    box_map (local, region, &inverse);
+  else memmove (local, bidx->box, sizeof(local));
+
+  descend_s descend = {item, region, fcn, data};
+  return visit_index (bidx, local, descend_item, &descend);
+}
+
+typedef struct {
+  gdouble      x;
+  gdouble      y;
+  gdouble      best;			// starts at the tolerance
+  pick_item_s *item;
+  pick_item_s *at;			// sheet item being searched
+  gpointer     skip;			// under construction by a tool
+} search_s;
+
+static gboolean
+search_leaf (pick_index_s *idx, pick_item_s *leaf, gpointer data)
+{
+  search_s *search = data;
+  shape_s *shape = shape_scratch ();
+  shape_build (idx, shape, leaf);
+  gdouble d = shape_distance (shape, search->x, search->y);
+  if (d <= search->best) {
+    search->best = d;
+    search->item = search->at;
+  }
+  return TRUE;
+}
+
+static void
+search_item (pick_index_s *idx, search_s *search, pick_item_s *item)
+{
+  if (item->top == search->skip) return;
+  if (box_distance (item->box, search->x, search->y) > search->best) return;
+
+  gdouble region[4] = {search->x - search->best, search->y - search->best,
+		       search->x + search->best, search->y + search->best};
+  search->at = item;
+  visit_leaves (idx, item, region, search_leaf, search);
+}
+
+static void
+search_node (pick_index_s *idx, search_s *search, guint n)
+{
+  pick_node_s *node = &g_array_index (idx->nodes, pick_node_s, n);
+
+  if (node->leaf) {
+    for (guint i = 0; i < node->count; i++)
+      search_item (idx, search,
+		   &g_array_index (idx->items, pick_item_s, node->first + i));
+    return;
+  }
+
+  guint   order[PICK_FANOUT];
+  gdouble dist[PICK_FANOUT];
+  guint   count = 0;
+  for (guint i = 0; i < node->count; i++) {
+    guint child = node->first + i;
+    gdouble d = box_distance (g_array_index (idx->nodes,
+					     pick_node_s, child).box,
+			      search->x, search->y);
+    if (d > search->best) continue;
+    guint j = count++;
+    for (; j > 0 && dist[j - 1] > d; j--) {
+      dist[j]  = dist[j - 1];
+      order[j] = order[j - 1];
+    }
+    dist[j]  = d;
+    order[j] = child;
+  }
+  for (guint i = 0; i < count && dist[i] <= search->best; i++)
+    search_node (idx, search, order[i]);
+}
+
+static pick_item_s *
+nearest_item (sheet_s *sheet, gdouble x, gdouble y, gdouble tolerance,
+	      gdouble *distance_p)
+{
+  pick_index_s *idx = index_get (sheet);
+  search_s search;
+
+  search.x    = x;
+  search.y    = y;
+  search.best = tolerance;
+  search.item = NULL;
+  search.skip = sheet_tool_entity (sheet);
+
+  if (idx->nodes->len > 0) search_node (idx, &search, idx->nodes->len - 1);
+  for (guint i = idx->indexed; i < idx->items->len; i++)
+    search_item (idx, &search, &g_array_index (idx->items, pick_item_s, i));
+  if (distance_p) *distance_p = search.best;
+  return search.item;
+}
+
+/***
+    The entity on the sheet list nearest (x, y), in sheet units,
+    within tolerance, or NULL.  matrix_p gets the sheet transform in
+    force where the entity is drawn.
+ ***/
+
+gpointer
+pick_nearest (sheet_s *sheet, gdouble x, gdouble y, gdouble tolerance,
+	      cairo_matrix_t *matrix_p, gdouble *distance_p)
+{
+  if (!sheet || isnan (x) || isnan (y)) return NULL;
+
+  gdouble distance;
+  pick_item_s *item = nearest_item (sheet, x, y, tolerance, &distance);
+  if (!item) return NULL;
+
+  if (matrix_p) {
+    if (item->base) *matrix_p = *item->base;
+    else cairo_matrix_init_identity (matrix_p);
+  }
+  if (distance_p) *distance_p = distance;
+  return item->top;
+}
+
+/***
+    Track the entity under the pointer; a NAN position clears it.
+    Returns TRUE if it changed and the view wants redrawing.
+ ***/
+
+gboolean
+pick_hover (sheet_s *sheet, gdouble x, gdouble y, gdouble tolerance)
+{
+  if (!sheet) return FALSE;
+
+  pick_item_s *item = NULL;
+  if (!isnan (x) && !isnan (y))
+    item = nearest_item (sheet, x, y, tolerance, NULL);
+
+  pick_index_s *idx = sheet_pick (sheet);
+  if (!idx) return FALSE;
+
+  gpointer hover = item ? item->top : NULL;
+  if (hover == idx->hover) return FALSE;
+  idx->hover      = hover;
+  idx->hover_base = item ? item->base : NULL;
+  return TRUE;
+}
+
+gpointer
+pick_hovered (sheet_s *sheet, cairo_matrix_t *matrix_p)
+{
+  pick_index_s *idx = sheet ? sheet_pick (sheet) : NULL;
+  if (!idx || !idx->hover) return NULL;
+
+  if (matrix_p) {
+    if (idx->hover_base) *matrix_p = *idx->hover_base;
+    else cairo_matrix_init_identity (matrix_p);
+  }
+  return idx->hover;
+}
+
+
+/***
+    Every leaf whose box on the sheet meets box, x0, y0, x1, y1, in
+    no particular order, until fcn returns FALSE.  Returns how many
+    were visited.
+ ***/
+
+typedef struct {
+  const gdouble *box;
+  pick_query_f   fcn;
+  gpointer       data;
+  guint          count;
+} query_s;
+
+static gboolean
+query_leaf (pick_index_s *idx, pick_item_s *leaf, gpointer data)
+{
+  query_s *query = data;
+  query->count++;
+  return (*query->fcn) (leaf->top, leaf->entity, leaf->box, query->data);
+}
+
+static gboolean
+query_item (pick_index_s *idx, pick_item_s *item, gpointer data)
+{
+  query_s *query = data;
+  return visit_leaves (idx, item, query->box, query_leaf, query);
+}
+
+guint
+pick_query (sheet_s *sheet, const gdouble *box, pick_query_f fcn,
+	    gpointer data)
+{
+  if (!sheet || !box || !fcn) return 0;
+
+  query_s query = {box, fcn, data, 0};
+  visit_index (index_get (sheet), box, query_item, &query);
+  return query.count;
+}
+
+/***
+    The leaves inside block instances within radius of (x, y), with
+    the transforms carrying them onto the sheet; snap.c looks for
+    snap points among them, since it stores none for instances.
+ ***/
+
+typedef struct {
+  const gdouble *region;
+  pick_leaf_f    fcn;
+  gpointer       data;
+} leaves_s;
+
+static gboolean
+instance_leaf (pick_index_s *idx, pick_item_s *leaf, gpointer data)
+{
+  leaves_s *leaves = data;
+  (*leaves->fcn) (leaf->top, leaf->entity, leaf->matrix, leaves->data);
+  return TRUE;
+}
+
+static gboolean
+instance_item (pick_index_s *idx, pick_item_s *item, gpointer data)
+{
+  leaves_s *leaves = data;
+  if (entity_type (item->entity) == ENTITY_TYPE_INSTANCE &&
+      item->top != sheet_tool_entity (idx->sheet))
+    visit_leaves (idx, item, leaves->region, instance_leaf, leaves);
+  return TRUE;
+}
+
+void
+pick_instance_leaves (sheet_s *sheet, gdouble x, gdouble y, gdouble radius,
+		      pick_leaf_f fcn, gpointer data)
+{
+  if (!sheet || !fcn || isnan (x) || isnan (y)) return;
+
+  gdouble region[4] = {x - radius, y - radius, x + radius, y + radius};
+  leaves_s leaves = {region, fcn, data};
+  visit_index (index_get (sheet), region, instance_item, &leaves);
+}
+
+
+/*************** intersections **************/
+
+typedef enum {
+  CURVE_SEGMENT,
+  CURVE_CUBIC,
+  CURVE_CONIC
+} curve_e;
+
+typedef struct {
+  curve_e   type;
+  point_s   p[4];
+  conic_s   k;
+} curve_s;
+
+typedef struct {
+  guint     curve;
+  gdouble   t0;
+  gdouble   t1;
+  point_s   a;
+  point_s   b;
+} piece_s;
+
+static void
+curve_at (const curve_s *c, gdouble t, point_s *p, point_s *d)
+{
+  point_s d2;
+
+  switch (c->type) {
+  case CURVE_SEGMENT:
+    point_x (d) = point_x (&c->p[1]) - point_x (&c->p[0]);
+    point_y (d) = point_y (&c->p[1]) - point_y (&c->p[0]);
+    point_x (p) = point_x (&c->p[0]) + t * point_x (d);
+    point_y (p) = point_y (&c->p[0]) + t * point_y (d);
+    break;
+  case CURVE_CUBIC:
+    cubic_at (c->p, t, p, d, &d2);
+    break;
+  case CURVE_CONIC:
+    conic_at (&c->k, c->k.start + t * c->k.sweep, p, d);
+    point_x (d) *= c->k.sweep;
+    point_y (d) *= c->k.sweep;
+    break;
+  }
+}
+
+static void
+gather_curves (shape_s *shape, GArray *curves)
+{
+  curve_s c;
+
+  c.type = CURVE_SEGMENT;
+  for (guint i = 0; i < shape->segments->len; i++) {
+    segment_s *seg = &g_array_index (shape->segments, segment_s, i);
+    c.p[0] = seg->p0;
+    c.p[1] = seg->p1;
+    g_array_append_val (curves, c);
+  }
+  c.type = CURVE_CUBIC;
+  for (guint i = 0; i + 3 < shape->cubics->len; i += 4) {
+    memmove (c.p, &g_array_index (shape->cubics, point_s, i),
+	     4 * sizeof(point_s));
+    g_array_append_val (curves, c);
+  }
+  c.type = CURVE_CONIC;
+  for (guint i = 0; i < shape->conics->len; i++) {
+    c.k = g_array_index (shape->conics, conic_s, i);
+    g_array_append_val (curves, c);
+  }
+}
+
+typedef struct {
+  search_s *search;
+  GArray   *curves;
+} gather_s;
+
+static gboolean
+gather_leaf (pick_index_s *idx, pick_item_s *leaf, gpointer data)
+{
+  gather_s *gather = data;
+  search_s *search = gather->search;
+  if (box_distance (leaf->box, search->x, search->y) <= search->best) {
+    shape_s *shape = shape_scratch ();
+    shape_build (idx, shape, leaf);
+    gather_curves (shape, gather->curves);
+  }
+  return TRUE;
+}
+
+static gboolean
+gather_item (pick_index_s *idx, pick_item_s *item, gpointer data)
+{
+  gather_s *gather = data;
+  search_s *search = gather->search;
+  if (item->top != search->skip &&
+      box_distance (item->box, search->x, search->y) <= search->best) {
+    gdouble region[4] = {search->x - search->best, search->y - search->best,
+			 search->x + search->best, search->y + search->best};
+    visit_leaves (idx, item, region, gather_leaf, gather);
+  }
+  return TRUE;
+}
+
+/***
+    Where two curves cross near a first guess: Newton on
+    C1(s) - C2(t) = 0.
+ ***/
+
+static gboolean
+refine_crossing (const curve_s *c1, const curve_s *c2,
+		 gdouble s, gdouble t, point_s *result)
+{
+  point_s p1, d1, p2, d2;
+
+  for (gint i = 0; i < PICK_NEWTON; i++) {
+    curve_at (c1, s, &p1, &d1);
+    curve_at (c2, t, &p2, &d2);
+    gdouble fx = point_x (&p1) - point_x (&p2);
+    gdouble fy = point_y (&p1) - point_y (&p2);
+    gdouble det = point_y (&d1) * point_x (&d2) - point_x (&d1) * point_y (&d2);
+    if (det == 0.0) break;
+    gdouble ds = (fy * point_x (&d2) - fx * point_y (&d2)) / det;
+    gdouble dt = (point_x (&d1) * fy - point_y (&d1) * fx) / det;
+    s = CLAMP (s + ds, 0.0, 1.0);
+    t = CLAMP (t + dt, 0.0, 1.0);
+  }
+  curve_at (c1, s, &p1, &d1);
+  curve_at (c2, t, &p2, &d2);
+  gdouble scale = MAX (hypot (point_x (&d1), point_y (&d1)),
+		       hypot (point_x (&d2), point_y (&d2)));
+  if (hypot (point_x (&p1) - point_x (&p2), point_y (&p1) - point_y (&p2))
+      > 1e-9 * MAX (scale, 1.0))
+    return FALSE;
+  point_x (result) = (point_x (&p1) + point_x (&p2)) / 2.0;
+  point_y (result) = (point_y (&p1) + point_y (&p2)) / 2.0;
+  return TRUE;
+}
+
+/***
+    The crossing of any two curves nearest (x, y) within radius.
+    Only entities within reach are looked at; their curves are cut
+    into short chords, chords that cross give a first guess, and
+    refine_crossing finishes it on the curves themselves.
+ ***/
+
+gboolean
+pick_intersection (sheet_s *sheet, gdouble x, gdouble y, gdouble radius,
+		   point_s *result)
+{
+  if (!sheet || isnan (x) || isnan (y) || !(radius > 0.0)) return FALSE;
+
+  pick_index_s *idx = index_get (sheet);
+  GArray *curves = g_array_new (FALSE, FALSE, sizeof(curve_s));
+  GArray *pieces = g_array_new (FALSE, FALSE, sizeof(piece_s));
+  search_s search;
+
+  search.x    = x;
+  search.y    = y;
+  search.best = radius;
+  search.skip = sheet_tool_entity (sheet);
+
+  gdouble region[4] = {x - radius, y - radius, x + radius, y + radius};
+  gather_s gather = {&search, curves};
+  visit_index (idx, region, gather_item, &gather);
+
+  for (guint c = 0; c < curves->len; c++) {
+    curve_s *curve = &g_array_index (curves, curve_s, c);
+    gint steps = (curve->type == CURVE_SEGMENT) ? 1 : PICK_SAMPLES;
+    piece_s piece;
+    point_s d;
+    piece.curve = c;
+    curve_at (curve, 0.0, &piece.b, &d);
+    for (gint i = 1; i <= steps; i++) {
+      piece.a  = piece.b;
+      piece.t0 = (gdouble)(i - 1) / (gdouble)steps;
+      piece.t1 = (gdouble)i / (gdouble)steps;
+      curve_at (curve, piece.t1, &piece.b, &d);
+      if (dist_segment (x, y, &piece.a, &piece.b) <= radius)
+	g_array_append_val (pieces, piece);
+    }
+  }
+
+  gboolean found = FALSE;
+  gdouble best = radius;
+  for (guint i = 0; i < pieces->len; i++) {
+    piece_s *pi = &g_array_index (pieces, piece_s, i);
+    for (guint j = i + 1; j < pieces->len; j++) {
+      piece_s *pj = &g_array_index (pieces, piece_s, j);
+      if (pi->curve == pj->curve) continue;
+
+      gdouble rx = point_x (&pi->b) - point_x (&pi->a);
+      gdouble ry = point_y (&pi->b) - point_y (&pi->a);
+      gdouble sx = point_x (&pj->b) - point_x (&pj->a);
+      gdouble sy = point_y (&pj->b) - point_y (&pj->a);
+      gdouble den = rx * sy - ry * sx;
+      if (den == 0.0) continue;
+      gdouble qx = point_x (&pj->a) - point_x (&pi->a);
+      gdouble qy = point_y (&pj->a) - point_y (&pi->a);
+      gdouble u = (qx * sy - qy * sx) / den;
+      gdouble v = (qx * ry - qy * rx) / den;
+      if (u < -1e-9 || u > 1.0 + 1e-9 || v < -1e-9 || v > 1.0 + 1e-9)
+	continue;
+
+      point_s p;
+      if (!refine_crossing (&g_array_index (curves, curve_s, pi->curve),
+			    &g_array_index (curves, curve_s, pj->curve),
+			    pi->t0 + u * (pi->t1 - pi->t0),
+			    pj->t0 + v * (pj->t1 - pj->t0), &p))
+	continue;
+      gdouble d = hypot (point_x (&p) - x, point_y (&p) - y);
+      if (d <= best) {
+	best = d;
+	*result = p;
+	found = TRUE;
+      }
+    }
+  }
+
+  g_array_free (curves, TRUE);
+  g_array_free (pieces, TRUE);
+  return found;
+}
+
+/***
+    Build the index, and with it the snap points, if need be.
+ ***/
+
+void
+pick_ensure (sheet_s *sheet)
+{
+  if (sheet) index_get (sheet);
+}
+
+
+/*************** upkeep **************/
+
+void
+pick_append (sheet_s *sheet, gpointer entity)
+{
+  pick_index_s *idx = sheet ? sheet_pick (sheet) : NULL;
+  if (idx && entity) collect_top (idx, entity);
+}
+
+/***
+    Entities changed in place are normally still in the unindexed
+    tail, the lines tool growing its polyline; those just get new
+    boxes.  Anything else rebuilds.
+ ***/
+
+void
+pick_modify (sheet_s *sheet, gpointer entity)
+{
+  pick_index_s *idx = sheet ? sheet_pick (sheet) : NULL;
+  if (!idx) return;
+
+  gboolean found = FALSE;
+  for (guint i = idx->indexed; i < idx->items->len; i++) {
+    pick_item_s *item = &g_array_index (idx->items, pick_item_s, i);
+    if (item->top == entity) {
+      item_box (idx, item);
+      if (!found) snap_remove (sheet, entity);
+      if (entity_type (item->entity) != ENTITY_TYPE_INSTANCE)
+	snap_add (sheet, entity, item->entity, item->matrix);
+      found = TRUE;
+    }
+  }
+  if (!found) pick_invalidate (sheet);
+}
+
+void
+pick_invalidate (sheet_s *sheet)
+{
+  pick_index_s *idx = sheet ? sheet_pick (sheet) : NULL;
+  if (!idx) return;
+
+  index_free (idx);
+  sheet_pick (sheet) = NULL;
+  snap_invalidate (sheet);
+}
@@ -0,0 +1,29 @@
+#ifndef PICK_H
+#define PICK_H
+
+#define PICK_TOLERANCE	4.0		// in pixels
+
+typedef gboolean (*pick_query_f) (gpointer top, gpointer entity,
+				  const gdouble *box, gpointer data);
+typedef void (*pick_leaf_f) (gpointer top, gpointer entity,
+			     const cairo_matrix_t *matrix, gpointer data);
+
+gpointer pick_nearest (sheet_s *sheet, gdouble x, gdouble y,
+		       gdouble tolerance, cairo_matrix_t *matrix_p,
+		       gdouble *distance_p);
+gboolean pick_hover (sheet_s *sheet, gdouble x, gdouble y,
+		     gdouble tolerance);
+gpointer pick_hovered (sheet_s *sheet, cairo_matrix_t *matrix_p);
+gboolean pick_intersection (sheet_s *sheet, gdouble x, gdouble y,
+			    gdouble radius, point_s *result);
+void pick_ensure (sheet_s *sheet);
+void pick_instance_leaves (sheet_s *sheet, gdouble x, gdouble y,
+			   gdouble radius, pick_leaf_f fcn, gpointer data);
+guint pick_query (sheet_s *sheet, const gdouble *box, pick_query_f fcn,
+		  gpointer data);
+
+void pick_append (sheet_s *sheet, gpointer entity);
+void pick_modify (sheet_s *sheet, gpointer entity);
+void pick_invalidate (sheet_s *sheet);
+
+#endif  /* PICK_H */
@@ -0,0 +1,349 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <string.h>
+
+#include "gf.h"
+#include "entities.h"
+#include "pick.h"
+#include "trace.h"
+#include "../pluginsrcs/plugin.h"
+#include "plugin_api.h"
+
+#if 0 // comments
+
+     Version 2 of the plugin interface, the services behind
+     gfig_api_s (see pluginsrcs/plugin.h).  Batches are plain arrays
+     of circles and lines filled on whatever thread the plugin likes.
+     Committing one puts it on a queue that the main loop drains the
+     way python.c drains its worker: entities are built and joined to
+     the active sheet in one go, and each sheet touched is redrawn
+     once per drain.  Work handed to run gets a thread of its own and
+     its done callback is queued behind whatever it committed.
+     Queries off the main thread wait on the queue too, so they see
+     everything committed before them.
+
+#endif
+
+struct gfig_batch_s {
+  GArray *circles;			// gfig_circle_s
+  GArray *lines;			// gfig_line_s, points not used
+  GArray *points;			// gfig_point_s, the lines in order
+};
+
+typedef enum {
+  PLUGIN_MERGE,
+  PLUGIN_DONE,
+  PLUGIN_QUERY
+} plugin_op_e;
+
+typedef struct {
+  plugin_op_e	 kind;
+  gfig_batch_s	*batch;
+  gfig_done_fcn	 done;
+  gpointer	 data;
+  gdouble	 box[4];
+  GArray	*hits;			// gfig_hit_s
+  gboolean	 finished;
+} plugin_op_s;
+
+typedef struct {
+  gfig_work_fcn	work;
+  gfig_done_fcn	done;
+  gpointer	data;
+} plugin_job_s;
+
+static GMutex   plugin_lock;
+static GCond    plugin_cond;
+static GQueue   plugin_ops   = G_QUEUE_INIT;
+static gboolean plugin_armed = FALSE;
+
+
+/*************** batches **************/
+
+static gfig_batch_s *
+batch_new (void)
+{
+  gfig_batch_s *batch = gfig_try_malloc0 (sizeof(gfig_batch_s));
+  batch->circles = g_array_new (FALSE, FALSE, sizeof(gfig_circle_s));
+  batch->lines   = g_array_new (FALSE, FALSE, sizeof(gfig_line_s));
+  batch->points  = g_array_new (FALSE, FALSE, sizeof(gfig_point_s));
+  return batch;
+}
+
+static void
+batch_free (gfig_batch_s *batch)
+{
+  if (!batch) return;
+  g_array_free (batch->circles, TRUE);
+  g_array_free (batch->lines, TRUE);
+  g_array_free (batch->points, TRUE);
+  g_free (batch);
+}
+
+static void
+append_circles (gfig_batch_s *batch, const gfig_circle_s *circles, guint nr)
+{
+  if (batch && circles) g_array_append_vals (batch->circles, circles, nr);
+}
+
+static void
+append_lines (gfig_batch_s *batch, const gfig_line_s *lines, guint nr)
+{
+  if (!batch || !lines) return;
+  for (guint i = 0; i < nr; i++) {
+    if (!lines[i].points || lines[i].nr_points < 2) continue;
+    gfig_line_s line = lines[i];
+    line.points = NULL;
+    g_array_append_val (batch->lines, line);
+    g_array_append_vals (batch->points, lines[i].points, line.nr_points);
+  }
+}
+
+static gpointer
+batch_circle (sheet_s *sheet, const gfig_circle_s *c)
+{
+  if (isnan (c->x) || isnan (c->y) || !(c->r > 0.0)) return NULL;
+  return entity_build_circle (sheet, c->x, c->y, c->r, 0.0, 2.0 * G_PI,
+			      FALSE, c->filled, NULL);
+}
+
+static gpointer
+batch_line (sheet_s *sheet, const gfig_line_s *line,
+	    const gfig_point_s *points)
+{
+  GList *verts = NULL;
+  for (gint i = line->nr_points - 1; i >= 0; i--) {
+    point_s *point = gfig_try_malloc0 (sizeof(point_s));
+    point_x (point) = points[i].x;
+    point_y (point) = points[i].y;
+    verts = g_list_prepend (verts, point);
+  }
+  return entity_build_polyline (sheet, verts, line->closed, line->filled,
+				line->spline, NULL, INTERSECT_POINT, NAN);
+}
+
+/***
+    Builds the batch on the active sheet and frees it.  Returns the
+    sheet if anything was appended.
+ ***/
+
+static sheet_s *
+batch_merge (gfig_batch_s *batch)
+{
+  sheet_s *sheet = get_active_sheet ();
+  GList *entities = NULL;
+
+  TRACE_BEGIN ("plugin_merge");
+  if (sheet) {
+    for (guint i = 0; i < batch->circles->len; i++) {
+      gpointer entity =
+	batch_circle (sheet, &g_array_index (batch->circles,
+					     gfig_circle_s, i));
+      if (entity) entities = g_list_prepend (entities, entity);
+    }
+    const gfig_point_s *points = (const gfig_point_s *)batch->points->data;
+    for (guint i = 0; i < batch->lines->len; i++) {
+      gfig_line_s *line = &g_array_index (batch->lines, gfig_line_s, i);
+      entities = g_list_prepend (entities, batch_line (sheet, line, points));
+      points += line->nr_points;
+    }
+  }
+  batch_free (batch);
+
+  if (entities)
+    entity_append_entities (sheet, g_list_reverse (entities));
+  TRACE_END ("plugin_merge");
+  return entities ? sheet : NULL;
+}
+
+
+/*************** queries **************/
+
+static gfig_kind_e
+hit_kind (gpointer entity)
+{
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_CIRCLE:   return GFIG_KIND_CIRCLE;
+  case ENTITY_TYPE_ELLIPSE:  return GFIG_KIND_ELLIPSE;
+  case ENTITY_TYPE_TEXT:     return GFIG_KIND_TEXT;
+  case ENTITY_TYPE_POLYLINE: return GFIG_KIND_LINE;
+  default:		     return GFIG_KIND_OTHER;
+  }
+}
+
+static gboolean
+hit_collect (gpointer top, gpointer entity, const gdouble *box,
+	     gpointer data)
+{
+  GArray *hits = data;
+  gfig_hit_s hit;
+  hit.kind = hit_kind (entity);
+  memcpy (hit.box, box, sizeof(hit.box));
+  hit.id   = top;
+  g_array_append_val (hits, hit);
+  return TRUE;
+}
+
+static void
+query_collect (plugin_op_s *op)
+{
+  sheet_s *sheet = get_active_sheet ();
+  if (sheet) pick_query (sheet, op->box, hit_collect, op->hits);
+}
+
+
+/*************** the main loop side **************/
+
+static gboolean
+plugin_drain (gpointer user_data)
+{
+  GQueue batch;
+  GList *touched = NULL;
+  plugin_op_s *op;
+
+  g_mutex_lock (&plugin_lock);
+  batch = plugin_ops;
+  g_queue_init (&plugin_ops);
+  plugin_armed = FALSE;
+  g_mutex_unlock (&plugin_lock);
+
+  while ((op = g_queue_pop_head (&batch))) {
+    switch (op->kind) {
+    case PLUGIN_MERGE:
+      {
+	sheet_s *sheet = batch_merge (op->batch);
+	if (sheet && !g_list_find (touched, sheet))
+	  touched = g_list_prepend (touched, sheet);
+	g_free (op);
+      }
+      break;
+    case PLUGIN_DONE:
+      for (GList *l = touched; l; l = l->next) force_redraw (l->data);
+      g_list_free (touched);
+      touched = NULL;
+      (*op->done) (op->data);
+      g_free (op);
+      break;
+    case PLUGIN_QUERY:			// the waiting thread owns op
+      query_collect (op);
+      g_mutex_lock (&plugin_lock);
+      op->finished = TRUE;
+      g_cond_broadcast (&plugin_cond);
+      g_mutex_unlock (&plugin_lock);
+      break;
+    }
+  }
+
+  for (GList *l = touched; l; l = l->next) force_redraw (l->data);
+  g_list_free (touched);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+plugin_push (plugin_op_s *op)
+{
+  g_mutex_lock (&plugin_lock);
+  g_queue_push_tail (&plugin_ops, op);
+  if (!plugin_armed) {
+    plugin_armed = TRUE;
+    g_idle_add (plugin_drain, NULL);
+  }
+  g_mutex_unlock (&plugin_lock);
+}
+
+static gboolean
+on_main (void)
+{
+  return g_main_context_is_owner (g_main_context_default ());
+}
+
+
+/*************** the services **************/
+
+static void
+batch_commit (gfig_batch_s *batch)
+{
+  if (!batch) return;
+  plugin_op_s *op = gfig_try_malloc0 (sizeof(plugin_op_s));
+  op->kind  = PLUGIN_MERGE;
+  op->batch = batch;
+  plugin_push (op);
+}
+
+static guint
+query (gdouble x0, gdouble y0, gdouble x1, gdouble y1,
+       gfig_hit_fcn fcn, gpointer data)
+{
+  plugin_op_s op = {0};
+  op.kind   = PLUGIN_QUERY;
+  op.box[0] = MIN (x0, x1);
+  op.box[1] = MIN (y0, y1);
+  op.box[2] = MAX (x0, x1);
+  op.box[3] = MAX (y0, y1);
+  op.hits   = g_array_new (FALSE, FALSE, sizeof(gfig_hit_s));
+
+  if (on_main ()) query_collect (&op);
+  else {
+    plugin_push (&op);
+    g_mutex_lock (&plugin_lock);
+    while (!op.finished) g_cond_wait (&plugin_cond, &plugin_lock);
+    g_mutex_unlock (&plugin_lock);
+  }
+
+  guint count = op.hits->len;
+  if (fcn)
+    for (guint i = 0; i < op.hits->len; i++)
+      if (!(*fcn) (&g_array_index (op.hits, gfig_hit_s, i), data)) break;
+  g_array_free (op.hits, TRUE);
+  return count;
+}
+
+static gpointer
+plugin_worker (gpointer data)
+{
+  plugin_job_s *job = data;
+
+  (*job->work) (plugin_api (), job->data);
+  if (job->done) {
+    plugin_op_s *op = gfig_try_malloc0 (sizeof(plugin_op_s));
+    op->kind = PLUGIN_DONE;
+    op->done = job->done;
+    op->data = job->data;
+    plugin_push (op);
+  }
+  g_free (job);
+  return NULL;
+}
+
+static void
+run (gfig_work_fcn work, gfig_done_fcn done, gpointer data)
+{
+  if (!work) return;
+  plugin_job_s *job = gfig_try_malloc0 (sizeof(plugin_job_s));
+  job->work = work;
+  job->done = done;
+  job->data = data;
+  g_thread_unref (g_thread_new ("gf-plugin", plugin_worker, job));
+}
+
+static const gfig_api_s api = {
+  .version	  = GFIG_PLUGIN_API_VERSION,
+  .size		  = sizeof(gfig_api_s),
+  .batch_new	  = batch_new,
+  .append_circles = append_circles,
+  .append_lines	  = append_lines,
+  .batch_commit	  = batch_commit,
+  .batch_free	  = batch_free,
+  .query	  = query,
+  .run		  = run,
+};
+
+const gfig_api_s *
+plugin_api (void)
+{
+  return &api;
+}
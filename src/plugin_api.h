@@ -0,0 +1,6 @@
+#ifndef PLUGIN_API_H
+#define PLUGIN_API_H
+
+const gfig_api_s *plugin_api (void);
+
+#endif  /* PLUGIN_API_H */
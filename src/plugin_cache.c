@@ -0,0 +1,183 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gf.h"
+#include "plugin_cache.h"
+
+#if 0 // comments
+
+     What query_plugin says about each plugin, its name, description
+     and icon, is kept in $HOME/.gfig/plugins, a key file with a group
+     per plugin path, so that starting up costs a stat per plugin
+     rather than a dlopen.  An entry is good while the modification
+     time and size of the file still match; otherwise the plugin is
+     opened and queried once and the entry rewritten.  Entries for
+     plugins that were not looked up this run are dropped when the
+     index is saved, and it is only written when something changed.
+
+#endif
+
+#define PLUGIN_CACHE		"plugins"
+
+#define KEY_PLUGIN_MTIME	"MTime"
+#define KEY_PLUGIN_SIZE		"Size"
+#define KEY_PLUGIN_NAME		"Name"
+#define KEY_PLUGIN_DESC		"Description"
+#define KEY_PLUGIN_ICON		"Icon"
+
+static GKeyFile   *cache = NULL;
+static GHashTable *seen  = NULL;	// paths looked up this run
+static gboolean    dirty = FALSE;
+
+static gchar *
+cache_path (void)
+{
+  return g_strdup_printf ("%s/.%s/%s",
+			  g_get_home_dir (),
+			  g_get_prgname (),
+			  PLUGIN_CACHE);
+}
+
+void
+plugin_cache_load (void)
+{
+  if (cache) return;
+
+  cache = g_key_file_new ();
+  seen  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  dirty = FALSE;
+
+  gchar *path = cache_path ();
+  if (!g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free (cache);
+    cache = g_key_file_new ();
+  }
+  g_free (path);
+}
+
+/***
+    The number of strings in an XPM is in its first line: width,
+    height, colours and characters per pixel.
+ ***/
+
+static guint
+xpm_length (gchar **icon_xpm)
+{
+  gint width, height, colours, cpp;
+
+  if (!icon_xpm || !icon_xpm[0] ||
+      4 != sscanf (icon_xpm[0], "%d %d %d %d",
+		   &width, &height, &colours, &cpp) ||
+      height < 0 || colours < 0)
+    return 0;
+  return 1 + colours + height;
+}
+
+/***
+    A NULL-terminated copy of the XPM a plugin hands back, which lives
+    in the plugin and goes when it is closed.
+ ***/
+
+gchar **
+plugin_xpm_copy (gchar **icon_xpm)
+{
+  guint len = xpm_length (icon_xpm);
+  if (len == 0) return NULL;
+
+  gchar **copy = gfig_try_malloc0 ((len + 1) * sizeof(gchar *));
+  for (guint i = 0; i < len; i++) copy[i] = g_strdup (icon_xpm[i]);
+  return copy;
+}
+
+/***
+    On a hit the caller owns the strings returned, the icon freed with
+    g_strfreev.
+ ***/
+
+gboolean
+plugin_cache_lookup (const gchar *path, gint64 mtime, gint64 size,
+		     gchar **name_p, gchar **desc_p, gchar ***icon_xpm_p)
+{
+  plugin_cache_load ();
+  g_hash_table_add (seen, g_strdup (path));
+
+  if (!g_key_file_has_group (cache, path) ||
+      g_key_file_get_int64 (cache, path, KEY_PLUGIN_MTIME, NULL) != mtime ||
+      g_key_file_get_int64 (cache, path, KEY_PLUGIN_SIZE, NULL) != size)
+    return FALSE;
+
+  if (name_p)
+    *name_p = g_key_file_get_string (cache, path, KEY_PLUGIN_NAME, NULL);
+  if (desc_p)
+    *desc_p = g_key_file_get_string (cache, path, KEY_PLUGIN_DESC, NULL);
+  if (icon_xpm_p)
+    *icon_xpm_p = g_key_file_get_string_list (cache, path,
+					      KEY_PLUGIN_ICON, NULL, NULL);
+  return TRUE;
+}
+
+void
+plugin_cache_store (const gchar *path, gint64 mtime, gint64 size,
+		    const gchar *name, const gchar *desc, gchar **icon_xpm)
+{
+  plugin_cache_load ();
+  g_hash_table_add (seen, g_strdup (path));
+
+  g_key_file_remove_group (cache, path, NULL);
+  g_key_file_set_int64 (cache, path, KEY_PLUGIN_MTIME, mtime);
+  g_key_file_set_int64 (cache, path, KEY_PLUGIN_SIZE, size);
+  if (name) g_key_file_set_string (cache, path, KEY_PLUGIN_NAME, name);
+  if (desc) g_key_file_set_string (cache, path, KEY_PLUGIN_DESC, desc);
+  guint len = xpm_length (icon_xpm);
+  if (len > 0)
+    g_key_file_set_string_list (cache, path, KEY_PLUGIN_ICON,
+				(const gchar * const *)icon_xpm, len);
+  dirty = TRUE;
+}
+
+void
+plugin_cache_save (void)
+{
+  if (!cache) return;
+
+  gchar **groups = g_key_file_get_groups (cache, NULL);
+  for (gint i = 0; groups && groups[i]; i++) {
+    if (!g_hash_table_contains (seen, groups[i])) {
+      g_key_file_remove_group (cache, groups[i], NULL);
+      dirty = TRUE;
+    }
+  }
+  g_strfreev (groups);
+
+  if (dirty) {
+    GError *error = NULL;
+    gsize length;
+    gchar *data = g_key_file_to_data (cache, &length, NULL);
+    gchar *dir  = g_strdup_printf ("%s/.%s",
+				   g_get_home_dir (),
+				   g_get_prgname ());
+    g_mkdir_with_parents (dir, 0777);
+    g_free (dir);
+
+    gchar *path = cache_path ();
+    g_file_set_contents (path, data, length, &error);
+    if (error) {
+      log_string (LOG_GFIG_ERROR, NULL, error->message);
+      g_clear_error (&error);
+    }
+    g_free (path);
+    g_free (data);
+    dirty = FALSE;
+  }
+
+  g_key_file_free (cache);
+  g_hash_table_destroy (seen);
+  cache = NULL;
+  seen  = NULL;
+}
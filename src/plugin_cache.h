@@ -0,0 +1,14 @@
+#ifndef PLUGIN_CACHE_H
+#define PLUGIN_CACHE_H
+
+void plugin_cache_load (void);
+gboolean plugin_cache_lookup (const gchar *path, gint64 mtime, gint64 size,
+			      gchar **name_p, gchar **desc_p,
+			      gchar ***icon_xpm_p);
+void plugin_cache_store (const gchar *path, gint64 mtime, gint64 size,
+			 const gchar *name, const gchar *desc,
+			 gchar **icon_xpm);
+void plugin_cache_save (void);
+gchar **plugin_xpm_copy (gchar **icon_xpm);
+
+#endif  /* PLUGIN_CACHE_H */
@@ -23,11 +23,24 @@
 #include "utilities.h"
 #include "fallbacks.h"
 #include "python.h"
+#include "xml.h"
+#include "journal.h"
+#include "history.h"
+#include "binary.h"
+#include "block.h"
+#include "stats.h"
+#include "trace.h"
+#include "memory.h"
 
 PyObject *global_dict;
 
 #define SHEET_NAME "__sheet__"
 
+typedef void (*main_call_f)(gpointer data);
+static void call_main (main_call_f call, sheet_s *sheet, gpointer data);
+static void worker_start (void);
+static gboolean worker_stop (void);
+
 typedef enum {
   METHOD_BUILD,
   METHOD_APPEND,
@@ -43,6 +56,7 @@ static const gchar translate_name[]   = {"gfig.Translate"};
 static const gchar rotate_name[]      = {"gfig.Rotate"};
 static const gchar pen_name[]         = {"gfig.Pen"};
 static const gchar point_name[]       = {"gfig.Point"};
+static const gchar points_name[]      = {"gfig.Points"};
 static const gchar circle_name[]      = {"gfig.Circle"};
 static const gchar text_name[]        = {"gfig.Text"};
 static const gchar polyline_name[]    = {"gfig.Polyline"};
@@ -96,6 +110,12 @@ generic_dealloc (PyObject *self)
 
 /********************** utilities ******************/
 
+static void
+materialize_main (gpointer data)
+{
+  materialize_sheet (data);
+}
+
 static sheet_s*
 get_sheet ()
 {
@@ -119,6 +139,8 @@ get_sheet ()
       else frame = PyObject_GetAttrString (frame, "f_back");
     }
   }
+  if (sheet && sheet_lazy (sheet))	// only the main loop clears it
+    call_main (materialize_main, sheet, sheet);
   return sheet;
 }
 
@@ -256,15 +278,58 @@ gfig_test (PyObject *self, PyObject *pArgs, PyObject *keywds)
 }
 #endif
 
+static void
+clear_main (gpointer data)
+{
+  sheet_s  *sheet = data;
+  journal_delete (sheet, JOURNAL_ALL);
+  history_clear (sheet);
+  force_redraw (sheet);
+}
+
 static PyObject *
 gfig_clear (PyObject *self, PyObject *pArgs, PyObject *keywds)
 {
   sheet_s  *sheet = get_sheet ();
-  clear_entities (&sheet_entities (sheet));
-  force_redraw (sheet);
+  call_main (clear_main, sheet, sheet);
   return Py_None;
 }
 
+typedef struct {
+  sheet_s  *sheet;
+  gboolean  rc;
+} history_call_s;
+
+static void
+undo_main (gpointer data)
+{
+  history_call_s *hc = data;
+  hc->rc = history_undo (hc->sheet);
+}
+
+static void
+redo_main (gpointer data)
+{
+  history_call_s *hc = data;
+  hc->rc = history_redo (hc->sheet);
+}
+
+static PyObject *
+gfig_undo (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  history_call_s hc = {get_sheet (), FALSE};
+  call_main (undo_main, hc.sheet, &hc);
+  return PyBool_FromLong (hc.rc);
+}
+
+static PyObject *
+gfig_redo (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  history_call_s hc = {get_sheet (), FALSE};
+  call_main (redo_main, hc.sheet, &hc);
+  return PyBool_FromLong (hc.rc);
+}
+
 /************************ pen *******************/
 
 static PyObject *
@@ -487,6 +552,204 @@ static PyTypeObject gfig_Point = {
   .tp_init	= point_init,
 };
 
+/************************ points *******************/
+
+/***
+    A read-only run of points in one contiguous array, as returned by
+    Intersect.  Indexing wraps a copy of the point in a gfig.Point
+    only when asked, and the buffer protocol hands out the array
+    itself as an n by 2 block of doubles, so numpy and memoryview see
+    it without a copy.  Polyline and DrawLine take it as it stands.
+    The array never changes once it is set, so that no exported
+    buffer can be left pointing at freed memory; __init__ runs once.
+ ***/
+
+typedef struct {
+  PyObject_HEAD
+  GArray     *points;			// point_s
+  Py_ssize_t  shape[2];
+  Py_ssize_t  strides[2];
+} gfig_PointsObject;
+
+static PyTypeObject gfig_Points;
+
+static gboolean
+is_gfig_points (PyObject *xobj)
+{
+  return (xobj && (Py_TYPE (xobj) == &gfig_Points));
+}
+
+static PyObject *
+points_wrap (GArray *points)
+{
+  gfig_PointsObject *pobj =
+    (gfig_PointsObject *)gfig_Points.tp_alloc (&gfig_Points, 0);
+  if (pobj) pobj->points = points;
+  else g_array_free (points, TRUE);
+  return (PyObject *)pobj;
+}
+
+static void
+points_dealloc (PyObject *self)
+{
+  gfig_PointsObject *pobj = (gfig_PointsObject *)self;
+  if (pobj->points) g_array_free (pobj->points, TRUE);
+  Py_TYPE(self)->tp_free (self);
+}
+
+static int
+points_init (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  gfig_PointsObject *pobj = (gfig_PointsObject *)self;
+  PyObject *seq = NULL;
+
+  if (pobj->points) {
+    PyErr_SetString (PyExc_TypeError, "Points are read-only");
+    return -1;
+  }
+  if (!PyArg_ParseTuple (args, "|O", &seq)) return -1;
+
+  GArray *points = g_array_new (FALSE, FALSE, sizeof(point_s));
+  if (seq && is_gfig_points (seq)) {
+    GArray *from = ((gfig_PointsObject *)seq)->points;
+    if (from) g_array_append_vals (points, from->data, from->len);
+  }
+  else if (seq) {
+    PyObject *fast = PySequence_Fast (seq, "Points: expected a sequence");
+    if (!fast) {
+      g_array_free (points, TRUE);
+      return -1;
+    }
+    Py_ssize_t len = PySequence_Fast_GET_SIZE (fast);
+    for (Py_ssize_t i = 0; i < len; i++) {
+      PyObject *obj = PySequence_Fast_GET_ITEM (fast, i);
+      point_s point;
+      if (is_gfig_point (obj))
+	point = *(point_s *)((gfig_GenericObject *)obj)->entity;
+      else if (!PyArg_ParseTuple (obj, "dd", &point.x, &point.y)) {
+	Py_DECREF (fast);
+	g_array_free (points, TRUE);
+	return -1;
+      }
+      g_array_append_val (points, point);
+    }
+    Py_DECREF (fast);
+  }
+  pobj->points = points;
+  return 0;
+}
+
+static Py_ssize_t
+points_length (PyObject *self)
+{
+  gfig_PointsObject *pobj = (gfig_PointsObject *)self;
+  return pobj->points ? pobj->points->len : 0;
+}
+
+static PyObject *
+points_item (PyObject *self, Py_ssize_t i)
+{
+  gfig_PointsObject *pobj = (gfig_PointsObject *)self;
+  if (i < 0 || i >= points_length (self)) {
+    PyErr_SetString (PyExc_IndexError, "Points index out of range");
+    return NULL;
+  }
+
+  PyObject *robj = gfig_Point.tp_alloc (&gfig_Point, 0);
+  if (robj) {
+    point_s *point = gfig_try_malloc0 (sizeof(point_s));
+    *point = g_array_index (pobj->points, point_s, i);
+    ((gfig_GenericObject *)robj)->entity = point;
+  }
+  return robj;
+}
+
+static int
+points_getbuffer (PyObject *self, Py_buffer *view, int flags)
+{
+  gfig_PointsObject *pobj = (gfig_PointsObject *)self;
+
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString (PyExc_BufferError, "Points are read-only");
+    return -1;
+  }
+
+  guint len = pobj->points ? pobj->points->len : 0;
+  pobj->shape[0]   = len;
+  pobj->shape[1]   = 2;
+  pobj->strides[0] = sizeof(point_s);
+  pobj->strides[1] = sizeof(gdouble);
+
+  view->obj        = self;
+  view->buf        = len ? pobj->points->data : NULL;
+  view->len        = len * sizeof(point_s);
+  view->readonly   = 1;
+  if (flags & PyBUF_ND) {
+    view->itemsize = sizeof(gdouble);
+    view->format   = (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim     = 2;
+    view->shape    = pobj->shape;
+    view->strides  = (flags & PyBUF_STRIDES) ? pobj->strides : NULL;
+  }
+  else {				// without a shape, plain bytes
+    view->itemsize = 1;
+    view->format   = (flags & PyBUF_FORMAT) ? "B" : NULL;
+    view->ndim     = 1;
+    view->shape    = NULL;
+    view->strides  = NULL;
+  }
+  view->suboffsets = NULL;
+  view->internal   = NULL;
+  Py_INCREF (self);
+  return 0;
+}
+
+static PyObject *
+points_repr (PyObject *obj)
+{
+  gchar *str = g_strdup_printf ("%s (%zd)", points_name,
+				points_length (obj));
+  PyObject *robj = PyUnicode_FromString (str);
+  g_free (str);
+  return robj;
+}
+
+static PyObject *
+points_sizeof (PyObject *self, PyObject *unused)
+{
+  return PyLong_FromSsize_t (sizeof(gfig_PointsObject) + sizeof(GArray) +
+			     points_length (self) * sizeof(point_s));
+}
+
+static PySequenceMethods points_sequence = {
+  .sq_length	= points_length,
+  .sq_item	= points_item,
+};
+
+static PyBufferProcs points_buffer = {
+  .bf_getbuffer	= points_getbuffer,
+};
+
+static PyMethodDef points_methods[] = {
+  {"__sizeof__", (PyCFunction)points_sizeof, METH_NOARGS, NULL},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject gfig_Points = {
+  .ob_base	= PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name	= points_name,
+  .tp_basicsize	= sizeof(gfig_PointsObject),
+  .tp_dealloc	= points_dealloc,
+  .tp_repr	= points_repr,
+  .tp_str	= points_repr,
+  .tp_as_sequence = &points_sequence,
+  .tp_as_buffer	= &points_buffer,
+  .tp_methods	= points_methods,
+  .tp_flags	= Py_TPFLAGS_DEFAULT,
+  .tp_doc	= "gfig point array type",
+  .tp_init	= points_init,
+};
+
 /************************ transform *******************/
 
 static PyObject *
@@ -888,6 +1151,145 @@ gfig_draw (PyObject *self, PyObject *pArgs, PyObject *keywds)
   return (PyObject *)method_draw (METHOD_APPEND, self, pArgs, keywds);
 }
 
+/********************************** blocks ********************/
+
+/***
+    DefineBlock keeps its own copies of the entities, so the Python
+    objects stay free to change or go away; the copy goes through
+    the binary entity codec, which already handles every type.  The
+    worker only encodes: decoding looks blocks up in the project, so
+    it is done on the main loop along with the definition.
+ ***/
+
+typedef struct {
+  project_s	*project;
+  environment_s	*env;
+  const gchar	*name;
+  GList		*blobs;			// GBytes
+} define_call_s;
+
+static void
+define_main (gpointer data)
+{
+  define_call_s *dc = data;
+  GList *entities = NULL;
+
+  for (GList *l = dc->blobs; l; l = l->next) {
+    gsize len;
+    const guint8 *blob = g_bytes_get_data (l->data, &len);
+    gpointer entity = binary_decode_entity (blob, len, dc->env, dc->project);
+    if (entity) entities = g_list_prepend (entities, entity);
+  }
+  entities = g_list_reverse (entities);
+  if (block_define (dc->project, dc->name, entities))
+    journal_block (dc->project, dc->name, entities);
+}
+
+static PyObject *
+gfig_define_block (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  PyObject *rc = Py_False;
+  sheet_s *sheet = get_sheet ();
+  project_s *project = sheet ? sheet_project (sheet) : NULL;
+  Py_ssize_t t_count = PyTuple_Size (pArgs);
+  PyObject *nobj = (t_count > 0) ? PyTuple_GetItem (pArgs, 0) : NULL;
+
+  if (project && nobj && PyUnicode_Check (nobj)) {
+    GList *blobs = NULL;
+    for (gint i = 1; i < t_count; i++) {
+      PyObject *tobj = PyTuple_GetItem (pArgs, i);
+      if (is_gfig_entity (tobj)) {
+	gfig_GenericObject *gobj = (gfig_GenericObject *)tobj;
+	blobs = g_list_prepend (blobs, binary_encode_entity (gobj->entity));
+      }
+    }
+    define_call_s dc;
+    dc.project = project;
+    dc.env     = sheet_environment (sheet);
+    dc.name    = PyUnicode_AsUTF8 (nobj);
+    dc.blobs   = g_list_reverse (blobs);
+    call_main (define_main, sheet, &dc);
+    g_list_free_full (dc.blobs, (GDestroyNotify)g_bytes_unref);
+    rc = Py_True;
+  }
+  else log_string (LOG_GFPY_ERROR, sheet,
+		   _ ("DefineBlock: Missing block name.\n"));
+  
+  Py_INCREF (rc);
+  return rc;
+}
+
+/***
+    The block is looked up, and the instance appended, on the main
+    loop, since a definition there may be replacing it.
+ ***/
+
+typedef struct {
+  sheet_s	 *sheet;
+  const gchar	 *name;
+  cairo_matrix_t *matrix;
+  pen_s		 *pen;
+  gboolean	  found;
+} draw_call_s;
+
+static void
+draw_main (gpointer data)
+{
+  draw_call_s *dc = data;
+  block_s *block = block_lookup (sheet_project (dc->sheet), dc->name);
+
+  dc->found = block != NULL;
+  if (block) {
+    entity_append_instance (dc->sheet, block, dc->matrix, dc->pen);
+    force_redraw (dc->sheet);
+  }
+}
+
+static PyObject *
+gfig_draw_block (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  PyObject *rc = Py_False;
+  sheet_s *sheet = get_sheet ();
+  PyObject *nobj = (PyTuple_Size (pArgs) > 0) ?
+    PyTuple_GetItem (pArgs, 0) : NULL;
+
+  if (sheet && nobj && PyUnicode_Check (nobj)) {
+    cairo_matrix_t *matrix = NULL;
+    pen_s *pen = NULL;
+    if (keywds) {
+      PyObject *tf = PyDict_GetItemString(keywds, "transform");
+      if (!tf) tf = PyDict_GetItemString(keywds, "tf");
+      if (tf) {
+	if (is_gfig_transform (tf))
+	  matrix = ((gfig_GenericObject *)tf)->entity;
+	else log_string (LOG_GFPY_ERROR, sheet,
+			 _ ("DrawBlock: Invalid transform.\n"));
+      }
+      PyObject *pobj = PyDict_GetItemString(keywds, "pen");
+      if (pobj) {
+	if (is_gfig_pen (pobj))
+	  pen = ((gfig_GenericObject *)pobj)->entity;
+	else log_string (LOG_GFPY_ERROR, sheet,
+			 _ ("DrawBlock: Invalid pen.\n"));
+      }
+    }
+    draw_call_s dc;
+    dc.sheet  = sheet;
+    dc.name   = PyUnicode_AsUTF8 (nobj);
+    dc.matrix = matrix;
+    dc.pen    = pen;
+    dc.found  = FALSE;
+    call_main (draw_main, sheet, &dc);
+    if (dc.found) rc = Py_True;
+  }
+  if (rc != Py_True)
+    log_string (LOG_GFPY_ERROR, sheet,
+		_ ("DrawBlock: Undefined block.\n"));
+  
+  Py_INCREF (rc);
+  return rc;
+}
+
 /* converts degrees to radians, assumes arg is degrees */
 static PyObject*
 gfig_degrees (PyObject* self, PyObject* pArgs)
@@ -966,21 +1368,6 @@ gfig_iterSIC (PyObject* self, PyObject* pArgs)
 
 /********************************** intersect ********************/
 
-static void
-append_intersect_point (gpointer data, gpointer user_data)
-{
-  point_s *pt = data;
-  PyObject *list = user_data;
-
-  PyObject *pobj = gfig_try_malloc0 (sizeof(PyObject));
-  gfig_GenericObject *obj = (gfig_GenericObject *)pobj;
-  pobj->ob_refcnt = 1;
-  pobj->ob_type = &gfig_Point;
-  obj->entity = pt;
-  obj->ob_base.ob_refcnt = 1;
-  PyList_Append (list, pobj);
-}
-
 static PyObject *
 gfig_intersect (PyObject *self, PyObject *pArgs, PyObject *keywds)
 {
@@ -999,9 +1386,12 @@ gfig_intersect (PyObject *self, PyObject *pArgs, PyObject *keywds)
     }
   }
   if (points) {
-    PyObject *list = PyList_New (0);
-    g_list_foreach (points, append_intersect_point, list);
-    return list;
+    GArray *array = g_array_sized_new (FALSE, FALSE, sizeof(point_s),
+				       g_list_length (points));
+    for (GList *l = points; l; l = l->next)
+      g_array_append_vals (array, l->data, 1);
+    g_list_free_full (points, g_free);
+    return points_wrap (array);
   }
   else {
     Py_INCREF (Py_None);
@@ -1010,14 +1400,249 @@ gfig_intersect (PyObject *self, PyObject *pArgs, PyObject *keywds)
 }
 
 
+/********************************** render stats ********************/
+
+typedef struct {
+  sheet_s	 *sheet;
+  gint		  detail;		// -1 leave as is
+  gint		  hud;
+  gint		  reset;
+  render_stats_s  rs;
+} stats_call_s;
+
+static void
+stats_main (gpointer data)
+{
+  stats_call_s *sc = data;
+  if (sc->reset) stats_reset ();
+  if (sc->detail >= 0) stats_set_detail (sc->detail);
+  if (sc->hud >= 0 && sc->hud != stats_hud ()) {
+    stats_set_hud (sc->hud);
+    if (sc->sheet) force_redraw (sc->sheet);
+  }
+  stats_snapshot (&sc->rs);
+}
+
+static const gchar *stats_type_names[STATS_TYPES] = {
+  "none", "circle", "ellipse", "text", "polyline",
+  "transform", "group", "instance"
+};
+
+/* gfig.RenderStats (detail=, hud=, reset=) -> dict of the last frame */
+static PyObject *
+gfig_render_stats (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  stats_call_s sc = {0};
+  sc.detail = -1;
+  sc.hud    = -1;
+
+  static char *kwlist[] = {"detail", "hud", "reset", NULL};
+  if (!PyArg_ParseTupleAndKeywords (pArgs, keywds, "|ppp", kwlist,
+				    &sc.detail, &sc.hud, &sc.reset))
+    return NULL;
+  sc.sheet = get_sheet ();
+  call_main (stats_main, sc.sheet, &sc);
+
+  frame_stats_s *fs = &sc.rs.last;
+  PyObject *types = PyDict_New ();
+  for (gint i = 0; i < STATS_TYPES; i++) {
+    if (fs->type_count[i] == 0) continue;
+    PyObject *t = Py_BuildValue ("{s:I,s:d}",
+				 "count", fs->type_count[i],
+				 "ms", fs->type_ms[i]);
+    PyDict_SetItemString (types, stats_type_names[i], t);
+    Py_DECREF (t);
+  }
+
+  PyObject *histogram = PyList_New (0);
+  for (gint b = 0; b < STATS_BUCKETS; b++) {
+    PyObject *h = Py_BuildValue ("(dI)", stats_bucket_limit (b),
+				 sc.rs.histogram[b]);
+    PyList_Append (histogram, h);
+    Py_DECREF (h);
+  }
+
+  return Py_BuildValue ("{s:d,s:d,s:d,s:I,s:I,s:I,s:I,s:N,"
+			"s:K,s:I,s:d,s:d,s:d,s:d,s:N}",
+			"total_ms",	  fs->total_ms,
+			"text_ms",	  fs->text_ms,
+			"geometry_ms",	  fs->geometry_ms,
+			"drawn",	  fs->drawn,
+			"culled",	  fs->culled,
+			"matrix_changes", fs->matrix_changes,
+			"style_changes",  fs->style_changes,
+			"types",	  types,
+			"frames",	  (unsigned long long)sc.rs.frames,
+			"window",	  sc.rs.ring_len,
+			"p50_ms",	  sc.rs.p50,
+			"p95_ms",	  sc.rs.p95,
+			"p99_ms",	  sc.rs.p99,
+			"worst_ms",	  sc.rs.worst,
+			"histogram",	  histogram);
+}
+
+/********************************** memory stats ********************/
+
+typedef struct {
+  gchar	  *name;
+  gboolean project;
+  memory_s mem;
+} memory_entry_s;
+
+static void
+memory_main (gpointer data)
+{
+  GArray *entries = data;
+  GtkTreeModel *model = GTK_TREE_MODEL (get_projects ());
+  GtkTreeIter iter;
+
+  if (gtk_tree_model_get_iter_first (model, &iter)) {
+    do {
+      project_s *project = NULL;
+      gtk_tree_model_get (model, &iter, PROJECT_STRUCT_COL, &project, -1);
+      if (!project) continue;
+
+      memory_entry_s pe = {0};
+      pe.name    = g_strdup (project_name (project));
+      pe.project = TRUE;
+      memory_project (project, &pe.mem);
+      g_array_append_val (entries, pe);
+
+      GtkTreeModel *sheets = GTK_TREE_MODEL (project_sheets (project));
+      GtkTreeIter sheet_iter;
+      if (sheets && gtk_tree_model_get_iter_first (sheets, &sheet_iter)) {
+	do {
+	  sheet_s *sheet = NULL;
+	  gtk_tree_model_get (sheets, &sheet_iter,
+			      SHEET_STRUCT_COL, &sheet, -1);
+	  if (!sheet) continue;
+	  memory_entry_s se = {0};
+	  se.name = g_strdup (sheet_name (sheet));
+	  memory_sheet (sheet, &se.mem);
+	  g_array_append_val (entries, se);
+	} while (gtk_tree_model_iter_next (sheets, &sheet_iter));
+      }
+    } while (gtk_tree_model_iter_next (model, &iter));
+  }
+}
+
+static PyObject *
+memory_dict (memory_entry_s *me)
+{
+  memory_s *mem = &me->mem;
+  return Py_BuildValue ("{s:s,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,"
+			"s:I,s:I,s:I}",
+			"name",	       me->name ? me->name : "",
+			"total",       (Py_ssize_t)memory_total (mem),
+			"entities",    (Py_ssize_t)mem->entities,
+			"vertices",    (Py_ssize_t)mem->vertices,
+			"pens",	       (Py_ssize_t)mem->pens,
+			"strings",     (Py_ssize_t)mem->strings,
+			"caches",      (Py_ssize_t)mem->caches,
+			"display",     (Py_ssize_t)mem->display,
+			"history",     (Py_ssize_t)mem->history,
+			"surface",     (Py_ssize_t)mem->surface,
+			"python",      (Py_ssize_t)mem->python,
+			"nr_entities", mem->nr_entities,
+			"nr_vertices", mem->nr_vertices,
+			"nr_objects",  mem->nr_wrappers);
+}
+
+/* gfig.MemoryStats () -> list of project dicts, each with its sheets */
+static PyObject *
+gfig_memory_stats (PyObject *self, PyObject *pArgs, PyObject *keywds)
+{
+  GArray *entries = g_array_new (FALSE, FALSE, sizeof(memory_entry_s));
+  call_main (memory_main, get_sheet (), entries);
+
+  PyObject *projects = PyList_New (0);
+  PyObject *sheets = NULL;
+  for (guint i = 0; i < entries->len; i++) {
+    memory_entry_s *me = &g_array_index (entries, memory_entry_s, i);
+    PyObject *dict = memory_dict (me);
+    if (me->project) {
+      sheets = PyList_New (0);
+      PyDict_SetItemString (dict, "sheets", sheets);
+      Py_DECREF (sheets);		// the dict holds it
+      PyList_Append (projects, dict);
+    }
+    else if (sheets)
+      PyList_Append (sheets, dict);
+    Py_DECREF (dict);
+    g_free (me->name);
+  }
+  g_array_free (entries, TRUE);
+  return projects;
+}
+
 /********************************** pen fcns ********************/
 
+/***
+    The sheet pen belongs to the main loop, which draws with it and
+    lets the pen dialogue replace it.  A script on the worker gets its
+    own copy of each sheet pen, taken on the main loop when first
+    wanted and dropped when the job ends; the setters change the copy
+    and hand the change to the main loop.  Entities built without a
+    pen of their own are built from the copy.
+ ***/
+
+static GHashTable *script_pens = NULL;	// sheet -> pen_s, worker only
+
+typedef struct {
+  sheet_s *sheet;
+  pen_s   *pen;
+} pen_call_s;
+
+static void
+pen_copy_main (gpointer data)
+{
+  pen_call_s *pc = data;
+  pc->pen = copy_pen (environment_pen (sheet_environment (pc->sheet)));
+}
+
+static void
+pen_apply_main (gpointer data)
+{
+  pen_call_s *pc = data;
+  pen_s *pen = environment_pen (sheet_environment (pc->sheet));
+  if (pen == pc->pen) return;
+  pen_lw_std_idx (pen) = pen_lw_std_idx (pc->pen);
+  pen_lw (pen)         = pen_lw (pc->pen);
+  *pen_colour (pen)    = *pen_colour (pc->pen);
+}
+
+static pen_s *
+script_pen (sheet_s *sheet)
+{
+  if (!sheet) return NULL;
+  if (!python_in_worker ()) return environment_pen (sheet_environment (sheet));
+
+  if (!script_pens)
+    script_pens = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+					 (GDestroyNotify)delete_pen_copy);
+  pen_s *pen = g_hash_table_lookup (script_pens, sheet);
+  if (!pen) {
+    pen_call_s pc = { sheet, NULL };
+    call_main (pen_copy_main, sheet, &pc);
+    pen = pc.pen;
+    if (pen) g_hash_table_insert (script_pens, sheet, pen);
+  }
+  return pen;
+}
+
+static void
+script_pen_apply (sheet_s *sheet, pen_s *pen)
+{
+  pen_call_s pc = { sheet, pen };
+  call_main (pen_apply_main, sheet, &pc);
+}
+
 static PyObject *
 gfig_get_penwidthidx (PyObject *self, PyObject *pArgs, PyObject *keywds)
 {
   sheet_s *sheet = get_sheet ();
-  environment_s * env = sheet_environment (sheet);
-  pen_s *pen = environment_pen (env);
+  pen_s *pen = script_pen (sheet);
+  if (!pen) return PyLong_FromLong (0L);
   //  gdouble width = environment_win_wid (env);
   gint width = pen_lw_std_idx (pen);
   return PyLong_FromLong ((long)width);
@@ -1033,11 +1658,13 @@ gfig_set_penwidthidx (PyObject *self, PyObject *pArgs, PyObject *keywds)
   if (PyArg_ParseTuple (pArgs, "i", &penidx)) {
     if (penidx >= STANDARD_LINE_WIDTH_0 &&
 	penidx <= STANDARD_LINE_WIDTH_8) {
-      environment_s * env = sheet_environment (sheet);
-      pen_s *pen = environment_pen (env);
-      pen_lw_std_idx (pen) = penidx;
-      pen_lw (pen) = get_lw_from_idx (penidx);
-      rc = Py_True;
+      pen_s *pen = script_pen (sheet);
+      if (pen) {
+	pen_lw_std_idx (pen) = penidx;
+	pen_lw (pen) = get_lw_from_idx (penidx);
+	script_pen_apply (sheet, pen);
+	rc = Py_True;
+      }
     }
     else log_string (LOG_GFPY_ERROR, sheet,
 		     _ ("Setpenwidthidx: Invalid pen width index.\n"));
@@ -1056,11 +1683,13 @@ gfig_set_penwidth (PyObject *self, PyObject *pArgs, PyObject *keywds)
 
   sheet_s  *sheet = get_sheet ();
   if (PyArg_ParseTuple (pArgs, "d", &penwidth)) {
-    environment_s * env = sheet_environment (sheet);
-    pen_s *pen = environment_pen (env);
-    pen_lw_std_idx (pen) = STANDARD_LINE_WIDTH_CUSTOM;
-    pen_lw (pen) = penwidth;
-    rc = Py_True;
+    pen_s *pen = script_pen (sheet);
+    if (pen) {
+      pen_lw_std_idx (pen) = STANDARD_LINE_WIDTH_CUSTOM;
+      pen_lw (pen) = penwidth;
+      script_pen_apply (sheet, pen);
+      rc = Py_True;
+    }
   }
   else log_string (LOG_GFPY_ERROR, sheet,
 		   _ ("Setpenwidth: Missing parameter.\n"));
@@ -1078,13 +1707,15 @@ gfig_set_pencolour (PyObject *self, PyObject *pArgs, PyObject *keywds)
   if (PyFloat_Check (obj)) {
     gdouble red, green , blue, alpha = 1.0;
     if (PyArg_ParseTuple (pArgs, "ddd|d", &red, &green, &blue, &alpha)) {
-      environment_s * env = sheet_environment (sheet);
-      pen_s *pen = environment_pen (env);
-      pen_colour_red (pen)	= red;
-      pen_colour_green (pen)	= green;
-      pen_colour_blue (pen)	= blue;
-      pen_colour_alpha (pen)	= alpha;
-      rc = Py_True;
+      pen_s *pen = script_pen (sheet);
+      if (pen) {
+	pen_colour_red (pen)	= red;
+	pen_colour_green (pen)	= green;
+	pen_colour_blue (pen)	= blue;
+	pen_colour_alpha (pen)	= alpha;
+	script_pen_apply (sheet, pen);
+	rc = Py_True;
+      }
     }
     else log_string (LOG_GFPY_ERROR, sheet,
 		     _ ("Setpencolour: Invalid colour specification.\n"));
@@ -1094,13 +1725,13 @@ gfig_set_pencolour (PyObject *self, PyObject *pArgs, PyObject *keywds)
     if (PyArg_ParseTuple (pArgs, "s", &cname)) {
       GdkRGBA rgba;
       css_colours_s *col = find_css_colour_rgba (cname, &rgba);
-      if (col) {
-	environment_s * env = sheet_environment (sheet);
-	pen_s *pen = environment_pen (env);
+      pen_s *pen = col ? script_pen (sheet) : NULL;
+      if (pen) {
 	pen_colour_red (pen)	= rgba.red;
 	pen_colour_green (pen)	= rgba.green;
 	pen_colour_blue (pen)	= rgba.blue;
-	pen_colour_alpha (pen)	= rgba.alpha;	
+	pen_colour_alpha (pen)	= rgba.alpha;
+	script_pen_apply (sheet, pen);
 	rc = Py_True;
       }
       else log_string (LOG_GFPY_ERROR, sheet,
@@ -1223,10 +1854,12 @@ point_circle (method_e method, PyObject *self,
 	if (rvec[r] > 0.0) {
 	  if (method == METHOD_APPEND)
 	    entity_append_circle (sheet, xx, yy, rvec[r], start,
-				  stop, negative, filled, pen);
+				  stop, negative, filled,
+				  pen ? : script_pen (sheet));
 	  else
 	    circle = entity_build_circle (sheet, xx, yy, rvec[r], start,
-					  stop, negative, filled, pen);
+					  stop, negative, filled,
+					  pen ? : script_pen (sheet));
 	  didit = TRUE;
 	}
 	else log_string (LOG_GFPY_ERROR, sheet,
@@ -1306,11 +1939,13 @@ method_circle (method_e method, PyObject *self,
 	    if (rvec[r] > 0.0) {
 	      if (method == METHOD_APPEND)
 		entity_append_circle (sheet, xvec[x], yvec[y], rvec[r],
-				      start, stop, negative, filled, pen);
+				      start, stop, negative, filled,
+				      pen ? : script_pen (sheet));
 	      else
 		circle = 
 		  entity_build_circle (sheet, xvec[x], yvec[y], rvec[r],
-				       start, stop, negative, filled, pen);
+				       start, stop, negative, filled,
+				       pen ? : script_pen (sheet));
 	      didit = TRUE;
 	    }
 	    else log_string (LOG_GFPY_ERROR, sheet,
@@ -1491,14 +2126,15 @@ method_text (method_e method, PyObject *self,
 
   if (method == METHOD_APPEND) {
     entity_append_text (sheet, x, y, string, (int)size, theta, txt_size,
-			filled, font, alignment, justify, spread, lead, pen);
+			filled, font, alignment, justify, spread, lead,
+			pen ? : script_pen (sheet));
     rc = Py_True;
     force_redraw (sheet);
   }
   else
     text = entity_build_text (sheet, x, y, string, (int)size, theta, txt_size,
 			      filled, font, alignment, justify, spread, lead,
-			      pen);
+			      pen ? : script_pen (sheet));
   
   if (method == METHOD_APPEND) { 
     Py_INCREF(rc);
@@ -1658,11 +2294,12 @@ point_ellipseffae (method_e method, PyObject *self,
 	      gdouble b  = avec[a] * sqrt (1.0 - evec[e] * evec[e]);
 	      if (method == METHOD_APPEND)
 		entity_append_ellipse (sheet, cx, cy, avec[a], b, t, start,
-				       stop, negative, filled, pen);
+				       stop, negative, filled,
+				       pen ? : script_pen (sheet));
 	      else
 		ellipse = entity_build_ellipse (sheet, cx, cy, avec[a], b,
 					       t, start, stop, negative,
-						filled, pen);
+					       filled, pen ? : script_pen (sheet));
 	      didit = TRUE;
 	    }
 	    else log_string (LOG_GFPY_ERROR, sheet,
@@ -1785,11 +2422,13 @@ method_ellipseffae (method_e method, PyObject *self,
 		  if (method == METHOD_APPEND)
 		    entity_append_ellipse (sheet, cx, cy,
 					   avec[a], b, t, start, stop,
-					   negative, filled, pen);
+					   negative, filled,
+					   pen ? : script_pen (sheet));
 		  else
 		    ellipse = entity_build_ellipse (sheet, cx, cy,
 						    avec[a], b, t, start, stop,
-						    negative, filled, pen);
+						    negative, filled,
+						    pen ? : script_pen (sheet));
 		  didit = TRUE;
 		}
 		else log_string (LOG_GFPY_ERROR, sheet,
@@ -1950,11 +2589,12 @@ point_ellipsecabt (method_e method, PyObject *self,
 	      if (method == METHOD_APPEND)
 		entity_append_ellipse (sheet, xx, yy, avec[a], bvec[b],
 				       tvec[t], start, stop, negative,
-				       filled, pen);
+				       filled, pen ? : script_pen (sheet));
 	      else
 		ellipse = entity_build_ellipse (sheet, xx, yy, avec[a],
 						bvec[b], tvec[t], start,
-						stop, negative, filled, pen);
+						stop, negative, filled,
+						pen ? : script_pen (sheet));
 	      didit = TRUE;
 	    }
 	    else log_string (LOG_GFPY_ERROR, sheet,
@@ -2052,14 +2692,15 @@ method_ellipsecabt (method_e method, PyObject *self,
 					   xvec[x], yvec[y],
 					   avec[a], bvec[b],
 					   tvec[t], start, stop,
-					   negative, filled, pen);
+					   negative, filled,
+					   pen ? : script_pen (sheet));
 		  else
 		    ellipse = entity_build_ellipse (sheet,
 						    xvec[x], yvec[y],
 						    avec[a], bvec[b],
 						    tvec[t], start,
-						    stop, negative,
-						    filled, pen);
+						    stop, negative, filled,
+						    pen ? : script_pen (sheet));
 		  didit = TRUE;
 		}
 		else log_string (LOG_GFPY_ERROR, sheet,
@@ -2179,8 +2820,8 @@ method_polyline (method_e method, PyObject *self,
   if (PyArg_ParseTupleAndKeywords (pArgs, keywds, "O|pppOid", kwlist,
 				   &points, &filled, &closed, &spline,
 				   &penobj, &intersect, &radius)) {
-    if (PyList_Check (points)) {
-      gint len =  (int)PyList_Size (points);
+    if (PyList_Check (points) || is_gfig_points (points)) {
+      gint len = is_gfig_points (points) ? 0 : (int)PyList_Size (points);
       GList *verts = NULL;	// fixme free on error
 
       if (penobj && is_gfig_pen (penobj)) {
@@ -2189,6 +2830,14 @@ method_polyline (method_e method, PyObject *self,
 	pen = copy_pen (e_pen);
       }
 
+      if (is_gfig_points (points) && points_length (points) > 0) {
+	GArray *array = ((gfig_PointsObject *)points)->points;
+	for (gint i = array->len - 1; i >= 0; i--)
+	  verts = g_list_prepend (verts,
+				  copy_point (&g_array_index (array,
+							      point_s, i)));
+      }
+
       for (gint i = 0; i < len; i++) {
 	PyObject *obj = PyList_GetItem (points, i);
 	if (PyTuple_Check (obj) && PyTuple_Size (obj) == 2) {
@@ -2219,7 +2868,8 @@ method_polyline (method_e method, PyObject *self,
 
       if (verts) {
 	if (method == METHOD_APPEND) {
-	  entity_append_polyline (sheet, verts, closed, filled, spline, pen,
+	  entity_append_polyline (sheet, verts, closed, filled, spline,
+				  pen ? : script_pen (sheet),
 				  intersect, radius);
 	  force_redraw (sheet);
 	  Py_INCREF (Py_True);
@@ -2227,7 +2877,8 @@ method_polyline (method_e method, PyObject *self,
 	}
 	else {
 	  return (void *)entity_build_polyline (sheet, verts,
-						closed, filled, spline, pen,
+						closed, filled, spline,
+						pen ? : script_pen (sheet),
 						intersect, radius);
 	}
       }
@@ -2291,6 +2942,10 @@ static PyMethodDef GfigMethods[] = {
   {"CaptureStderr", log_CaptureStderr, METH_VARARGS, "Logs stderr"},
   {"Clear", (PyCFunction)gfig_clear, METH_VARARGS | METH_KEYWORDS,
    "delete all the entities"},
+  {"Undo", (PyCFunction)gfig_undo, METH_VARARGS | METH_KEYWORDS,
+   "undo the last step, False if there was none"},
+  {"Redo", (PyCFunction)gfig_redo, METH_VARARGS | METH_KEYWORDS,
+   "redo the last undone step, False if there was none"},
   {"DrawCircle", (PyCFunction)gfig_draw_circle,
    METH_VARARGS | METH_KEYWORDS, "gfig circle"},
   {"DrawEllipseCABT", (PyCFunction)gfig_draw_ellipseCABT,
@@ -2321,6 +2976,14 @@ static PyMethodDef GfigMethods[] = {
    METH_VARARGS | METH_KEYWORDS, "draw an object"},
   {"Intersect", (PyCFunction)gfig_intersect, 
    METH_VARARGS | METH_KEYWORDS, "find the intersecting points of two objects"},
+  {"RenderStats", (PyCFunction)gfig_render_stats, 
+   METH_VARARGS | METH_KEYWORDS, "frame timings, culling and a histogram"},
+  {"MemoryStats", (PyCFunction)gfig_memory_stats, 
+   METH_VARARGS | METH_KEYWORDS, "memory held by each project and sheet"},
+  {"DefineBlock", (PyCFunction)gfig_define_block, 
+   METH_VARARGS | METH_KEYWORDS, "define a named block of objects"},
+  {"DrawBlock", (PyCFunction)gfig_draw_block, 
+   METH_VARARGS | METH_KEYWORDS, "draw an instance of a block"},
 #if 0
   {"Test", (PyCFunction)gfig_test,
    METH_VARARGS | METH_KEYWORDS, "test"},
@@ -2356,6 +3019,11 @@ PyInit_gfig(void)
   Py_INCREF(&gfig_Point);
   PyModule_AddObject(m, "Point", (PyObject *)&gfig_Point);
   
+  gfig_Points.tp_new = PyType_GenericNew;
+  PyType_Ready(&gfig_Points);
+  Py_INCREF(&gfig_Points);
+  PyModule_AddObject(m, "Points", (PyObject *)&gfig_Points);
+  
   gfig_Transform.tp_new = PyType_GenericNew;
   PyType_Ready(&gfig_Transform);
   Py_INCREF(&gfig_Transform);
@@ -2407,16 +3075,29 @@ PyInit_gfig(void)
 void *
 get_local_pydict (sheet_s *sheet)
 {
+  PyGILState_STATE gstate = PyGILState_Ensure ();
   PyObject *local_dict = PyDict_New ();
   PyObject *pysheet = PyLong_FromVoidPtr ((void *)sheet);
   PyDict_SetItemString (local_dict, SHEET_NAME, pysheet);
   Py_DECREF(pysheet);
+  PyGILState_Release (gstate);
   return (void *)local_dict;
 }
 
+/***
+    The interpreter is started by the first thing that needs it, or
+    after the first frame (see startup.c), whichever comes first.
+ ***/
+
+static gboolean python_started = FALSE;
+
 void
 init_python ()
 {
+  if (python_started) return;
+  python_started = TRUE;
+  TRACE_BEGIN ("init_python");
+
   PyImport_AppendInittab("gfig", &PyInit_gfig);
   //PyImport_AppendInittab("noddy", &PyInit_noddy);
   
@@ -2466,6 +3147,10 @@ init_python ()
 		     "gf_intersect = gfig.Intersect\n"
 		     "gf_catenate  = gfig.Catenate\n"
 		     "gf_invert    = gfig.Invert\n"
+		     "gf_block     = gfig.DefineBlock\n"
+		     "gf_insert    = gfig.DrawBlock\n"
+		     "gf_stats     = gfig.RenderStats\n"
+		     "gf_memory    = gfig.MemoryStats\n"
 #if 0
 		     "gf_scale     = gfig.SetScale\n"
 		     "gf_translate = gfig.SetTranslate\n"
@@ -2478,6 +3163,7 @@ init_python ()
 		     "gf_pline_t   = gfig.Polyline\n"
 		     "gf_text_t    = gfig.Text\n"
 		     "gf_point_t   = gfig.Point\n"
+		     "gf_points_t  = gfig.Points\n"
 		     "gf_pen_t     = gfig.Pen\n"
 		     "gf_transform_t = gfig.Transform\n"
 		     "gf_trans_t   = gfig.Transform\n"
@@ -2519,11 +3205,113 @@ init_python ()
   lcmd = g_strdup_printf ("PANGO_ALIGN_RIGHT  = %d\n", PANGO_ALIGN_RIGHT);
   PyRun_SimpleString (lcmd);
   g_free (lcmd);
+
+  worker_start ();
+  TRACE_END ("init_python");
+}
+
+/***
+    Sheets get their local dictionary when Python is first used on
+    them.  Main thread only.
+ ***/
+
+static PyObject *
+sheet_dict (sheet_s *sheet)
+{
+  init_python ();
+  if (sheet && !sheet_pydict (sheet))
+    sheet_pydict (sheet) = get_local_pydict (sheet);
+  return sheet ? sheet_pydict (sheet) : NULL;
+}
+
+/********************* compiled code cache **************/
+
+/***
+    Command lines and point expressions are mostly re-runs of things
+    already typed, so compiled code objects are kept keyed by start
+    symbol and source text, least recently used dropped first.
+ ***/
+
+#define CODE_CACHE_SIZE	64
+
+typedef struct {
+  gchar    *key;
+  PyObject *code;
+} code_entry_s;
+
+static GHashTable *code_cache = NULL;	// key -> GList link in code_lru
+static GQueue      code_lru = G_QUEUE_INIT;	// most recent at the head
+
+static void
+code_entry_free (code_entry_s *entry)
+{
+  Py_XDECREF (entry->code);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+static void
+code_cache_clear (void)
+{
+  code_entry_s *entry;
+
+  if (code_cache) {
+    g_hash_table_destroy (code_cache);
+    code_cache = NULL;
+  }
+  while ((entry = g_queue_pop_head (&code_lru)))
+    code_entry_free (entry);
+}
+
+/***
+    Returns a new reference, or NULL with the Python error set.
+ ***/
+
+static PyObject *
+compile_cached (const gchar *source, gint start)
+{
+  if (!code_cache)
+    code_cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+  gchar *key = g_strdup_printf ("%d:%s", start, source);
+  GList *link = g_hash_table_lookup (code_cache, key);
+  if (link) {
+    g_free (key);
+    g_queue_unlink (&code_lru, link);
+    g_queue_push_head_link (&code_lru, link);
+    code_entry_s *entry = link->data;
+    Py_INCREF (entry->code);
+    return entry->code;
+  }
+
+  PyObject *code = Py_CompileString (source, "<string>", start);
+  if (!code) {
+    g_free (key);
+    return NULL;
+  }
+
+  code_entry_s *entry = gfig_try_malloc0 (sizeof(code_entry_s));
+  entry->key  = key;
+  entry->code = code;
+  Py_INCREF (code);
+  g_queue_push_head (&code_lru, entry);
+  g_hash_table_insert (code_cache, key, code_lru.head);
+
+  while (g_queue_get_length (&code_lru) > CODE_CACHE_SIZE) {
+    code_entry_s *old = g_queue_pop_tail (&code_lru);
+    g_hash_table_remove (code_cache, old->key);
+    code_entry_free (old);
+  }
+
+  return code;
 }
 
 void
 term_python ()
 {
+  if (!python_started) return;
+  if (!worker_stop ()) return;		// still running; let exit take it
+  code_cache_clear ();
   Py_Finalize();
 }
 
@@ -2609,25 +3397,28 @@ python_evaluate_point (gchar *pystr, sheet_s *sheet,
     la = NAN;
     ra = NAN;
 
-    PyObject *eval = Py_CompileString(first_arg, "filename", Py_eval_input);
+    PyObject *local_dict = sheet_dict (sheet);
+    PyGILState_STATE gstate = PyGILState_Ensure ();
+    PyObject *eval = compile_cached (first_arg, Py_eval_input);
     if (eval) {
-      PyObject *local_dict = sheet_pydict (sheet);
       PyObject *result = PyEval_EvalCode(eval, global_dict, local_dict);
+      Py_DECREF(eval);
       if (result) {
 	la = get_double (result);
-	Py_DECREF(eval);
 	Py_DECREF(result);
-	eval = Py_CompileString(second_arg, "filename", Py_eval_input);
+	eval = compile_cached (second_arg, Py_eval_input);
 	if (eval) {
 	  result = PyEval_EvalCode(eval, global_dict, local_dict);
+	  Py_DECREF(eval);
 	  if (result) {
 	    ra = get_double (result);
-	    Py_DECREF(eval);
 	    Py_DECREF(result);
 	  }
 	}
       }
     }
+    if (PyErr_Occurred ()) PyErr_Print ();
+    PyGILState_Release (gstate);
     if (!isnan (la) && !isnan (ra)) {
       gdouble xv, yv;
       if (coords == COORDINATES_POLAR) {
@@ -2655,8 +3446,8 @@ python_evaluate_point (gchar *pystr, sheet_s *sheet,
 
 /********************* string and script evaluation **************/
 
-void
-evaluate_python (gchar *pystr, sheet_s *sheet)
+static void
+run_string (gchar *pystr, sheet_s *sheet)
 {
 
   /**********
@@ -2689,18 +3480,21 @@ evaluate_python (gchar *pystr, sheet_s *sheet)
 
   PyObject *local_dict = sheet_pydict (sheet);
 
-  PyObject *rc = 
-    PyRun_String (pystr,  Py_single_input, global_dict, local_dict);
+  PyObject *code = compile_cached (pystr, Py_single_input);
+  PyObject *rc =
+    code ? PyEval_EvalCode (code, global_dict, local_dict) : NULL;
+  Py_XDECREF (code);
   if (rc == NULL) {                 // error
     PyObject* ex = PyErr_Occurred();
     if (ex) {
       PyErr_Print ();
     }
   }
+  else Py_DECREF (rc);
 }
 
-void
-execute_python (const gchar *pyfile,  sheet_s *sheet)
+static void
+run_file (const gchar *pyfile,  sheet_s *sheet)
 {
 
   /**********
@@ -2741,13 +3535,357 @@ execute_python (const gchar *pyfile,  sheet_s *sheet)
   
 
   PyObject *rc = 
-    PyRun_File (fp,  pyfile, Py_file_input, global_dict, local_dict);
+    PyRun_FileEx (fp,  pyfile, Py_file_input, global_dict, local_dict, 1);
   if (rc == NULL) {                 // error
     PyObject* ex = PyErr_Occurred();
     if (ex) {
       PyErr_Print ();
     }
   }
+  else Py_DECREF (rc);
+}
+
+/********************* script worker **************/
+
+/***
+    Scripts and command lines run one at a time on a worker thread
+    so that a long generator does not stall redraws and input.  The
+    worker never touches the sheets or GTK itself: appended entities
+    and log text go on a queue that the main loop drains in batches,
+    redrawing each affected sheet once per batch, and anything that
+    needs an answer (clear, undo, redo) waits on the main loop with
+    the GIL released.  The main thread takes the GIL only for the
+    brief evaluations it does itself.
+ ***/
+
+typedef enum {
+  JOB_STRING,
+  JOB_FILE,
+  JOB_QUIT
+} job_e;
+
+typedef struct {
+  job_e		 kind;
+  gchar		*text;
+  sheet_s	*sheet;
+} job_s;
+
+typedef enum {
+  MAIN_APPEND,
+  MAIN_LOG,
+  MAIN_CALL
+} main_e;
+
+typedef struct {
+  main_e	 kind;
+  sheet_s	*sheet;
+  gpointer	 data;			// entity, log text or call data
+  log_level_e	 level;
+  main_call_f	 call;
+  gboolean	 done;
+} main_op_s;
+
+#define WORKER_STOP_USECS	(2 * G_USEC_PER_SEC)
+
+static GThread       *worker        = NULL;
+static GAsyncQueue   *worker_jobs   = NULL;
+static unsigned long  worker_ident  = 0;
+static gint           worker_busy   = 0;	// a job is running
+static gint           worker_gone   = 0;
+static sheet_s       *worker_sheet  = NULL;	// of the running job
+static PyThreadState *main_tstate   = NULL;
+
+static GMutex   main_lock;
+static GCond    main_cond;
+static GQueue   main_ops     = G_QUEUE_INIT;
+static gboolean main_armed   = FALSE;
+static gboolean main_closing = FALSE;
+
+gboolean
+python_in_worker (void)
+{
+  return worker && g_thread_self () == worker;
+}
+
+static gboolean
+main_drain (gpointer user_data)
+{
+  GQueue   batch;
+  GList   *touched = NULL;
+  main_op_s *op;
+
+  g_mutex_lock (&main_lock);
+  batch = main_ops;
+  g_queue_init (&main_ops);
+  main_armed = FALSE;
+  g_mutex_unlock (&main_lock);
+
+  while ((op = g_queue_pop_head (&batch))) {
+    if (op->kind != MAIN_LOG && op->sheet &&
+	!g_list_find (touched, op->sheet))
+      touched = g_list_prepend (touched, op->sheet);
+    switch (op->kind) {
+    case MAIN_APPEND:
+      if (!main_closing) entity_append_entity (op->sheet, op->data);
+      g_free (op);
+      break;
+    case MAIN_LOG:
+      if (!main_closing) log_string (op->level, op->sheet, op->data);
+      g_free (op->data);
+      g_free (op);
+      break;
+    case MAIN_CALL:			// the waiting worker owns op
+      if (!main_closing) (*op->call) (op->data);
+      g_mutex_lock (&main_lock);
+      op->done = TRUE;
+      g_cond_broadcast (&main_cond);
+      g_mutex_unlock (&main_lock);
+      break;
+    }
+  }
+
+  if (!main_closing)
+    for (GList *l = touched; l; l = l->next) force_redraw (l->data);
+  g_list_free (touched);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+main_push (main_op_s *op)
+{
+  g_mutex_lock (&main_lock);
+  g_queue_push_tail (&main_ops, op);
+  if (!main_armed) {
+    main_armed = TRUE;
+    g_idle_add (main_drain, NULL);
+  }
+  g_mutex_unlock (&main_lock);
+}
+
+void
+python_defer_append (sheet_s *sheet, gpointer entity)
+{
+  main_op_s *op = gfig_try_malloc0 (sizeof(main_op_s));
+  op->kind  = MAIN_APPEND;
+  op->sheet = sheet;
+  op->data  = entity;
+  main_push (op);
+}
+
+void
+python_defer_log (log_level_e level, sheet_s *sheet, const gchar *str)
+{
+  main_op_s *op = gfig_try_malloc0 (sizeof(main_op_s));
+  op->kind  = MAIN_LOG;
+  op->sheet = sheet;
+  op->data  = g_strdup (str);
+  op->level = level;
+  main_push (op);
+}
+
+/***
+    Run call on the main thread, in order with everything queued
+    before it, and wait for it.  Called with the GIL held.
+ ***/
+
+static void
+call_main (main_call_f call, sheet_s *sheet, gpointer data)
+{
+  if (!python_in_worker ()) {
+    (*call) (data);
+    return;
+  }
+
+  main_op_s op = {0};
+  op.kind  = MAIN_CALL;
+  op.sheet = sheet;
+  op.data  = data;
+  op.call  = call;
+
+  Py_BEGIN_ALLOW_THREADS
+  main_push (&op);
+  g_mutex_lock (&main_lock);
+  while (!op.done) g_cond_wait (&main_cond, &main_lock);
+  g_mutex_unlock (&main_lock);
+  Py_END_ALLOW_THREADS
+}
+
+static void
+job_free (job_s *job)
+{
+  g_free (job->text);
+  g_free (job);
+}
+
+static gpointer
+worker_main (gpointer data)
+{
+  PyGILState_STATE gstate = PyGILState_Ensure ();
+  worker_ident = PyThread_get_thread_ident ();
+  PyGILState_Release (gstate);
+
+  for (;;) {
+    job_s *job = g_async_queue_pop (worker_jobs);
+    if (job->kind == JOB_QUIT) {
+      job_free (job);
+      break;
+    }
+
+    gstate = PyGILState_Ensure ();
+    g_atomic_pointer_set (&worker_sheet, job->sheet);
+    g_atomic_int_set (&worker_busy, 1);
+    if (job->kind == JOB_STRING) {
+      TRACE_BEGIN ("evaluate_python");
+      run_string (job->text, job->sheet);
+      TRACE_END ("evaluate_python");
+    }
+    else {
+      TRACE_BEGIN ("execute_python");
+      run_file (job->text, job->sheet);
+      TRACE_END ("execute_python");
+    }
+    g_atomic_int_set (&worker_busy, 0);
+    g_atomic_pointer_set (&worker_sheet, NULL);
+    if (script_pens) g_hash_table_remove_all (script_pens);
+    // an interrupt that came too late must not hit the next job
+    PyThreadState_SetAsyncExc (worker_ident, NULL);
+    PyGILState_Release (gstate);
+    job_free (job);
+  }
+
+  g_atomic_int_set (&worker_gone, 1);
+  return NULL;
+}
+
+static void
+worker_submit (job_e kind, const gchar *text, sheet_s *sheet)
+{
+  job_s *job = gfig_try_malloc0 (sizeof(job_s));
+  job->kind  = kind;
+  job->text  = g_strdup (text);
+  job->sheet = sheet;
+  g_async_queue_push (worker_jobs, job);
+}
+
+static void
+worker_start (void)
+{
+  worker_jobs = g_async_queue_new ();
+  worker = g_thread_new ("python", worker_main, NULL);
+  main_tstate = PyEval_SaveThread ();
+}
+
+/***
+    A script that ignores KeyboardInterrupt, or is stuck in C, would
+    hold up quitting for ever, so the wait is bounded.  FALSE if the
+    worker is still running; it is left to die with the process.
+ ***/
+
+static gboolean
+worker_stop (void)
+{
+  if (!worker) return TRUE;
+
+  python_cancel ();
+  main_closing = TRUE;
+  worker_submit (JOB_QUIT, NULL, NULL);
+  gint64 until = g_get_monotonic_time () + WORKER_STOP_USECS;
+  while (!g_atomic_int_get (&worker_gone)) {
+    if (g_get_monotonic_time () >= until) return FALSE;
+    main_drain (NULL);			// release a worker waiting on us
+    g_usleep (1000);
+  }
+  g_thread_join (worker);
+  worker = NULL;
+  main_drain (NULL);
+  g_async_queue_unref (worker_jobs);
+  PyEval_RestoreThread (main_tstate);
+  return TRUE;
+}
+
+/***
+    Drop queued jobs and raise KeyboardInterrupt in the running one.
+ ***/
+
+void
+python_cancel (void)
+{
+  job_s *job;
+
+  if (!worker) return;
+  while ((job = g_async_queue_try_pop (worker_jobs))) job_free (job);
+
+  PyGILState_STATE gstate = PyGILState_Ensure ();
+  if (g_atomic_int_get (&worker_busy))
+    PyThreadState_SetAsyncExc (worker_ident, PyExc_KeyboardInterrupt);
+  PyGILState_Release (gstate);
+}
+
+static gboolean
+release_sheet_dict (sheet_s *sheet)
+{
+  if (sheet_pydict (sheet)) {
+    PyGILState_STATE gstate = PyGILState_Ensure ();
+    Py_XDECREF ((PyObject *)sheet_pydict (sheet));
+    sheet_pydict (sheet) = NULL;
+    PyGILState_Release (gstate);
+  }
+  return TRUE;
+}
+
+/***
+    The sheet is going away: drop its queued jobs and stop its running
+    one, then apply whatever the worker left for it and release its
+    dictionary.  FALSE if the job would not stop in time, in which
+    case the sheet must be kept.
+ ***/
+
+gboolean
+python_forget_sheet (sheet_s *sheet)
+{
+  GQueue keep = G_QUEUE_INIT;
+  job_s *job;
+
+  if (!sheet) return TRUE;
+  if (!worker) return release_sheet_dict (sheet);
+
+  g_async_queue_lock (worker_jobs);
+  while ((job = g_async_queue_try_pop_unlocked (worker_jobs))) {
+    if (job->sheet == sheet) job_free (job);
+    else g_queue_push_tail (&keep, job);
+  }
+  while ((job = g_queue_pop_head (&keep)))
+    g_async_queue_push_unlocked (worker_jobs, job);
+  g_async_queue_unlock (worker_jobs);
+
+  if (g_atomic_pointer_get (&worker_sheet) == sheet) {
+    PyGILState_STATE gstate = PyGILState_Ensure ();
+    if (g_atomic_pointer_get (&worker_sheet) == sheet)
+      PyThreadState_SetAsyncExc (worker_ident, PyExc_KeyboardInterrupt);
+    PyGILState_Release (gstate);
+  }
+  gint64 until = g_get_monotonic_time () + WORKER_STOP_USECS;
+  while (g_atomic_pointer_get (&worker_sheet) == sheet) {
+    if (g_get_monotonic_time () >= until) return FALSE;
+    main_drain (NULL);			// release a worker waiting on us
+    g_usleep (1000);
+  }
+  main_drain (NULL);
+  return release_sheet_dict (sheet);
+}
+
+void
+evaluate_python (gchar *pystr, sheet_s *sheet)
+{
+  sheet_dict (sheet);
+  worker_submit (JOB_STRING, pystr, sheet);
+}
+
+void
+execute_python (const gchar *pyfile,  sheet_s *sheet)
+{
+  sheet_dict (sheet);
+  worker_submit (JOB_FILE, pyfile, sheet);
 }
 
 static gboolean
@@ -2783,6 +3921,82 @@ is_gfig_entity (PyObject *xobj)
   // fixme add the rest when they happen
 }
 
+static gboolean
+is_gfig_object (PyObject *xobj)
+{
+  return is_gfig_entity (xobj) ||
+    (xobj && ((Py_TYPE (xobj) == &gfig_Pen)       ||
+	      (Py_TYPE (xobj) == &gfig_Point)     ||
+	      (Py_TYPE (xobj) == &gfig_Transform) ||
+	      (Py_TYPE (xobj) == &gfig_Scale)     ||
+	      (Py_TYPE (xobj) == &gfig_Translate) ||
+	      (Py_TYPE (xobj) == &gfig_Rotate)));
+}
+
+static gsize
+py_sizeof (PyObject *obj)
+{
+  gsize size = Py_TYPE (obj)->tp_basicsize;
+  PyObject *getsizeof = PySys_GetObject ("getsizeof");	// borrowed
+  PyObject *rc = getsizeof ?
+    PyObject_CallFunctionObjArgs (getsizeof, obj, NULL) : NULL;
+  if (rc) {
+    size = PyLong_AsSize_t (rc);
+    Py_DECREF (rc);
+  }
+  if (PyErr_Occurred ()) PyErr_Clear ();
+  return size;
+}
+
+static void
+py_value_memory (PyObject *obj, gsize *bytes_p, guint *wrappers_p)
+{
+  *bytes_p += py_sizeof (obj);
+  if (is_gfig_object (obj)) {
+    (*wrappers_p)++;
+    gfig_GenericObject *gobj = (gfig_GenericObject *)obj;
+    if (is_gfig_entity (obj) && gobj->entity)
+      *bytes_p += entity_size (gobj->entity);
+  }
+}
+
+/***
+    The local dictionary of a sheet and the values in it, one level
+    into lists and tuples, with the gfig objects among them and the
+    entities they own.  Called on the main thread; the worker lets go
+    of the interpreter lock while it waits in call_main.
+ ***/
+
+void
+python_memory (sheet_s *sheet, gsize *bytes_p, guint *wrappers_p)
+{
+  gsize bytes = 0;
+  guint wrappers = 0;
+  PyObject *dict = sheet ? sheet_pydict (sheet) : NULL;
+
+  if (dict) {
+    PyGILState_STATE gstate = PyGILState_Ensure ();
+    bytes = py_sizeof (dict);
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next (dict, &pos, &key, &value)) {
+      bytes += py_sizeof (key);
+      py_value_memory (value, &bytes, &wrappers);
+      if (PyList_Check (value) || PyTuple_Check (value)) {
+	PyObject *seq = PySequence_Fast (value, "");
+	Py_ssize_t n = seq ? PySequence_Fast_GET_SIZE (seq) : 0;
+	for (Py_ssize_t i = 0; i < n; i++)
+	  py_value_memory (PySequence_Fast_GET_ITEM (seq, i),
+			   &bytes, &wrappers);
+	Py_XDECREF (seq);
+      }
+    }
+    PyGILState_Release (gstate);
+  }
+  if (bytes_p)    *bytes_p    = bytes;
+  if (wrappers_p) *wrappers_p = wrappers;
+}
+
 static gboolean
 entry_key_press_cb (GtkWidget *widget,
 		    GdkEvent  *event,
@@ -8,6 +8,12 @@ void  init_python ();
 void  evaluate_python (gchar *pystr, sheet_s *sheet);
 void  execute_python (const gchar *pyfile, sheet_s *sheet);
 void *get_local_pydict (sheet_s *sheet);
+gboolean python_in_worker (void);
+void python_defer_append (sheet_s *sheet, gpointer entity);
+void python_defer_log (log_level_e level, sheet_s *sheet, const gchar *str);
+void python_cancel (void);
+gboolean python_forget_sheet (sheet_s *sheet);
+void python_memory (sheet_s *sheet, gsize *bytes_p, guint *wrappers_p);
 gboolean python_evaluate_point (gchar *pystr, sheet_s *sheet,
 	  		        gdouble *xvp, gdouble *yvp);
 void evaluate_point (sheet_s *sheet, gdouble *pxip, gdouble *pyip,
@@ -18,6 +18,7 @@ typedef struct {
   GtkWidget        *origin_draw;
   GtkWidget        *grid_draw;
   GtkWidget        *grid_snap;
+  GtkWidget        *object_snap;
   GtkWidget        *grid_value;
 } scale_private_data_s;
 #define scale_inches(p)		(p)->inches
@@ -29,6 +30,7 @@ typedef struct {
 #define scale_org_draw(p)	(p)->origin_draw
 #define scale_grid_draw(p)	(p)->grid_draw
 #define scale_grid_snap(p)	(p)->grid_snap
+#define scale_object_snap(p)	(p)->object_snap
 #define scale_grid_value(p)	(p)->grid_value
 
 GtkWidget *
@@ -99,6 +101,13 @@ select_scale (void **private_data, environment_s *env)
   gtk_box_pack_start (GTK_BOX (hbox), GTK_WIDGET (scale_grid_snap (ppd)),
 		    FALSE, FALSE, 2);
 
+  scale_object_snap (ppd) =
+    gtk_check_button_new_with_label (_ ("Snap to Objects"));
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (scale_object_snap (ppd)),
+						   environment_snap_objects (env));
+  gtk_box_pack_start (GTK_BOX (hbox), GTK_WIDGET (scale_object_snap (ppd)),
+		    FALSE, FALSE, 2);
+
 
   GtkWidget *lbl = gtk_label_new (_ ("Grid point"));
   gtk_box_pack_start (GTK_BOX (hbox), GTK_WIDGET (lbl), FALSE, FALSE, 2);
@@ -235,6 +244,11 @@ extract_scale (void *private_data, environment_s *env)
       gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (scale_grid_snap (ppd)));
   }
 
+  if (scale_object_snap (ppd)) {
+    environment_snap_objects (env) =
+      gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (scale_object_snap (ppd)));
+  }
+
   if (scale_grid_value (ppd)) {
     environment_target_grid (env) =
       gtk_spin_button_get_value (GTK_SPIN_BUTTON (scale_grid_value (ppd)));
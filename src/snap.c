@@ -0,0 +1,444 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <math.h>
+
+#include "gf.h"
+#include "utilities.h"
+#include "pick.h"
+#include "snap.h"
+
+#if 0 // comments
+
+     Object snapping.  The fixed snap points of each entity --
+     endpoints, midpoints, centres and quadrants -- are kept in a
+     hash of square cells, so a query looks at the handful of cells
+     around the pointer whatever the size of the sheet.  The cells
+     are filled as the pick index collects entities (see pick.c),
+     and entities are added and removed from them one at a time as
+     the pick index sees them change.  Block instances are the
+     exception: the points of the few near the pointer are worked out
+     per query, so a block drawn ten thousand times is not stored ten
+     thousand times over.
+
+     Intersections are not stored: there are too many and most are
+     never wanted.  They are worked out on demand from the entities
+     pick.c finds within the tolerance of the pointer.
+
+     With nothing in reach the point falls back to the grid.
+
+#endif
+
+#define SNAP_CELLS	256		// cells across the larger paper side
+#define SNAP_MAX_CELLS	256		// visited before scanning them all
+
+typedef struct {
+  gdouble   x;
+  gdouble   y;
+  snap_e    kind;
+  gpointer  top;
+} snap_point_s;
+
+typedef struct {
+  gint64    key;
+  GArray   *points;			// snap_point_s
+} snap_cell_s;
+
+typedef struct {
+  gdouble     cell;			// cell side, sheet units
+  GHashTable *cells;			// gint64 * -> snap_cell_s
+  GHashTable *owners;			// top entity -> GArray of gint64
+  snap_e      marker;			// last object snap, for the view
+  point_s     marker_point;
+} snap_grid_s;
+
+
+static gint64
+cell_key (snap_grid_s *grid, gint64 ix, gint64 iy)
+{
+  return (ix << 32) ^ (iy & 0xffffffff);
+}
+
+static gint64
+cell_index (snap_grid_s *grid, gdouble v)
+{
+  return (gint64)floor (v / grid->cell);
+}
+
+static void
+cell_free (gpointer data)
+{
+  snap_cell_s *cell = data;
+  g_array_free (cell->points, TRUE);
+  g_free (cell);
+}
+
+static void
+owner_free (gpointer data)
+{
+  g_array_free (data, TRUE);
+}
+
+static snap_grid_s *
+grid_new (sheet_s *sheet)
+{
+  environment_s *env = sheet_environment (sheet);
+  paper_s *paper = environment_paper (env);
+
+  snap_grid_s *grid = gfig_try_malloc0 (sizeof(snap_grid_s));
+  grid->cell = MAX (paper_h_dim (paper), paper_v_dim (paper)) *
+    environment_uupdu (env) / (gdouble)SNAP_CELLS;
+  if (!(grid->cell > 0.0)) grid->cell = 1.0;
+  grid->cells  = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+					NULL, cell_free);
+  grid->owners = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					NULL, owner_free);
+  return grid;
+}
+
+static void
+grid_free (snap_grid_s *grid)
+{
+  g_hash_table_destroy (grid->cells);
+  g_hash_table_destroy (grid->owners);
+  g_free (grid);
+}
+
+static snap_grid_s *
+grid_get (sheet_s *sheet)
+{
+  snap_grid_s *grid = sheet_snap (sheet);
+  if (!grid) grid = sheet_snap (sheet) = grid_new (sheet);
+  return grid;
+}
+
+static void
+add_point (snap_grid_s *grid, gpointer top, const cairo_matrix_t *matrix,
+	   gdouble x, gdouble y, snap_e kind)
+{
+  if (matrix) cairo_matrix_transform_point (matrix, &x, &y);
+  if (isnan (x) || isnan (y)) return;
+
+  gint64 key = cell_key (grid, cell_index (grid, x), cell_index (grid, y));
+  snap_cell_s *cell = g_hash_table_lookup (grid->cells, &key);
+  if (!cell) {
+    cell = gfig_try_malloc0 (sizeof(snap_cell_s));
+    cell->key = key;
+    cell->points = g_array_new (FALSE, FALSE, sizeof(snap_point_s));
+    g_hash_table_insert (grid->cells, &cell->key, cell);
+  }
+
+  snap_point_s point = {x, y, kind, top};
+  g_array_append_val (cell->points, point);
+
+  GArray *keys = g_hash_table_lookup (grid->owners, top);
+  if (!keys) {
+    keys = g_array_new (FALSE, FALSE, sizeof(gint64));
+    g_hash_table_insert (grid->owners, top, keys);
+  }
+  g_array_append_val (keys, key);
+}
+
+/***
+    Points on a circular or elliptical arc: the centre, the ends if
+    it is open, and those of the four quadrant points the arc
+    passes through.  (cx, cy) + (ux, uy) cos(a) + (vx, vy) sin(a).
+ ***/
+
+static void
+add_arc (snap_grid_s *grid, gpointer top, const cairo_matrix_t *matrix,
+	 gdouble cx, gdouble cy, gdouble ux, gdouble uy,
+	 gdouble vx, gdouble vy, gdouble start, gdouble stop,
+	 gboolean negative)
+{
+  gdouble sweep;
+  if (negative) {
+    if (stop > start)
+      stop -= 2.0 * G_PI * ceil ((stop - start) / (2.0 * G_PI));
+    sweep = MAX (stop - start, -2.0 * G_PI);
+  }
+  else {
+    if (stop < start)
+      stop += 2.0 * G_PI * ceil ((start - stop) / (2.0 * G_PI));
+    sweep = MIN (stop - start, 2.0 * G_PI);
+  }
+
+  add_point (grid, top, matrix, cx, cy, SNAP_CENTRE);
+  for (gint q = 0; q < 4; q++) {
+    gdouble a = (gdouble)q * G_PI / 2.0;
+    gdouble d = fmod (a - start, 2.0 * G_PI);
+    if (sweep >= 0.0) {
+      if (d < 0.0) d += 2.0 * G_PI;
+      if (d > sweep) continue;
+    }
+    else {
+      if (d > 0.0) d -= 2.0 * G_PI;
+      if (d < sweep) continue;
+    }
+    add_point (grid, top, matrix,
+	       cx + ux * cos (a) + vx * sin (a),
+	       cy + uy * cos (a) + vy * sin (a), SNAP_QUADRANT);
+  }
+  if (fabs (sweep) < 2.0 * G_PI) {
+    add_point (grid, top, matrix,
+	       cx + ux * cos (start) + vx * sin (start),
+	       cy + uy * cos (start) + vy * sin (start), SNAP_ENDPOINT);
+    add_point (grid, top, matrix,
+	       cx + ux * cos (start + sweep) + vx * sin (start + sweep),
+	       cy + uy * cos (start + sweep) + vy * sin (start + sweep),
+	       SNAP_ENDPOINT);
+  }
+}
+
+static void
+grid_add (snap_grid_s *grid, gpointer top, gpointer entity,
+	  const cairo_matrix_t *matrix)
+{
+  switch (entity_type (entity)) {
+  case ENTITY_TYPE_CIRCLE:
+    {
+      entity_circle_s *circle = entity;
+      gdouble r = entity_circle_r (circle);
+      add_arc (grid, top, matrix,
+	       entity_circle_x (circle), entity_circle_y (circle),
+	       r, 0.0, 0.0, r,
+	       entity_circle_start (circle), entity_circle_stop (circle),
+	       entity_circle_negative (circle));
+    }
+    break;
+  case ENTITY_TYPE_ELLIPSE:
+    {
+      entity_ellipse_s *ellipse = entity;
+      gdouble a  = entity_ellipse_a (ellipse);
+      gdouble b  = entity_ellipse_b (ellipse);
+      gdouble ct = cos (entity_ellipse_t (ellipse));
+      gdouble st = sin (entity_ellipse_t (ellipse));
+      add_arc (grid, top, matrix,
+	       entity_ellipse_x (ellipse), entity_ellipse_y (ellipse),
+	       a * ct, -a * st, b * st, b * ct,
+	       entity_ellipse_start (ellipse), entity_ellipse_stop (ellipse),
+	       entity_ellipse_negative (ellipse));
+    }
+    break;
+  case ENTITY_TYPE_POLYLINE:
+    {
+      entity_polyline_s *polyline = entity;
+      GList *verts = entity_polyline_verts (polyline);
+      point_s *first = verts ? verts->data : NULL;
+      point_s *prev  = NULL;
+
+      if (entity_polyline_spline (polyline)) {	// points on the curve
+	guint n = g_list_length (verts);
+	gint i = 0;
+	for (GList *l = verts; l; l = l->next, i++)
+	  if (i == 0 || i >= 3 || n < 4)
+	    add_point (grid, top, matrix, point_x ((point_s *)l->data),
+		       point_y ((point_s *)l->data), SNAP_ENDPOINT);
+	break;
+      }
+
+      for (GList *l = verts; l; l = l->next) {
+	point_s *p = l->data;
+	add_point (grid, top, matrix, point_x (p), point_y (p),
+		   SNAP_ENDPOINT);
+	if (prev)
+	  add_point (grid, top, matrix,
+		     (point_x (prev) + point_x (p)) / 2.0,
+		     (point_y (prev) + point_y (p)) / 2.0, SNAP_MIDPOINT);
+	prev = p;
+      }
+      if (prev && prev != first &&
+	  (entity_polyline_closed (polyline) ||
+	   entity_polyline_filled (polyline)))
+	add_point (grid, top, matrix,
+		   (point_x (prev) + point_x (first)) / 2.0,
+		   (point_y (prev) + point_y (first)) / 2.0, SNAP_MIDPOINT);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/***
+    Called by pick.c for each leaf entity it indexes, with the
+    transform that carries the leaf onto the sheet.
+ ***/
+
+void
+snap_add (sheet_s *sheet, gpointer top, gpointer entity,
+	  const cairo_matrix_t *matrix)
+{
+  if (sheet && entity) grid_add (grid_get (sheet), top, entity, matrix);
+}
+
+void
+snap_remove (sheet_s *sheet, gpointer top)
+{
+  snap_grid_s *grid = sheet ? sheet_snap (sheet) : NULL;
+  if (!grid) return;
+
+  GArray *keys = g_hash_table_lookup (grid->owners, top);
+  if (!keys) return;
+
+  for (guint k = 0; k < keys->len; k++) {
+    gint64 key = g_array_index (keys, gint64, k);
+    snap_cell_s *cell = g_hash_table_lookup (grid->cells, &key);
+    if (!cell) continue;			// already emptied
+    for (guint i = cell->points->len; i > 0; i--)
+      if (g_array_index (cell->points, snap_point_s, i - 1).top == top)
+	g_array_remove_index_fast (cell->points, i - 1);
+    if (cell->points->len == 0) g_hash_table_remove (grid->cells, &key);
+  }
+  g_hash_table_remove (grid->owners, top);
+}
+
+void
+snap_invalidate (sheet_s *sheet)
+{
+  snap_grid_s *grid = sheet ? sheet_snap (sheet) : NULL;
+  if (!grid) return;
+
+  grid_free (grid);
+  sheet_snap (sheet) = NULL;
+}
+
+static void
+nearest_in_cell (snap_cell_s *cell, gdouble x, gdouble y,
+		 gdouble *best_p, snap_point_s **point_p)
+{
+  for (guint i = 0; i < cell->points->len; i++) {
+    snap_point_s *p = &g_array_index (cell->points, snap_point_s, i);
+    gdouble d = hypot (p->x - x, p->y - y);
+    if (d < *best_p || (d == *best_p && *point_p && p->kind < (*point_p)->kind)) {
+      *best_p  = d;
+      *point_p = p;
+    }
+  }
+}
+
+static void
+near_leaf (gpointer top, gpointer entity, const cairo_matrix_t *matrix,
+	   gpointer data)
+{
+  grid_add (data, top, entity, matrix);
+}
+
+/***
+    Move (*pxp, *pyp) to the nearest snap point within tolerance,
+    in sheet units, or failing that to the grid.  Returns what it
+    snapped to.
+ ***/
+
+snap_e
+snap_point (sheet_s *sheet, gdouble *pxp, gdouble *pyp, gdouble tolerance)
+{
+  if (!sheet || !pxp || !pyp) return SNAP_NONE;
+
+  environment_s *env = sheet_environment (sheet);
+  gdouble x = *pxp;
+  gdouble y = *pyp;
+  snap_e kind = SNAP_NONE;
+  gdouble best = tolerance;
+  snap_grid_s *last = sheet_snap (sheet);
+
+  if (last) last->marker = SNAP_NONE;
+  if (environment_snap_objects (env) && !isnan (x) && !isnan (y)) {
+    pick_ensure (sheet);			// fills the cells too
+    snap_grid_s *grid = sheet_snap (sheet);
+    snap_point_s *found = NULL;
+
+    if (grid) {
+      gint64 x0 = cell_index (grid, x - tolerance);
+      gint64 x1 = cell_index (grid, x + tolerance);
+      gint64 y0 = cell_index (grid, y - tolerance);
+      gint64 y1 = cell_index (grid, y + tolerance);
+
+      if ((x1 - x0 + 1) * (y1 - y0 + 1) >
+	  MIN (SNAP_MAX_CELLS, g_hash_table_size (grid->cells))) {
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init (&iter, grid->cells);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+	  nearest_in_cell (value, x, y, &best, &found);
+      }
+      else {
+	for (gint64 ix = x0; ix <= x1; ix++)
+	  for (gint64 iy = y0; iy <= y1; iy++) {
+	    gint64 key = cell_key (grid, ix, iy);
+	    snap_cell_s *cell = g_hash_table_lookup (grid->cells, &key);
+	    if (cell) nearest_in_cell (cell, x, y, &best, &found);
+	  }
+      }
+      /***
+	  Leaves inside block instances aren't in the cells; their
+	  points go in a grid of their own, for this query only.
+       ***/
+      snap_grid_s *near = grid_new (sheet);
+      pick_instance_leaves (sheet, x, y, tolerance, near_leaf, near);
+      GHashTableIter iter;
+      gpointer value;
+      g_hash_table_iter_init (&iter, near->cells);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+	nearest_in_cell (value, x, y, &best, &found);
+
+      if (found) {
+	kind = found->kind;
+	*pxp = found->x;
+	*pyp = found->y;
+      }
+      grid_free (near);
+    }
+
+    point_s isect;
+    if (pick_intersection (sheet, x, y, best, &isect) &&
+	hypot (point_x (&isect) - x, point_y (&isect) - y) < best) {
+      kind = SNAP_INTERSECTION;
+      *pxp = point_x (&isect);
+      *pyp = point_y (&isect);
+    }
+
+    if ((grid = sheet_snap (sheet))) {
+      grid->marker = kind;
+      point_x (&grid->marker_point) = *pxp;
+      point_y (&grid->marker_point) = *pyp;
+    }
+  }
+
+  if (kind == SNAP_NONE && environment_snap_grid (env)) {
+    snap_to_grid (env, pxp, pyp);
+    kind = SNAP_GRID;
+  }
+  return kind;
+}
+
+/***
+    The object snap found by the last snap_point, for marking in the
+    view.
+ ***/
+
+snap_e
+snap_marker (sheet_s *sheet, point_s *point)
+{
+  snap_grid_s *grid = sheet ? sheet_snap (sheet) : NULL;
+  if (!grid) return SNAP_NONE;
+  if (point) *point = grid->marker_point;
+  return grid->marker;
+}
+
+const gchar *
+snap_name (snap_e kind)
+{
+  switch (kind) {
+  case SNAP_GRID:		return _ ("grid");
+  case SNAP_ENDPOINT:		return _ ("endpoint");
+  case SNAP_MIDPOINT:		return _ ("midpoint");
+  case SNAP_CENTRE:		return _ ("centre");
+  case SNAP_QUADRANT:		return _ ("quadrant");
+  case SNAP_INTERSECTION:	return _ ("intersection");
+  default:			return "";
+  }
+}
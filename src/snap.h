@@ -0,0 +1,26 @@
+#ifndef SNAP_H
+#define SNAP_H
+
+#define SNAP_TOLERANCE	6.0		// in pixels
+
+typedef enum {
+  SNAP_NONE,
+  SNAP_GRID,
+  SNAP_ENDPOINT,
+  SNAP_MIDPOINT,
+  SNAP_CENTRE,
+  SNAP_QUADRANT,
+  SNAP_INTERSECTION
+} snap_e;
+
+snap_e snap_point (sheet_s *sheet, gdouble *pxp, gdouble *pyp,
+		   gdouble tolerance);
+snap_e snap_marker (sheet_s *sheet, point_s *point);
+const gchar *snap_name (snap_e kind);
+
+void snap_add (sheet_s *sheet, gpointer top, gpointer entity,
+	       const cairo_matrix_t *matrix);
+void snap_remove (sheet_s *sheet, gpointer top);
+void snap_invalidate (sheet_s *sheet);
+
+#endif  /* SNAP_H */
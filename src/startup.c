@@ -0,0 +1,138 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+
+#include "gf.h"
+#include "trace.h"
+#include "startup.h"
+
+#if 0 // comments
+
+     Startup timing and deferred initialisation.  main calls
+     startup_begin first and startup_phase at the end of each step,
+     so every phase is timed from the one before.  Work the first
+     window does not need, the Python interpreter, the colour store
+     and the plugin scan, is handed to startup_defer instead of being
+     done in main.  Deferred work runs in low priority idle callbacks,
+     one task at a time, starting after the first frame of the main
+     window is drawn.  Each task is also safe to start early: anything
+     that needs it first does its own initialisation, which makes the
+     deferred call a no op.
+
+     Every phase and task is a trace event as well.  If GF3_STARTUP is
+     set, the times are written to the log once the last deferred
+     task is done.
+
+#endif
+
+typedef struct {
+  const gchar	*name;			// a string literal
+  gdouble	 ms;			// since the previous mark
+  gdouble	 at_ms;			// since startup_begin
+} startup_mark_s;
+
+typedef struct {
+  const gchar	*name;
+  startup_f	 fcn;
+} startup_task_s;
+
+static gint64  start_us   = 0;
+static gint64  last_us    = 0;
+static GArray *marks      = NULL;	// startup_mark_s
+static GQueue  tasks      = G_QUEUE_INIT;
+static gulong  draw_id    = 0;
+
+void
+startup_begin (void)
+{
+  start_us = last_us = g_get_monotonic_time ();
+  if (!marks) marks = g_array_new (FALSE, FALSE, sizeof(startup_mark_s));
+  TRACE_BEGIN ("startup");
+}
+
+void
+startup_phase (const gchar *name)
+{
+  if (!marks) return;
+
+  gint64 now = g_get_monotonic_time ();
+  startup_mark_s mark;
+  mark.name  = name;
+  mark.ms    = (gdouble)(now - last_us) / 1000.0;
+  mark.at_ms = (gdouble)(now - start_us) / 1000.0;
+  g_array_append_val (marks, mark);
+  last_us = now;
+}
+
+void
+startup_defer (const gchar *name, startup_f fcn)
+{
+  startup_task_s *task = gfig_try_malloc0 (sizeof(startup_task_s));
+  task->name = name;
+  task->fcn  = fcn;
+  g_queue_push_tail (&tasks, task);
+}
+
+/***
+    The times so far, one line per mark.  The caller frees it.
+ ***/
+
+gchar *
+startup_report (void)
+{
+  GString *report = g_string_new (_ ("Startup times:\n"));
+  for (guint i = 0; marks && i < marks->len; i++) {
+    startup_mark_s *mark = &g_array_index (marks, startup_mark_s, i);
+    g_string_append_printf (report, "  %-16s %9.3f ms  at %9.3f ms\n",
+			    mark->name, mark->ms, mark->at_ms);
+  }
+  return g_string_free (report, FALSE);
+}
+
+static gboolean
+startup_idle (gpointer data)
+{
+  startup_task_s *task = g_queue_pop_head (&tasks);
+
+  if (task) {
+    last_us = g_get_monotonic_time ();
+    TRACE_BEGIN (task->name);
+    (*task->fcn) ();
+    TRACE_END (task->name);
+    startup_phase (task->name);
+    g_free (task);
+  }
+  if (!g_queue_is_empty (&tasks)) return G_SOURCE_CONTINUE;
+
+  if (g_getenv ("GF3_STARTUP")) {
+    gchar *report = startup_report ();
+    log_string (LOG_NORMAL, NULL, report);
+    g_free (report);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+startup_drawn (GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+  g_signal_handler_disconnect (widget, draw_id);
+  draw_id = 0;
+  startup_phase ("first frame");
+  TRACE_END ("startup");
+  g_idle_add_full (G_PRIORITY_LOW, startup_idle, NULL, NULL);
+  return GDK_EVENT_PROPAGATE;
+}
+
+/***
+    Starts the deferred tasks once window has drawn its first frame.
+ ***/
+
+void
+startup_first_frame (GtkWidget *window)
+{
+  draw_id = g_signal_connect_after (window, "draw",
+				    G_CALLBACK (startup_drawn), NULL);
+}
@@ -0,0 +1,12 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+typedef void (*startup_f) (void);
+
+void startup_begin (void);
+void startup_phase (const gchar *name);
+void startup_defer (const gchar *name, startup_f fcn);
+void startup_first_frame (GtkWidget *window);
+gchar *startup_report (void);
+
+#endif  /* STARTUP_H */
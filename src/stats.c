@@ -0,0 +1,203 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "gf.h"
+#include "stats.h"
+
+#if 0 // comments
+
+     Render statistics.  da_draw_cb brackets each frame with
+     stats_frame_begin and stats_frame_end; in between, stats_frame
+     returns the frame being counted, and the display list and
+     draw_entities add to it: entries drawn and culled, matrix and
+     style changes, and, when detail is on, the time spent on each
+     entry by entity type and split text against geometry.  Timing
+     each entry costs two clock reads, so it is off unless asked for.
+
+     The totals of the last STATS_RING frames are kept in a ring, from
+     which stats_snapshot works out percentiles and a histogram of
+     frame times in buckets doubling from half a millisecond, so a
+     slow drawing can be measured as it is used, not just when it is
+     profiled.  All of this lives on the main thread; python.c takes
+     its snapshot through call_main.
+
+#endif
+
+static frame_stats_s  current;
+static frame_stats_s  last;
+static gboolean       in_frame = FALSE;
+static gint64         frame_start;
+static gboolean       detail = FALSE;
+static gboolean       hud = FALSE;
+static gdouble        ring[STATS_RING];
+static guint          ring_next = 0;
+static guint          ring_len = 0;
+static guint64        frames = 0;
+
+gint64
+stats_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+stats_frame_begin (void)
+{
+  memset (&current, 0, sizeof(frame_stats_s));
+  in_frame = TRUE;
+  frame_start = stats_now ();
+}
+
+void
+stats_frame_end (void)
+{
+  if (!in_frame) return;
+  in_frame = FALSE;
+  current.total_ms = (gdouble)(stats_now () - frame_start) / 1.0e6;
+  last = current;
+  ring[ring_next] = current.total_ms;
+  ring_next = (ring_next + 1) % STATS_RING;
+  if (ring_len < STATS_RING) ring_len++;
+  frames++;
+}
+
+frame_stats_s *
+stats_frame (void)
+{
+  return in_frame ? &current : NULL;
+}
+
+gboolean
+stats_detail (void)
+{
+  return in_frame && detail;
+}
+
+void
+stats_set_detail (gboolean on)
+{
+  detail = on;
+}
+
+/***
+    Charges the time since start to the entity's type.
+ ***/
+
+void
+stats_entry (gpointer entity, gint64 start)
+{
+  entity_type_e type = entity_type (entity);
+  gdouble ms = (gdouble)(stats_now () - start) / 1.0e6;
+
+  if (type < STATS_TYPES) {
+    current.type_ms[type] += ms;
+    current.type_count[type]++;
+  }
+  if (type == ENTITY_TYPE_TEXT) current.text_ms += ms;
+  else current.geometry_ms += ms;
+}
+
+gdouble
+stats_bucket_limit (gint bucket)
+{
+  return (bucket < STATS_BUCKETS - 1) ? ldexp (0.5, bucket) : INFINITY;
+}
+
+static gint
+ms_compare (gconstpointer a, gconstpointer b)
+{
+  gdouble d = *(const gdouble *)a - *(const gdouble *)b;
+  return (d < 0.0) ? -1 : (d > 0.0);
+}
+
+void
+stats_snapshot (render_stats_s *rs)
+{
+  memset (rs, 0, sizeof(render_stats_s));
+  rs->last     = last;
+  rs->frames   = frames;
+  rs->ring_len = ring_len;
+  if (ring_len == 0) return;
+
+  gdouble sorted[STATS_RING];
+  memcpy (sorted, ring, ring_len * sizeof(gdouble));
+  qsort (sorted, ring_len, sizeof(gdouble), ms_compare);
+  rs->p50   = sorted[(ring_len - 1) * 50 / 100];
+  rs->p95   = sorted[(ring_len - 1) * 95 / 100];
+  rs->p99   = sorted[(ring_len - 1) * 99 / 100];
+  rs->worst = sorted[ring_len - 1];
+
+  for (guint i = 0; i < ring_len; i++) {
+    gint b = 0;
+    while (b < STATS_BUCKETS - 1 && sorted[i] >= stats_bucket_limit (b)) b++;
+    rs->histogram[b]++;
+  }
+}
+
+void
+stats_reset (void)
+{
+  ring_next = ring_len = 0;
+  frames = 0;
+  memset (&last, 0, sizeof(frame_stats_s));
+}
+
+gboolean
+stats_hud (void)
+{
+  return hud;
+}
+
+void
+stats_set_hud (gboolean on)
+{
+  hud = on;
+}
+
+/***
+    A few lines in the top left corner of the canvas, in device space.
+ ***/
+
+void
+stats_hud_draw (cairo_t *cr)
+{
+  render_stats_s rs;
+  stats_snapshot (&rs);
+
+  gchar *lines[4];
+  lines[0] = g_strdup_printf ("frame %.2f ms  p50 %.2f  p95 %.2f  p99 %.2f",
+			      rs.last.total_ms, rs.p50, rs.p95, rs.p99);
+  lines[1] = g_strdup_printf ("drawn %u  culled %u",
+			      rs.last.drawn, rs.last.culled);
+  lines[2] = g_strdup_printf ("matrix %u  style %u",
+			      rs.last.matrix_changes, rs.last.style_changes);
+  lines[3] = detail ?
+    g_strdup_printf ("text %.2f ms  geometry %.2f ms",
+		     rs.last.text_ms, rs.last.geometry_ms) : NULL;
+
+  cairo_save (cr);
+  cairo_identity_matrix (cr);
+  cairo_reset_clip (cr);
+  cairo_select_font_face (cr, "monospace",
+			  CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size (cr, 11.0);
+  gint n = lines[3] ? 4 : 3;
+  cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 0.6);
+  cairo_rectangle (cr, 4.0, 4.0, 330.0, 6.0 + 14.0 * n);
+  cairo_fill (cr);
+  cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 0.9);
+  for (gint i = 0; i < n; i++) {
+    cairo_move_to (cr, 8.0, 18.0 + 14.0 * i);
+    cairo_show_text (cr, lines[i]);
+    g_free (lines[i]);
+  }
+  cairo_restore (cr);
+}
@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+
+#define STATS_TYPES	(ENTITY_TYPE_INSTANCE + 1)
+#define STATS_RING	256		// frames kept for the histogram
+#define STATS_BUCKETS	11		// 0.5ms doubling, the last open
+
+typedef struct {
+  gdouble	total_ms;
+  gdouble	text_ms;
+  gdouble	geometry_ms;
+  gdouble	type_ms[STATS_TYPES];
+  guint		type_count[STATS_TYPES];
+  guint		drawn;
+  guint		culled;
+  guint		matrix_changes;
+  guint		style_changes;
+} frame_stats_s;
+
+typedef struct {
+  frame_stats_s	last;
+  guint64	frames;
+  guint		ring_len;
+  gdouble	p50;
+  gdouble	p95;
+  gdouble	p99;
+  gdouble	worst;
+  guint		histogram[STATS_BUCKETS];
+} render_stats_s;
+
+void stats_frame_begin (void);
+void stats_frame_end (void);
+frame_stats_s *stats_frame (void);
+gboolean stats_detail (void);
+gint64 stats_now (void);
+void stats_entry (gpointer entity, gint64 start);
+void stats_snapshot (render_stats_s *rs);
+void stats_reset (void);
+void stats_set_detail (gboolean detail);
+gboolean stats_hud (void);
+void stats_set_hud (gboolean hud);
+void stats_hud_draw (cairo_t *cr);
+gdouble stats_bucket_limit (gint bucket);
+
+#endif  /* STATS_H */
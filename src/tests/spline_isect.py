@@ -0,0 +1,41 @@
+
+# timings for spline intersections, results go to stdout
+
+import math
+import time
+
+def wave (n, f, phase, y0) :
+  return [ (0.5 + 9.0 * i / n, y0 + math.sin (f * i + phase)) for i in range (n) ]
+
+def bench (name, a, b, reps) :
+  t0 = time.perf_counter ()
+  for r in range (reps) :
+    x = gf_intersect (a, b)
+  t1 = time.perf_counter ()
+  print ("%-24s %4d points %8.3f ms" % (name, len (x), 1000.0 * (t1 - t0) / reps))
+  return x
+
+gf_spw(0.5)
+
+for n in (16, 64, 256, 1024) :
+  s0 = gf_line_t (wave (n, 0.7, 0.0, 5.0), spline=True)
+  s1 = gf_line_t (wave (n, 0.7, 1.5, 5.0), spline=True)
+  bench ("spline/spline %d" % n, s0, s1, 5)
+
+s0 = gf_line_t (wave (256, 0.7, 0.0, 5.0), spline=True)
+l0 = gf_line_t (wave (256, 0.3, 0.5, 5.0))
+bench ("spline/line 256", s0, l0, 5)
+
+c0 = gf_circle_t (5, 5, 0.8)
+bench ("spline/circle 256", s0, c0, 5)
+
+e0 = gf_ellcabt_t (5, 5, 4, 0.9, gf_deg(10))
+bench ("spline/ellipse 256", s0, e0, 5)
+
+s2 = gf_line_t ([ (1,2), (3,4), (2.5,1), (0.0, 0.0) ], spline=True)
+s3 = gf_line_t ([ (0,3), (3,0), (1,0), (3,3) ], spline=True)
+x = bench ("spline/spline small", s2, s3, 100)
+gf_draw ((s2, s3))
+gf_spw(3.5)
+if (len (x) >= 2) :
+  gf_draw (gf_line_t (x))
@@ -0,0 +1,155 @@
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib/gi18n-lib.h>
+#include <stdio.h>
+
+#include "gf.h"
+#include "trace.h"
+
+#if 0 // comments
+
+     Event tracing for stalls.  TRACE_BEGIN and TRACE_END bracket the
+     things worth seeing on a timeline (loads and saves, frames,
+     Python jobs, intersections and plugin calls); when tracing is off
+     each costs one test of trace_enabled.  When it is on, events go
+     into a ring per thread, so the Python worker and the main loop
+     never contend, and the oldest events are overwritten once a ring
+     fills.
+
+     trace_dump writes every ring out in the Chrome trace event format,
+     which chrome://tracing and ui.perfetto.dev both open.  Names must
+     be string literals, as only the pointer is kept.
+
+     Tracing is switched on by the GF3_TRACE environment variable or
+     from the File menu.  If GF3_TRACE names a file, the trace is
+     written there on quit.
+
+#endif
+
+#define TRACE_EVENTS	65536		// per thread
+
+typedef struct {
+  const gchar	*name;
+  gint64	 ts;			// microseconds, monotonic
+  gchar		 phase;
+} trace_ev_s;
+
+typedef struct {
+  GMutex	 lock;			// held only against trace_dump
+  trace_ev_s	*events;
+  guint		 next;
+  guint		 len;
+  gint		 tid;
+  gchar		*thread;
+} trace_ring_s;
+
+gint trace_enabled = 0;
+
+static GMutex   rings_lock;
+static GList   *rings = NULL;
+static gint     next_tid = 1;
+static gchar   *trace_file = NULL;
+static GPrivate ring_key;		// rings live as long as the program
+
+static trace_ring_s *
+ring_for_thread (void)
+{
+  trace_ring_s *ring = g_private_get (&ring_key);
+  if (ring) return ring;
+
+  ring = gfig_try_malloc0 (sizeof(trace_ring_s));
+  g_mutex_init (&ring->lock);
+  ring->events = gfig_try_malloc0 (TRACE_EVENTS * sizeof(trace_ev_s));
+  g_mutex_lock (&rings_lock);
+  ring->tid = next_tid++;
+  rings = g_list_append (rings, ring);
+  g_mutex_unlock (&rings_lock);
+  ring->thread = (ring->tid == 1) ?
+    g_strdup ("main") : g_strdup_printf ("thread %d", ring->tid);
+  g_private_set (&ring_key, ring);
+  return ring;
+}
+
+void
+trace_event (const gchar *name, gchar phase)
+{
+  trace_ring_s *ring = ring_for_thread ();
+  trace_ev_s ev = {name, g_get_monotonic_time (), phase};
+
+  g_mutex_lock (&ring->lock);
+  ring->events[ring->next] = ev;
+  ring->next = (ring->next + 1) % TRACE_EVENTS;
+  if (ring->len < TRACE_EVENTS) ring->len++;
+  g_mutex_unlock (&ring->lock);
+}
+
+void
+trace_set (gboolean on)
+{
+  if (on) ring_for_thread ();		// so the main thread is tid 1
+  g_atomic_int_set (&trace_enabled, on ? 1 : 0);
+}
+
+void
+trace_init (void)
+{
+  const gchar *env = g_getenv ("GF3_TRACE");
+  if (!env || !*env || !g_strcmp0 (env, "0")) return;
+
+  if (g_strcmp0 (env, "1")) trace_file = g_strdup (env);
+  trace_set (TRUE);
+}
+
+static void
+write_ring (GString *json, trace_ring_s *ring, gboolean *first)
+{
+  g_string_append_printf (json,
+			  "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			  "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			  *first ? "" : ",", ring->tid, ring->thread);
+  *first = FALSE;
+
+  g_mutex_lock (&ring->lock);
+  guint start = (ring->next + TRACE_EVENTS - ring->len) % TRACE_EVENTS;
+  for (guint i = 0; i < ring->len; i++) {
+    trace_ev_s *ev = &ring->events[(start + i) % TRACE_EVENTS];
+    g_string_append_printf (json,
+			    ",\n{\"name\":\"%s\",\"ph\":\"%c\","
+			    "\"ts\":%lld,\"pid\":1,\"tid\":%d}",
+			    ev->name, ev->phase, (long long)ev->ts, ring->tid);
+  }
+  g_mutex_unlock (&ring->lock);
+}
+
+gboolean
+trace_dump (const gchar *file)
+{
+  GString *json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  gboolean first = TRUE;
+
+  g_mutex_lock (&rings_lock);
+  for (GList *l = rings; l; l = l->next) write_ring (json, l->data, &first);
+  g_mutex_unlock (&rings_lock);
+  g_string_append (json, "\n]}\n");
+
+  GError *error = NULL;
+  gboolean rc = g_file_set_contents (file, json->str, json->len, &error);
+  if (!rc) {
+    gchar *msg = g_strdup_printf (_ ("Trace not written: %s\n"),
+				  error->message);
+    log_string (LOG_GFIG_ERROR, NULL, msg);
+    g_free (msg);
+    g_clear_error (&error);
+  }
+  g_string_free (json, TRUE);
+  return rc;
+}
+
+void
+trace_quit (void)
+{
+  if (trace_file && trace_enabled) trace_dump (trace_file);
+}
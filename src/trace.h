@@ -0,0 +1,17 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+extern gint trace_enabled;
+
+#define TRACE_BEGIN(name) \
+  do { if (unlikely (trace_enabled)) trace_event ((name), 'B'); } while (0)
+#define TRACE_END(name) \
+  do { if (unlikely (trace_enabled)) trace_event ((name), 'E'); } while (0)
+
+void trace_init (void);
+void trace_set (gboolean on);
+void trace_event (const gchar *name, gchar phase);
+gboolean trace_dump (const gchar *file);
+void trace_quit (void);
+
+#endif  /* TRACE_H */
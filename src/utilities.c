@@ -68,6 +68,17 @@ snap_to_grid (environment_s *env, gdouble *pxp, gdouble *pyp)
   }
 }
 
+/***
+    Sheet units per device pixel, as of the last draw.
+ ***/
+
+gdouble
+device_pixel (environment_s *env)
+{
+  return sqrt (fabs (environment_inv_xx (env) * environment_inv_yy (env) -
+		     environment_inv_xy (env) * environment_inv_yx (env)));
+}
+
 pen_s *
 copy_pen (pen_s *oldpen)
 {
@@ -6,6 +6,7 @@ gdouble pen_lw_cvt (environment_s *env);
 pen_s *copy_environment_pen (environment_s *env);
 pen_s *copy_pen (pen_s *env);
 void snap_to_grid (environment_s *env, gdouble *pxp, gdouble *pyp);
+gdouble device_pixel (environment_s *env);
 guint clear_state_bit (GdkEvent *event);
 guint set_state_bit (GdkEvent *event);
 
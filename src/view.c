@@ -23,6 +23,14 @@ char *strsep(char **stringp, const char *delim);
 #include "python.h"
 #include "entities.h"
 #include "view.h"
+#include "xml.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+#include "stats.h"
+#include "trace.h"
+#include "snap.h"
+#include "grid.h"
 #include "../pluginsrcs/plugin.h"
 
 typedef struct {
@@ -77,6 +85,7 @@ do_config (environment_s *env)
 void
 force_redraw (sheet_s *sheet)
 {
+  if (python_in_worker ()) return;	// the batch drain redraws
   environment_s *env = sheet_environment (sheet);
   GtkWidget *da = GTK_WIDGET (environment_da (env));
   if (da && gtk_widget_get_mapped (da))
@@ -277,6 +286,27 @@ tree_clicked_cb (GtkWidget *treeview,
   return rc;
 }
 
+static void
+tree_activated_cb (GtkTreeView       *tree_view,
+		   GtkTreePath       *path,
+		   GtkTreeViewColumn *column,
+		   gpointer           data)
+{
+  project_s *project =  (project_s *)data;
+  GtkTreeModel *model = gtk_tree_view_get_model (tree_view);
+  GtkTreeIter iter;
+  sheet_s *sheet = NULL;
+
+  if (gtk_tree_model_get_iter (model, &iter, path))
+    gtk_tree_model_get (model, &iter, SHEET_STRUCT_COL, &sheet, -1);
+  if (sheet) {
+    if (sheet_window (sheet))
+      gtk_window_present (GTK_WINDOW (sheet_window (sheet)));
+    else
+      create_new_view (project, sheet, NULL);
+  }
+}
+
 static void
 sheet_selection_changed_cb (GtkTreeSelection *treeselection,
 			    gpointer          data)
@@ -333,6 +363,8 @@ show_sheets (GtkWidget *object, gpointer data)
                     project);
   g_signal_connect(tree, "button-press-event",
 		   G_CALLBACK (tree_clicked_cb), project);
+  g_signal_connect(tree, "row-activated",
+		   G_CALLBACK (tree_activated_cb), project);
 
   GtkCellRenderer *renderer;
   GtkTreeViewColumn *column;
@@ -397,6 +429,34 @@ scale_settings (GtkWidget *object, gpointer data)
   gtk_widget_destroy (dialog);
 }
 
+static void
+undo_cb (GtkWidget *object, gpointer data)
+{
+  history_undo (data);
+}
+
+static void
+redo_cb (GtkWidget *object, gpointer data)
+{
+  history_redo (data);
+}
+
+static void
+history_usage (GtkWidget *object, gpointer data)
+{
+  sheet_s *sheet = data;
+  gsize total, retained;
+  guint undo, redo;
+
+  history_memory (sheet, &total, &retained, &undo, &redo);
+  gchar *msg =
+    g_strdup_printf (_ ("History: %u undo, %u redo, %" G_GSIZE_FORMAT
+			" bytes held, %" G_GSIZE_FORMAT " of %d retained"),
+		     undo, redo, total, retained, HISTORY_BYTE_CAP);
+  log_string (LOG_NORMAL, sheet, msg);
+  g_free (msg);
+}
+
 
 static void
 build_view_menu (GtkWidget *vbox, project_s *project,
@@ -446,6 +506,31 @@ build_view_menu (GtkWidget *vbox, project_s *project,
                     G_CALLBACK (close_view), NULL);
   gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
   
+  /********* edit menu ********/
+
+  menu = gtk_menu_new();
+  item = gtk_menu_item_new_with_label (_ ("Edit"));
+  gtk_menu_item_set_submenu (GTK_MENU_ITEM (item), menu);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menubar), item);
+
+  item = gtk_menu_item_new_with_label (_ ("Undo"));
+  g_signal_connect (G_OBJECT (item), "activate",
+                    G_CALLBACK (undo_cb), sheet);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
+  item = gtk_menu_item_new_with_label (_ ("Redo"));
+  g_signal_connect (G_OBJECT (item), "activate",
+                    G_CALLBACK (redo_cb), sheet);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
+  item = gtk_separator_menu_item_new();
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
+  item = gtk_menu_item_new_with_label (_ ("History usage"));
+  g_signal_connect (G_OBJECT (item), "activate",
+                    G_CALLBACK (history_usage), sheet);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+
   /********* settings ********/
 
   menu = gtk_menu_new();
@@ -577,6 +662,9 @@ colour_button_clicked_cb (GtkButton *widget,
     case ENTITY_TYPE_TRANSFORM:
     case ENTITY_TYPE_GROUP:
       break;
+    case ENTITY_TYPE_INSTANCE:
+      pen = entity_instance_pen ((entity_instance_s *)ety);
+      break;
     }
   }
   else pen = sheet_environment (sheet) ?
@@ -696,7 +784,8 @@ da_draw_cb (GtkWidget *widget, cairo_t *cr, gpointer data)
   paper_s       *paper = environment_paper (env);
   pen_s         *pen   = environment_pen (env);
 
-
+  TRACE_BEGIN ("da_draw_cb");
+  stats_frame_begin ();
   
   cairo_set_source_surface (cr, environment_surface (env), 0.0, 0.0);
 
@@ -753,6 +842,8 @@ da_draw_cb (GtkWidget *widget, cairo_t *cr, gpointer data)
 
   cairo_rectangle (cr, clip_min_x, clip_min_y, clip_max_w, clip_max_h);
   cairo_clip (cr);
+
+  grid_draw (env, cr);
 		      
   cairo_set_source_rgba (cr,
 			 pen_colour_red (pen),
@@ -765,10 +856,45 @@ da_draw_cb (GtkWidget *widget, cairo_t *cr, gpointer data)
   cairo_save (cr);
   environment_cr (env) = cr;
   if (sheet_entities (sheet))
-    g_list_foreach (sheet_entities (sheet), draw_entities, env);
+    display_draw (sheet, env);
   if (sheet_transients (sheet))
     g_list_foreach (sheet_transients (sheet), draw_entities, env);
   cairo_restore (cr);
+
+  // recolour whatever is under the pointer
+  cairo_matrix_t hover_matrix;
+  gpointer hover = pick_hovered (sheet, &hover_matrix);
+  if (hover) {
+    cairo_save (cr);
+    cairo_transform (cr, &hover_matrix);
+    cairo_push_group (cr);
+    draw_entities (hover, env);
+    cairo_pattern_t *mask = cairo_pop_group (cr);
+    cairo_set_source_rgba (cr, 1.0, 0.5, 0.0, 0.9);
+    cairo_mask (cr, mask);
+    cairo_pattern_destroy (mask);
+    cairo_restore (cr);
+  }
+
+  // mark the object snap in effect, in device space
+  point_s marker;
+  snap_e kind = snap_marker (sheet, &marker);
+  if (kind != SNAP_NONE && kind != SNAP_GRID) {
+    gdouble mx = point_x (&marker);
+    gdouble my = point_y (&marker);
+    cairo_user_to_device (cr, &mx, &my);
+    cairo_save (cr);
+    cairo_identity_matrix (cr);
+    cairo_set_line_width (cr, 1.5);
+    cairo_set_source_rgba (cr, 1.0, 0.5, 0.0, 0.9);
+    cairo_rectangle (cr, mx - 4.0, my - 4.0, 8.0, 8.0);
+    cairo_stroke (cr);
+    cairo_restore (cr);
+  }
+
+  stats_frame_end ();
+  if (stats_hud ()) stats_hud_draw (cr);
+  TRACE_END ("da_draw_cb");
  
 #if 0
   // dummy stuff for test
@@ -789,21 +915,35 @@ da_draw_cb (GtkWidget *widget, cairo_t *cr, gpointer data)
   return GDK_EVENT_STOP;		// handled
 }
 
-static gboolean
-da_motion_cb (GtkWidget *widget,
-              GdkEvent  *event,
-              gpointer   user_data) 
+/***
+    Motion arrives far faster than the display can show it, so the
+    latest event is kept and dealt with once per frame clock tick.
+ ***/
+
+static void
+motion_apply (sheet_s *sheet, GdkEvent *event)
 {
-  sheet_s       *sheet = (sheet_s *)user_data;
   environment_s *env = sheet_environment (sheet);
   GdkEventMotion *motion = (GdkEventMotion *)event;
 
   gdouble px = motion->x + environment_hoff (env);
   gdouble py = motion->y + environment_voff (env);
   cairo_matrix_transform_point (&environment_inv_tf (env), &px, &py);
-  snap_to_grid (env, &px, &py);
 
-  gchar *lbl = g_strdup_printf ("%#.4g %#.4g\n", px, py);
+  gdouble pixel = device_pixel (env);
+  gboolean redraw = pick_hover (sheet, px, py, PICK_TOLERANCE * pixel);
+
+  point_s was;
+  snap_e was_kind = snap_marker (sheet, &was);
+  snap_e kind = snap_point (sheet, &px, &py, SNAP_TOLERANCE * pixel);
+  if (kind != was_kind ||
+      (kind > SNAP_GRID && (px != point_x (&was) || py != point_y (&was))))
+    redraw = TRUE;
+  if (redraw) force_redraw (sheet);
+
+  gchar *lbl = (kind > SNAP_GRID)
+    ? g_strdup_printf ("%#.4g %#.4g %s\n", px, py, snap_name (kind))
+    : g_strdup_printf ("%#.4g %#.4g\n", px, py);
   gtk_label_set_text (GTK_LABEL (environment_readout (env)), lbl);
   g_free (lbl);
 
@@ -811,6 +951,74 @@ da_motion_cb (GtkWidget *widget,
   if(bf) {
     (*bf)(event, sheet, px, py);
   }
+}
+
+static void
+motion_done (gpointer user_data)
+{
+  sheet_s       *sheet = (sheet_s *)user_data;
+  environment_s *env = sheet_environment (sheet);
+
+  environment_motion_tick (env) = 0;
+  if (environment_motion (env)) {
+    gdk_event_free (environment_motion (env));
+    environment_motion (env) = NULL;
+  }
+}
+
+static gboolean
+motion_tick_cb (GtkWidget     *widget,
+		GdkFrameClock *frame_clock,
+		gpointer       user_data)
+{
+  sheet_s       *sheet = (sheet_s *)user_data;
+  environment_s *env = sheet_environment (sheet);
+  GdkEvent      *event = environment_motion (env);
+
+  environment_motion (env) = NULL;
+  if (event) {
+    motion_apply (sheet, event);
+    gdk_event_free (event);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/***
+    Deal with any waiting motion now, so that a button or key sees
+    the pointer where it last was.
+ ***/
+
+static void
+motion_flush (sheet_s *sheet)
+{
+  environment_s *env = sheet ? sheet_environment (sheet) : NULL;
+  if (!env || !environment_motion_tick (env)) return;
+
+  GdkEvent *event = environment_motion (env);
+  environment_motion (env) = NULL;
+  gtk_widget_remove_tick_callback (environment_da (env),
+				   environment_motion_tick (env));
+  if (event) {
+    motion_apply (sheet, event);
+    gdk_event_free (event);
+  }
+}
+
+static gboolean
+da_motion_cb (GtkWidget *widget,
+              GdkEvent  *event,
+              gpointer   user_data) 
+{
+  sheet_s       *sheet = (sheet_s *)user_data;
+  environment_s *env = sheet_environment (sheet);
+
+  if (environment_motion (env)) gdk_event_free (environment_motion (env));
+  environment_motion (env) = gdk_event_copy (event);
+  if (!environment_motion_tick (env))
+    environment_motion_tick (env) =
+      gtk_widget_add_tick_callback (widget, motion_tick_cb,
+				    sheet, motion_done);
+  gdk_event_request_motions ((GdkEventMotion *)event);
 	   
   return GDK_EVENT_PROPAGATE;
 }
@@ -880,6 +1088,11 @@ da_enter_exit_cb (GtkWidget *widget,
     sheet_s *sheet = user_data;
     set_active_sheet (sheet);
   }
+  else {
+    motion_flush (user_data);
+    if (pick_hover (user_data, NAN, NAN, 0.0))
+      force_redraw (user_data);
+  }
   
   notify_key_set (etype);
   return GDK_EVENT_PROPAGATE;
@@ -894,6 +1107,7 @@ da_button_cb (GtkWidget *widget,
   sheet_s *sheet = user_data;
   //  GdkEventButton *button = (GdkEventButton *)event;
 
+  motion_flush (sheet);
   button_f bf = return_current_tool ();
   if(bf) {
     (*bf)(event, sheet, NAN, NAN);
@@ -993,6 +1207,8 @@ build_view_grid (GtkWidget *vbox,
 		    G_CALLBACK (da_motion_cb), sheet);
   g_signal_connect (da, "button-press-event",
 		    G_CALLBACK (da_button_cb), sheet);
+  g_signal_connect_swapped (da, "destroy",
+			    G_CALLBACK (grid_free), env);
   gtk_grid_attach (GTK_GRID (grid), da, 0, 0, 1, 1);
 }
 
@@ -1104,6 +1320,8 @@ create_new_view (project_s *project, sheet_s *this_sheet, const gchar *script)
   environment_s	*env = sheet_environment (this_sheet);
   
   g_assert (env != NULL);
+
+  materialize_sheet (this_sheet);
   
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 #if 0
@@ -1136,6 +1354,9 @@ create_new_view (project_s *project, sheet_s *this_sheet, const gchar *script)
 
   g_signal_connect (window, "destroy",
 		    G_CALLBACK (close_view), NULL);
+  g_signal_connect (window, "destroy",
+		    G_CALLBACK (gtk_widget_destroyed),
+		    &sheet_window (this_sheet));
 #if 0
   script_ctl_s *script_ctl = gfig_try_malloc0 (sizeof(script_ctl_s));
   // will be freed by map_event
@@ -1172,7 +1393,15 @@ create_new_view (project_s *project, sheet_s *this_sheet, const gchar *script)
   
   gtk_entry_set_placeholder_text (GTK_ENTRY (entry),
 				  (_ ("Python expression")));
-  gtk_box_pack_start (GTK_BOX (vbox), GTK_WIDGET (entry), FALSE, FALSE, 2);
+
+  GtkWidget *hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 4);
+  gtk_box_pack_start (GTK_BOX (hbox), GTK_WIDGET (entry), TRUE, TRUE, 0);
+  GtkWidget *cancel =
+    gtk_button_new_from_icon_name ("process-stop", GTK_ICON_SIZE_BUTTON);
+  gtk_widget_set_tooltip_text (cancel, _ ("Interrupt the running script"));
+  g_signal_connect (cancel, "clicked", G_CALLBACK (python_cancel), NULL);
+  gtk_box_pack_start (GTK_BOX (hbox), cancel, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, FALSE, 2);
 
   g_signal_connect (entry, "activate",
 		    G_CALLBACK (eval_python_expr),
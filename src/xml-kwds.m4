@@ -23,6 +23,7 @@ entry(alignment)
 entry(alpha)
 entry(angle)
 entry(baxis)
+entry(block)
 entry(blue)
 entry(centre)
 entry(circle)
@@ -37,6 +38,7 @@ entry(font)
 entry(green)
 entry(grid)
 entry(inch)
+entry(instance)
 entry(justify)
 entry(landscape)
 entry(lead)
@@ -8,7 +8,16 @@
 #include "gf.h"
 #include "utilities.h"
 #include "select_pen.h"
+#include "entities.h"
 #include "fallbacks.h"
+#include "binary.h"
+#include "block.h"
+#include "xml.h"
+#include "journal.h"
+#include "history.h"
+#include "pick.h"
+#include "display.h"
+#include "trace.h"
 
 #include "xml-kwds.h"
 
@@ -17,6 +26,59 @@ typedef struct {
   gint indent;
 } context_s;
 
+#define LOAD_CHUNK_SIZE		(64 * 1024)
+#define LOAD_SLICE_USECS	(8 * 1000)
+
+enum {
+  SCAN_OUTSIDE,				// fed to the parser
+  SCAN_HEAD,				// <sheet ... >, fed
+  SCAN_QUOTED,				// an attribute value in the head, fed
+  SCAN_LEAD,				// looking for <environment
+  SCAN_ENV,				// <environment> ... </environment>, fed
+  SCAN_BODY				// skipped up to </sheet>
+};
+
+typedef struct {
+  gchar               *filename;
+  GInputStream        *stream;
+  GMarkupParseContext *context;
+  gchar               *buffer;
+  goffset              size;
+  goffset              done;
+  gboolean             cancelled;
+  GtkWidget           *dialog;
+  GtkWidget           *progress;
+  GPtrArray           *sheets;		// lazy_sheet_s, in file order
+  GArray              *opens;		// goffset of each <sheet
+  GArray              *closes;		// goffset just past each </sheet>
+  gint                 open_match;
+  gint                 close_match;
+  gint                 part;		// SCAN_*, where the scan is
+  gint                 env_match;
+  guint64              mtime;
+  gint                 first;		// projects there before the load
+  gboolean             eager;		// sheets parsed in full
+} load_state_s;
+
+/***
+    A sheet whose entities have not been parsed yet.  The first scan
+    only records where its section lies in the file; the entities are
+    built by materialize_sheet when the sheet is first needed.  A
+    sheet whose file has changed since is stale and stays unparsed;
+    the drawing can't be saved while it has one.
+ ***/
+
+typedef struct {
+  gchar    *filename;
+  goffset   size;
+  guint64   mtime;
+  goffset   start;
+  goffset   end;
+  gboolean  stale;
+} lazy_sheet_s;
+
+static load_state_s *loading = NULL;
+
 GQuark parse_quark = 0;
 
 GHashTable *element_hash = NULL;
@@ -386,6 +448,30 @@ write_group (GString *string, gpointer type, gint indent)
       write_close_transform (string, NULL, indent);
 }
 
+static void
+write_instance (GString *string, gpointer type, gint indent)
+{
+  entity_instance_s *instance = type;
+  block_s *block = entity_instance_block (instance);
+  cairo_matrix_t *matrix = &entity_instance_transform (instance);
+  gchar *name = g_markup_escape_text (block ? block_name (block) : "", -1);
+  
+  g_string_append_printf (string, "%*s<%s %s=\"%s\" \
+   %s=\"%f\" %s=\"%f\" %s=\"%f\" %s=\"%f\" %s=\"%f\" %s=\"%f\">\n",
+			  indent, " ", INSTANCE,
+			  BLOCK, name,
+			  XX,  matrix->xx,
+			  YX,  matrix->yx,
+			  YY,  matrix->yy,
+			  XY,  matrix->xy,
+			  X0,  matrix->x0,
+			  Y0,  matrix->y0);
+  if (entity_instance_pen (instance))
+    write_pen_spec (string, indent + 2, entity_instance_pen (instance));
+  g_string_append_printf (string, "%*s</%s>\n",  indent , " ", INSTANCE);
+  g_free (name);
+}
+
 static void
 write_entities (gpointer data, gpointer user_data)
 {
@@ -415,6 +501,9 @@ write_entities (gpointer data, gpointer user_data)
   case ENTITY_TYPE_GROUP:	// fixme
     write_group (string, data, indent);
     break;
+  case ENTITY_TYPE_INSTANCE:
+    write_instance (string, data, indent);
+    break;
   }
 }
 
@@ -442,6 +531,7 @@ save_sheet_func (GtkTreeModel *model,
   gtk_tree_model_get (model, iter,
 		      SHEET_STRUCT_COL, &sheet, -1);
   if (sheet) {
+    materialize_sheet (sheet);
     g_string_append_printf (string, "%*s<%s %s=\"%s\" %s=\"%s\">\n",
 			    indent, " ", SHEET,
 			    NAME, sheet_name (sheet),
@@ -476,6 +566,18 @@ save_project_func (GtkTreeModel *model,
     write_environment (string, indent + 2, project_environment (project));
 
     context->indent += 2;
+    GList *blocks = block_list (project);
+    for (GList *l = blocks; l; l = l->next) {
+      block_s *block = l->data;
+      gchar *name = g_markup_escape_text (block_name (block), -1);
+      g_string_append_printf (string, "%*s<%s %s=\"%s\">\n",
+			      indent + 2, " ", BLOCK, NAME, name);
+      g_list_foreach (block_entities (block), write_entities, context);
+      g_string_append_printf (string, "%*s</%s>\n", indent + 2, " ", BLOCK);
+      g_free (name);
+    }
+    g_list_free (blocks);
+
     gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
 			    save_sheet_func,
 			    context);
@@ -488,6 +590,21 @@ save_project_func (GtkTreeModel *model,
 void
 save_drawing (gchar *file)
 {
+  TRACE_BEGIN ("save_drawing");
+  if (!materialize_all ()) {
+    gchar *msg = g_strdup_printf (_ ("%s not saved: a sheet could not be read from its file.\n"),
+				  file);
+    log_string (LOG_GFIG_ERROR, NULL, msg);
+    g_free (msg);
+    TRACE_END ("save_drawing");
+    return;
+  }
+  if (g_str_has_suffix (file, BINARY_DRAWING_SUFFIX)) {
+    if (save_drawing_binary (file)) journal_saved (file);
+    TRACE_END ("save_drawing");
+    return;
+  }
+  
   GString *string = g_string_new (NULL);
   gint indent = 0;
   
@@ -502,12 +619,14 @@ save_drawing (gchar *file)
 			  context);
   write_header_close (string);
   gchar *content = g_string_free (string, FALSE);
-  g_file_set_contents (file,
-		       content,
-		       -1,
-		       NULL);
+  if (g_file_set_contents (file,
+			   content,
+			   -1,
+			   NULL))
+    journal_saved (file);
   g_free (content);
   g_free (context);
+  TRACE_END ("save_drawing");
 }	 
 
 
@@ -551,6 +670,7 @@ parser_end_element (GMarkupParseContext *context,
   case KWD_TRANSFORM:
     {
       sheet_s *sheet = user_data;
+      if (sheet_lazy (sheet)) break;
       entity_transform_s *transform =
 	gfig_try_malloc0 (sizeof(entity_transform_s));
       entity_tf_type (transform) = ENTITY_TYPE_TRANSFORM;
@@ -559,6 +679,16 @@ parser_end_element (GMarkupParseContext *context,
 	g_list_append (sheet_entities (sheet), transform);
     }
     break;
+  case KWD_BLOCK:
+    {
+      sheet_s *scratch = user_data;
+      block_define (sheet_project (scratch), sheet_name (scratch),
+		    sheet_entities (scratch));
+      g_free (sheet_name (scratch));
+      g_free (scratch);
+      g_markup_parse_context_pop (context);
+    }
+    break;
   case KWD_DRAWING:
   case KWD_PAPER:
   case KWD_PEN:
@@ -568,6 +698,7 @@ parser_end_element (GMarkupParseContext *context,
   case KWD_ELLIPSE:
   case KWD_TEXT:
   case KWD_POLYLINE:
+  case KWD_INSTANCE:
   case KWD_STRING:
   case KWD_PROJECT:
     g_markup_parse_context_pop (context);
@@ -578,6 +709,40 @@ parser_end_element (GMarkupParseContext *context,
 }
 
 
+/***
+    Used while scanning to step over an element without building
+    anything.  None of these elements nest inside one another.
+ ***/
+
+static void
+skip_end_element (GMarkupParseContext *context,
+		  const gchar *element_name,
+		  gpointer      user_data,
+		  GError      **error)
+{
+  switch(get_kwd (element_name)) {
+  case KWD_ENVIRONMENT:
+  case KWD_CIRCLE:
+  case KWD_ELLIPSE:
+  case KWD_TEXT:
+  case KWD_POLYLINE:
+  case KWD_INSTANCE:
+    g_markup_parse_context_pop (context);
+    break;
+  default:
+    break;
+  }
+}
+
+const GMarkupParser skip_parser_ops = {
+  NULL,				// start_element
+  skip_end_element,
+  NULL,                         // parser_text,
+  NULL,                         // passthrough
+  parser_error,
+};
+
+
 static void
 paper_start_element (GMarkupParseContext *context,
 		     const gchar *element_name,
@@ -1031,6 +1196,39 @@ const GMarkupParser circle_parser_ops = {
   parser_error,
 };
 
+static void
+instance_start_element (GMarkupParseContext *context,
+			const gchar *element_name,
+			const gchar **attribute_names,
+			const gchar **attribute_values,
+			gpointer      user_data,
+			GError      **error)
+{
+  entity_instance_s *instance = user_data;
+  
+  switch(get_kwd (element_name)) {
+  case KWD_PEN:
+    if (!entity_instance_pen (instance))
+      entity_instance_pen (instance) = gfig_try_malloc0 (sizeof(pen_s));
+    g_markup_parse_context_push (context, &pen_parser_ops,
+				 entity_instance_pen (instance));
+    break;
+  default:
+    g_set_error (error, parse_quark, 1, _ ("Invalid element in INSTANCE: %s"),
+		 element_name);
+    break;
+  }
+}
+
+
+const GMarkupParser instance_parser_ops = {
+  instance_start_element,
+  parser_end_element,
+  NULL,                         // parser_text,
+  NULL,                         // passthrough
+  parser_error,
+};
+
 static void
 string_text (GMarkupParseContext *context,
 	     const gchar         *text,
@@ -1326,6 +1524,49 @@ sheet_start_element (GMarkupParseContext *context,
       g_markup_parse_context_push (context, &ellipse_parser_ops, ellipse);
     }
     break;
+  case KWD_INSTANCE:
+    {
+      entity_instance_s *instance =
+	entity_build_instance (sheet, NULL, NULL, NULL);
+      cairo_matrix_t *matrix = &entity_instance_transform (instance);
+      if (attribute_names && attribute_values) {
+        for (gint i = 0; attribute_names[i]; i++) {
+	  switch(get_kwd (attribute_names[i])) {
+	  case KWD_BLOCK:
+	    entity_instance_block (instance) =
+	      block_get (sheet_project (sheet), attribute_values[i]);
+	    break;
+	  case KWD_XX:
+	    matrix->xx = get_double (attribute_values[i]);
+	    break;
+	  case KWD_YX:
+	    matrix->yx = get_double (attribute_values[i]);
+	    break;
+	  case KWD_XY:
+	    matrix->xy = get_double (attribute_values[i]);
+	    break;
+	  case KWD_YY:
+	    matrix->yy = get_double (attribute_values[i]);
+	    break;
+	  case KWD_X0:
+	    matrix->x0 = get_double (attribute_values[i]);
+	    break;
+	  case KWD_Y0:
+	    matrix->y0 = get_double (attribute_values[i]);
+	    break;
+	  default:
+	    g_set_error (error, parse_quark, 1,
+			 _ ("Invalid sheet instance attribute: %s"),
+			 attribute_names[i]);
+	    break;
+	  }
+	}
+      }
+      sheet_entities (sheet) =
+	g_list_append (sheet_entities (sheet), instance);
+      g_markup_parse_context_push (context, &instance_parser_ops, instance);
+    }
+    break;
   default:
     g_set_error (error, parse_quark, 1, _ ("Invalid element in SHEET: %s"),
 		 element_name);
@@ -1342,6 +1583,61 @@ const GMarkupParser sheet_parser_ops = {
   parser_error,
 };
 
+/***
+    Materializing a sheet reparses its section of the file; the
+    environment was already taken on the first scan.
+ ***/
+
+static void
+sheet_body_start_element (GMarkupParseContext *context,
+			  const gchar *element_name,
+			  const gchar **attribute_names,
+			  const gchar **attribute_values,
+			  gpointer      user_data,
+			  GError      **error)
+{
+  if (get_kwd (element_name) == KWD_ENVIRONMENT)
+    g_markup_parse_context_push (context, &skip_parser_ops, NULL);
+  else
+    sheet_start_element (context, element_name,
+			 attribute_names, attribute_values,
+			 user_data, error);
+}
+
+
+const GMarkupParser sheet_body_parser_ops = {
+  sheet_body_start_element,
+  parser_end_element,
+  NULL,                         // parser_text,
+  NULL,                         // passthrough
+  parser_error,
+};
+
+
+static void
+lazy_initial_start_element (GMarkupParseContext *context,
+			    const gchar *element_name,
+			    const gchar **attribute_names,
+			    const gchar **attribute_values,
+			    gpointer      user_data,
+			    GError      **error)
+{
+  if (get_kwd (element_name) == KWD_SHEET)
+    g_markup_parse_context_push (context, &sheet_body_parser_ops, user_data);
+  else
+    g_set_error (error, parse_quark, 1, _ ("Invalid element in SHEET: %s"),
+		 element_name);
+}
+
+
+const GMarkupParser lazy_initial_parser_ops = {
+  lazy_initial_start_element,
+  parser_end_element,
+  NULL,                         // parser_text,
+  NULL,                         // passthrough
+  parser_error,
+};
+
 
 static void
 project_start_element (GMarkupParseContext *context,
@@ -1383,6 +1679,16 @@ project_start_element (GMarkupParseContext *context,
 	}
       }
       append_sheet (project, valid_parent ? &parent : NULL, name, &sheet);
+      if (loading && !loading->eager) {
+	lazy_sheet_s *lazy = gfig_try_malloc0 (sizeof(lazy_sheet_s));
+	lazy->filename = g_strdup (loading->filename);
+	lazy->size  = loading->size;
+	lazy->mtime = loading->mtime;
+	lazy->start = -1;
+	lazy->end   = -1;
+	sheet_lazy (sheet) = lazy;
+	g_ptr_array_add (loading->sheets, sheet);
+      }
       g_markup_parse_context_push (context, &sheet_parser_ops, sheet);
     }
     break;
@@ -1390,6 +1696,28 @@ project_start_element (GMarkupParseContext *context,
     g_markup_parse_context_push (context, &environment_parser_ops,
 				 project_environment (project));
     break;
+  case KWD_BLOCK:		// parsed as a scratch sheet, see parser_end_element
+    {
+      sheet_s *scratch = gfig_try_malloc0 (sizeof(sheet_s));
+      sheet_project (scratch) = project;
+      sheet_environment (scratch) = project_environment (project);
+      if (attribute_names && attribute_values) {
+        for (gint i = 0; attribute_names[i]; i++) {
+	  switch(get_kwd (attribute_names[i])) {
+	  case KWD_NAME:
+	    sheet_name (scratch) = g_strdup (attribute_values[i]);
+	    break;
+	  default:
+	    g_set_error (error, parse_quark, 1,
+			 _ ("Invalid project block attribute: %s"),
+			 attribute_names[i]);
+	    break;
+	  }
+	}
+      }
+      g_markup_parse_context_push (context, &sheet_parser_ops, scratch);
+    }
+    break;
   default:
     g_set_error (error, parse_quark, 1, _ ("Invalid element in PROJECT: %s"),
 		 element_name);
@@ -1483,14 +1811,385 @@ const GMarkupParser initial_parser_ops = {
   parser_error,
 };
 
+
+static void
+load_error_dialogue (const gchar *filename, GError *error)
+{
+  GtkWidget *dialog;
+
+  dialog = gtk_message_dialog_new (NULL,
+				   GTK_DIALOG_DESTROY_WITH_PARENT,
+				   GTK_MESSAGE_WARNING,
+				   GTK_BUTTONS_OK,
+				   _ ("Error reading drawing file %s: %s"),
+				   filename, error->message);
+  gtk_window_set_keep_above (GTK_WINDOW (dialog), TRUE);
+  gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_MOUSE);
+  gtk_dialog_run (GTK_DIALOG (dialog));
+  gtk_widget_destroy (dialog);
+}
+
+static void
+load_cancel_cb (GtkDialog *dialog, gint response_id, gpointer user_data)
+{
+  load_state_s *ls = user_data;
+  ls->cancelled = TRUE;
+}
+
 void
-load_drawing (gchar *filename)
+lazy_sheet_free (sheet_s *sheet)
+{
+  lazy_sheet_s *lazy = sheet_lazy (sheet);
+  if (lazy) {
+    g_free (lazy->filename);
+    g_free (lazy);
+    sheet_lazy (sheet) = NULL;
+  }
+}
+
+/***
+    Hand one chunk to the parser.  Sheets don't nest, so the n'th
+    open and close found on the way belong to the n'th sheet created
+    by the parse; matches may straddle chunks.  Unless the load has
+    gone eager only the start tag and environment of each sheet are
+    parsed.  Its entities are stepped over byte by byte up to the
+    </sheet>, which the parser is handed bare, so the first scan costs
+    GMarkup nothing per entity.
+ ***/
+
+static void
+feed_span (load_state_s *ls, const gchar *buf, gssize nr, GError **error)
+{
+  if (nr > 0 && !*error)
+    g_markup_parse_context_parse (ls->context, buf, nr, error);
+}
+
+static void
+feed_chunk (load_state_s *ls, const gchar *buf, gssize nr, goffset base,
+	    GError **error)
+{
+  static const gchar open[]  = "<" SHEET;
+  static const gchar close[] = "</" SHEET ">";
+  static const gchar env[]   = "<" ENVIRONMENT;
+  static const gchar env_close[] = "</" ENVIRONMENT ">";
+  const gint ol = sizeof(open) - 1;
+  const gint cl = sizeof(close) - 1;
+  const gint el = sizeof(env) - 1;
+  const gint ecl = sizeof(env_close) - 1;
+  gssize from = (ls->part == SCAN_LEAD || ls->part == SCAN_BODY) ? -1 : 0;
+
+  for (gssize i = 0; i < nr && !*error; i++) {
+    gchar c = buf[i];
+    
+    if (ls->open_match == ol) {
+      if (g_ascii_isspace (c) || c == '>' || c == '/') {
+	goffset at = base + i - ol;
+	g_array_append_val (ls->opens, at);
+	if (!ls->eager && ls->part == SCAN_OUTSIDE) ls->part = SCAN_HEAD;
+      }
+      ls->open_match = 0;
+    }
+    if (c == open[ls->open_match]) ls->open_match++;
+    else ls->open_match = (c == open[0]) ? 1 : 0;
+
+    if (c == close[ls->close_match]) {
+      if (++ls->close_match == cl) {
+	goffset at = base + i + 1;
+	g_array_append_val (ls->closes, at);
+	ls->close_match = 0;
+	if (ls->part == SCAN_LEAD || ls->part == SCAN_BODY) {
+	  feed_span (ls, close, cl, error);
+	  ls->part = SCAN_OUTSIDE;
+	  from = i + 1;
+	  continue;
+	}
+      }
+    }
+    else ls->close_match = (c == close[0]) ? 1 : 0;
+
+    switch (ls->part) {
+    case SCAN_HEAD:
+      if (c == '"') ls->part = SCAN_QUOTED;
+      else if (c == '>') {
+	feed_span (ls, buf + from, i + 1 - from, error);
+	from = -1;
+	ls->part = SCAN_LEAD;
+	ls->env_match = 0;
+      }
+      break;
+    case SCAN_QUOTED:
+      if (c == '"') ls->part = SCAN_HEAD;
+      break;
+    case SCAN_LEAD:
+      if (c == env[ls->env_match]) {
+	if (++ls->env_match == el) {
+	  feed_span (ls, env, el, error);
+	  from = i + 1;
+	  ls->part = SCAN_ENV;
+	  ls->env_match = 0;
+	}
+      }
+      else if (ls->env_match || !g_ascii_isspace (c))
+	ls->part = SCAN_BODY;
+      break;
+    case SCAN_ENV:
+      if (c == env_close[ls->env_match]) {
+	if (++ls->env_match == ecl) {
+	  feed_span (ls, buf + from, i + 1 - from, error);
+	  from = -1;
+	  ls->part = SCAN_BODY;
+	}
+      }
+      else ls->env_match = (c == env_close[0]) ? 1 : 0;
+      break;
+    default:
+      break;
+    }
+  }
+  if (from >= 0) feed_span (ls, buf + from, nr - from, error);
+}
+
+/***
+    Give each lazy sheet its extent.  The scan knows nothing of
+    comments or CDATA, so unless every sheet gets an extent of its own
+    in order nothing is settled and FALSE comes back.
+ ***/
+
+static gboolean
+settle_sheets (load_state_s *ls)
+{
+  guint nr = ls->sheets->len;
+  goffset last = 0;
+
+  if (ls->opens->len != nr || ls->closes->len != nr) return FALSE;
+  for (guint i = 0; i < nr; i++) {
+    goffset start = g_array_index (ls->opens,  goffset, i);
+    goffset end   = g_array_index (ls->closes, goffset, i);
+    if (start < last || end <= start) return FALSE;
+    last = end;
+  }
+
+  for (guint i = 0; i < nr; i++) {
+    lazy_sheet_s *lazy = sheet_lazy ((sheet_s *)g_ptr_array_index (ls->sheets, i));
+    lazy->start = g_array_index (ls->opens,  goffset, i);
+    lazy->end   = g_array_index (ls->closes, goffset, i);
+  }
+  return TRUE;
+}
+
+/***
+    Forget everything the load has built so far.
+ ***/
+
+static void
+discard_load (load_state_s *ls)
+{
+  for (guint i = 0; i < ls->sheets->len; i++)
+    lazy_sheet_free (g_ptr_array_index (ls->sheets, i));
+  g_ptr_array_set_size (ls->sheets, 0);
+  discard_projects (ls->first);
+}
+
+/***
+    Start over from the top of the file with every sheet parsed in
+    full, for files whose sheet sections can't be trusted.
+ ***/
+
+static gboolean
+load_restart_eager (load_state_s *ls)
+{
+  GError *error = NULL;
+
+  gchar *msg =
+    g_strdup_printf (_ ("Sheet sections in %s could not be located; reading it in full.\n"),
+		     ls->filename);
+  log_string (LOG_NORMAL, NULL, msg);
+  g_free (msg);
+
+  discard_load (ls);
+  g_seekable_seek (G_SEEKABLE (ls->stream), 0, G_SEEK_SET, NULL, &error);
+  if (error) {
+    load_error_dialogue (ls->filename, error);
+    g_clear_error (&error);
+    return FALSE;
+  }
+
+  g_markup_parse_context_free (ls->context);
+  ls->context = g_markup_parse_context_new (&initial_parser_ops, 0,
+					    NULL, NULL);
+  g_array_set_size (ls->opens, 0);
+  g_array_set_size (ls->closes, 0);
+  ls->open_match  = 0;
+  ls->close_match = 0;
+  ls->part      = SCAN_OUTSIDE;
+  ls->env_match = 0;
+  ls->done  = 0;
+  ls->eager = TRUE;
+  return TRUE;
+}
+
+static void
+load_state_free (load_state_s *ls)
+{
+  g_ptr_array_free (ls->sheets, TRUE);
+  g_array_free (ls->opens, TRUE);
+  g_array_free (ls->closes, TRUE);
+  if (ls->dialog)  gtk_widget_destroy (ls->dialog);
+  if (ls->context) g_markup_parse_context_free (ls->context);
+  if (ls->stream)  g_object_unref (ls->stream);
+  g_free (ls->buffer);
+  g_free (ls->filename);
+  g_free (ls);
+}
+
+static load_state_s *
+load_state_new (gchar *filename)
+{
+  GError *error = NULL;
+  GFile  *file  = g_file_new_for_path (filename);
+  GFileInputStream *stream = g_file_read (file, NULL, &error);
+
+  if (error) {
+    load_error_dialogue (filename, error);
+    g_clear_error (&error);
+    g_object_unref (file);
+    return NULL;
+  }
+
+  load_state_s *ls = gfig_try_malloc0 (sizeof(load_state_s));
+  ls->filename = g_strdup (filename);
+  ls->stream   = G_INPUT_STREAM (stream);
+  ls->buffer   = gfig_try_malloc0 (LOAD_CHUNK_SIZE);
+  ls->sheets   = g_ptr_array_new ();
+  ls->opens    = g_array_new (FALSE, FALSE, sizeof(goffset));
+  ls->closes   = g_array_new (FALSE, FALSE, sizeof(goffset));
+  ls->first    =
+    gtk_tree_model_iter_n_children (GTK_TREE_MODEL (get_projects ()), NULL);
+
+  GFileInfo *info =
+    g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		       G_FILE_ATTRIBUTE_TIME_MODIFIED,
+		       G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info) {
+    ls->size  = g_file_info_get_size (info);
+    ls->mtime = g_file_info_get_attribute_uint64 (info,
+					G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    g_object_unref (info);
+  }
+  g_object_unref (file);
+
+  // fixme -- might need G_MARKUP_PREFIX_ERROR_POSITION in flags
+  ls->context = g_markup_parse_context_new (&initial_parser_ops,
+					    0,      // GMarkupParseFlags flags
+					    NULL,   // gpointer user_data,
+					    NULL);  // GDestroyNotify
+  return ls;
+}
+
+static void
+load_show_progress (load_state_s *ls)
+{
+  gchar *base = g_path_get_basename (ls->filename);
+  
+  ls->dialog = gtk_dialog_new_with_buttons (_ ("Loading drawing"),
+					    NULL,
+					    GTK_DIALOG_DESTROY_WITH_PARENT,
+					    _ ("_Cancel"), GTK_RESPONSE_CANCEL,
+					    NULL);
+  gtk_window_set_position (GTK_WINDOW (ls->dialog), GTK_WIN_POS_MOUSE);
+  g_signal_connect (ls->dialog, "response",
+		    G_CALLBACK (load_cancel_cb), ls);
+  GtkWidget *content = gtk_dialog_get_content_area (GTK_DIALOG (ls->dialog));
+  ls->progress = gtk_progress_bar_new ();
+  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (ls->progress), base);
+  gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (ls->progress), TRUE);
+  gtk_container_add (GTK_CONTAINER (content), ls->progress);
+  gtk_widget_show_all (ls->dialog);
+  g_free (base);
+}
+
+/***
+    Read and parse one slice of the file.  Chunks are fed to the parse
+    context until the file is exhausted or the time slice runs out, so
+    neither the whole file nor the whole parse ever sits on the main
+    loop at once.
+ ***/
+
+static gboolean
+load_slice (gpointer data)
+{
+  load_state_s *ls = data;
+  GError *error = NULL;
+  gint64 until = g_get_monotonic_time () + LOAD_SLICE_USECS;
+
+  while (!ls->cancelled) {
+    gssize nr = g_input_stream_read (ls->stream, ls->buffer,
+				     LOAD_CHUNK_SIZE, NULL, &error);
+    loading = ls;
+    if (nr > 0) {
+      feed_chunk (ls, ls->buffer, nr, ls->done, &error);
+      ls->done += nr;
+    }
+    else if (nr == 0)
+      g_markup_parse_context_end_parse (ls->context, &error);
+    loading = NULL;
+
+    if (!ls->eager && nr >= 0 &&
+	(error || (nr == 0 && !settle_sheets (ls)))) {
+      g_clear_error (&error);		// the skipping went wrong
+      if (load_restart_eager (ls)) continue;
+      discard_load (ls);
+      load_state_free (ls);
+      return G_SOURCE_REMOVE;
+    }
+    
+    if (error) {
+      load_error_dialogue (ls->filename, error);
+      g_clear_error (&error);
+      discard_load (ls);
+      load_state_free (ls);
+      return G_SOURCE_REMOVE;
+    }
+
+    if (nr == 0) {
+      gchar *filename = g_strdup (ls->filename);
+      gint first = ls->first;
+      load_state_free (ls);
+      journal_attach (filename, 0);
+      block_report_undefined (first);
+      g_free (filename);
+      notify_projects (NOTIFY_MAP_FIRST);
+      return G_SOURCE_REMOVE;
+    }
+    
+    if (g_get_monotonic_time () >= until) break;
+  }
+
+  if (ls->cancelled) {
+    log_string (LOG_NORMAL, NULL, _ ("Drawing load cancelled.\n"));
+    discard_load (ls);			// a part drawing must not be saved
+    load_state_free (ls);
+    return G_SOURCE_REMOVE;
+  }
+  
+  if (ls->progress && ls->size > 0)
+    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (ls->progress),
+				   (gdouble)ls->done / (gdouble)ls->size);
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+load_step (gpointer data)
 {
-  GMarkupParseContext *context = NULL;
-  gchar   *contents = NULL;
-  gsize    length;
-  GError  *error = NULL;
+  TRACE_BEGIN ("load_step");
+  gboolean rc = load_slice (data);
+  TRACE_END ("load_step");
+  return rc;
+}
 
+static void
+load_init (void)
+{
   if (!element_hash) {
     element_hash = g_hash_table_new (g_str_hash,  g_str_equal);
     for (gint i = 0; i < nr_keys; i++)
@@ -1500,61 +2199,227 @@ load_drawing (gchar *filename)
   
   if (parse_quark == 0)
     parse_quark = g_quark_from_string ("Parsing error");
+}
 
-  g_file_get_contents (filename,
-                       &contents,
-                       &length,
-                       &error);
-
- if (error) {
-    GtkWidget *dialog;
-
-    dialog = gtk_message_dialog_new (NULL,
-                                     GTK_DIALOG_DESTROY_WITH_PARENT,
-                                     GTK_MESSAGE_WARNING,
-                                     GTK_BUTTONS_OK,
-                                     _ ("Error reading drawing file %s: %s"),
-                                     filename, error->message);
-    gtk_window_set_keep_above (GTK_WINDOW (dialog), TRUE);
-    gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_MOUSE);
-    gtk_dialog_run (GTK_DIALOG (dialog));
-    gtk_widget_destroy (dialog);
-    g_clear_error (&error);
+/***
+    Drawings with unsaved changes in their journal are restored from
+    the newest snapshot, and binary drawings need no parse; either way
+    the load is done here and now.
+ ***/
+
+static gboolean
+load_without_parse (gchar *filename)
+{
+  guint64 gen = 0;
+  gchar *snapshot;
+  gboolean loaded = FALSE;
+  gint first =
+    gtk_tree_model_iter_n_children (GTK_TREE_MODEL (get_projects ()), NULL);
+
+  journal_detach ();
+  if ((snapshot = journal_snapshot (filename, &gen))) {
+    gchar *msg = g_strdup_printf (_ ("Restoring unsaved changes to %s.\n"),
+				  filename);
+    log_string (LOG_NORMAL, NULL, msg);
+    g_free (msg);
+    loaded = load_drawing_binary (snapshot);
+    g_free (snapshot);
+    if (!loaded) {			// fall back to the drawing itself
+      journal_set_aside (filename);
+      gen = 0;
+    }
+  }
+  if (!loaded) {
+    if (!is_drawing_binary (filename)) return FALSE;
+    if (!load_drawing_binary (filename)) return TRUE;	// nothing to map
+  }
+
+  journal_attach (filename, gen);
+  block_report_undefined (first);
+  notify_projects (NOTIFY_MAP_FIRST);
+  return TRUE;
+}
+
+/***
+    Load from an idle source with a progress dialogue so that the UI
+    stays live.  Only the first sheet is mapped when the parse
+    completes; the entities of the others are read when they are
+    opened from the sheets dialogue or used by a script.
+ ***/
+
+void
+load_drawing (gchar *filename)
+{
+  TRACE_BEGIN ("load_drawing");
+  if (load_without_parse (filename)) {
+    TRACE_END ("load_drawing");
     return;
   }
- 
- // fixme -- might need G_MARKUP_PREFIX_ERROR_POSITION in flags
-  context = g_markup_parse_context_new (&initial_parser_ops,
-                                        0,      // GMarkupParseFlags flags
-                                        NULL,   // gpointer user_data,
-                                        NULL);  // GDestroyNotify
-
-  g_markup_parse_context_parse (context,
-                                contents,
-                                length,
-                                &error);
-  if (error) {
-    GtkWidget *dialog;
-
-    dialog = gtk_message_dialog_new (NULL,
-                                     GTK_DIALOG_DESTROY_WITH_PARENT,
-                                     GTK_MESSAGE_WARNING,
-                                     GTK_BUTTONS_OK,
-                                     _ ("Error reading drawing file %s: %s"),
-                                     filename, error->message);
-    gtk_window_set_keep_above (GTK_WINDOW (dialog), TRUE);
-    gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_MOUSE);
-    gtk_dialog_run (GTK_DIALOG (dialog));
-    gtk_widget_destroy (dialog);
-    g_clear_error (&error);
+  
+  load_init ();
+
+  load_state_s *ls = load_state_new (filename);
+  if (!ls) {
+    TRACE_END ("load_drawing");
     return;
   }
 
-  if (context)  g_markup_parse_context_free (context);
-  context = NULL;
-  if (contents) g_free (contents);
-  contents = NULL;
+  load_show_progress (ls);
+  g_idle_add (load_step, ls);
+  TRACE_END ("load_drawing");
+}
 
-  notify_projects (NOTIFY_MAP);
+/***
+    Same chunked parse, but run to completion before returning.  For
+    use before the main loop is running, e.g. --dump-xml.
+ ***/
+
+void
+load_drawing_now (gchar *filename)
+{
+  TRACE_BEGIN ("load_drawing_now");
+  if (load_without_parse (filename)) {
+    TRACE_END ("load_drawing_now");
+    return;
+  }
+  
+  load_init ();
+
+  load_state_s *ls = load_state_new (filename);
+  if (!ls) {
+    TRACE_END ("load_drawing_now");
+    return;
+  }
+
+  while (load_step (ls) == G_SOURCE_CONTINUE);
+  TRACE_END ("load_drawing_now");
+}
+
+/***
+    Build the entities of a sheet that was loaded lazily by reparsing
+    just its section of the file.  FALSE if the sheet still has no
+    entities of its own: its load is in progress, or its file has
+    changed since (size or modification time) and it is stale.
+ ***/
+
+gboolean
+materialize_sheet (sheet_s *sheet)
+{
+  if (!sheet || !sheet_lazy (sheet)) return TRUE;
+
+  lazy_sheet_s *lazy = sheet_lazy (sheet);
+  if (lazy->start < 0 || lazy->stale) return FALSE;
+
+  GError *error = NULL;
+  GFile  *file  = g_file_new_for_path (lazy->filename);
+  GFileInfo *info =
+    g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		       G_FILE_ATTRIBUTE_TIME_MODIFIED,
+		       G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  goffset size = -1;
+  guint64 mtime = 0;
+  if (info) {
+    size  = g_file_info_get_size (info);
+    mtime = g_file_info_get_attribute_uint64 (info,
+					G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    g_object_unref (info);
+  }
+  if (size != lazy->size || mtime != lazy->mtime) {
+    gchar *msg =
+      g_strdup_printf (_ ("%s changed since it was loaded; sheet %s can't be read and the drawing can't be saved.\n"),
+		       lazy->filename, sheet_name (sheet));
+    log_string (LOG_GFIG_ERROR, sheet, msg);
+    g_free (msg);
+    lazy->stale = TRUE;
+    g_object_unref (file);
+    return FALSE;
+  }
+
+  sheet_lazy (sheet) = NULL;
+  history_forget (sheet);
+  pick_invalidate (sheet);
+  display_invalidate (sheet);
+
+  GFileInputStream *stream = g_file_read (file, NULL, &error);
+  if (!error)
+    g_seekable_seek (G_SEEKABLE (stream), lazy->start,
+		     G_SEEK_SET, NULL, &error);
+  if (!error) {
+    GMarkupParseContext *context =
+      g_markup_parse_context_new (&lazy_initial_parser_ops, 0, sheet, NULL);
+    gchar *buffer = gfig_try_malloc0 (LOAD_CHUNK_SIZE);
+    goffset left = lazy->end - lazy->start;
+    while (!error && left > 0) {
+      gssize nr = g_input_stream_read (G_INPUT_STREAM (stream), buffer,
+				       MIN (left, LOAD_CHUNK_SIZE),
+				       NULL, &error);
+      if (nr <= 0) break;
+      left -= nr;
+      g_markup_parse_context_parse (context, buffer, nr, &error);
+    }
+    if (!error) g_markup_parse_context_end_parse (context, &error);
+    g_markup_parse_context_free (context);
+    g_free (buffer);
+  }
+  if (stream) g_object_unref (stream);
+
+  g_object_unref (file);
+  if (error) {				// half a sheet must not be saved
+    load_error_dialogue (lazy->filename, error);
+    g_clear_error (&error);
+    clear_entities (&sheet_entities (sheet));
+    lazy->stale = TRUE;
+    sheet_lazy (sheet) = lazy;
+    return FALSE;
+  }
+
+  g_free (lazy->filename);
+  g_free (lazy);
+  return TRUE;
 }
 
+static gboolean
+materialize_func (GtkTreeModel *model,
+		  GtkTreePath *path,
+		  GtkTreeIter *iter,
+		  gpointer data)
+{
+  gboolean *ok = data;
+  sheet_s *sheet = NULL;
+
+  gtk_tree_model_get (model, iter, SHEET_STRUCT_COL, &sheet, -1);
+  if (sheet && !materialize_sheet (sheet)) *ok = FALSE;
+  return FALSE;
+}
+
+static gboolean
+materialize_project_func (GtkTreeModel *model,
+			  GtkTreePath *path,
+			  GtkTreeIter *iter,
+			  gpointer data)
+{
+  project_s *project = NULL;
+
+  gtk_tree_model_get (model, iter, PROJECT_STRUCT_COL, &project, -1);
+  if (project && project_sheets (project))
+    gtk_tree_model_foreach (GTK_TREE_MODEL (project_sheets (project)),
+			    materialize_func, data);
+  return FALSE;
+}
+
+/***
+    Materialize every sheet of every project.  FALSE if any is left
+    without its entities, in which case writing the drawing out would
+    lose them.
+ ***/
+
+gboolean
+materialize_all (void)
+{
+  gboolean ok = TRUE;
+
+  if (get_projects ())
+    gtk_tree_model_foreach (GTK_TREE_MODEL (get_projects ()),
+			    materialize_project_func, &ok);
+  return ok;
+}
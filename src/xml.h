@@ -3,5 +3,9 @@
 
 void save_drawing (gchar *file);
 void load_drawing (gchar *file);
+void load_drawing_now (gchar *file);
+gboolean materialize_sheet (sheet_s *sheet);
+gboolean materialize_all (void);
+void lazy_sheet_free (sheet_s *sheet);
 
 #endif /* XML_H */